@@ -283,6 +283,7 @@ public:
     ~RCValue() {}
 private:
     template <class TT> friend class RCPtr;
+    template <class TT> friend class SingleThreadedRCPtr;
     int _rc_incref() const {
         return ++_rc_refcount;
     }
@@ -388,4 +389,64 @@ private:
     mutable SpinLock lock; // exists solely for the purpose of implementing reset() safely
 };
 
+/**
+ * Reference counted pointer whose owner serializes all changes to it.
+ *
+ * The count of the object pointed to is still maintained atomically,
+ * so the object itself may be shared with RCPtrs in other threads,
+ * but the pointer has no lock of its own, which makes it half the
+ * size of an RCPtr.  Copying out of it while another thread resets
+ * it is not safe.
+ */
+template <class C>
+class SingleThreadedRCPtr {
+public:
+    SingleThreadedRCPtr(C *init = NULL) : value(init) {
+        if (init != NULL) {
+            static_cast<RCValue*>(value)->_rc_incref();
+        }
+    }
+
+    ~SingleThreadedRCPtr() {
+        reset();
+    }
+
+    void reset(C *newValue = NULL) {
+        if (newValue != NULL) {
+            static_cast<RCValue*>(newValue)->_rc_incref();
+        }
+        C *tmp = value;
+        value = newValue;
+        if (tmp != NULL && static_cast<RCValue*>(tmp)->_rc_decref() == 0) {
+            delete tmp;
+        }
+    }
+
+    SingleThreadedRCPtr<C> &operator =(const RCPtr<C> &other) {
+        reset(other.get());
+        return *this;
+    }
+
+    C *get() const {
+        return value;
+    }
+
+    C *operator ->() const {
+        return value;
+    }
+
+    bool operator! () const {
+        return !value;
+    }
+
+    operator bool () const {
+        return value != NULL;
+    }
+
+private:
+    C *value;
+
+    DISALLOW_COPY_AND_ASSIGN(SingleThreadedRCPtr);
+};
+
 #endif // ATOMIC_HH
@@ -96,6 +96,18 @@ inline uint32_t ep_sync_fetch_and_add(volatile uint32_t *dest, uint32_t value) {
     return original;
 }
 
+inline uint32_t ep_sync_fetch_and_or(volatile uint32_t *dest, uint32_t value) {
+    uint32_t original = *dest;
+    atomic_or_32(dest, value);
+    return original;
+}
+
+inline uint32_t ep_sync_fetch_and_and(volatile uint32_t *dest, uint32_t value) {
+    uint32_t original = *dest;
+    atomic_and_32(dest, value);
+    return original;
+}
+
 inline hrtime_t ep_sync_fetch_and_add(volatile hrtime_t *dest, hrtime_t value) {
     size_t original = *dest;
     if (value == 1) {
@@ -33,6 +33,11 @@ private:
 };
 
 void BackfillDiskCallback::callback(GetValue &gv) {
+    Item *itm = gv.getValue();
+    engine->getEpStore()->getIOThrottle().consumed(io_backfill,
+                                                   itm->getKey().length() +
+                                                   itm->getNBytes());
+
     ReceivedItemTapOperation tapop(true);
     // if the tap connection is closed, then free an Item instance
     if (!connMap.performTapOp(tapConnName, tapop, gv.getValue())) {
@@ -51,9 +56,19 @@ bool BackfillDiskLoad::callback(Dispatcher &d, TaskId t) {
          return true;
     }
 
+    double throttled = engine->getEpStore()->getIOThrottle().admit(io_backfill);
+    if (throttled > 0) {
+        d.snooze(t, throttled);
+        return true;
+    }
+
     if (connMap.checkConnectivity(name) && !engine->getEpStore()->isFlushAllScheduled()) {
         shared_ptr<Callback<GetValue> > backfill_cb(new BackfillDiskCallback(name, connMap, engine));
-        store->dump(vbucket, backfill_cb);
+        if (since > 0) {
+            store->dumpSince(vbucket, since, backfill_cb);
+        } else {
+            store->dump(vbucket, backfill_cb);
+        }
         valid = true;
     }
     // Should decr the disk backfill counter regardless of the connectivity status
@@ -78,16 +93,20 @@ bool BackFillVisitor::visitBucket(RCPtr<VBucket> &vb) {
 
     if (vBucketFilter(vb->getId())) {
         VBucketVisitor::visitBucket(vb);
+        std::map<uint16_t, uint64_t>::iterator sit = backfillSeqnos.find(vb->getId());
+        since = sit != backfillSeqnos.end() ? sit->second : 0;
         // If the current resident ratio for a given vbucket is below the resident threshold
         // for memory backfill only, schedule the disk backfill for more efficient bg fetches.
         double numItems = static_cast<double>(vb->ht.getNumItems());
         double numNonResident = static_cast<double>(vb->ht.getNumNonResidentItems());
-        if (numItems == 0) {
+        // With full eviction, evicted items are only on disk.
+        bool fullEviction = engine->epstore->isFullEviction();
+        if (numItems == 0 && !fullEviction) {
             return true;
         }
 
         double residentThreshold = engine->getTapConfig().getBackfillResidentThreshold();
-        residentRatioBelowThreshold =
+        residentRatioBelowThreshold = fullEviction ||
             ((numItems - numNonResident) / numItems) < residentThreshold ? true : false;
         if (efficientVBDump && residentRatioBelowThreshold) {
             vbuckets.push_back(vb->getId());
@@ -95,8 +114,11 @@ bool BackFillVisitor::visitBucket(RCPtr<VBucket> &vb) {
             engine->tapConnMap->performTapOp(name, tapop, static_cast<void*>(NULL));
         }
         // When the backfill is scheduled for a given vbucket, set the TAP cursor to
-        // the beginning of the open checkpoint.
-        engine->tapConnMap->SetCursorToOpenCheckpoint(name, vb->getId());
+        // the beginning of the open checkpoint.  A backfill of what changed since a
+        // sequence number leaves the cursor where it resumes from.
+        if (since == 0) {
+            engine->tapConnMap->SetCursorToOpenCheckpoint(name, vb->getId());
+        }
         return true;
     }
     return false;
@@ -108,6 +130,11 @@ void BackFillVisitor::visit(StoredValue *v) {
     if (efficientVBDump && residentRatioBelowThreshold && !v->isResident()) {
         return;
     }
+    // Nor is an item the client already had, unless it changed since it
+    // was persisted.
+    if (since > 0 && !v->isDirty() && v->getBySeqno() != 0 && v->getBySeqno() <= since) {
+        return;
+    }
     std::string k = v->getKey();
     queued_item qi(new QueuedItem(k, value_t(NULL),
                                   currentBucket->getId(), queue_op_set,
@@ -124,12 +151,15 @@ void BackFillVisitor::apply(void) {
             Dispatcher *d(engine->epstore->getRODispatcher());
             KVStore *underlying(engine->epstore->getROUnderlying());
             assert(d);
+            std::map<uint16_t, uint64_t>::iterator sit = backfillSeqnos.find(*it);
             shared_ptr<DispatcherCallback> cb(new BackfillDiskLoad(name,
                                                                    engine,
                                                                    *engine->tapConnMap,
                                                                    underlying,
                                                                    *it,
-                                                                   validityToken));
+                                                                   validityToken,
+                                                                   sit != backfillSeqnos.end() ?
+                                                                   sit->second : 0));
             d->schedule(cb, NULL, Priority::TapBgFetcherPriority);
         }
         vbuckets.clear();
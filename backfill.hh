@@ -23,8 +23,10 @@ class BackfillDiskLoad : public DispatcherCallback {
 public:
 
     BackfillDiskLoad(const std::string &n, EventuallyPersistentEngine* e,
-                     TapConnMap &tcm, KVStore *s, uint16_t vbid, const void *token)
-        : name(n), engine(e), connMap(tcm), store(s), vbucket(vbid), validityToken(token) { }
+                     TapConnMap &tcm, KVStore *s, uint16_t vbid, const void *token,
+                     uint64_t sinceSeqno = 0)
+        : name(n), engine(e), connMap(tcm), store(s), vbucket(vbid), validityToken(token),
+          since(sinceSeqno) { }
 
     void callback(GetValue &gv);
 
@@ -39,6 +41,8 @@ private:
     KVStore                    *store;
     uint16_t                    vbucket;
     const void                 *validityToken;
+    // Only load what changed after this sequence number, unless 0.
+    uint64_t                    since;
 };
 
 /**
@@ -55,7 +59,8 @@ public:
         found(),
         validityToken(token), valid(true),
         efficientVBDump(e->epstore->getStorageProperties().hasEfficientVBDump()),
-        residentRatioBelowThreshold(false) {
+        residentRatioBelowThreshold(false), backfillSeqnos(tc->getBackfillSeqnos()),
+        since(0) {
 
         found.reserve(e->getTapConfig().getBackfillBacklogLimit());
     }
@@ -93,6 +98,11 @@ private:
     bool valid;
     bool efficientVBDump;
     bool residentRatioBelowThreshold;
+    // The vbuckets that are only backfilled with what changed since a
+    // sequence number.
+    std::map<uint16_t, uint64_t> backfillSeqnos;
+    // The sequence number the current vbucket is backfilled from, or 0.
+    uint64_t since;
 };
 
 /**
@@ -42,6 +42,12 @@ void BlackholeKVStore::get(const std::string &,
     cb.callback(rv);
 }
 
+void BlackholeKVStore::getMulti(uint16_t, uint16_t,
+                                std::vector<VBucketBGFetchItem*> &)
+{
+    // Nothing is ever stored, so the values stay not found.
+}
+
 
 void BlackholeKVStore::del(const Item &,
                            uint64_t,
@@ -91,7 +97,7 @@ void BlackholeKVStore::dump(uint16_t, shared_ptr<Callback<GetValue> >)
 StorageProperties BlackholeKVStore::getStorageProperties()
 {
     size_t concurrency(10);
-    StorageProperties rv(concurrency, concurrency - 1, 1, true, true);
+    StorageProperties rv(concurrency, concurrency - 1, 1, true, true, true);
     return rv;
 }
 
@@ -0,0 +1,90 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#include "config.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "bloomfilter.hh"
+#include "stored-value.hh"
+
+BloomFilter::BloomFilter(size_t key_count, double false_positive_prob) :
+    capacity(std::max(key_count, static_cast<size_t>(1))), bits(NULL) {
+    double p = false_positive_prob;
+    if (p <= 0.0 || p >= 1.0) {
+        p = 0.01;
+    }
+    // m = -n ln(p) / ln(2)^2 and k = (m / n) ln(2)
+    double m = -static_cast<double>(capacity) * std::log(p) / (M_LN2 * M_LN2);
+    numWords = (static_cast<size_t>(m) + BITS_PER_WORD - 1) / BITS_PER_WORD;
+    numWords = std::max(numWords, static_cast<size_t>(1));
+    numBits = numWords * BITS_PER_WORD;
+    double k = static_cast<double>(numBits) / static_cast<double>(capacity) * M_LN2;
+    numHashes = std::max(static_cast<size_t>(k + 0.5), static_cast<size_t>(1));
+
+    size_t *b = new size_t[numWords];
+    std::fill(b, b + numWords, 0);
+    bits = b;
+}
+
+BloomFilter::~BloomFilter() {
+    delete[] const_cast<size_t*>(bits);
+}
+
+// The k bit positions come from two hashes of the key (Kirsch and
+// Mitzenmacher): h1 + i * h2.
+static void hashKey(const std::string &key, uint64_t &h1, uint64_t &h2) {
+    h1 = HashTable::hash64(key.data(), key.length());
+    h2 = h1 * 0xff51afd7ed558ccdULL;
+    h2 ^= h2 >> 33;
+    h2 |= 1;
+}
+
+void BloomFilter::setBit(size_t bit) {
+    volatile size_t *word = bits + bit / BITS_PER_WORD;
+    size_t mask = static_cast<size_t>(1) << (bit % BITS_PER_WORD);
+    size_t old = *word;
+    while ((old & mask) == 0) {
+        if (ep_sync_bool_compare_and_swap(word, old, old | mask)) {
+            ++bitsSet;
+            return;
+        }
+        old = *word;
+    }
+}
+
+void BloomFilter::addKey(const std::string &key) {
+    uint64_t h1, h2;
+    hashKey(key, h1, h2);
+    for (size_t i = 0; i < numHashes; ++i) {
+        setBit(static_cast<size_t>((h1 + i * h2) % numBits));
+    }
+}
+
+bool BloomFilter::maybeKeyExists(const std::string &key) const {
+    uint64_t h1, h2;
+    hashKey(key, h1, h2);
+    for (size_t i = 0; i < numHashes; ++i) {
+        size_t bit = static_cast<size_t>((h1 + i * h2) % numBits);
+        size_t mask = static_cast<size_t>(1) << (bit % BITS_PER_WORD);
+        if ((bits[bit / BITS_PER_WORD] & mask) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t BloomFilter::getEstimatedKeyCount() const {
+    double m = static_cast<double>(numBits);
+    double x = static_cast<double>(bitsSet.get());
+    if (x >= m) {
+        return static_cast<size_t>(-1);
+    }
+    // n = -(m / k) ln(1 - X / m) (Swamidass and Baldi)
+    return static_cast<size_t>(-m / static_cast<double>(numHashes)
+                               * std::log(1.0 - x / m) + 0.5);
+}
+
+double BloomFilter::getFalsePositiveRate() const {
+    double fill = static_cast<double>(bitsSet.get()) / static_cast<double>(numBits);
+    return std::pow(fill, static_cast<double>(numHashes));
+}
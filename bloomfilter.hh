@@ -0,0 +1,88 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#ifndef BLOOMFILTER_HH
+#define BLOOMFILTER_HH 1
+
+#include <string>
+
+#include "common.hh"
+#include "atomic.hh"
+
+/**
+ * Bloom filter over the keys a vbucket has on disk.
+ *
+ * maybeKeyExists() is never false for a key that was added, and is
+ * true for a key that wasn't with about the false positive
+ * probability the filter was sized for, as long as it doesn't get
+ * many more keys than it was sized for.  Keys can't be taken out, so
+ * deleted keys linger until the filter is rebuilt.
+ *
+ * Keys may be added and looked up concurrently.
+ */
+class BloomFilter : public RCValue {
+public:
+
+    /**
+     * Create an empty filter.
+     *
+     * @param key_count the number of keys the filter is sized for
+     * @param false_positive_prob the false positive probability
+     *        wanted with that many keys
+     */
+    BloomFilter(size_t key_count, double false_positive_prob);
+
+    ~BloomFilter();
+
+    void addKey(const std::string &key);
+
+    /**
+     * False if the key was surely never added.
+     */
+    bool maybeKeyExists(const std::string &key) const;
+
+    /**
+     * Get the number of keys the filter was sized for.
+     */
+    size_t getKeyCapacity() const {
+        return capacity;
+    }
+
+    /**
+     * Estimate the number of distinct keys added from the number of
+     * bits set.
+     */
+    size_t getEstimatedKeyCount() const;
+
+    /**
+     * Get the probability of a false positive with the bits set so
+     * far.
+     */
+    double getFalsePositiveRate() const;
+
+    size_t getNumBits() const {
+        return numBits;
+    }
+
+    size_t getNumHashes() const {
+        return numHashes;
+    }
+
+    size_t getMemorySize() const {
+        return sizeof(BloomFilter) + numWords * sizeof(size_t);
+    }
+
+private:
+    void setBit(size_t bit);
+
+    static const size_t BITS_PER_WORD = sizeof(size_t) * 8;
+
+    size_t          capacity;
+    size_t          numBits;
+    size_t          numWords;
+    size_t          numHashes;
+    volatile size_t *bits;
+    Atomic<size_t>  bitsSet;
+
+    DISALLOW_COPY_AND_ASSIGN(BloomFilter);
+};
+
+#endif /* BLOOMFILTER_HH */
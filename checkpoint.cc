@@ -1,5 +1,8 @@
 /* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
 #include "config.h"
+
+#include <algorithm>
+
 #include "vbucket.hh"
 #include "checkpoint.hh"
 #include "ep_engine.h"
@@ -38,22 +41,267 @@ private:
     CheckpointConfig &config;
 };
 
+/**
+ * Matches the items a client resuming from a sequence number already
+ * received.  Meta items have no sequence number and always pass.
+ */
+class ReceivedBefore {
+public:
+    ReceivedBefore(uint64_t s) : seqno(s) { }
+
+    bool operator()(const queued_item &qi) const {
+        return seqno > 0 && qi->getBySeqno() != 0 && qi->getBySeqno() <= seqno;
+    }
+
+private:
+    uint64_t seqno;
+};
+
+Checkpoint::~Checkpoint() {
+    std::vector<queued_item*>::iterator it;
+    for (it = chunks.begin(); it != chunks.end(); ++it) {
+        delete [] *it;
+    }
+    if (spillFile) {
+        spillFile->release(spillOffsets.front(), spillOffsets.back());
+    }
+    stats.memOverhead.decr(memorySize());
+    assert(stats.memOverhead.get() < GIGANTOR);
+}
+
 void Checkpoint::setState(checkpoint_state state) {
     checkpointState = state;
 }
 
 void Checkpoint::popBackCheckpointEndItem() {
-    if (toWrite.size() > 0 && toWrite.back()->getOperation() == queue_op_checkpoint_end) {
-        toWrite.pop_back();
+    // The last slot is never empty, as the item in it is the latest one.
+    if (numSlots > 0 && slot(numSlots - 1)->getOperation() == queue_op_checkpoint_end) {
+        slot(--numSlots).reset();
+    }
+}
+
+static void appendItem(std::vector<queued_item*> &chunks, size_t &numSlots,
+                       const queued_item &qi) {
+    if (numSlots == chunks.size() * CHECKPOINT_CHUNK_SIZE) {
+        chunks.push_back(new queued_item[CHECKPOINT_CHUNK_SIZE]);
+    }
+    chunks[numSlots / CHECKPOINT_CHUNK_SIZE][numSlots % CHECKPOINT_CHUNK_SIZE] = qi;
+    ++numSlots;
+}
+
+void Checkpoint::pushSlot(const queued_item &qi) {
+    size_t numChunks = chunks.size();
+    appendItem(chunks, numSlots, qi);
+    if (chunks.size() != numChunks) {
+        // The new node covers the chunks from i - lowbit(i) to i (1-based),
+        // the last of which has no empty slots yet.
+        size_t i = chunks.size();
+        size_t count = 0;
+        for (size_t j = i - 1; j > 0; j -= j & -j) {
+            count += emptySlotTree[j - 1];
+        }
+        for (size_t j = i - (i & -i); j > 0; j -= j & -j) {
+            count -= emptySlotTree[j - 1];
+        }
+        emptySlotTree.push_back(count);
+        updateMemOverhead();
+    }
+}
+
+void Checkpoint::addEmptySlot(size_t pos) {
+    for (size_t i = pos / CHECKPOINT_CHUNK_SIZE + 1; i <= emptySlotTree.size(); i += i & -i) {
+        ++emptySlotTree[i - 1];
+    }
+    ++numEmptySlots;
+}
+
+size_t Checkpoint::getNumEmptySlotsUpTo(const CheckpointIterator &it) {
+    size_t pos = it.getPosition();
+    if (pos >= numSlots || numEmptySlots == 0) {
+        return numEmptySlots;
+    }
+    // The whole chunks before the position's, then the slots of its own.
+    size_t chunk = pos / CHECKPOINT_CHUNK_SIZE;
+    size_t count = 0;
+    for (size_t i = chunk; i > 0; i -= i & -i) {
+        count += emptySlotTree[i - 1];
+    }
+    for (size_t p = chunk * CHECKPOINT_CHUNK_SIZE; p <= pos; ++p) {
+        if (!slot(p)) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+void Checkpoint::updateMemOverhead() {
+    size_t numChunks = isSpilled() ? residentChunks.size() : chunks.size();
+    size_t overhead = chunks.capacity() * sizeof(queued_item*) +
+                      numChunks * CHECKPOINT_CHUNK_SIZE * sizeof(queued_item) +
+                      keyIndex.capacity() * sizeof(index_entry) +
+                      emptySlotTree.capacity() * sizeof(size_t) +
+                      spillOffsets.capacity() * sizeof(off_t);
+    if (overhead > memOverhead) {
+        stats.memOverhead.incr(overhead - memOverhead);
+    } else {
+        stats.memOverhead.decr(memOverhead - overhead);
+    }
+    memOverhead = overhead;
+    assert(stats.memOverhead.get() < GIGANTOR);
+}
+
+static uint64_t hashKey(const std::string &key) {
+    return HashTable::hash64(key.data(), key.length());
+}
+
+static index_entry &emptyEntry(std::vector<index_entry> &index, uint64_t h) {
+    size_t mask = index.size() - 1;
+    size_t i = static_cast<size_t>(h) & mask;
+    while (index[i].position != 0) {
+        i = (i + 1) & mask;
+    }
+    index[i].tag = static_cast<uint32_t>(h >> 32);
+    return index[i];
+}
+
+index_entry &Checkpoint::findEntry(const std::string &key) {
+    assert(!keyIndex.empty());
+    uint64_t h = hashKey(key);
+    uint32_t tag = static_cast<uint32_t>(h >> 32);
+    size_t mask = keyIndex.size() - 1;
+    size_t i = static_cast<size_t>(h) & mask;
+    for (; keyIndex[i].position != 0; i = (i + 1) & mask) {
+        if (keyIndex[i].tag == tag && slot(keyIndex[i].position - 1)->getKey() == key) {
+            return keyIndex[i];
+        }
+    }
+    keyIndex[i].tag = tag;
+    return keyIndex[i];
+}
+
+// Number of index entries for the given number of keys, keeping the
+// index at most two thirds full.
+static size_t indexSizeFor(size_t numKeys) {
+    size_t size = 16;
+    while (numKeys * 3 > size * 2) {
+        size <<= 1;
+    }
+    return size;
+}
+
+void Checkpoint::reserveKey() {
+    if (keyIndex.size() >= indexSizeFor(numItems + 1)) {
+        return;
+    }
+    index_entry empty = {0, 0, 0};
+    std::vector<index_entry> old(indexSizeFor(numItems + 1), empty);
+    old.swap(keyIndex);
+    std::vector<index_entry>::iterator it;
+    for (it = old.begin(); it != old.end(); ++it) {
+        if (it->position != 0) {
+            emptyEntry(keyIndex, hashKey(slot(it->position - 1)->getKey())) = *it;
+        }
+    }
+    updateMemOverhead();
+}
+
+void Checkpoint::relayout(CheckpointManager *checkpointManager,
+                          const std::vector<std::pair<queued_item, uint64_t> > &inserted) {
+    assert(!isSpilled());
+    // The cursors in this checkpoint, in the order of their positions.
+    std::vector<std::pair<size_t, CheckpointCursor*> > moving;
+    std::set<std::string>::iterator nit;
+    for (nit = cursors.begin(); nit != cursors.end(); ++nit) {
+        CheckpointCursor *cursor = checkpointManager->getCursor_UNLOCKED(*nit);
+        if (cursor && *(cursor->currentCheckpoint) == this) {
+            // Count the empty slots behind it before they are gone.
+            checkpointManager->syncCursorOffset_UNLOCKED(*cursor);
+            moving.push_back(std::make_pair(cursor->currentPos.getPosition(), cursor));
+        }
+    }
+    std::sort(moving.begin(), moving.end());
+
+    std::vector<queued_item*> newChunks;
+    size_t newNumSlots = 0;
+    // The new position and the mutation id of each item with a key.
+    std::vector<std::pair<size_t, uint64_t> > keyed;
+    keyed.reserve(numItems + inserted.size());
+    size_t nextCursor = 0;
+    bool insertedYet = inserted.empty();
+    std::vector<std::pair<queued_item, uint64_t> >::const_iterator iit;
+
+    for (size_t pos = 0; pos < numSlots; ++pos) {
+        queued_item &qi = slot(pos);
+        if (!qi) {
+            continue;
+        }
+        if (!insertedYet && qi->getKey().size() > 0) {
+            // The items are inserted after the meta items at the head.
+            for (iit = inserted.begin(); iit != inserted.end(); ++iit) {
+                keyed.push_back(std::make_pair(newNumSlots, iit->second));
+                appendItem(newChunks, newNumSlots, iit->first);
+            }
+            insertedYet = true;
+        }
+        // Cursors are on the items they read last, which are never empty.
+        for (; nextCursor < moving.size() && moving[nextCursor].first <= pos; ++nextCursor) {
+            size_t newPos = newNumSlots;
+            if (moving[nextCursor].first < pos) {
+                newPos = newNumSlots - 1;
+            }
+            moving[nextCursor].second->currentPos = CheckpointIterator(this, newPos);
+        }
+        if (qi->getKey().size() > 0) {
+            keyed.push_back(std::make_pair(newNumSlots, findEntry(qi->getKey()).mutation_id));
+        }
+        appendItem(newChunks, newNumSlots, qi);
     }
+    if (!insertedYet) {
+        for (iit = inserted.begin(); iit != inserted.end(); ++iit) {
+            keyed.push_back(std::make_pair(newNumSlots, iit->second));
+            appendItem(newChunks, newNumSlots, iit->first);
+        }
+    }
+    for (; nextCursor < moving.size(); ++nextCursor) {
+        size_t newPos = newNumSlots;
+        if (moving[nextCursor].first < numSlots) {
+            newPos = newNumSlots - 1;
+        }
+        moving[nextCursor].second->currentPos = CheckpointIterator(this, newPos);
+    }
+
+    std::vector<queued_item*>::iterator cit;
+    for (cit = chunks.begin(); cit != chunks.end(); ++cit) {
+        delete [] *cit;
+    }
+    chunks.swap(newChunks);
+    numSlots = newNumSlots;
+    numEmptySlots = 0;
+    std::vector<size_t>(chunks.size(), 0).swap(emptySlotTree);
+    std::vector<std::pair<size_t, CheckpointCursor*> >::iterator mit;
+    for (mit = moving.begin(); mit != moving.end(); ++mit) {
+        mit->second->emptySlotsSeen = 0;
+    }
+
+    index_entry empty = {0, 0, 0};
+    std::vector<index_entry>(indexSizeFor(keyed.size()), empty).swap(keyIndex);
+    std::vector<std::pair<size_t, uint64_t> >::iterator kit;
+    for (kit = keyed.begin(); kit != keyed.end(); ++kit) {
+        index_entry &entry = emptyEntry(keyIndex, hashKey(slot(kit->first)->getKey()));
+        entry.position = static_cast<uint32_t>(kit->first + 1);
+        entry.mutation_id = kit->second;
+    }
+    updateMemOverhead();
 }
 
 uint64_t Checkpoint::getCasForKey(const std::string &key) {
     uint64_t cas = 0;
-    checkpoint_index::iterator it = keyIndex.find(key);
-    if (it != keyIndex.end()) {
-        std::list<queued_item>::iterator currPos = it->second.position;
-        cas = (*(currPos))->getCas();
+    // The keys of a spilled checkpoint aren't indexed anymore.
+    if (numItems > 0 && !isSpilled()) {
+        index_entry &entry = findEntry(key);
+        if (entry.position != 0) {
+            cas = slot(entry.position - 1)->getCas();
+        }
     }
     return cas;
 }
@@ -62,122 +310,160 @@ queue_dirty_t Checkpoint::queueDirty(const queued_item &qi, CheckpointManager *c
     assert (checkpointState == opened);
 
     uint64_t newMutationId = checkpointManager->nextMutationId();
-    queue_dirty_t rv;
+    queue_dirty_t rv = NEW_ITEM;
 
-    checkpoint_index::iterator it = keyIndex.find(qi->getKey());
-    // Check if this checkpoint already had an item for the same key.
-    if (it != keyIndex.end()) {
-        std::list<queued_item>::iterator currPos = it->second.position;
-        uint64_t currMutationId = it->second.mutation_id;
-
-        if (*(checkpointManager->persistenceCursor.currentCheckpoint) == this) {
-            // If the existing item is in the left-hand side of the item pointed by the
-            // persistence cursor, decrease the persistence cursor's offset by 1.
-            const std::string &key = (*(checkpointManager->persistenceCursor.currentPos))->getKey();
-            checkpoint_index::iterator ita = keyIndex.find(key);
-            if (ita != keyIndex.end()) {
-                uint64_t mutationId = ita->second.mutation_id;
-                if (currMutationId <= mutationId) {
-                    checkpointManager->decrPersistenceCursorOffset(1);
-                }
-            }
-            // If the persistence cursor points to the existing item for the same key,
-            // shift the cursor left by 1.
-            if (checkpointManager->persistenceCursor.currentPos == currPos) {
-                checkpointManager->decrPersistenceCursorPos_UNLOCKED();
-            }
-        }
+    if (qi->getOperation() == queue_op_del) {
+        maxDelSeqno = std::max(maxDelSeqno, qi->getBySeqno());
+    }
 
-        std::map<const std::string, CheckpointCursor>::iterator map_it;
-        for (map_it = checkpointManager->tapCursors.begin();
-             map_it != checkpointManager->tapCursors.end(); map_it++) {
-
-            if (*(map_it->second.currentCheckpoint) == this) {
-                const std::string &key = (*(map_it->second.currentPos))->getKey();
-                checkpoint_index::iterator ita = keyIndex.find(key);
-                if (ita != keyIndex.end()) {
-                    uint64_t mutationId = ita->second.mutation_id;
-                    if (currMutationId <= mutationId) {
-                        --(map_it->second.offset);
-                    }
-                }
-                // If an TAP cursor points to the existing item for the same key, shift it left by 1
-                if (map_it->second.currentPos == currPos) {
-                    --(map_it->second.currentPos);
-                }
-            }
-        }
+    if (qi->getKey().size() == 0) {
+        // Meta items are neither indexed nor deduplicated.
+        pushSlot(qi);
+        return rv;
+    }
+
+    reserveKey();
+    index_entry &entry = findEntry(qi->getKey());
+    // Check if this checkpoint already had an item for the same key.
+    if (entry.position != 0) {
+        size_t currPos = entry.position - 1;
         // Copy the queued time of the existing item to the new one.
-        qi->setQueuedTime((*currPos)->getQueuedTime());
-        // Remove the existing item for the same key from the list.
-        toWrite.erase(currPos);
+        qi->setQueuedTime(slot(currPos)->getQueuedTime());
+        // Leave the slot of the existing item empty.  The cursors at or
+        // after it take it off their offsets when they are next synced.
+        slot(currPos).reset();
+        addEmptySlot(currPos);
         rv = EXISTING_ITEM;
     } else {
-        if (qi->getKey().size() > 0) {
-            ++numItems;
-        }
-        rv = NEW_ITEM;
-    }
-    // Push the new item into the list
-    toWrite.push_back(qi);
-
-    if (qi->getKey().size() > 0) {
-        std::list<queued_item>::iterator last = toWrite.end();
-        // --last is okay as the list is not empty now.
-        index_entry entry = {--last, newMutationId};
-        // Set the index of the key to the new item that is pushed back into the list.
-        keyIndex[qi->getKey()] = entry;
-        if (rv == NEW_ITEM) {
-            size_t newEntrySize = qi->getKey().size() + sizeof(index_entry) + sizeof(queued_item);
-            memOverhead += newEntrySize;
-            stats.memOverhead.incr(newEntrySize);
-            assert(stats.memOverhead.get() < GIGANTOR);
-        }
+        ++numItems;
+    }
+
+    // Push the new item into the queue and point the key's index entry to it.
+    pushSlot(qi);
+    entry.position = static_cast<uint32_t>(numSlots);
+    entry.mutation_id = newMutationId;
+
+    if (numEmptySlots >= CHECKPOINT_CHUNK_SIZE && numEmptySlots > numSlots - numEmptySlots) {
+        relayout(checkpointManager, std::vector<std::pair<queued_item, uint64_t> >());
     }
     return rv;
 }
 
-size_t Checkpoint::mergePrevCheckpoint(Checkpoint *pPrevCheckpoint) {
-    size_t numNewItems = 0;
-    size_t newEntryMemOverhead = 0;
-    std::list<queued_item>::reverse_iterator rit = pPrevCheckpoint->rbegin();
-    for (; rit != pPrevCheckpoint->rend(); ++rit) {
-        const std::string &key = (*rit)->getKey();
-        if (key.size() == 0) {
+size_t Checkpoint::mergePrevCheckpoint(Checkpoint *pPrevCheckpoint,
+                                       CheckpointManager *checkpointManager) {
+    std::vector<std::pair<queued_item, uint64_t> > inserted;
+    for (size_t pos = 0; pos < pPrevCheckpoint->numSlots; ++pos) {
+        // Not a reference, as reading the next chunk of a spilled
+        // checkpoint may drop this one.
+        queued_item qi = pPrevCheckpoint->slot(pos);
+        if (!qi || qi->getKey().size() == 0) {
             continue;
         }
-        checkpoint_index::iterator it = keyIndex.find(key);
-        if (it == keyIndex.end()) {
-            // Skip the first two meta items
-            std::list<queued_item>::iterator pos = toWrite.begin();
-            for (; pos != toWrite.end(); ++pos) {
-                if ((*pos)->getKey().compare("") != 0) {
-                    break;
-                }
-            }
-            toWrite.insert(pos, *rit);
-            index_entry entry = {--pos, pPrevCheckpoint->getMutationIdForKey(key)};
-            keyIndex[key] = entry;
-            newEntryMemOverhead += key.size() + sizeof(index_entry);
-            ++numItems;
-            ++numNewItems;
+        if (numItems == 0 || findEntry(qi->getKey()).position == 0) {
+            uint64_t mid = pPrevCheckpoint->isSpilled() ?
+                0 : pPrevCheckpoint->getMutationIdForKey(qi->getKey());
+            inserted.push_back(std::make_pair(qi, mid));
         }
     }
-    memOverhead += newEntryMemOverhead;
-    stats.memOverhead.incr(newEntryMemOverhead);
-    assert(stats.memOverhead.get() < GIGANTOR);
-    return numNewItems;
+    if (!inserted.empty()) {
+        relayout(checkpointManager, inserted);
+        numItems += inserted.size();
+    }
+    startSeqno = std::min(startSeqno, pPrevCheckpoint->startSeqno);
+    maxDelSeqno = std::max(maxDelSeqno, pPrevCheckpoint->maxDelSeqno);
+    return inserted.size();
 }
 
 uint64_t Checkpoint::getMutationIdForKey(const std::string &key) {
     uint64_t mid = 0;
-    checkpoint_index::iterator it = keyIndex.find(key);
-    if (it != keyIndex.end()) {
-        mid = it->second.mutation_id;
+    if (numItems > 0 && !isSpilled()) {
+        index_entry &entry = findEntry(key);
+        if (entry.position != 0) {
+            mid = entry.mutation_id;
+        }
     }
     return mid;
 }
 
+void Checkpoint::getItemsToSpill(CheckpointManager *checkpointManager,
+                                 std::vector<queued_item> &items) {
+    if (numEmptySlots > 0) {
+        relayout(checkpointManager, std::vector<std::pair<queued_item, uint64_t> >());
+    }
+    items.reserve(numSlots);
+    for (size_t pos = 0; pos < numSlots; ++pos) {
+        const queued_item &qi = slot(pos);
+        if (qi) {
+            items.push_back(qi);
+        }
+    }
+}
+
+void Checkpoint::spill(CheckpointSpillFile *file, const std::vector<off_t> &offsets) {
+    assert(checkpointState == closed && numEmptySlots == 0);
+    std::vector<queued_item*>::iterator it;
+    for (it = chunks.begin(); it != chunks.end(); ++it) {
+        delete [] *it;
+        *it = NULL;
+    }
+    chunks.resize(offsets.size() - 1);
+    assert(chunks.size() * CHECKPOINT_CHUNK_SIZE >= numSlots);
+    std::vector<index_entry>().swap(keyIndex);
+    std::vector<size_t>().swap(emptySlotTree);
+    spillFile = file;
+    spillOffsets = offsets;
+    updateMemOverhead();
+}
+
+bool Checkpoint::getChunkToLoad(size_t pos, spilled_chunk &sc) {
+    if (!isSpilled() || pos >= numSlots || chunks[pos / CHECKPOINT_CHUNK_SIZE]) {
+        return false;
+    }
+    sc.chunk = pos / CHECKPOINT_CHUNK_SIZE;
+    sc.start = spillOffsets[sc.chunk];
+    sc.end = spillOffsets[sc.chunk + 1];
+    sc.count = std::min(numSlots - sc.chunk * CHECKPOINT_CHUNK_SIZE,
+                        static_cast<size_t>(CHECKPOINT_CHUNK_SIZE));
+    return true;
+}
+
+bool Checkpoint::installChunk(const spilled_chunk &sc, queued_item *items) {
+    // The checkpoint may have been removed and another one spilled to
+    // the same space meanwhile.
+    if (!isSpilled() || sc.chunk >= chunks.size() || chunks[sc.chunk] ||
+        spillOffsets[sc.chunk] != sc.start || spillOffsets[sc.chunk + 1] != sc.end) {
+        return false;
+    }
+    if (residentChunks.size() >= SPILLED_CHECKPOINT_RESIDENT_CHUNKS) {
+        size_t oldest = residentChunks.front();
+        residentChunks.pop_front();
+        delete [] chunks[oldest];
+        chunks[oldest] = NULL;
+    }
+    chunks[sc.chunk] = items;
+    residentChunks.push_back(sc.chunk);
+    updateMemOverhead();
+    return true;
+}
+
+queued_item *Checkpoint::loadChunk(size_t chunk) {
+    spilled_chunk sc;
+    bool toLoad = getChunkToLoad(chunk * CHECKPOINT_CHUNK_SIZE, sc);
+    assert(toLoad);
+    queued_item *items = new queued_item[CHECKPOINT_CHUNK_SIZE];
+    if (!spillFile->read(sc.start, sc.end, items, sc.count)) {
+        delete [] items;
+        if (!spillReadFailed) {
+            unreadableItem = queued_item(new QueuedItem("", 0xffff, queue_op_empty));
+            spillReadFailed = true;
+        }
+        return NULL;
+    }
+    bool installed = installChunk(sc, items);
+    assert(installed);
+    return items;
+}
+
 CheckpointManager::~CheckpointManager() {
     LockHolder lh(queueLock);
     std::list<Checkpoint*>::iterator it = checkpointList.begin();
@@ -185,6 +471,7 @@ CheckpointManager::~CheckpointManager() {
         delete *it;
         ++it;
     }
+    delete spillFile;
 }
 
 uint64_t CheckpointManager::getOpenCheckpointId_UNLOCKED() {
@@ -219,7 +506,7 @@ void CheckpointManager::setOpenCheckpointId_UNLOCKED(uint64_t id) {
         checkpointList.back()->setId(id);
         // Update the checkpoint_start item with the new Id.
         queued_item qi = createCheckpointItem(id, vbucketId, queue_op_checkpoint_start);
-        std::list<queued_item>::iterator it = ++(checkpointList.back()->begin());
+        CheckpointIterator it = ++(checkpointList.back()->begin());
         *it = qi;
     }
 }
@@ -230,7 +517,7 @@ bool CheckpointManager::addNewCheckpoint_UNLOCKED(uint64_t id) {
         closeOpenCheckpoint_UNLOCKED(checkpointList.back()->getId());
     }
 
-    Checkpoint *checkpoint = new Checkpoint(stats, id, opened);
+    Checkpoint *checkpoint = new Checkpoint(stats, id, lastBySeqno, opened);
     // Add a dummy item into the new checkpoint, so that any cursor referring to the actual first
     // item in this new checkpoint can be safely shifted left by 1 if the first item is removed
     // and pushed into the tail.
@@ -299,6 +586,7 @@ protocol_binary_response_status CheckpointManager::startOnlineUpdate() {
     --(onlineUpdateCursor.currentCheckpoint);
 
     onlineUpdateCursor.currentPos = checkpointList.back()->begin();
+    onlineUpdateCursor.emptySlotsSeen = 0;
     (*(onlineUpdateCursor.currentCheckpoint))->registerCursorName(onlineUpdateCursor.name);
 
     doOnlineUpdate = true;
@@ -361,9 +649,11 @@ protocol_binary_response_status CheckpointManager::beginHotReload() {
     checkOpenCheckpoint_UNLOCKED(true, true);
 
     //Update persistence cursor due to hotReload
+    syncCursorOffset_UNLOCKED(persistenceCursor);
     (*(persistenceCursor.currentCheckpoint))->removeCursorName(persistenceCursor.name);
     persistenceCursor.currentCheckpoint = --(checkpointList.end());
     persistenceCursor.currentPos = checkpointList.back()->begin();
+    persistenceCursor.emptySlotsSeen = 0;
 
     (*(persistenceCursor.currentCheckpoint))->registerCursorName(persistenceCursor.name);
 
@@ -398,6 +688,7 @@ bool CheckpointManager::registerTAPCursor(const std::string &name, uint64_t chec
                                           bool closedCheckpointOnly, bool alwaysFromBeginning) {
     LockHolder lh(queueLock);
     assert(checkpointList.size() > 0);
+    droppedTAPCursors.erase(name);
 
     bool found = false;
     std::list<Checkpoint*>::iterator it = checkpointList.begin();
@@ -432,14 +723,17 @@ bool CheckpointManager::registerTAPCursor(const std::string &name, uint64_t chec
         (*it)->registerCursorName(name);
     } else {
         size_t offset = 0;
-        std::list<queued_item>::iterator curr;
+        uint64_t resumeSeqno = 0;
+        CheckpointIterator curr;
         if (!alwaysFromBeginning &&
             map_it != tapCursors.end() &&
             (*(map_it->second.currentCheckpoint))->getId() == (*it)->getId()) {
             // If the cursor is currently in the checkpoint to start with, simply start from
             // its current position.
+            syncCursorOffset_UNLOCKED(map_it->second);
             curr = map_it->second.currentPos;
             offset = map_it->second.offset;
+            resumeSeqno = map_it->second.resumeSeqno;
         } else {
             // Set the cursor's position to the begining of the checkpoint to start with
             curr = (*it)->begin();
@@ -450,7 +744,9 @@ bool CheckpointManager::registerTAPCursor(const std::string &name, uint64_t chec
         }
 
         CheckpointCursor cursor(name, it, curr, offset, closedCheckpointOnly, open_chk_id);
+        cursor.resumeSeqno = resumeSeqno;
         tapCursors[name] = cursor;
+        markCursorPosition_UNLOCKED(tapCursors[name]);
         // Register the tap cursor's name to the checkpoint.
         (*it)->registerCursorName(name);
     }
@@ -458,8 +754,69 @@ bool CheckpointManager::registerTAPCursor(const std::string &name, uint64_t chec
     return found;
 }
 
+resume_seqno_t CheckpointManager::registerTAPCursorBySeqno(const std::string &name,
+                                                           uint64_t seqno) {
+    LockHolder lh(queueLock);
+    assert(checkpointList.size() > 0);
+    droppedTAPCursors.erase(name);
+
+    if (getOpenCheckpointId_UNLOCKED() == 0) {
+        // The vbucket is still receiving backfill items from another node.
+        return RESUME_INVALID;
+    }
+    if (seqno > lastBySeqno || seqno < purgeSeqno) {
+        // Either the sequence number is from another history of this
+        // vbucket, or deletions since it were dropped from memory.
+        return RESUME_INVALID;
+    }
+
+    // Start from the last checkpoint created at or before the sequence
+    // number, as nothing after it can be in an earlier one.  If even
+    // the first one was created after it, what was dropped from memory
+    // in between has to be backfilled.
+    resume_seqno_t rv = RESUME_WITH_BACKFILL;
+    std::list<Checkpoint*>::iterator it = checkpointList.begin();
+    if (seqno >= checkpointList.front()->getStartSeqno()) {
+        rv = RESUME_FROM_CHECKPOINTS;
+        std::list<Checkpoint*>::iterator next = it;
+        while (++next != checkpointList.end() && (*next)->getStartSeqno() <= seqno) {
+            it = next;
+        }
+    }
+
+    size_t offset = 0;
+    std::list<Checkpoint*>::iterator pos = checkpointList.begin();
+    for (; pos != it; ++pos) {
+        offset += (*pos)->getNumItems() + 2; // 2 is for checkpoint start and end items.
+    }
+
+    std::map<const std::string, CheckpointCursor>::iterator map_it = tapCursors.find(name);
+    if (map_it != tapCursors.end()) {
+        (*(map_it->second.currentCheckpoint))->removeCursorName(name);
+    }
+
+    CheckpointCursor cursor(name, it, (*it)->begin(), offset, false,
+                            getOpenCheckpointId_UNLOCKED());
+    cursor.resumeSeqno = seqno;
+    tapCursors[name] = cursor;
+    markCursorPosition_UNLOCKED(tapCursors[name]);
+    (*it)->registerCursorName(name);
+
+    return rv;
+}
+
 bool CheckpointManager::removeTAPCursor(const std::string &name) {
     LockHolder lh(queueLock);
+    droppedTAPCursors.erase(name);
+    return removeTAPCursor_UNLOCKED(name);
+}
+
+bool CheckpointManager::wasTAPCursorDropped(const std::string &name) {
+    LockHolder lh(queueLock);
+    return droppedTAPCursors.erase(name) > 0;
+}
+
+bool CheckpointManager::removeTAPCursor_UNLOCKED(const std::string &name) {
     std::map<const std::string, CheckpointCursor>::iterator it = tapCursors.find(name);
     if (it == tapCursors.end()) {
         return false;
@@ -475,6 +832,11 @@ bool CheckpointManager::removeTAPCursor(const std::string &name) {
         (*cit)->removeCursorName(name);
     }
 
+    if (it->second.currentCheckpoint == checkpointList.begin() &&
+        checkpointList.front()->getState() == closed &&
+        checkpointList.front()->getNumberOfCursors() == 0) {
+        notifyUnrefCheckpoint_UNLOCKED();
+    }
     tapCursors.erase(it);
     return true;
 }
@@ -499,6 +861,33 @@ size_t CheckpointManager::getNumCheckpoints() {
     return checkpointList.size();
 }
 
+size_t CheckpointManager::getNumSpilledCheckpoints() {
+    LockHolder lh(queueLock);
+    size_t numSpilled = 0;
+    std::list<Checkpoint*>::iterator it = checkpointList.begin();
+    for (; it != checkpointList.end(); ++it) {
+        if ((*it)->isSpilled()) {
+            ++numSpilled;
+        }
+    }
+    return numSpilled;
+}
+
+bool CheckpointManager::canCreateNewCheckpoint_UNLOCKED() {
+    // Spilled checkpoints don't count against the max number of checkpoints,
+    // as they hardly take any memory.
+    size_t numCheckpoints = checkpointList.size();
+    std::list<Checkpoint*>::iterator it = checkpointList.begin();
+    for (; it != checkpointList.end(); ++it) {
+        if ((*it)->isSpilled()) {
+            --numCheckpoints;
+        }
+    }
+    return numCheckpoints < checkpointConfig.getMaxCheckpoints() ||
+           (numCheckpoints == checkpointConfig.getMaxCheckpoints() &&
+            checkpointList.front()->getNumberOfCursors() == 0);
+}
+
 std::list<std::string> CheckpointManager::getTAPCursorNames() {
     LockHolder lh(queueLock);
     std::list<std::string> cursor_names;
@@ -532,15 +921,9 @@ size_t CheckpointManager::removeClosedUnrefCheckpoints(const RCPtr<VBucket> &vbu
     LockHolder lh(queueLock);
     assert(vbucket);
     uint64_t oldCheckpointId = 0;
-    bool canCreateNewCheckpoint = false;
-    if (checkpointList.size() < checkpointConfig.getMaxCheckpoints() ||
-        (checkpointList.size() == checkpointConfig.getMaxCheckpoints() &&
-         checkpointList.front()->getNumberOfCursors() == 0)) {
-        canCreateNewCheckpoint = true;
-    }
     if (vbucket->getState() == vbucket_state_active &&
         !checkpointConfig.isInconsistentSlaveCheckpoint() &&
-        canCreateNewCheckpoint) {
+        canCreateNewCheckpoint_UNLOCKED()) {
 
         bool forceCreation = isCheckpointCreationForHighMemUsage(vbucket);
         // Check if this master active vbucket needs to create a new open checkpoint.
@@ -551,6 +934,7 @@ size_t CheckpointManager::removeClosedUnrefCheckpoints(const RCPtr<VBucket> &vbu
         // If the persistence cursor reached to the end of the old open checkpoint, move it to
         // the new open checkpoint.
         if ((*(persistenceCursor.currentCheckpoint))->getId() == oldCheckpointId) {
+            syncCursorOffset_UNLOCKED(persistenceCursor);
             if (++(persistenceCursor.currentPos) ==
                 (*(persistenceCursor.currentCheckpoint))->end()) {
                 moveCursorToNextCheckpoint(persistenceCursor);
@@ -564,6 +948,7 @@ size_t CheckpointManager::removeClosedUnrefCheckpoints(const RCPtr<VBucket> &vbu
         for (; tap_it != tapCursors.end(); ++tap_it) {
             CheckpointCursor &cursor = tap_it->second;
             if ((*(cursor.currentCheckpoint))->getId() == oldCheckpointId) {
+                syncCursorOffset_UNLOCKED(cursor);
                 if (++(cursor.currentPos) == (*(cursor.currentCheckpoint))->end()) {
                     moveCursorToNextCheckpoint(cursor);
                 } else {
@@ -612,10 +997,16 @@ size_t CheckpointManager::removeClosedUnrefCheckpoints(const RCPtr<VBucket> &vbu
     }
     unrefCheckpointList.splice(unrefCheckpointList.begin(), checkpointList,
                                checkpointList.begin(), it);
+    std::list<Checkpoint*>::iterator unref_it = unrefCheckpointList.begin();
+    for (; unref_it != unrefCheckpointList.end(); ++unref_it) {
+        purgeSeqno = std::max(purgeSeqno, (*unref_it)->getMaxDelSeqno());
+    }
     // If any cursor on a replica vbucket or downstream active vbucket receiving checkpoints from
     // the upstream master is very slow and causes more closed checkpoints in memory,
     // collapse those closed checkpoints into a single one to reduce the memory overhead.
+    // Spilling them to disk takes care of that instead when it is enabled.
     if (!checkpointConfig.canKeepClosedCheckpoints() &&
+        checkpointConfig.getSpillPath().empty() &&
         (vbucket->getState() == vbucket_state_replica ||
          (vbucket->getState() == vbucket_state_active &&
           checkpointConfig.isInconsistentSlaveCheckpoint()))) {
@@ -631,6 +1022,80 @@ size_t CheckpointManager::removeClosedUnrefCheckpoints(const RCPtr<VBucket> &vbu
     return numUnrefItems;
 }
 
+Checkpoint *CheckpointManager::getCheckpointToSpill_UNLOCKED() {
+    // The last closed checkpoint stays in memory, as the others are merged
+    // into it when they are collapsed.
+    if (checkpointList.size() < 3) {
+        return NULL;
+    }
+    std::list<Checkpoint*>::iterator last = checkpointList.end();
+    --last; --last;
+    bool referenced = false;
+    std::list<Checkpoint*>::iterator it = checkpointList.begin();
+    for (; it != last; ++it) {
+        // Only TAP cursors are in the checkpoints before these ones.
+        if (it == persistenceCursor.currentCheckpoint ||
+            (doOnlineUpdate && it == onlineUpdateCursor.currentCheckpoint)) {
+            break;
+        }
+        // Those before the first cursor are about to be removed anyway.
+        referenced = referenced || (*it)->getNumberOfCursors() > 0;
+        if (referenced && (*it)->getState() == closed && !(*it)->isSpilled()) {
+            return *it;
+        }
+    }
+    return NULL;
+}
+
+size_t CheckpointManager::spillClosedCheckpoints() {
+    // This function is executed periodically by the non-IO dispatcher.
+    const std::string &spillPath = checkpointConfig.getSpillPath();
+    if (spillPath.empty()) {
+        return 0;
+    }
+
+    LockHolder lh(queueLock);
+    if (spillFile) {
+        spillFile->truncate();
+    }
+
+    size_t numItemsSpilled = 0;
+    while (true) {
+        double current = static_cast<double>(stats.currentSize.get() + stats.memOverhead.get());
+        Checkpoint *checkpoint = getCheckpointToSpill_UNLOCKED();
+        if (current <= stats.mem_low_wat || !checkpoint) {
+            break;
+        }
+        if (!spillFile) {
+            spillFile = new CheckpointSpillFile(stats, spillPath, vbucketId);
+        }
+        uint64_t checkpointId = checkpoint->getId();
+        std::vector<queued_item> items;
+        checkpoint->getItemsToSpill(this, items);
+
+        // Don't hold the lock while writing.  The checkpoint is closed, so
+        // only its removal can change it meanwhile.
+        lh.unlock();
+        std::vector<off_t> offsets;
+        bool written = spillFile->write(items, CHECKPOINT_CHUNK_SIZE, offsets);
+        lh.lock();
+
+        if (!written) {
+            break;
+        }
+        if (getCheckpointToSpill_UNLOCKED() != checkpoint ||
+            checkpoint->getId() != checkpointId) {
+            spillFile->release(offsets.front(), offsets.back());
+            break;
+        }
+        checkpoint->spill(spillFile, offsets);
+        numItemsSpilled += items.size();
+    }
+
+    stats.checkpointItemsSpilled.incr(numItemsSpilled);
+    return numItemsSpilled;
+}
+
 void CheckpointManager::removeInvalidCursorsOnCheckpoint(Checkpoint *pCheckpoint) {
     std::list<std::string> invalidCursorNames;
     const std::set<std::string> &cursors = pCheckpoint->getCursorNameList();
@@ -673,7 +1138,7 @@ void CheckpointManager::collapseClosedCheckpoints(std::list<Checkpoint*> &collap
         ++rit; ++rit;// Move to the second lastest closed checkpoint.
         size_t numDuplicatedItems = 0, numMetaItems = 0;
         for (; rit != checkpointList.rend(); ++rit) {
-            size_t numAddedItems = (*lastClosedChk)->mergePrevCheckpoint(*rit);
+            size_t numAddedItems = (*lastClosedChk)->mergePrevCheckpoint(*rit, this);
             numDuplicatedItems += ((*rit)->getNumItems() - numAddedItems);
             numMetaItems += 2; // checkpoint start and end meta items
             slowCursors.insert((*rit)->getCursorNameList().begin(),
@@ -686,11 +1151,13 @@ void CheckpointManager::collapseClosedCheckpoints(std::list<Checkpoint*> &collap
                 persistenceCursor.currentCheckpoint = lastClosedChk;
                 persistenceCursor.currentPos =  (*lastClosedChk)->begin();
                 persistenceCursor.offset = 0;
+                persistenceCursor.emptySlotsSeen = 0;
                 (*lastClosedChk)->registerCursorName(persistenceCursor.name);
             } else if ((*sit).compare(onlineUpdateCursor.name) == 0) { // onlineUpdate cursor
                 onlineUpdateCursor.currentCheckpoint = lastClosedChk;
                 onlineUpdateCursor.currentPos =  (*lastClosedChk)->begin();
                 onlineUpdateCursor.offset = 0;
+                onlineUpdateCursor.emptySlotsSeen = 0;
                 (*lastClosedChk)->registerCursorName(onlineUpdateCursor.name);
             } else { // Reposition tap cursors
                 std::map<const std::string, CheckpointCursor>::iterator mit = tapCursors.find(*sit);
@@ -698,6 +1165,7 @@ void CheckpointManager::collapseClosedCheckpoints(std::list<Checkpoint*> &collap
                     mit->second.currentCheckpoint = lastClosedChk;
                     mit->second.currentPos =  (*lastClosedChk)->begin();
                     mit->second.offset = 0;
+                    mit->second.emptySlotsSeen = 0;
                     (*lastClosedChk)->registerCursorName(mit->second.name);
                 }
             }
@@ -738,6 +1206,7 @@ bool CheckpointManager::queueDirty(const queued_item &qi, const RCPtr<VBucket> &
 
     // The current open checkpoint should be always the last one in the checkpoint list.
     assert(checkpointList.back()->getState() == opened);
+    qi->getItem().setBySeqno(++lastBySeqno);
     size_t numItemsBefore = getNumItemsForPersistence_UNLOCKED();
     if (checkpointList.back()->queueDirty(qi, this) == NEW_ITEM) {
         ++numItems;
@@ -745,15 +1214,9 @@ bool CheckpointManager::queueDirty(const queued_item &qi, const RCPtr<VBucket> &
     size_t numItemsAfter = getNumItemsForPersistence_UNLOCKED();
 
     assert(vbucket);
-    bool canCreateNewCheckpoint = false;
-    if (checkpointList.size() < checkpointConfig.getMaxCheckpoints() ||
-        (checkpointList.size() == checkpointConfig.getMaxCheckpoints() &&
-         checkpointList.front()->getNumberOfCursors() == 0)) {
-        canCreateNewCheckpoint = true;
-    }
     if (vbucket->getState() == vbucket_state_active &&
         !checkpointConfig.isInconsistentSlaveCheckpoint() &&
-        canCreateNewCheckpoint) {
+        canCreateNewCheckpoint_UNLOCKED()) {
         // Only the master active vbucket can create a next open checkpoint.
         checkOpenCheckpoint_UNLOCKED(false, true);
     }
@@ -766,6 +1229,7 @@ bool CheckpointManager::queueDirty(const queued_item &qi, const RCPtr<VBucket> &
 uint64_t CheckpointManager::getAllItemsFromCurrentPosition(CheckpointCursor &cursor,
                                                            uint64_t barrier,
                                                            std::vector<queued_item> &items) {
+    syncCursorOffset_UNLOCKED(cursor);
     while (true) {
         if ( barrier > 0 )  {
             if ((*(cursor.currentCheckpoint))->getId() >= barrier) {
@@ -786,6 +1250,7 @@ uint64_t CheckpointManager::getAllItemsFromCurrentPosition(CheckpointCursor &cur
             break;
         }
     }
+    markCursorPosition_UNLOCKED(cursor);
 
     uint64_t checkpointId = 0;
     // Get the last closed checkpoint Id.
@@ -823,8 +1288,14 @@ uint64_t CheckpointManager::getAllItemsForTAPConnection(const std::string &name,
                          name.c_str());
         return 0;
     }
+    uint64_t resumeSeqno = it->second.resumeSeqno;
     uint64_t checkpointId = getAllItemsFromCurrentPosition(it->second, 0, items);
     it->second.offset = numItems;
+    if (resumeSeqno > 0) {
+        items.erase(std::remove_if(items.begin(), items.end(),
+                                   ReceivedBefore(resumeSeqno)),
+                    items.end());
+    }
     return checkpointId;
 }
 
@@ -840,8 +1311,54 @@ uint64_t CheckpointManager::getAllItemsForOnlineUpdate(std::vector<queued_item>
     return checkpointId;
 }
 
+void CheckpointManager::loadNextChunk_UNLOCKED(LockHolder &lh, const std::string &name) {
+    std::map<const std::string, CheckpointCursor>::iterator it = tapCursors.find(name);
+    if (!spillFile || it == tapCursors.end()) {
+        return;
+    }
+    // Spilled checkpoints have no empty slots, so stepping a copy of
+    // the cursor doesn't read anything.
+    std::list<Checkpoint*>::iterator cit = it->second.currentCheckpoint;
+    CheckpointIterator next = it->second.currentPos;
+    if (++next == (*cit)->end()) {
+        if (++cit == checkpointList.end()) {
+            return;
+        }
+        next = ++((*cit)->begin());
+    }
+    spilled_chunk sc;
+    if (!(*cit)->getChunkToLoad(next.getPosition(), sc)) {
+        return;
+    }
+    Checkpoint *checkpoint = *cit;
+    uint64_t checkpointId = checkpoint->getId();
+    CheckpointSpillFile *file = spillFile;
+    queued_item *items = new queued_item[CHECKPOINT_CHUNK_SIZE];
+
+    // Don't hold the lock while reading.  The spill file outlives the
+    // checkpoints, but the checkpoint may be gone by the time the chunk
+    // is read, and a failed read is left to the cursor to retry.
+    lh.unlock();
+    bool read = file->read(sc.start, sc.end, items, sc.count);
+    lh.lock();
+
+    bool installed = false;
+    if (read) {
+        for (cit = checkpointList.begin(); cit != checkpointList.end(); ++cit) {
+            if (*cit == checkpoint && checkpoint->getId() == checkpointId) {
+                installed = checkpoint->installChunk(sc, items);
+                break;
+            }
+        }
+    }
+    if (!installed) {
+        delete [] items;
+    }
+}
+
 queued_item CheckpointManager::nextItem(const std::string &name, bool &isLastMutationItem) {
     LockHolder lh(queueLock);
+    loadNextChunk_UNLOCKED(lh, name);
     isLastMutationItem = false;
     std::map<const std::string, CheckpointCursor>::iterator it = tapCursors.find(name);
     if (it == tapCursors.end()) {
@@ -860,11 +1377,29 @@ queued_item CheckpointManager::nextItem(const std::string &name, bool &isLastMut
     }
 
     CheckpointCursor &cursor = it->second;
-    if ((*(it->second.currentCheckpoint))->getState() == closed) {
-        return nextItemFromClosedCheckpoint(cursor, isLastMutationItem);
-    } else {
-        return nextItemFromOpenedCheckpoint(cursor, isLastMutationItem);
+    syncCursorOffset_UNLOCKED(cursor);
+    queued_item qi;
+    ReceivedBefore receivedBefore(cursor.resumeSeqno);
+    do {
+        if ((*(it->second.currentCheckpoint))->getState() == closed) {
+            qi = nextItemFromClosedCheckpoint(cursor, isLastMutationItem);
+        } else {
+            qi = nextItemFromOpenedCheckpoint(cursor, isLastMutationItem);
+        }
+    } while (receivedBefore(qi));
+    markCursorPosition_UNLOCKED(cursor);
+
+    if ((*(cursor.currentCheckpoint))->hasUnreadableItems()) {
+        getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                         "VBucket %d CheckpointManager: Dropping the cursor of TAP "
+                         "connection \"%s\", as items it needs couldn't be read back "
+                         "from the spill file\n", vbucketId, name.c_str());
+        removeTAPCursor_UNLOCKED(name);
+        droppedTAPCursors.insert(name);
+        queued_item empty(new QueuedItem("", 0xffff, queue_op_empty));
+        return empty;
     }
+    return qi;
 }
 
 queued_item CheckpointManager::nextItemFromClosedCheckpoint(CheckpointCursor &cursor,
@@ -930,6 +1465,9 @@ void CheckpointManager::clear(vbucket_state_t vbState) {
     checkpointList.clear();
     numItems = 0;
     mutationCounter = 0;
+    // Sequence numbers keep going, but none of the old ones can be
+    // resumed from anymore.
+    purgeSeqno = ++lastBySeqno;
 
     uint64_t checkpointId = vbState == vbucket_state_active ? 1 : 0;
     // Add a new open checkpoint.
@@ -942,6 +1480,8 @@ void CheckpointManager::resetCursors() {
     persistenceCursor.currentCheckpoint = checkpointList.begin();
     persistenceCursor.currentPos = checkpointList.front()->begin();
     persistenceCursor.offset = 0;
+    persistenceCursor.emptySlotsSeen = 0;
+    persistenceCursor.resumeSeqno = 0;
     checkpointList.front()->registerCursorName(persistenceCursor.name);
 
     // Reset all the TAP cursors.
@@ -950,6 +1490,8 @@ void CheckpointManager::resetCursors() {
         cit->second.currentCheckpoint = checkpointList.begin();
         cit->second.currentPos = checkpointList.front()->begin();
         cit->second.offset = 0;
+        cit->second.emptySlotsSeen = 0;
+        cit->second.resumeSeqno = 0;
         checkpointList.front()->registerCursorName(cit->second.name);
     }
 }
@@ -966,14 +1508,32 @@ bool CheckpointManager::moveCursorToNextCheckpoint(CheckpointCursor &cursor) {
 
     // Remove the cursor's name from its current checkpoint.
     (*(cursor.currentCheckpoint))->removeCursorName(cursor.name);
+    if (cursor.currentCheckpoint == checkpointList.begin() &&
+        checkpointList.front()->getNumberOfCursors() == 0) {
+        notifyUnrefCheckpoint_UNLOCKED();
+    }
     // Move the cursor to the next checkpoint.
     ++(cursor.currentCheckpoint);
     cursor.currentPos = (*(cursor.currentCheckpoint))->begin();
+    cursor.emptySlotsSeen = 0;
+    // Nothing from here on was received before the cursor resumed.
+    if ((*(cursor.currentCheckpoint))->getStartSeqno() >= cursor.resumeSeqno) {
+        cursor.resumeSeqno = 0;
+    }
     // Register the cursor's name to its new current checkpoint.
     (*(cursor.currentCheckpoint))->registerCursorName(cursor.name);
     return true;
 }
 
+void CheckpointManager::notifyUnrefCheckpoint_UNLOCKED() {
+    UnrefCheckpointListener *listener = checkpointConfig.getUnrefCheckpointListener();
+    // Closed checkpoints that are kept around are only removed by the
+    // checkpoint remover, once memory runs short.
+    if (listener && !checkpointConfig.canKeepClosedCheckpoints()) {
+        listener->unrefCheckpoint(vbucketId);
+    }
+}
+
 uint64_t CheckpointManager::checkOpenCheckpoint_UNLOCKED(bool forceCreation, bool timeBound) {
     int checkpointId = 0;
     timeBound = timeBound &&
@@ -1029,6 +1589,7 @@ size_t CheckpointManager::getNumItemsForTAPConnection(const std::string &name) {
     size_t remains = 0;
     std::map<const std::string, CheckpointCursor>::iterator it = tapCursors.find(name);
     if (it != tapCursors.end()) {
+        syncCursorOffset_UNLOCKED(it->second);
         remains = (numItems >= it->second.offset) ? numItems - it->second.offset : 0;
     }
     return remains;
@@ -1039,13 +1600,15 @@ void CheckpointManager::decrTapCursorFromCheckpointEnd(const std::string &name)
     std::map<const std::string, CheckpointCursor>::iterator it = tapCursors.find(name);
     if (it != tapCursors.end() &&
         (*(it->second.currentPos))->getOperation() == queue_op_checkpoint_end) {
+        syncCursorOffset_UNLOCKED(it->second);
         --(it->second.offset);
         --(it->second.currentPos);
+        markCursorPosition_UNLOCKED(it->second);
     }
 }
 
 bool CheckpointManager::isLastMutationItemInCheckpoint(CheckpointCursor &cursor) {
-    std::list<queued_item>::iterator it = cursor.currentPos;
+    CheckpointIterator it = cursor.currentPos;
     ++it;
     if (it == (*(cursor.currentCheckpoint))->end() ||
         (*it)->getOperation() == queue_op_checkpoint_end) {
@@ -1100,12 +1663,15 @@ bool CheckpointManager::checkAndAddNewCheckpoint(uint64_t id, bool &pCursorRepos
             for (; cit != cursors.end(); ++cit) {
                 if ((*cit).compare(persistenceCursor.name) == 0) { // Persistence cursor
                     persistenceCursor.currentPos = checkpointList.back()->begin();
+                    persistenceCursor.emptySlotsSeen = 0;
                 } else if ((*cit).compare(onlineUpdateCursor.name) == 0) { // OnlineUpdate cursor
                     onlineUpdateCursor.currentPos = checkpointList.back()->begin();
+                    onlineUpdateCursor.emptySlotsSeen = 0;
                 } else { // TAP cursors
                     std::map<const std::string, CheckpointCursor>::iterator mit =
                         tapCursors.find(*cit);
                     mit->second.currentPos = checkpointList.back()->begin();
+                    mit->second.emptySlotsSeen = 0;
                 }
             }
             return true;
@@ -1120,7 +1686,7 @@ bool CheckpointManager::checkAndAddNewCheckpoint(uint64_t id, bool &pCursorRepos
         size_t numDuplicatedItems = 0, numMetaItems = 0;
         // Collapse all checkpoints.
         for (; rit != checkpointList.rend(); ++rit) {
-            size_t numAddedItems = checkpointList.back()->mergePrevCheckpoint(*rit);
+            size_t numAddedItems = checkpointList.back()->mergePrevCheckpoint(*rit, this);
             numDuplicatedItems += ((*rit)->getNumItems() - numAddedItems);
             numMetaItems += 2; // checkpoint start and end meta items
             delete *rit;
@@ -1153,7 +1719,7 @@ bool CheckpointManager::hasNext(const std::string &name) {
     }
 
     bool hasMore = true;
-    std::list<queued_item>::iterator curr = it->second.currentPos;
+    CheckpointIterator curr = it->second.currentPos;
     ++curr;
     if (curr == (*(it->second.currentCheckpoint))->end() &&
         (*(it->second.currentCheckpoint))->getState() == opened) {
@@ -1175,7 +1741,7 @@ queued_item CheckpointManager::createCheckpointItem(uint64_t id,
 bool CheckpointManager::hasNextForPersistence() {
     LockHolder lh(queueLock);
     bool hasMore = true;
-    std::list<queued_item>::iterator curr = persistenceCursor.currentPos;
+    CheckpointIterator curr = persistenceCursor.currentPos;
     ++curr;
     if (curr == (*(persistenceCursor.currentCheckpoint))->end() &&
         (*(persistenceCursor.currentCheckpoint))->getState() == opened) {
@@ -1211,6 +1777,8 @@ CheckpointConfig::CheckpointConfig(EventuallyPersistentEngine &e) {
     itemNumBasedNewCheckpoint = config.isItemNumBasedNewChk();
     keepClosedCheckpoints = config.isKeepClosedChks();
     metaItemsOnly = config.isChkMetaItemsOnly();
+    spillPath = config.getChkSpillPath();
+    unrefCheckpointListener = NULL;
 }
 
 bool CheckpointConfig::validateCheckpointMaxItemsParam(size_t checkpoint_max_items) {
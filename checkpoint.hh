@@ -6,12 +6,14 @@
 #include <list>
 #include <map>
 #include <set>
+#include <vector>
 
 #include "common.hh"
 #include "atomic.hh"
 #include "locks.hh"
 #include "queueditem.hh"
 #include "stats.hh"
+#include "checkpoint_spill.hh"
 
 #define MIN_CHECKPOINT_ITEMS 100
 #define MAX_CHECKPOINT_ITEMS 500000
@@ -24,23 +26,79 @@
 #define DEFAULT_MAX_CHECKPOINTS 2
 #define MAX_CHECKPOINTS_UPPER_BOUND 5
 
+// Number of items in each chunk of a checkpoint's queue.
+#define CHECKPOINT_CHUNK_SIZE 64
+
+// Number of chunks of a spilled checkpoint kept in memory at a time.
+#define SPILLED_CHECKPOINT_RESIDENT_CHUNKS 4
+
 typedef enum {
     opened,
     closed
 } checkpoint_state;
 
+/**
+ * An entry of a checkpoint's key index.  The key itself is the one of
+ * the item at the position, so it isn't copied.
+ */
 struct index_entry {
-    std::list<queued_item>::iterator position;
+    uint32_t position;      //!< One past the item's position (0 is empty)
+    uint32_t tag;           //!< Upper bits of the key's hash
     uint64_t mutation_id;
 };
 
-typedef unordered_map<std::string, index_entry> checkpoint_index;
+/**
+ * A chunk of a spilled checkpoint to be read back from the spill file.
+ */
+struct spilled_chunk {
+    size_t chunk;           //!< The index of the chunk in its checkpoint
+    off_t  start;           //!< The offset of the chunk in the spill file
+    off_t  end;             //!< The offset right after the chunk
+    size_t count;           //!< The number of items in the chunk
+};
 
 class Checkpoint;
 class CheckpointManager;
 class CheckpointConfig;
 class VBucket;
 
+/**
+ * Iterates over the items of a checkpoint in the order they were
+ * queued, skipping the slots of the items that were deduplicated.
+ */
+class CheckpointIterator {
+    friend class Checkpoint;
+public:
+    CheckpointIterator() : checkpoint(NULL), pos(0) { }
+
+    CheckpointIterator(Checkpoint *c, size_t p) : checkpoint(c), pos(p) { }
+
+    inline CheckpointIterator &operator++();
+
+    inline CheckpointIterator &operator--();
+
+    inline queued_item &operator*() const;
+
+    bool operator==(const CheckpointIterator &other) const {
+        return pos == other.pos && checkpoint == other.checkpoint;
+    }
+
+    bool operator!=(const CheckpointIterator &other) const {
+        return !(*this == other);
+    }
+
+    /**
+     * Return the position of the item in its checkpoint's queue.
+     */
+    size_t getPosition() const {
+        return pos;
+    }
+
+private:
+    Checkpoint *checkpoint;
+    size_t      pos;
+};
+
 /**
  * A checkpoint cursor
  */
@@ -48,26 +106,31 @@ class CheckpointCursor {
     friend class CheckpointManager;
     friend class Checkpoint;
 public:
-    CheckpointCursor() { }
+    CheckpointCursor() : emptySlotsSeen(0), resumeSeqno(0) { }
 
-    CheckpointCursor(const std::string &n) : name(n) { }
+    CheckpointCursor(const std::string &n) : name(n), emptySlotsSeen(0), resumeSeqno(0) { }
 
     CheckpointCursor(const std::string &n,
                      std::list<Checkpoint*>::iterator checkpoint,
-                     std::list<queued_item>::iterator pos,
+                     CheckpointIterator pos,
                      size_t os = 0, bool isClosedCheckpointOnly = false,
                      uint64_t openChkId = 1) :
         name(n), currentCheckpoint(checkpoint), currentPos(pos),
-        offset(os), closedCheckpointOnly(isClosedCheckpointOnly),
-        openChkIdAtRegistration(openChkId) { }
+        offset(os), emptySlotsSeen(0), closedCheckpointOnly(isClosedCheckpointOnly),
+        openChkIdAtRegistration(openChkId), resumeSeqno(0) { }
 
 private:
     std::string                      name;
     std::list<Checkpoint*>::iterator currentCheckpoint;
-    std::list<queued_item>::iterator currentPos;
+    CheckpointIterator               currentPos;
     Atomic<size_t>                   offset;
+    // Empty slots up to currentPos already taken off the offset.
+    size_t                           emptySlotsSeen;
     bool                             closedCheckpointOnly;
     uint64_t                         openChkIdAtRegistration;
+    // Items up to this sequence number were already received by the
+    // client the cursor resumes for, or 0 if it didn't resume.
+    uint64_t                         resumeSeqno;
 };
 
 /**
@@ -78,22 +141,48 @@ typedef enum {
     NEW_ITEM          //!< The item is newly added to the tail.
 } queue_dirty_t;
 
+/**
+ * Result from registering a TAP cursor from a sequence number.
+ */
+typedef enum {
+    RESUME_FROM_CHECKPOINTS, //!< Everything since is still in the checkpoints.
+    RESUME_WITH_BACKFILL,    //!< What isn't in the checkpoints has to be backfilled.
+    RESUME_INVALID           //!< The sequence number can't be resumed from.
+} resume_seqno_t;
+
 /**
  * Representation of a checkpoint used in the unified queue for persistence and tap.
+ *
+ * Items are queued in chunks of CHECKPOINT_CHUNK_SIZE slots.  When an
+ * item is deduplicated, its slot is left empty rather than removed,
+ * and the queue is compacted once there are more empty slots than
+ * items.  Keys are found through an open addressing index of the item
+ * positions.
+ *
+ * Deduplication doesn't touch the cursors, not even the one on the
+ * item removed, as slots keep their positions.  The offset of a cursor
+ * is instead brought up to date by counting the empty slots up to its
+ * position whenever it is read or the cursor moves.
+ *
+ * A closed checkpoint that only slow TAP cursors still need can be
+ * spilled to the vbucket's CheckpointSpillFile.  Its chunks are then
+ * read back one at a time as the cursors reach them, and only a few
+ * of them are kept in memory.
  */
 class Checkpoint {
+    friend class CheckpointIterator;
 public:
-    Checkpoint(EPStats &st, uint64_t id, checkpoint_state state = opened) :
+    Checkpoint(EPStats &st, uint64_t id, uint64_t seqno = 0,
+               checkpoint_state state = opened) :
         stats(st), checkpointId(id), creationTime(ep_real_time()),
-        checkpointState(state), numItems(0), memOverhead(0) {
+        checkpointState(state), startSeqno(seqno), maxDelSeqno(0), numItems(0),
+        numSlots(0), numEmptySlots(0), spillFile(NULL), spillReadFailed(false),
+        memOverhead(0) {
         stats.memOverhead.incr(memorySize());
         assert(stats.memOverhead.get() < GIGANTOR);
     }
 
-    ~Checkpoint() {
-        stats.memOverhead.decr(memorySize());
-        assert(stats.memOverhead.get() < GIGANTOR);
-    }
+    ~Checkpoint();
 
     /**
      * Return the checkpoint Id
@@ -117,6 +206,22 @@ public:
         return creationTime;
     }
 
+    /**
+     * Return the last sequence number of the vbucket when this
+     * checkpoint was created.  Its items all come after it.
+     */
+    uint64_t getStartSeqno() const {
+        return startSeqno;
+    }
+
+    /**
+     * Return the highest sequence number of the deletions in this
+     * checkpoint.
+     */
+    uint64_t getMaxDelSeqno() const {
+        return maxDelSeqno;
+    }
+
     /**
      * Return the number of items belonging to this checkpoint.
      */
@@ -183,24 +288,22 @@ public:
     queue_dirty_t queueDirty(const queued_item &qi, CheckpointManager *checkpointManager);
 
 
-    std::list<queued_item>::iterator begin() {
-        return toWrite.begin();
-    }
-
-    std::list<queued_item>::iterator end() {
-        return toWrite.end();
-    }
-
-    std::list<queued_item>::reverse_iterator rbegin() {
-        return toWrite.rbegin();
+    CheckpointIterator begin() {
+        return CheckpointIterator(this, 0);
     }
 
-    std::list<queued_item>::reverse_iterator rend() {
-        return toWrite.rend();
+    CheckpointIterator end() {
+        return CheckpointIterator(this, numSlots);
     }
 
     uint64_t getCasForKey(const std::string &key);
 
+    /**
+     * Return the number of empty slots up to and including the given
+     * position.
+     */
+    size_t getNumEmptySlotsUpTo(const CheckpointIterator &pos);
+
     /**
      * Return the memory overhead of this checkpoint instance, except for the memory used by
      * all the items belonging to this checkpoint. The memory overhead of those items is
@@ -215,9 +318,11 @@ public:
      * Merge the previous checkpoint into the this checkpoint by adding the items from
      * the previous checkpoint, which don't exist in this checkpoint.
      * @param pPrevCheckpoint pointer to the previous checkpoint.
+     * @param checkpointManager the checkpoint manager to which this checkpoint belongs
      * @return the number of items added from the previous checkpoint.
      */
-    size_t mergePrevCheckpoint(Checkpoint *pPrevCheckpoint);
+    size_t mergePrevCheckpoint(Checkpoint *pPrevCheckpoint,
+                               CheckpointManager *checkpointManager);
 
     /**
      * Get the mutation id for a given key in this checkpoint
@@ -226,19 +331,153 @@ public:
      */
     uint64_t getMutationIdForKey(const std::string &key);
 
+    /**
+     * Return true if the items of this checkpoint were spilled to disk.
+     */
+    bool isSpilled() const {
+        return spillFile != NULL;
+    }
+
+    /**
+     * Return true if some of the spilled items couldn't be read back.
+     * They show up as empty items.
+     */
+    bool hasUnreadableItems() const {
+        return spillReadFailed;
+    }
+
+    /**
+     * Compact this checkpoint and copy its items, so that they can be
+     * spilled.
+     * @param checkpointManager the checkpoint manager to which this checkpoint belongs
+     * @param items the array that will contain the items of this checkpoint
+     */
+    void getItemsToSpill(CheckpointManager *checkpointManager,
+                         std::vector<queued_item> &items);
+
+    /**
+     * Drop the items of this checkpoint from memory, now that they were
+     * written to a spill file by chunks of CHECKPOINT_CHUNK_SIZE.
+     * @param file the file the items were written to
+     * @param offsets the offsets of the chunks in the file, followed by
+     *        the end of the last one
+     */
+    void spill(CheckpointSpillFile *file, const std::vector<off_t> &offsets);
+
+    /**
+     * Find the chunk of a spilled checkpoint that has to be read back
+     * for the item at a position.
+     * @param pos the position of the item
+     * @param sc set to the chunk to read
+     * @return false if the item is in memory already
+     */
+    bool getChunkToLoad(size_t pos, spilled_chunk &sc);
+
+    /**
+     * Take a chunk read back from the spill file, and drop the chunk
+     * read the longest ago if too many are in memory.
+     * @param sc the chunk
+     * @param items the items read, owned by this checkpoint if taken
+     * @return false if the chunk was already in memory, or isn't one
+     *         of this checkpoint anymore
+     */
+    bool installChunk(const spilled_chunk &sc, queued_item *items);
+
 private:
+    queued_item &slot(size_t pos) {
+        queued_item *chunk = chunks[pos / CHECKPOINT_CHUNK_SIZE];
+        if (!chunk) {
+            chunk = loadChunk(pos / CHECKPOINT_CHUNK_SIZE);
+            if (!chunk) {
+                return unreadableItem;
+            }
+        }
+        return chunk[pos % CHECKPOINT_CHUNK_SIZE];
+    }
+
+    /**
+     * Read a chunk of a spilled checkpoint back under the caller's
+     * lock.  CheckpointManager::loadNextChunk_UNLOCKED reads the chunks
+     * TAP cursors reach without holding it, so this is only for the
+     * ones that weren't.
+     *
+     * @return NULL if the chunk couldn't be read
+     */
+    queued_item *loadChunk(size_t chunk);
+
+    void pushSlot(const queued_item &qi);
+
+    /**
+     * Find the index entry of a key, or the empty entry it would take.
+     */
+    index_entry &findEntry(const std::string &key);
+
+    /**
+     * Make room in the key index for one more key.
+     */
+    void reserveKey();
+
+    /**
+     * Rewrite the queue without its empty slots, with the given items
+     * inserted after the meta items at its head, and move the cursors
+     * in this checkpoint along with their items.
+     */
+    void relayout(CheckpointManager *checkpointManager,
+                  const std::vector<std::pair<queued_item, uint64_t> > &inserted);
+
+    void updateMemOverhead();
+
+    /**
+     * Count an empty slot in emptySlotTree.
+     */
+    void addEmptySlot(size_t pos);
+
     EPStats                       &stats;
     uint64_t                       checkpointId;
     rel_time_t                     creationTime;
     checkpoint_state               checkpointState;
+    uint64_t                       startSeqno;
+    uint64_t                       maxDelSeqno;
     size_t                         numItems;
     std::set<std::string>          cursors; // List of cursors with their unique names.
-    // List is used for queueing mutations as vector incurs shift operations for deduplication.
-    std::list<queued_item>         toWrite;
-    checkpoint_index               keyIndex;
+    std::vector<queued_item*>      chunks;
+    size_t                         numSlots;
+    size_t                         numEmptySlots;
+    // Fenwick tree of the number of empty slots in each chunk.
+    std::vector<size_t>            emptySlotTree;
+    std::vector<index_entry>       keyIndex;
+    CheckpointSpillFile           *spillFile;
+    std::vector<off_t>             spillOffsets;
+    bool                           spillReadFailed;
+    // Stands in for the items of chunks that couldn't be read back.
+    queued_item                    unreadableItem;
+    // The chunks of a spilled checkpoint in memory, in the order read.
+    std::list<size_t>              residentChunks;
     size_t                         memOverhead;
 };
 
+CheckpointIterator &CheckpointIterator::operator++() {
+    // Spilled checkpoints have no empty slots, and aren't read from
+    // disk just to be skipped over.
+    do {
+        ++pos;
+    } while (pos < checkpoint->numSlots && checkpoint->numEmptySlots > 0 &&
+             !checkpoint->slot(pos));
+    return *this;
+}
+
+CheckpointIterator &CheckpointIterator::operator--() {
+    // The first slot holds a dummy item that is never deduplicated.
+    do {
+        --pos;
+    } while (pos > 0 && checkpoint->numEmptySlots > 0 && !checkpoint->slot(pos));
+    return *this;
+}
+
+queued_item &CheckpointIterator::operator*() const {
+    return checkpoint->slot(pos);
+}
+
 /**
  * Representation of a checkpoint manager that maintains the list of checkpoints
  * for each vbucket.
@@ -252,8 +491,10 @@ public:
     CheckpointManager(EPStats &st, uint16_t vbucket,
                       CheckpointConfig &config, uint64_t checkpointId = 1) :
         stats(st), checkpointConfig(config), vbucketId(vbucket), numItems(0),
-        mutationCounter(0), persistenceCursor("persistence"), onlineUpdateCursor("online_update"),
-        isCollapsedCheckpoint(false), doOnlineUpdate(false), doHotReload(false) {
+        mutationCounter(0), lastBySeqno(0), purgeSeqno(0),
+        persistenceCursor("persistence"), onlineUpdateCursor("online_update"),
+        isCollapsedCheckpoint(false), spillFile(NULL), doOnlineUpdate(false),
+        doHotReload(false) {
 
         addNewCheckpoint(checkpointId);
         registerPersistenceCursor();
@@ -284,6 +525,14 @@ public:
     size_t removeClosedUnrefCheckpoints(const RCPtr<VBucket> &vbucket,
                                         bool &newOpenCheckpointCreated);
 
+    /**
+     * Spill the closed checkpoints that only TAP cursors still need to
+     * disk, if a spill path is configured and the memory usage is above
+     * the low water mark.
+     * @return the number of items spilled
+     */
+    size_t spillClosedCheckpoints();
+
     /**
      * Register the new cursor for a given TAP connection
      * @param name the name of a given TAP connection
@@ -296,6 +545,18 @@ public:
     bool registerTAPCursor(const std::string &name, uint64_t checkpointId = 1,
                            bool closedCheckpointOnly = false, bool alwaysFromBeginning = false);
 
+    /**
+     * Register the cursor for a TAP connection that resumes from the
+     * sequence number of the last item it received.  The cursor skips
+     * the items the client already has.
+     * @param name the name of a given TAP connection
+     * @param seqno the sequence number to resume from
+     * @return whether everything since the sequence number can be sent
+     * from the checkpoints, has to be backfilled first, or can't be
+     * resumed from at all.
+     */
+    resume_seqno_t registerTAPCursorBySeqno(const std::string &name, uint64_t seqno);
+
     /**
      * Remove the cursor for a given TAP connection.
      * @param name the name of a given TAP connection
@@ -303,6 +564,13 @@ public:
      */
     bool removeTAPCursor(const std::string &name);
 
+    /**
+     * Return true once if the cursor of the given TAP connection was
+     * dropped because items it needed couldn't be read back from the
+     * spill file.  The connection has to be backfilled instead.
+     */
+    bool wasTAPCursorDropped(const std::string &name);
+
     /**
      * Get the Id of the checkpoint where the given TAP connection's cursor is currently located.
      * If the cursor is not found, return 0 as a checkpoint Id.
@@ -398,10 +666,32 @@ public:
 
     size_t getNumCheckpoints();
 
+    /**
+     * Return the sequence number of the last item queued.
+     */
+    uint64_t getHighSeqno() {
+        LockHolder lh(queueLock);
+        return lastBySeqno;
+    }
+
+    /**
+     * Continue the sequence numbers after the one given, as restored
+     * from disk.  Nothing before it can be resumed from, as the
+     * deletions before it aren't known.
+     */
+    void setHighSeqno(uint64_t seqno) {
+        LockHolder lh(queueLock);
+        lastBySeqno = std::max(lastBySeqno, seqno);
+        purgeSeqno = std::max(purgeSeqno, seqno);
+    }
+
+    size_t getNumSpilledCheckpoints();
+
     /**
      * Return the total number of remaining items that should be visited by the persistence cursor.
      */
     size_t getNumItemsForPersistence_UNLOCKED() {
+        syncCursorOffset_UNLOCKED(persistenceCursor);
         size_t num_items = numItems;
         size_t offset = persistenceCursor.offset;
         return num_items > offset ? num_items - offset : 0;
@@ -451,6 +741,18 @@ private:
 
     void registerPersistenceCursor();
 
+    /**
+     * Return true if the number of checkpoints in memory allows a new
+     * open checkpoint to be created.
+     */
+    bool canCreateNewCheckpoint_UNLOCKED();
+
+    /**
+     * Return the first closed checkpoint in memory that only TAP cursors
+     * still need, or NULL if there is none.
+     */
+    Checkpoint *getCheckpointToSpill_UNLOCKED();
+
     /**
      * Create a new open checkpoint and add it to the checkpoint list.
      * The lock should be acquired before calling this function.
@@ -470,12 +772,29 @@ private:
 
     queued_item nextItemFromOpenedCheckpoint(CheckpointCursor &cursor, bool &isLastMutationItem);
 
+    /**
+     * Read the chunk of a spilled checkpoint a TAP cursor is about to
+     * reach back from the spill file, if it isn't in memory.  The lock
+     * is released while reading, so that queueing isn't held up.
+     * @param lh the holder of queueLock
+     * @param name the name of the TAP connection
+     */
+    void loadNextChunk_UNLOCKED(LockHolder &lh, const std::string &name);
+
     uint64_t getAllItemsFromCurrentPosition(CheckpointCursor &cursor,
                                             uint64_t barrier,
                                             std::vector<queued_item> &items);
 
     bool moveCursorToNextCheckpoint(CheckpointCursor &cursor);
 
+    bool removeTAPCursor_UNLOCKED(const std::string &name);
+
+    /**
+     * Tell the listener, if any, that the oldest checkpoint may be removed,
+     * as the last cursor in it just left.
+     */
+    void notifyUnrefCheckpoint_UNLOCKED();
+
     /**
      * Check the current open checkpoint to see if we need to create the new open checkpoint.
      * @param forceCreation is to indicate if a new checkpoint is created due to online update or
@@ -521,10 +840,37 @@ private:
         }
     }
 
-    void decrPersistenceCursorPos_UNLOCKED() {
-        if (persistenceCursor.currentPos != (*(persistenceCursor.currentCheckpoint))->begin()) {
-            --(persistenceCursor.currentPos);
+    /**
+     * Take the items deduplicated behind a cursor since it was last
+     * brought up to date off its offset.  Call this before moving it.
+     */
+    void syncCursorOffset_UNLOCKED(CheckpointCursor &cursor) {
+        size_t emptySlots =
+            (*(cursor.currentCheckpoint))->getNumEmptySlotsUpTo(cursor.currentPos);
+        cursor.offset -= emptySlots - cursor.emptySlotsSeen;
+        cursor.emptySlotsSeen = emptySlots;
+    }
+
+    /**
+     * Only count the items deduplicated behind a cursor from where it
+     * is now.  Call this after moving it.
+     */
+    void markCursorPosition_UNLOCKED(CheckpointCursor &cursor) {
+        cursor.emptySlotsSeen =
+            (*(cursor.currentCheckpoint))->getNumEmptySlotsUpTo(cursor.currentPos);
+    }
+
+    /**
+     * Return the cursor with a given name, or NULL if there is none.
+     */
+    CheckpointCursor *getCursor_UNLOCKED(const std::string &name) {
+        if (name.compare(persistenceCursor.name) == 0) {
+            return &persistenceCursor;
+        } else if (name.compare(onlineUpdateCursor.name) == 0) {
+            return &onlineUpdateCursor;
         }
+        std::map<const std::string, CheckpointCursor>::iterator it = tapCursors.find(name);
+        return it != tapCursors.end() ? &(it->second) : NULL;
     }
 
     bool isLastMutationItemInCheckpoint(CheckpointCursor &cursor);
@@ -545,17 +891,43 @@ private:
     uint16_t                 vbucketId;
     Atomic<size_t>           numItems;
     uint64_t                 mutationCounter;
+    uint64_t                 lastBySeqno;
+    // Deletions up to this sequence number are no longer in memory, so
+    // they can't be resumed from.
+    uint64_t                 purgeSeqno;
     std::list<Checkpoint*>   checkpointList;
     CheckpointCursor         persistenceCursor;
     CheckpointCursor         onlineUpdateCursor;
     bool                     isCollapsedCheckpoint;
     uint64_t                 lastClosedCheckpointId;
     std::map<const std::string, CheckpointCursor> tapCursors;
+    // TAP connections whose cursors were dropped (see wasTAPCursorDropped).
+    std::set<std::string>    droppedTAPCursors;
+    // Created when a checkpoint is first spilled.
+    CheckpointSpillFile     *spillFile;
 
     Atomic<bool>              doOnlineUpdate;
     Atomic<bool>              doHotReload;
 };
 
+/**
+ * Told about the vbuckets whose oldest checkpoint is no longer referenced
+ * by any cursor, so that it can be removed without waiting for the next
+ * run of the checkpoint remover.
+ */
+class UnrefCheckpointListener {
+public:
+    virtual ~UnrefCheckpointListener() {}
+
+    /**
+     * Called with the checkpoint manager's lock held, so this must not
+     * call back into the checkpoint manager.
+     *
+     * @param vbid the vbucket whose oldest checkpoint became unreferenced
+     */
+    virtual void unrefCheckpoint(uint16_t vbid) = 0;
+};
+
 /**
  * A class containing the config parameters for checkpoint.
  */
@@ -569,7 +941,9 @@ public:
           inconsistentSlaveCheckpoint (false),
           itemNumBasedNewCheckpoint(true),
           keepClosedCheckpoints(false),
-          metaItemsOnly(true) { }
+          metaItemsOnly(true),
+          spillPath(""),
+          unrefCheckpointListener(NULL) { }
 
     CheckpointConfig(EventuallyPersistentEngine &e);
 
@@ -601,9 +975,18 @@ public:
         return metaItemsOnly;
     }
 
+    const std::string &getSpillPath() const {
+        return spillPath;
+    }
+
+    UnrefCheckpointListener *getUnrefCheckpointListener() const {
+        return unrefCheckpointListener;
+    }
+
 protected:
     friend class CheckpointConfigChangeListener;
     friend class EventuallyPersistentEngine;
+    friend class EventuallyPersistentStore;
 
     bool validateCheckpointMaxItemsParam(size_t checkpoint_max_items);
     bool validateCheckpointPeriodParam(size_t checkpoint_period);
@@ -629,6 +1012,14 @@ protected:
         metaItemsOnly = value;
     }
 
+    void setSpillPath(const std::string &value) {
+        spillPath = value;
+    }
+
+    void setUnrefCheckpointListener(UnrefCheckpointListener *listener) {
+        unrefCheckpointListener = listener;
+    }
+
     static void addConfigChangeListener(EventuallyPersistentEngine &engine);
 
 private:
@@ -649,6 +1040,10 @@ private:
     bool keepClosedCheckpoints;
     // Flag indicating if a checkpoint should contain items with keys and meta data only.
     bool metaItemsOnly;
+    // Directory to spill closed checkpoints of slow TAP cursors to, or empty not to spill them.
+    std::string spillPath;
+    // Told when the oldest checkpoint of a vbucket becomes unreferenced, if set.
+    UnrefCheckpointListener *unrefCheckpointListener;
 };
 
 #endif /* CHECKPOINT_HH */
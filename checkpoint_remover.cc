@@ -5,6 +5,30 @@
 #include "ep.hh"
 #include "checkpoint_remover.hh"
 
+// How long the UnrefCheckpointRemover sleeps unless woken up.
+static const double UNREF_CHECKPOINT_REMOVER_SLEEP_TIME = 3600;
+
+/**
+ * Remove the closed unreferenced checkpoints of a vbucket.
+ */
+static void removeClosedUnrefCheckpoints(EventuallyPersistentStore *store, EPStats &stats,
+                                         RCPtr<VBucket> &vb) {
+    bool newCheckpointCreated = false;
+    size_t removed = vb->checkpointManager.removeClosedUnrefCheckpoints(vb,
+                                                                       newCheckpointCreated);
+    // If the new checkpoint is created, notify this event to the tap notify IO thread
+    // so that it can then signal all paused TAP connections.
+    if (newCheckpointCreated) {
+        store->getEPEngine().notifyNotificationThread();
+    }
+    stats.itemsRemovedFromCheckpoints.incr(removed);
+    if (removed > 0) {
+        getLogger()->log(EXTENSION_LOG_INFO, NULL,
+                         "Removed %d closed unreferenced checkpoints from VBucket %d.\n",
+                         removed, vb->getId());
+    }
+}
+
 /**
  * Remove all the closed unreferenced checkpoints for each vbucket.
  */
@@ -15,32 +39,16 @@ public:
      * Construct a CheckpointVisitor.
      */
     CheckpointVisitor(EventuallyPersistentStore *s, EPStats &st, bool *sfin)
-        : store(s), stats(st), removed(0),
-          stateFinalizer(sfin) {}
+        : store(s), stats(st), stateFinalizer(sfin) {}
 
     bool visitBucket(RCPtr<VBucket> &vb) {
         currentBucket = vb;
-        bool newCheckpointCreated = false;
-        removed = vb->checkpointManager.removeClosedUnrefCheckpoints(vb, newCheckpointCreated);
-        // If the new checkpoint is created, notify this event to the tap notify IO thread
-        // so that it can then signal all paused TAP connections.
-        if (newCheckpointCreated) {
-            store->getEPEngine().notifyNotificationThread();
-        }
-        update();
+        removeClosedUnrefCheckpoints(store, stats, vb);
+        // What slow TAP cursors still pin can go to disk instead.
+        vb->checkpointManager.spillClosedCheckpoints();
         return false;
     }
 
-    void update() {
-        stats.itemsRemovedFromCheckpoints.incr(removed);
-        if (removed > 0) {
-            getLogger()->log(EXTENSION_LOG_INFO, NULL,
-                             "Removed %d closed unreferenced checkpoints from VBucket %d.\n",
-                             removed, currentBucket->getId());
-        }
-        removed = 0;
-    }
-
     void complete() {
         if (stateFinalizer) {
             *stateFinalizer = true;
@@ -50,7 +58,6 @@ public:
 private:
     EventuallyPersistentStore *store;
     EPStats                   &stats;
-    size_t                     removed;
     bool                      *stateFinalizer;
 };
 
@@ -65,3 +72,36 @@ bool ClosedUnrefCheckpointRemover::callback(Dispatcher &d, TaskId t) {
     d.snooze(t, sleepTime);
     return true;
 }
+
+void UnrefCheckpointRemover::unrefCheckpoint(uint16_t vbid) {
+    LockHolder lh(mutex);
+    if (vbuckets.insert(vbid).second && vbuckets.size() == 1 && task.get()) {
+        dispatcher->wake(task, &task);
+    }
+}
+
+bool UnrefCheckpointRemover::callback(Dispatcher &d, TaskId t) {
+    std::set<uint16_t> vbs;
+    LockHolder lh(mutex);
+    // From then on, waking the job up hands out the task that replaces
+    // it.  Taking the running one instead could bring back one that was
+    // just replaced, and leave the replacement to run on its own.
+    if (!task.get()) {
+        task = t;
+    }
+    vbs.swap(vbuckets);
+    lh.unlock();
+
+    if (!vbs.empty()) {
+        ++stats.checkpointRemoverWakeups;
+    }
+    std::set<uint16_t>::iterator it = vbs.begin();
+    for (; it != vbs.end(); ++it) {
+        RCPtr<VBucket> vb = store->getVBucket(*it);
+        if (vb) {
+            removeClosedUnrefCheckpoints(store, stats, vb);
+        }
+    }
+    d.snooze(t, UNREF_CHECKPOINT_REMOVER_SLEEP_TIME);
+    return true;
+}
@@ -8,6 +8,7 @@
 #include "common.hh"
 #include "stats.hh"
 #include "dispatcher.hh"
+#include "checkpoint.hh"
 
 class EventuallyPersistentStore;
 
@@ -39,4 +40,42 @@ private:
     bool                       available;
 };
 
+/**
+ * Dispatcher job removing the closed unreferenced checkpoints of the
+ * vbuckets whose oldest checkpoint was just left by its last cursor, so
+ * that the memory they hold is freed without waiting for the
+ * ClosedUnrefCheckpointRemover to visit every vbucket.
+ */
+class UnrefCheckpointRemover : public DispatcherCallback,
+                               public UnrefCheckpointListener {
+public:
+
+    /**
+     * Construct UnrefCheckpointRemover.
+     * @param s the store
+     * @param st the stats
+     * @param d the dispatcher the job is scheduled on
+     */
+    UnrefCheckpointRemover(EventuallyPersistentStore *s, EPStats &st, Dispatcher *d) :
+        store(s), stats(st), dispatcher(d) {}
+
+    void unrefCheckpoint(uint16_t vbid);
+
+    bool callback(Dispatcher &d, TaskId t);
+
+    std::string description() {
+        return std::string("Removing checkpoints left by their last cursor");
+    }
+
+private:
+    EventuallyPersistentStore *store;
+    EPStats                   &stats;
+    Dispatcher                *dispatcher;
+    // The task to wake up when told about a vbucket, known once it runs.
+    TaskId                     task;
+    // The vbuckets to visit on the next run.
+    std::set<uint16_t>         vbuckets;
+    Mutex                      mutex;
+};
+
 #endif /* CHECKPOINT_REMOVER_HH */
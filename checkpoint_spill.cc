@@ -0,0 +1,264 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#include "config.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "checkpoint_spill.hh"
+
+// Value length of the items that have no value.
+static const uint32_t NO_VALUE(0xffffffff);
+
+// Operation, vbucket, vbucket version, flags, expiry time, CAS, row id,
+// seqno, by seqno, queued time, key length and value length.
+static const size_t RECORD_HEADER_SIZE(1 + 2 + 2 + 4 + 4 + 8 + 8 + 4 + 8 + 4 + 2 + 4);
+
+static void putBytes(std::vector<char> &buf, const void *p, size_t n) {
+    buf.insert(buf.end(), static_cast<const char*>(p), static_cast<const char*>(p) + n);
+}
+
+static void put8(std::vector<char> &buf, uint8_t v) {
+    putBytes(buf, &v, sizeof(v));
+}
+
+static void put16(std::vector<char> &buf, uint16_t v) {
+    v = htons(v);
+    putBytes(buf, &v, sizeof(v));
+}
+
+static void put32(std::vector<char> &buf, uint32_t v) {
+    v = htonl(v);
+    putBytes(buf, &v, sizeof(v));
+}
+
+static void put64(std::vector<char> &buf, uint64_t v) {
+    v = htonll(v);
+    putBytes(buf, &v, sizeof(v));
+}
+
+static void encode(std::vector<char> &buf, const queued_item &qi) {
+    const std::string &key = qi->getKey();
+    const value_t &value = qi->getValue();
+    put8(buf, static_cast<uint8_t>(qi->getOperation()));
+    put16(buf, qi->getVBucketId());
+    put16(buf, qi->getVBucketVersion());
+    put32(buf, qi->getFlags());
+    put32(buf, static_cast<uint32_t>(qi->getExpiryTime()));
+    put64(buf, qi->getCas());
+    put64(buf, static_cast<uint64_t>(qi->getRowId()));
+    put32(buf, qi->getSeqno());
+    put64(buf, qi->getBySeqno());
+    put32(buf, qi->getQueuedTime());
+    put16(buf, static_cast<uint16_t>(key.length()));
+    put32(buf, value ? static_cast<uint32_t>(value->length()) : NO_VALUE);
+    putBytes(buf, key.data(), key.length());
+    if (value) {
+        putBytes(buf, value->getData(), value->length());
+    }
+}
+
+/**
+ * Reads the records of a chunk.
+ */
+class RecordReader {
+public:
+    RecordReader(const std::vector<char> &b) : buf(b), pos(0) {}
+
+    bool hasRemaining(size_t n) const {
+        return buf.size() - pos >= n;
+    }
+
+    const char *getBytes(size_t n) {
+        const char *p = &buf[pos];
+        pos += n;
+        return p;
+    }
+
+    uint8_t get8() {
+        return static_cast<uint8_t>(*getBytes(1));
+    }
+
+    uint16_t get16() {
+        uint16_t v;
+        memcpy(&v, getBytes(sizeof(v)), sizeof(v));
+        return ntohs(v);
+    }
+
+    uint32_t get32() {
+        uint32_t v;
+        memcpy(&v, getBytes(sizeof(v)), sizeof(v));
+        return ntohl(v);
+    }
+
+    uint64_t get64() {
+        uint64_t v;
+        memcpy(&v, getBytes(sizeof(v)), sizeof(v));
+        return ntohll(v);
+    }
+
+private:
+    const std::vector<char> &buf;
+    size_t                   pos;
+};
+
+static bool decode(RecordReader &reader, queued_item &qi) {
+    if (!reader.hasRemaining(RECORD_HEADER_SIZE)) {
+        return false;
+    }
+    enum queue_operation op = static_cast<enum queue_operation>(reader.get8());
+    uint16_t vbid = reader.get16();
+    uint16_t vbversion = reader.get16();
+    uint32_t flags = reader.get32();
+    time_t exptime = static_cast<time_t>(reader.get32());
+    uint64_t cas = reader.get64();
+    int64_t rowid = static_cast<int64_t>(reader.get64());
+    uint32_t seqno = reader.get32();
+    uint64_t bySeqno = reader.get64();
+    uint32_t queued = reader.get32();
+    uint16_t nkey = reader.get16();
+    uint32_t nvalue = reader.get32();
+    size_t nbody = nkey + (nvalue == NO_VALUE ? 0 : nvalue);
+    if (!reader.hasRemaining(nbody)) {
+        return false;
+    }
+
+    std::string key(reader.getBytes(nkey), nkey);
+    if (nvalue == NO_VALUE) {
+        qi.reset(new QueuedItem(key, vbid, op, vbversion, rowid, flags,
+                                exptime, cas, seqno));
+    } else {
+        value_t value(Blob::New(reader.getBytes(nvalue), nvalue));
+        qi.reset(new QueuedItem(key, value, vbid, op, vbversion, rowid, flags,
+                                exptime, cas, seqno));
+    }
+    qi->getItem().setBySeqno(bySeqno);
+    qi->setQueuedTime(queued);
+    return true;
+}
+
+CheckpointSpillFile::CheckpointSpillFile(EPStats &st, const std::string &dir,
+                                         uint16_t vbid) :
+    stats(st), file(-1), size(0) {
+    std::stringstream ss;
+    ss << dir << "/checkpoints-" << vbid << ".spill";
+    path = ss.str();
+}
+
+CheckpointSpillFile::~CheckpointSpillFile() {
+    if (file >= 0) {
+        close(file);
+        unlink(path.c_str());
+        stats.checkpointSpillSize.decr(size);
+    }
+}
+
+bool CheckpointSpillFile::write(const std::vector<queued_item> &items, size_t chunkSize,
+                                std::vector<off_t> &offsets) {
+    LockHolder lh(mutex);
+    if (file < 0) {
+        // Whatever a previous run left behind is of no use.
+        file = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (file < 0) {
+            getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                             "Failed to open the checkpoint spill file %s: %s\n",
+                             path.c_str(), strerror(errno));
+            return false;
+        }
+    }
+
+    offsets.clear();
+    std::vector<char> buf;
+    off_t end = size;
+    for (size_t i = 0; i < items.size(); i += chunkSize) {
+        offsets.push_back(end);
+        buf.clear();
+        for (size_t j = i; j < items.size() && j < i + chunkSize; ++j) {
+            encode(buf, items[j]);
+        }
+        size_t written = 0;
+        while (written < buf.size()) {
+            ssize_t n = pwrite(file, &buf[written], buf.size() - written, end + written);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            } else if (n <= 0) {
+                getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                                 "Failed to write to the checkpoint spill file %s: %s\n",
+                                 path.c_str(), strerror(errno));
+                // Leave the file as it was, as the segment won't be used.
+                if (ftruncate(file, size) != 0) {
+                    getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                                     "Failed to truncate the checkpoint spill file %s: %s\n",
+                                     path.c_str(), strerror(errno));
+                }
+                return false;
+            }
+            written += n;
+        }
+        end += buf.size();
+    }
+    offsets.push_back(end);
+
+    stats.checkpointSpillSize.incr(end - size);
+    size = end;
+    ++numSegments;
+    return true;
+}
+
+bool CheckpointSpillFile::read(off_t start, off_t end, queued_item *items, size_t count) {
+    std::vector<char> buf(end - start);
+    size_t nread = 0;
+    while (nread < buf.size()) {
+        ssize_t n = pread(file, &buf[nread], buf.size() - nread, start + nread);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n <= 0) {
+            getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                             "Failed to read from the checkpoint spill file %s: %s\n",
+                             path.c_str(), n < 0 ? strerror(errno) : "short read");
+            return false;
+        }
+        nread += n;
+    }
+
+    RecordReader reader(buf);
+    for (size_t i = 0; i < count; ++i) {
+        if (!decode(reader, items[i])) {
+            getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                             "Corrupted chunk at offset %llu of the checkpoint spill file %s\n",
+                             static_cast<unsigned long long>(start), path.c_str());
+            return false;
+        }
+    }
+    ++stats.checkpointSpillReads;
+    return true;
+}
+
+void CheckpointSpillFile::release(off_t start, off_t end) {
+#ifdef FALLOC_FL_PUNCH_HOLE
+    if (end > start &&
+        fallocate(file, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, start, end - start) != 0) {
+        getLogger()->log(EXTENSION_LOG_DEBUG, NULL,
+                         "Failed to punch a hole in the checkpoint spill file %s: %s\n",
+                         path.c_str(), strerror(errno));
+    }
+#else
+    (void)start;
+    (void)end;
+#endif
+    --numSegments;
+}
+
+void CheckpointSpillFile::truncate() {
+    LockHolder lh(mutex);
+    if (numSegments.get() > 0 || size == 0) {
+        return;
+    }
+    if (ftruncate(file, 0) != 0) {
+        getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                         "Failed to truncate the checkpoint spill file %s: %s\n",
+                         path.c_str(), strerror(errno));
+        return;
+    }
+    stats.checkpointSpillSize.decr(size);
+    size = 0;
+}
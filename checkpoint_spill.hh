@@ -0,0 +1,98 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#ifndef CHECKPOINT_SPILL_HH
+#define CHECKPOINT_SPILL_HH 1
+
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+#include "common.hh"
+#include "atomic.hh"
+#include "locks.hh"
+#include "queueditem.hh"
+#include "stats.hh"
+
+/**
+ * The file a vbucket spills closed checkpoints to, once only slow TAP
+ * cursors still need them.
+ *
+ * Each spilled checkpoint is a segment of the file, written in chunks
+ * that are read back one at a time as the cursors reach them.  The
+ * file is only appended to.  The space of a segment is given back
+ * when its checkpoint goes away where the platform can punch holes,
+ * and the file is truncated once no segment is left.
+ */
+class CheckpointSpillFile {
+public:
+
+    /**
+     * Construct a CheckpointSpillFile.  The file is created when first
+     * written to.
+     *
+     * @param st the stats
+     * @param dir the directory of the file
+     * @param vbid the vbucket spilling to the file
+     */
+    CheckpointSpillFile(EPStats &st, const std::string &dir, uint16_t vbid);
+
+    /**
+     * Close and remove the file.
+     */
+    ~CheckpointSpillFile();
+
+    /**
+     * Append a segment.
+     *
+     * @param items the items to write
+     * @param chunkSize the number of items in each chunk
+     * @param offsets set to the offset of each chunk, followed by the
+     *        end of the last one
+     * @return true if the segment was written
+     */
+    bool write(const std::vector<queued_item> &items, size_t chunkSize,
+               std::vector<off_t> &offsets);
+
+    /**
+     * Read back a chunk.
+     *
+     * @param start the offset of the chunk
+     * @param end the offset right after the chunk
+     * @param items set to the items of the chunk
+     * @param count the number of items in the chunk
+     * @return false if the chunk couldn't be read back whole
+     */
+    bool read(off_t start, off_t end, queued_item *items, size_t count);
+
+    /**
+     * Give back the space of a segment that is no longer needed.
+     */
+    void release(off_t start, off_t end);
+
+    /**
+     * Truncate the file if no segment is left in it.
+     */
+    void truncate();
+
+    size_t getNumSegments() const {
+        return numSegments.get();
+    }
+
+    const std::string &getPath() const {
+        return path;
+    }
+
+private:
+
+    EPStats        &stats;
+    std::string     path;
+    int             file;
+    off_t           size;
+    Atomic<size_t>  numSegments;
+    // Held while appending, so that the file isn't truncated meanwhile.
+    Mutex           mutex;
+
+    DISALLOW_COPY_AND_ASSIGN(CheckpointSpillFile);
+};
+
+#endif /* CHECKPOINT_SPILL_HH */
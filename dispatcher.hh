@@ -127,6 +127,8 @@ protected:
         callback = task.callback;
         isDaemonTask = task.isDaemonTask;
         blockShutdown = task.blockShutdown;
+        // A copy is made to wake the task up, so it's due right away.
+        snooze(0);
     }
 
     void snooze(const double secs) {
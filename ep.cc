@@ -122,8 +122,14 @@ public:
             store.setVbChunkDelThresholdTime(value);
         } else if (key.compare("max_txn_size") == 0) {
             store.setTxnSize(value);
+            store.updateTxnSizing();
+        } else if (key.compare("min_txn_size") == 0 ||
+                   key.compare("txn_target_latency") == 0) {
+            store.updateTxnSizing();
         } else if (key.compare("exp_pager_stime") == 0) {
             store.setExpiryPagerSleeptime(value);
+        } else if (key.compare(0, 3, "io_") == 0) {
+            store.updateIOThrottle();
         } else if (key.compare("couch_vbucket_batch_count") == 0) {
             shared_ptr<DispatcherCallback> cb(new VBucketBatchCountCallback(store.getRWUnderlying(),
                                                                             value));
@@ -133,46 +139,44 @@ public:
         }
     }
 
+    virtual void booleanValueChanged(const std::string &key, bool) {
+        if (key.compare("adaptive_txn_size") == 0) {
+            store.updateTxnSizing();
+        }
+    }
+
 private:
     EventuallyPersistentStore &store;
 };
 
 /**
- * Dispatcher job that performs disk fetches for non-resident get
- * requests.
+ * Dispatcher job that performs the disk fetches queued on a vbucket
+ * for non-resident get requests, in one batch.
  */
-class BGFetchCallback : public DispatcherCallback {
+class BGFetchBatchCallback : public DispatcherCallback {
 public:
-    BGFetchCallback(EventuallyPersistentStore *e,
-                    const std::string &k, uint16_t vbid, uint16_t vbv,
-                    uint64_t r, const void *c) :
-        ep(e), key(k), vbucket(vbid), vbver(vbv), rowid(r), cookie(c),
-        counter(ep->bgFetchQueue), init(gethrtime()) {
+    BGFetchBatchCallback(EventuallyPersistentStore *e,
+                         const RCPtr<VBucket> &b, uint16_t vbv) :
+        ep(e), vb(b), vbver(vbv) {
         assert(ep);
-        assert(cookie);
+        assert(vb);
     }
 
     bool callback(Dispatcher &, TaskId) {
-        ep->completeBGFetch(key, vbucket, vbver, rowid, cookie, init);
+        ep->completeBGFetchBatch(vb, vbver);
         return false;
     }
 
     std::string description() {
         std::stringstream ss;
-        ss << "Fetching item from disk:  " << key;
+        ss << "Fetching items from disk for vbucket " << vb->getId();
         return ss.str();
     }
 
 private:
     EventuallyPersistentStore *ep;
-    std::string                key;
-    uint16_t                   vbucket;
+    RCPtr<VBucket>             vb;
     uint16_t                   vbver;
-    uint64_t                   rowid;
-    const void                *cookie;
-    BGFetchCounter             counter;
-
-    hrtime_t init;
 };
 
 /**
@@ -311,6 +315,12 @@ public:
     bool callback(Dispatcher &d, TaskId t) {
         bool rv = false, isLastChunk = false;
 
+        double throttled = ep->getIOThrottle().admit(io_deletion);
+        if (throttled > 0) {
+            d.snooze(t, throttled);
+            return true;
+        }
+
         chunk_range_t range;
         if (current_range == range_list.end()) {
             range.first = -1;
@@ -331,6 +341,12 @@ public:
                                                                 isLastChunk);
         hrtime_t chunk_time = (gethrtime() - start_time) / 1000;
         stats.diskVBChunkDelHisto.add(chunk_time);
+        if (result == vbucket_del_success) {
+            // Row ids are dense enough for the range to count the rows.
+            size_t rows = range.first == -1 ? 1 :
+                static_cast<size_t>(range.second - range.first + 1);
+            ep->getIOThrottle().consumed(io_deletion, 0, rows);
+        }
         execution_time += chunk_time;
 
         switch(result) {
@@ -418,8 +434,8 @@ public:
         assert(epstore);
     }
 
-    void initVBucket(uint16_t vbid, uint16_t vb_version,
-                     uint64_t checkpointId, vbucket_state_t prevState);
+    void initVBucket(uint16_t vbid, uint16_t vb_version, uint64_t checkpointId,
+                     uint64_t highSeqno, vbucket_state_t prevState);
 
     void callback(GetValue &val);
 
@@ -439,6 +455,74 @@ private:
 };
 
 
+/**
+ * Dispatcher job that rebuilds a vbucket's Bloom filter of keys on
+ * disk.
+ *
+ * The replacement filter was set up when the job was scheduled, so
+ * keys flushed in the meantime are in it already.  Keys that are in
+ * memory go in too, since those waiting to be flushed may not be in
+ * what the scan of the disk sees.
+ */
+class BloomFilterRebuilder : public DispatcherCallback {
+public:
+    BloomFilterRebuilder(KVStore *s, RCPtr<VBucket> &b) :
+        store(s), vb(b) {
+        assert(store);
+    }
+
+    bool callback(Dispatcher &, TaskId) {
+        hrtime_t start(gethrtime());
+
+        KeyAdder adder(vb);
+        vb->ht.visit(adder);
+        shared_ptr<Callback<GetValue> > cb(new KeyAdder(vb));
+        store->dump(vb->getId(), cb);
+        vb->swapFilter();
+
+        RCPtr<BloomFilter> bf = vb->getFilter();
+        getLogger()->log(EXTENSION_LOG_INFO, NULL,
+                         "Rebuilt the Bloom filter of vbucket %d with "
+                         "about %d keys in %s\n", vb->getId(),
+                         bf ? bf->getEstimatedKeyCount() : 0,
+                         hrtime2text(gethrtime() - start).c_str());
+        return false;
+    }
+
+    std::string description() {
+        std::stringstream ss;
+        ss << "Rebuilding the Bloom filter of vbucket " << vb->getId();
+        return ss.str();
+    }
+
+private:
+
+    class KeyAdder : public HashTableVisitor, public Callback<GetValue> {
+    public:
+        KeyAdder(RCPtr<VBucket> &b) : vb(b) {}
+
+        void visit(StoredValue *v) {
+            vb->addToTempFilter(v->getKey());
+        }
+
+        void callback(GetValue &val) {
+            Item *i = val.getValue();
+            if (i != NULL) {
+                if (i->getVBucketId() == vb->getId()) {
+                    vb->addToTempFilter(i->getKey());
+                }
+                delete i;
+            }
+        }
+
+    private:
+        RCPtr<VBucket> vb;
+    };
+
+    KVStore        *store;
+    RCPtr<VBucket>  vb;
+};
+
 EventuallyPersistentStore::EventuallyPersistentStore(EventuallyPersistentEngine &theEngine,
                                                      KVStore *t,
                                                      bool startVb0,
@@ -448,9 +532,11 @@ EventuallyPersistentStore::EventuallyPersistentStore(EventuallyPersistentEngine
     vbuckets(theEngine.getConfiguration()),
     mutationLog(theEngine.getConfiguration().getKlogPath(),
                 theEngine.getConfiguration().getKlogBlockSize()),
-    diskFlushAll(false),
+    ioThrottle(bgFetchQueue), diskFlushAll(false),
     tctx(stats, t, mutationLog, theEngine.observeRegistry),
-    bgFetchDelay(0)
+    bgFetchDelay(0), fullEviction(false), bfilterEnabled(false),
+    bfilterKeyCount(0), bfilterFpProb(0), bfilterUnderlying(NULL),
+    bfilterDispatcher(NULL)
 {
     getLogger()->log(EXTENSION_LOG_INFO, NULL,
                      "Storage props:  c=%d/r=%d/rw=%d\n",
@@ -470,6 +556,20 @@ EventuallyPersistentStore::EventuallyPersistentStore(EventuallyPersistentEngine
         roUnderlying = rwUnderlying;
         roDispatcher = dispatcher;
     }
+
+    // Background fetches are spread over the read-only store and as
+    // many more readers of their own as configured and allowed.
+    bgFetchUnderlying.push_back(roUnderlying);
+    bgFetchDispatchers.push_back(roDispatcher);
+    if (hasSeparateRODispatcher()) {
+        size_t bgFetchers = std::min(theEngine.getConfiguration().getBgFetchThreads(),
+                                     storageProperties.maxReaders());
+        for (size_t i = 1; i < bgFetchers; ++i) {
+            bgFetchUnderlying.push_back(engine.newKVStore());
+            bgFetchDispatchers.push_back(new Dispatcher(theEngine));
+            bgFetchDispatchers.back()->start();
+        }
+    }
     nonIODispatcher = new Dispatcher(theEngine);
     flusher = new Flusher(this, dispatcher);
 
@@ -484,6 +584,12 @@ EventuallyPersistentStore::EventuallyPersistentStore(EventuallyPersistentEngine
     setTxnSize(config.getMaxTxnSize());
     config.addValueChangedListener("max_txn_size",
                                    new EPStoreValueChangeListener(*this));
+    config.addValueChangedListener("adaptive_txn_size",
+                                   new EPStoreValueChangeListener(*this));
+    config.addValueChangedListener("min_txn_size",
+                                   new EPStoreValueChangeListener(*this));
+    config.addValueChangedListener("txn_target_latency",
+                                   new EPStoreValueChangeListener(*this));
 
     stats.min_data_age.set(config.getMinDataAge());
     config.addValueChangedListener("min_data_age",
@@ -502,6 +608,33 @@ EventuallyPersistentStore::EventuallyPersistentStore(EventuallyPersistentEngine
     config.addValueChangedListener("tap_throttle_queue_cap",
                                    new StatsValueChangeListener(stats));
 
+    if (config.getItemEvictionPolicy().compare("full_eviction") == 0) {
+        if (storageProperties.hasEfficientGetByKey()) {
+            fullEviction = true;
+        } else {
+            getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                             "Full eviction needs a backend that can find "
+                             "items and their metadata by key, evicting "
+                             "values only\n");
+        }
+    }
+
+    // The filters only save anything when keys may be missing from
+    // memory.
+    bfilterEnabled = fullEviction && config.isBfilterEnabled();
+    bfilterKeyCount = config.getBfilterKeyCount();
+    bfilterFpProb = config.getBfilterFpProb();
+
+    // Rebuilding a filter reads a whole vbucket, which would hold up
+    // the background fetches of a reader for that long, so it gets a
+    // reader of its own if the backend allows one more.
+    if (bfilterEnabled && hasSeparateRODispatcher() &&
+        bgFetchDispatchers.size() < storageProperties.maxReaders()) {
+        bfilterUnderlying = engine.newKVStore();
+        bfilterDispatcher = new Dispatcher(theEngine);
+        bfilterDispatcher->start();
+    }
+
     setBGFetchDelay(config.getBgFetchDelay());
     config.addValueChangedListener("bg_fetch_delay",
                                    new EPStoreValueChangeListener(*this));
@@ -515,6 +648,16 @@ EventuallyPersistentStore::EventuallyPersistentStore(EventuallyPersistentEngine
 
     invalidItemDbPager = new InvalidItemDbPager(this, stats, vbDelChunkSize);
 
+    updateIOThrottle();
+    const char *ioLimits[] = { "io_backfill_bytes_limit", "io_backfill_ops_limit",
+                               "io_deletion_ops_limit", "io_flusher_bytes_limit",
+                               "io_flusher_ops_limit", "io_restore_bytes_limit",
+                               "io_restore_ops_limit" };
+    for (size_t i = 0; i < sizeof(ioLimits) / sizeof(ioLimits[0]); ++i) {
+        config.addValueChangedListener(ioLimits[i],
+                                       new EPStoreValueChangeListener(*this));
+    }
+
     config.addValueChangedListener("couch_vbucket_batch_count",
                                    new EPStoreValueChangeListener(*this));
 
@@ -525,6 +668,11 @@ EventuallyPersistentStore::EventuallyPersistentStore(EventuallyPersistentEngine
         vbuckets.setBucketVersion(0, 0);
     }
 
+    flusherPipeline = theEngine.getConfiguration().isFlusherPipeline();
+    flushBatchCollectorScheduled = false;
+    preparedFlushBatch = NULL;
+    flushWriteStart = 0;
+
     persistenceCheckpointIds = new uint64_t[BASE_VBUCKET_SIZE];
     for (size_t i = 0; i < BASE_VBUCKET_SIZE; ++i) {
         persistenceCheckpointIds[i] = 0;
@@ -546,6 +694,29 @@ EventuallyPersistentStore::EventuallyPersistentStore(EventuallyPersistentEngine
     bool syncset(mutationLog.setSyncConfig(theEngine.getConfiguration().getKlogSync()));
     assert(syncset);
 
+    shardWritersBusy = 0;
+    if (theEngine.getConfiguration().isFlusherShardWriters()) {
+        if (!rwUnderlying->hasConcurrentShardWrites()) {
+            getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                             "The store can't write its shards concurrently, "
+                             "not using shard writers\n");
+        } else if (mutationLog.isEnabled()) {
+            // The mutation log is written from the flusher thread only.
+            getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                             "Shard writers don't work with the mutation log, "
+                             "not using them\n");
+        } else {
+            for (size_t i = 0; i < num_shards; ++i) {
+                ShardWriter *writer = new ShardWriter(theEngine,
+                                                      engine.newKVStore(), i,
+                                                      mutationLog);
+                writer->tctx.setTxnSize(theEngine.getConfiguration().getMaxTxnSize());
+                shardWriters.push_back(writer);
+            }
+        }
+    }
+    updateTxnSizing();
+
     startDispatcher();
     startFlusher();
     startNonIODispatcher();
@@ -674,6 +845,13 @@ void EventuallyPersistentStore::initialize() {
                               Priority::CheckpointRemoverPriority,
                               checkpointRemoverInterval);
 
+    // Checkpoints left by their last cursor are removed right away, the
+    // remover above still creates new checkpoints and spills old ones.
+    unrefCheckpointRemover.reset(new UnrefCheckpointRemover(this, stats, nonIODispatcher));
+    nonIODispatcher->schedule(unrefCheckpointRemover, NULL,
+                              Priority::CheckpointRemoverPriority, 0);
+    engine.getCheckpointConfig().setUnrefCheckpointListener(unrefCheckpointRemover.get());
+
     shared_ptr<DispatcherCallback> obsRegCb(new ObserveRegistryCleaner(
                                             engine.getObserveRegistry(),
                                             stats, 60));
@@ -717,11 +895,27 @@ EventuallyPersistentStore::~EventuallyPersistentStore() {
         roDispatcher->stop(forceShutdown);
         delete roUnderlying;
     }
+    for (size_t i = 1; i < bgFetchDispatchers.size(); ++i) {
+        bgFetchDispatchers[i]->stop(forceShutdown);
+        delete bgFetchDispatchers[i];
+        delete bgFetchUnderlying[i];
+    }
+    if (bfilterDispatcher) {
+        bfilterDispatcher->stop(forceShutdown);
+        delete bfilterDispatcher;
+        delete bfilterUnderlying;
+    }
+    std::vector<ShardWriter*>::iterator wit;
+    for (wit = shardWriters.begin(); wit != shardWriters.end(); ++wit) {
+        (*wit)->dispatcher->stop(forceShutdown);
+        delete *wit;
+    }
     nonIODispatcher->stop(forceShutdown);
 
     delete flusher;
     delete dispatcher;
     delete nonIODispatcher;
+    delete preparedFlushBatch;
     delete []persistenceCheckpointIds;
     delete []dbShardQueues;
 }
@@ -738,6 +932,12 @@ const Flusher* EventuallyPersistentStore::getFlusher() {
     return flusher;
 }
 
+void EventuallyPersistentStore::wakeUpFlusher() {
+    if (flusher) {
+        flusher->hurry();
+    }
+}
+
 void EventuallyPersistentStore::startFlusher() {
     flusher->start();
 }
@@ -792,33 +992,43 @@ void EventuallyPersistentStore::firePendingVBucketOps() {
  */
 class Deleter {
 public:
-    Deleter(EventuallyPersistentStore *ep) : e(ep), startTime(ep_real_time()) {}
+    Deleter(EventuallyPersistentStore *ep) : e(ep), startTime(ep_real_time()),
+                                             deleted(0) {}
     void operator() (std::pair<uint16_t, std::string> vk) {
         RCPtr<VBucket> vb = e->getVBucket(vk.first);
         if (vb) {
             int bucket_num(0);
-            LockHolder lh = vb->ht.getLockedBucket(vk.second, &bucket_num);
-            StoredValue *v = vb->ht.unlocked_find(vk.second, bucket_num);
-            if (v && v->isExpired(startTime)) {
+            WriterLockHolder lh = vb->ht.getLockedBucket(vk.second, &bucket_num);
+            StoredValue *v = vb->ht.unlocked_find(vk.second, bucket_num, true);
+            if (v && v->isDeleted()) {
+                // Clean deleted items only stand in for keys that
+                // aren't on disk.
+                if (e->isFullEviction() && v->isClean()) {
+                    vb->ht.unlocked_evictItem(vk.second, bucket_num);
+                }
+            } else if (v && v->isExpired(startTime)) {
                 value_t value(NULL);
                 uint64_t cas = v->getCas();
                 vb->ht.unlocked_softDelete(v, 0);
                 e->queueDirty(vk.second, vb->getId(), queue_op_del, value,
                               v->getFlags(), v->getExptime(), cas, v->getSeqno(), v->getId(), false);
+                ++deleted;
             }
         }
     }
+    size_t numDeleted() { return deleted; }
 private:
     EventuallyPersistentStore *e;
     time_t                     startTime;
+    size_t                     deleted;
 };
 /// @endcond
 
-void
+size_t
 EventuallyPersistentStore::deleteExpiredItems(std::list<std::pair<uint16_t, std::string> > &keys) {
     // This can be made a lot more efficient, but I'd rather see it
     // show up in a profiling report first.
-    std::for_each(keys.begin(), keys.end(), Deleter(this));
+    return std::for_each(keys.begin(), keys.end(), Deleter(this)).numDeleted();
 }
 
 StoredValue *EventuallyPersistentStore::fetchValidValue(RCPtr<VBucket> vb,
@@ -841,6 +1051,32 @@ StoredValue *EventuallyPersistentStore::fetchValidValue(RCPtr<VBucket> vb,
     return v;
 }
 
+StoredValue *EventuallyPersistentStore::peekValidValue(RCPtr<VBucket> vb,
+                                                       const std::string &key,
+                                                       int bucket_num,
+                                                       bool &expired,
+                                                       bool wantDeleted) {
+    expired = false;
+    StoredValue *v = vb->ht.unlocked_find(key, bucket_num, wantDeleted);
+    if (v && !v->isDeleted()) { // In the deleted case, we ignore expiration time.
+        if (v->isExpired(ep_real_time())) {
+            expired = true;
+            return NULL;
+        }
+        // Only the bucket's read lock is held.
+        v->markReferenced();
+    }
+    return v;
+}
+
+void EventuallyPersistentStore::expireValue(RCPtr<VBucket> vb,
+                                            const std::string &key) {
+    int bucket_num(0);
+    WriterLockHolder lh = vb->ht.getLockedBucket(key, &bucket_num);
+    // Deletes the item if it is still there and still expired.
+    fetchValidValue(vb, key, bucket_num);
+}
+
 protocol_binary_response_status EventuallyPersistentStore::evictKey(const std::string &key,
                                                                     uint16_t vbucket,
                                                                     const char **msg,
@@ -852,7 +1088,7 @@ protocol_binary_response_status EventuallyPersistentStore::evictKey(const std::s
     }
 
     int bucket_num(0);
-    LockHolder lh = vb->ht.getLockedBucket(key, &bucket_num);
+    WriterLockHolder lh = vb->ht.getLockedBucket(key, &bucket_num);
     StoredValue *v = fetchValidValue(vb, key, bucket_num, force);
 
     protocol_binary_response_status rv(PROTOCOL_BINARY_RESPONSE_SUCCESS);
@@ -904,6 +1140,18 @@ ENGINE_ERROR_CODE EventuallyPersistentStore::set(const Item &itm,
 
     bool cas_op = (itm.getCas() != 0);
 
+    if (!force && fullEviction &&
+        (cas_op || vb->ht.getNumEvictedItems() > 0)) {
+        // The CAS can only be checked against the item in memory, and
+        // an evicted item has to come back before it's replaced, or it
+        // would be counted twice.
+        int bucket_num(0);
+        WriterLockHolder lh = vb->ht.getLockedBucket(itm.getKey(), &bucket_num);
+        if (bgFetchMissingKey(vb, itm.getKey(), bucket_num, cookie, !cas_op)) {
+            return ENGINE_EWOULDBLOCK;
+        }
+    }
+
     int64_t row_id = -1;
     mutation_type_t mtype = vb->ht.set(itm, row_id);
     ENGINE_ERROR_CODE ret = ENGINE_SUCCESS;
@@ -960,6 +1208,15 @@ ENGINE_ERROR_CODE EventuallyPersistentStore::add(const Item &itm,
         return ENGINE_NOT_STORED;
     }
 
+    if (fullEviction) {
+        // The key may exist on disk only.
+        int bucket_num(0);
+        WriterLockHolder lh = vb->ht.getLockedBucket(itm.getKey(), &bucket_num);
+        if (bgFetchMissingKey(vb, itm.getKey(), bucket_num, cookie, true)) {
+            return ENGINE_EWOULDBLOCK;
+        }
+    }
+
     switch (vb->ht.add(itm)) {
     case ADD_NOMEM:
         return ENGINE_ENOMEM;
@@ -1032,6 +1289,7 @@ void EventuallyPersistentStore::snapshotVBuckets(const Priority &priority) {
             vbucket_state vb_state;
             vb_state.state = vb->getState();
             vb_state.checkpointId = vbuckets.getPersistenceCheckpointId(vb->getId());
+            vb_state.highSeqno = vb->checkpointManager.getHighSeqno();
             states[p] = vb_state;
             return false;
         }
@@ -1078,6 +1336,12 @@ void EventuallyPersistentStore::setVBucketState(uint16_t vbid,
         if (to != vbucket_state_active) {
             newvb->checkpointManager.setOpenCheckpointId(0);
         }
+        if (bfilterEnabled && stats.warmupComplete.get()) {
+            // Nothing of this version of the vbucket is on disk yet.
+            // (Warmup may still find it on disk, and rebuilds the
+            // filters of all vbuckets once it's done.)
+            newvb->createFilter(bfilterKeyCount, bfilterFpProb);
+        }
         uint16_t vb_version = vbuckets.getBucketVersion(vbid);
         uint16_t vb_new_version = vb_version == (std::numeric_limits<uint16_t>::max() - 1) ?
                                   0 : vb_version + 1;
@@ -1229,44 +1493,87 @@ bool EventuallyPersistentStore::resetVBucket(uint16_t vbid) {
     return rv;
 }
 
-void EventuallyPersistentStore::completeBGFetch(const std::string &key,
-                                                uint16_t vbucket,
-                                                uint16_t vbver,
-                                                uint64_t rowid,
-                                                const void *cookie,
-                                                hrtime_t init) {
+static bool rowidLess(const VBucketBGFetchItem *a,
+                      const VBucketBGFetchItem *b) {
+    return a->rowid < b->rowid;
+}
+
+void EventuallyPersistentStore::completeBGFetchBatch(RCPtr<VBucket> &vb,
+                                                     uint16_t vbver) {
+    std::vector<VBucketBGFetchItem*> fetches;
+    vb->getBGFetchItems(fetches);
+    if (fetches.empty()) {
+        return;
+    }
+
     hrtime_t start(gethrtime());
+    ++stats.bg_batches;
+
+    // Go find the data, in the order it is laid out on disk
+    std::sort(fetches.begin(), fetches.end(), rowidLess);
+    getBGFetchUnderlying(vb->getId())->getMulti(vb->getId(), vbver, fetches);
+
+    std::vector<VBucketBGFetchItem*>::iterator it;
+    for (it = fetches.begin(); it != fetches.end(); ++it) {
+        completeBGFetch(vb, **it, start);
+        delete (*it)->value.getValue();
+        delete *it;
+    }
+}
+
+void EventuallyPersistentStore::completeBGFetch(RCPtr<VBucket> &queuedOn,
+                                                VBucketBGFetchItem &fetch,
+                                                hrtime_t start) {
+    const std::string &key = fetch.key;
+    uint16_t vbucket = queuedOn->getId();
     ++stats.bg_fetched;
     std::stringstream ss;
     ss << "Completed a background fetch, now at " << bgFetchQueue.get()
        << std::endl;
     getLogger()->log(EXTENSION_LOG_DEBUG, NULL, ss.str().c_str());
 
-    // Go find the data
-    RememberingCallback<GetValue> gcb;
-
-    roUnderlying->get(key, rowid, vbucket, vbver, gcb);
-    gcb.waitForValue();
-    assert(gcb.fired);
+    ENGINE_ERROR_CODE status = fetch.value.getStatus();
 
     // Lock to prevent a race condition between a fetch for restore and delete
     LockHolder lh(vbsetMutex);
 
     RCPtr<VBucket> vb = getVBucket(vbucket);
-    if (vb && vb->getState() == vbucket_state_active && gcb.val.getStatus() == ENGINE_SUCCESS) {
+    if (vb && vb->getState() == vbucket_state_active && status == ENGINE_SUCCESS) {
         int bucket_num(0);
-        LockHolder hlh = vb->ht.getLockedBucket(key, &bucket_num);
+        WriterLockHolder hlh = vb->ht.getLockedBucket(key, &bucket_num);
         StoredValue *v = fetchValidValue(vb, key, bucket_num);
 
         if (v && !v->isResident()) {
-            assert(gcb.val.getStatus() == ENGINE_SUCCESS);
-            v->restoreValue(gcb.val.getValue()->getValue(), stats, vb->ht);
+            v->restoreValue(fetch.value.getValue()->getValue(), stats, vb->ht);
             assert(v->isResident());
+        } else if (!v && fullEviction) {
+            // The whole item was evicted; bring it back unless the
+            // key came back to memory in the meantime.
+            if (vb->ht.unlocked_restoreEvicted(*fetch.value.getValue(),
+                                               bucket_num) == ADD_NOMEM) {
+                status = ENGINE_ENOMEM;
+            }
         }
+    } else if (vb && vb->getState() == vbucket_state_active &&
+               status == ENGINE_KEY_ENOENT && fetch.markMissing) {
+        int bucket_num(0);
+        WriterLockHolder hlh = vb->ht.getLockedBucket(key, &bucket_num);
+        vb->ht.unlocked_addTempDeleted(key, bucket_num);
+        status = ENGINE_SUCCESS;
+    }
+
+    if (vb && fetch.rowid == static_cast<uint64_t>(-1) &&
+        fetch.value.getStatus() == ENGINE_KEY_ENOENT && vb->getFilter()) {
+        ++vb->bfFalsePositives;
     }
 
     lh.unlock();
 
+    // Whoever joins the fetch up to here finds the item in memory
+    // when woken; from here on they start a fetch of their own.
+    queuedOn->completeBGFetchItem(&fetch);
+
+    hrtime_t init = fetch.initTime;
     hrtime_t stop = gethrtime();
 
     if (stop > start && start > init) {
@@ -1287,8 +1594,40 @@ void EventuallyPersistentStore::completeBGFetch(const std::string &key,
         stats.bgMaxLoad.setIfBigger(l);
     }
 
-    engine.notifyIOComplete(cookie, gcb.val.getStatus());
-    delete gcb.val.getValue();
+    engine.notifyIOComplete(fetch.cookies, status);
+    --bgFetchQueue;
+    assert(bgFetchQueue.get() < GIGANTOR);
+}
+
+void EventuallyPersistentStore::queueBGFetch(RCPtr<VBucket> &vb,
+                                             uint16_t vbver,
+                                             const std::string &key,
+                                             uint64_t rowid,
+                                             const void *cookie,
+                                             bool markMissing) {
+    assert(cookie);
+    bg_fetch_queue_t queued = vb->queueBGFetch(key, rowid, cookie,
+                                               markMissing);
+    if (queued == BG_FETCH_COALESCED) {
+        ++stats.bg_fetches_coalesced;
+        return;
+    }
+
+    ++bgFetchQueue;
+    std::stringstream ss;
+    ss << "Queued a background fetch, now at " << bgFetchQueue.get()
+       << std::endl;
+    getLogger()->log(EXTENSION_LOG_DEBUG, NULL, ss.str().c_str());
+
+    if (queued == BG_FETCH_NEW_BATCH) {
+        // Whatever else gets queued before the task runs is fetched
+        // along with this one.
+        shared_ptr<BGFetchBatchCallback> dcb(new BGFetchBatchCallback(this, vb,
+                                                                      vbver));
+        getBGFetchDispatcher(vb->getId())->schedule(dcb, NULL,
+                                                    Priority::BgFetcherPriority,
+                                                    bgFetchDelay);
+    }
 }
 
 void EventuallyPersistentStore::bgFetch(const std::string &key,
@@ -1296,15 +1635,61 @@ void EventuallyPersistentStore::bgFetch(const std::string &key,
                                         uint16_t vbver,
                                         uint64_t rowid,
                                         const void *cookie) {
-    shared_ptr<BGFetchCallback> dcb(new BGFetchCallback(this, key,
-                                                        vbucket, vbver,
-                                                        rowid, cookie));
-    assert(bgFetchQueue > 0);
-    std::stringstream ss;
-    ss << "Queued a background fetch, now at " << bgFetchQueue.get()
-       << std::endl;
-    getLogger()->log(EXTENSION_LOG_DEBUG, NULL, ss.str().c_str());
-    roDispatcher->schedule(dcb, NULL, Priority::BgFetcherPriority, bgFetchDelay);
+    RCPtr<VBucket> vb = getVBucket(vbucket);
+    if (!vb) {
+        engine.notifyIOComplete(cookie, ENGINE_NOT_MY_VBUCKET);
+        return;
+    }
+    queueBGFetch(vb, vbver, key, rowid, cookie, false);
+}
+
+bool EventuallyPersistentStore::bgFetchMissingKey(RCPtr<VBucket> &vb,
+                                                  const std::string &key,
+                                                  int bucket_num,
+                                                  const void *cookie,
+                                                  bool markMissing) {
+    if (!fullEviction || cookie == NULL ||
+        vb->getState() != vbucket_state_active ||
+        vb->ht.unlocked_find(key, bucket_num, true) != NULL) {
+        return false;
+    }
+
+    if (!vb->maybeKeyExistsInFilter(key)) {
+        ++vb->bfLookupsAvoided;
+        return false;
+    }
+
+    ++stats.bg_key_lookups;
+    queueBGFetch(vb, vbuckets.getBucketVersion(vb->getId()), key, -1, cookie,
+                 markMissing);
+    return true;
+}
+
+size_t
+EventuallyPersistentStore::evictItems(std::list<std::pair<uint16_t, std::string> > &keys) {
+    size_t evicted(0);
+    std::list<std::pair<uint16_t, std::string> >::iterator it;
+    for (it = keys.begin(); it != keys.end(); ++it) {
+        RCPtr<VBucket> vb = getVBucket(it->first);
+        if (!vb) {
+            continue;
+        }
+        int bucket_num(0);
+        WriterLockHolder lh = vb->ht.getLockedBucket(it->second, &bucket_num);
+        StoredValue *v = vb->ht.unlocked_find(it->second, bucket_num, true);
+        // A mutation still waiting in a checkpoint may be newer than
+        // what's on disk.
+        if (v && !v->isDeleted() &&
+            vb->checkpointManager.isKeyResidentInCheckpoints(it->second,
+                                                             v->getCas())) {
+            continue;
+        }
+        if (vb->ht.unlocked_evictItem(it->second, bucket_num)) {
+            ++stats.numItemEjects;
+            ++evicted;
+        }
+    }
+    return evicted;
 }
 
 GetValue EventuallyPersistentStore::get(const std::string &key,
@@ -1333,24 +1718,45 @@ GetValue EventuallyPersistentStore::get(const std::string &key,
         }
     }
 
+    if (vb->ht.usesLockFreeReads()) {
+        StoredValue *sv(NULL);
+        Item *itm = vb->ht.lockFreeGet(key, vbucket, ep_real_time(), &sv);
+        if (itm) {
+            ++stats.residentGets;
+            return GetValue(itm, ENGINE_SUCCESS, itm->getId(), -1, sv);
+        }
+    }
+
     int bucket_num(0);
-    LockHolder lh = vb->ht.getLockedBucket(key, &bucket_num);
-    StoredValue *v = fetchValidValue(vb, key, bucket_num);
+    bool expired(false);
+    ReaderLockHolder rlh = vb->ht.getReadLockedBucket(key, &bucket_num);
+    StoredValue *v = peekValidValue(vb, key, bucket_num, expired);
+    if (expired) {
+        rlh.unlock();
+        expireValue(vb, key);
+    }
 
     if (v) {
         // If the value is not resident, wait for it...
         if (!v->isResident()) {
             if (queueBG) {
+                ++stats.nonResidentGets;
                 bgFetch(key, vbucket, vbuckets.getBucketVersion(vbucket),
                         v->getId(), cookie);
             }
             return GetValue(NULL, ENGINE_EWOULDBLOCK, v->getId(), -1, v);
         }
 
+        ++stats.residentGets;
         GetValue rv(v->toItem(v->isLocked(ep_current_time()), vbucket),
                     ENGINE_SUCCESS, v->getId(), -1, v);
         return rv;
     } else {
+        if (!expired && queueBG &&
+            bgFetchMissingKey(vb, key, bucket_num, cookie)) {
+            ++stats.nonResidentGets;
+            return GetValue(NULL, ENGINE_EWOULDBLOCK);
+        }
         GetValue rv;
         if (engine.isDegradedMode()) {
             rv.setStatus(ENGINE_TMPFAIL);
@@ -1381,11 +1787,19 @@ ENGINE_ERROR_CODE EventuallyPersistentStore::getMetaData(const std::string &key,
     }
 
     int bucket_num(0);
+    bool expired(false);
     flags = 0;
-    LockHolder lh = vb->ht.getLockedBucket(key, &bucket_num);
-    StoredValue *v = fetchValidValue(vb, key, bucket_num, true);
+    ReaderLockHolder rlh = vb->ht.getReadLockedBucket(key, &bucket_num);
+    StoredValue *v = peekValidValue(vb, key, bucket_num, expired, true);
+    if (expired) {
+        rlh.unlock();
+        expireValue(vb, key);
+    }
 
-    if (v) {
+    if (v && v->isTempItem()) {
+        // Stands in for a key that is on disk neither.
+        return ENGINE_KEY_ENOENT;
+    } else if (v) {
         if (v->isDeleted()) {
             flags |= ntohl(GET_META_ITEM_DELETED_FLAG);
         }
@@ -1393,6 +1807,8 @@ ENGINE_ERROR_CODE EventuallyPersistentStore::getMetaData(const std::string &key,
         Item::encodeMeta(v->getSeqno(), cas, v->valLength(),
                          v->getFlags(), meta);
         return ENGINE_SUCCESS;
+    } else if (!expired && bgFetchMissingKey(vb, key, bucket_num, cookie)) {
+        return ENGINE_EWOULDBLOCK;
     } else {
         return ENGINE_KEY_ENOENT;
     }
@@ -1423,6 +1839,15 @@ ENGINE_ERROR_CODE EventuallyPersistentStore::setWithMeta(const Item &itm,
         }
     }
 
+    if (!force && fullEviction && vb->ht.getNumEvictedItems() > 0) {
+        // Bring an evicted item back before it's replaced (see set).
+        int bucket_num(0);
+        WriterLockHolder lh = vb->ht.getLockedBucket(itm.getKey(), &bucket_num);
+        if (bgFetchMissingKey(vb, itm.getKey(), bucket_num, cookie, true)) {
+            return ENGINE_EWOULDBLOCK;
+        }
+    }
+
     int64_t row_id = -1;
     mutation_type_t mtype = vb->ht.setWithMeta(itm, cas, row_id, allowExisting);
     ENGINE_ERROR_CODE ret = ENGINE_SUCCESS;
@@ -1487,11 +1912,13 @@ GetValue EventuallyPersistentStore::getAndUpdateTtl(const std::string &key,
     }
 
     int bucket_num(0);
-    LockHolder lh = vb->ht.getLockedBucket(key, &bucket_num);
+    WriterLockHolder lh = vb->ht.getLockedBucket(key, &bucket_num);
     StoredValue *v = fetchValidValue(vb, key, bucket_num);
 
     if (v) {
+        time_t oldExptime = v->getExptime();
         v->setExptime(exptime);
+        vb->ht.indexExpiry(v, oldExptime);
         // If the value is not resident, wait for it...
         if (!v->isResident()) {
             if (queueBG) {
@@ -1508,6 +1935,9 @@ GetValue EventuallyPersistentStore::getAndUpdateTtl(const std::string &key,
                     ENGINE_SUCCESS, v->getId());
         return rv;
     } else {
+        if (queueBG && bgFetchMissingKey(vb, key, bucket_num, cookie)) {
+            return GetValue(NULL, ENGINE_EWOULDBLOCK);
+        }
         GetValue rv;
         if (engine.isDegradedMode()) {
             rv.setStatus(ENGINE_TMPFAIL);
@@ -1541,8 +1971,13 @@ EventuallyPersistentStore::getFromUnderlying(const std::string &key,
     }
 
     int bucket_num(0);
-    LockHolder lh = vb->ht.getLockedBucket(key, &bucket_num);
-    StoredValue *v = fetchValidValue(vb, key, bucket_num);
+    bool expired(false);
+    ReaderLockHolder rlh = vb->ht.getReadLockedBucket(key, &bucket_num);
+    StoredValue *v = peekValidValue(vb, key, bucket_num, expired);
+    if (expired) {
+        rlh.unlock();
+        expireValue(vb, key);
+    }
 
     if (v) {
         uint16_t vbver = vbuckets.getBucketVersion(vbucket);
@@ -1554,6 +1989,9 @@ EventuallyPersistentStore::getFromUnderlying(const std::string &key,
         assert(bgFetchQueue > 0);
         roDispatcher->schedule(dcb, NULL, Priority::VKeyStatBgFetcherPriority, bgFetchDelay);
         return ENGINE_EWOULDBLOCK;
+    } else if (!expired && bgFetchMissingKey(vb, key, bucket_num, cookie)) {
+        // Checked on disk once the item is back in memory.
+        return ENGINE_EWOULDBLOCK;
     } else if (engine.isDegradedMode()) {
         return ENGINE_TMPFAIL;
     } else {
@@ -1576,7 +2014,7 @@ bool EventuallyPersistentStore::getLocked(const std::string &key,
     }
 
     int bucket_num(0);
-    LockHolder lh = vb->ht.getLockedBucket(key, &bucket_num);
+    WriterLockHolder lh = vb->ht.getLockedBucket(key, &bucket_num);
     StoredValue *v = fetchValidValue(vb, key, bucket_num);
 
     if (v) {
@@ -1610,6 +2048,10 @@ bool EventuallyPersistentStore::getLocked(const std::string &key,
         GetValue rv(it);
         cb.callback(rv);
 
+    } else if (bgFetchMissingKey(vb, key, bucket_num, cookie)) {
+        GetValue rv(NULL, ENGINE_EWOULDBLOCK);
+        cb.callback(rv);
+        return false;
     } else {
         GetValue rv;
         if (engine.isDegradedMode()) {
@@ -1638,15 +2080,30 @@ StoredValue* EventuallyPersistentStore::getStoredValue(const std::string &key,
     }
 
     int bucket_num(0);
-    LockHolder lh = vb->ht.getLockedBucket(key, &bucket_num);
+    WriterLockHolder lh = vb->ht.getLockedBucket(key, &bucket_num);
     return fetchValidValue(vb, key, bucket_num);
 }
 
+bool EventuallyPersistentStore::isDirty(const std::string &key,
+                                        uint16_t vbucket,
+                                        uint64_t cas) {
+    RCPtr<VBucket> vb = getVBucket(vbucket);
+    if (!vb) {
+        return false;
+    }
+
+    int bucket_num(0);
+    ReaderLockHolder rlh = vb->ht.getReadLockedBucket(key, &bucket_num);
+    StoredValue *v = vb->ht.unlocked_find(key, bucket_num);
+    return v != NULL && v->getCas() == cas && v->isDirty();
+}
+
 ENGINE_ERROR_CODE
 EventuallyPersistentStore::unlockKey(const std::string &key,
                                      uint16_t vbucket,
                                      uint64_t cas,
-                                     rel_time_t currentTime)
+                                     rel_time_t currentTime,
+                                     const void *cookie)
 {
 
     RCPtr<VBucket> vb = getVBucket(vbucket, vbucket_state_active);
@@ -1656,7 +2113,7 @@ EventuallyPersistentStore::unlockKey(const std::string &key,
     }
 
     int bucket_num(0);
-    LockHolder lh = vb->ht.getLockedBucket(key, &bucket_num);
+    WriterLockHolder lh = vb->ht.getLockedBucket(key, &bucket_num);
     StoredValue *v = fetchValidValue(vb, key, bucket_num);
 
     if (v) {
@@ -1669,6 +2126,10 @@ EventuallyPersistentStore::unlockKey(const std::string &key,
         return ENGINE_TMPFAIL;
     }
 
+    if (bgFetchMissingKey(vb, key, bucket_num, cookie)) {
+        return ENGINE_EWOULDBLOCK;
+    }
+
     if (engine.isDegradedMode()) {
         return ENGINE_TMPFAIL;
     }
@@ -1677,22 +2138,26 @@ EventuallyPersistentStore::unlockKey(const std::string &key,
 }
 
 
-bool EventuallyPersistentStore::getKeyStats(const std::string &key,
-                                            uint16_t vbucket,
-                                            struct key_stats &kstats)
+ENGINE_ERROR_CODE EventuallyPersistentStore::getKeyStats(const std::string &key,
+                                                         uint16_t vbucket,
+                                                         const void *cookie,
+                                                         struct key_stats &kstats)
 {
     RCPtr<VBucket> vb = getVBucket(vbucket, vbucket_state_active);
     if (!vb) {
-        return false;
+        return ENGINE_KEY_ENOENT;
     }
 
-    bool found = false;
     int bucket_num(0);
-    LockHolder lh = vb->ht.getLockedBucket(key, &bucket_num);
-    StoredValue *v = fetchValidValue(vb, key, bucket_num);
+    bool expired(false);
+    ReaderLockHolder rlh = vb->ht.getReadLockedBucket(key, &bucket_num);
+    StoredValue *v = peekValidValue(vb, key, bucket_num, expired);
+    if (expired) {
+        rlh.unlock();
+        expireValue(vb, key);
+    }
 
-    found = (v != NULL);
-    if (found) {
+    if (v) {
         kstats.dirty = v->isDirty();
         kstats.exptime = v->getExptime();
         kstats.flags = v->getFlags();
@@ -1701,8 +2166,11 @@ bool EventuallyPersistentStore::getKeyStats(const std::string &key,
         kstats.dirtied = 0; // v->getDirtied();
         kstats.data_age = v->getDataAge();
         kstats.last_modification_time = ep_abs_time(v->getDataAge());
+        return ENGINE_SUCCESS;
+    } else if (!expired && bgFetchMissingKey(vb, key, bucket_num, cookie)) {
+        return ENGINE_EWOULDBLOCK;
     }
-    return found;
+    return ENGINE_KEY_ENOENT;
 }
 
 ENGINE_ERROR_CODE EventuallyPersistentStore::deleteItem(const std::string &key,
@@ -1732,8 +2200,12 @@ ENGINE_ERROR_CODE EventuallyPersistentStore::deleteItem(const std::string &key,
     }
 
     int bucket_num(0);
-    LockHolder lh = vb->ht.getLockedBucket(key, &bucket_num);
+    WriterLockHolder lh = vb->ht.getLockedBucket(key, &bucket_num);
     StoredValue *v = vb->ht.unlocked_find(key, bucket_num);
+    if (!v && !force && !use_meta &&
+        bgFetchMissingKey(vb, key, bucket_num, cookie)) {
+        return ENGINE_EWOULDBLOCK;
+    }
     if (!v) {
         if (engine.isDegradedMode()) {
             LockHolder rlh(restore.mutex);
@@ -1790,6 +2262,9 @@ void EventuallyPersistentStore::reset() {
             vb->resetStats();
         }
     }
+    // Anything collected for the flusher from here on comes after the
+    // flush_all.
+    LockHolder lh(flushCollectMutex);
     if (diskFlushAll.cas(false, true)) {
         // Increase the write queue size by 1 as flusher will execute flush_all as a single task.
         stats.queue_size.set(getWriteQueueSize() + 1);
@@ -1816,10 +2291,35 @@ bool EventuallyPersistentStore::isVbCachedStateStale(uint16_t vb, vbucket_state_
     return false;
 }
 
+/**
+ * Dispatcher job collecting the flusher's next batch while it writes
+ * the current one.
+ */
+class FlushBatchCollector : public DispatcherCallback {
+public:
+    FlushBatchCollector(EventuallyPersistentStore *e) : ep(e) {}
+
+    bool callback(Dispatcher &, TaskId) {
+        ep->prepareFlushBatch();
+        return false;
+    }
+
+    std::string description() {
+        return std::string("Collecting items to flush");
+    }
+
+private:
+    EventuallyPersistentStore *ep;
+};
+
 std::queue<queued_item>* EventuallyPersistentStore::beginFlush() {
     std::queue<queued_item> *rv(NULL);
 
-    if (!hasItemsForPersistence() && writing.empty() && !diskFlushAll) {
+    LockHolder lh(flushCollectMutex);
+    FlushBatch *batch(preparedFlushBatch);
+    preparedFlushBatch = NULL;
+
+    if (!batch && !hasItemsForPersistence() && writing.empty() && !diskFlushAll) {
         stats.dirtyAge = 0;
         // If the persistence queue is empty, reset queue-related stats for each vbucket.
         size_t numOfVBuckets = vbuckets.getSize();
@@ -1836,114 +2336,191 @@ std::queue<queued_item>* EventuallyPersistentStore::beginFlush() {
         }
     } else {
         assert(rwUnderlying);
-        if (diskFlushAll) {
-            queued_item qi(new QueuedItem("", 0xffff, queue_op_flush));
-            writing.push(qi);
-            stats.memOverhead.incr(sizeof(queued_item));
-            assert(stats.memOverhead.get() < GIGANTOR);
-        }
-
-        std::vector<queued_item> item_list;
-        std::set<queued_item, CompareQueuedItemsByKey> item_set;
-        size_t dedup = 0;
-        size_t num_items = 0;
-        size_t numOfVBuckets = vbuckets.getSize();
-
-        item_list.reserve(getTxnSize());
-        assert(numOfVBuckets <= std::numeric_limits<uint16_t>::max());
-
-        for (size_t i = 0; i < numOfVBuckets; ++i) {
-            uint16_t vbid = static_cast<uint16_t>(i);
-            RCPtr<VBucket> vb = vbuckets.getBucket(vbid);
-            if (!vb) {
-                // Undefined vbucket..
-                continue;
-            }
-
-            vbucket_state_t st = vb->getState();
-            if (isVbCachedStateStale(vbid, st)) {
-                rwUnderlying->vbStateChanged(vbid, st);
-            }
-
-            // Grab all the items from online restore.
-            LockHolder rlh(restore.mutex);
-            std::map<uint16_t, std::vector<queued_item> >::iterator rit = restore.items.find(vbid);
-            if (rit != restore.items.end()) {
-                item_list.insert(item_list.end(), rit->second.begin(), rit->second.end());
-                rit->second.clear();
+        queued_item flushAll(new QueuedItem("", 0xffff, queue_op_flush));
+        if (batch) {
+            // The batch was collected before any pending flush_all
+            // (see prepareFlushBatch()), so it's written first.
+            ++stats.flusherPreparedBatches;
+            applyFlushBatch(*batch);
+            delete batch;
+            if (diskFlushAll) {
+                writing.push(flushAll);
+                stats.memOverhead.incr(sizeof(queued_item));
             }
-            rlh.unlock();
-
-            // Grab all the backfill items if exist.
-            vb->getBackfillItems(item_list);
-
-            // Get all dirty items from the checkpoint.
-            uint64_t checkpointId = vb->checkpointManager.getAllItemsForPersistence(item_list);
-            persistenceCheckpointIds[vbid] = checkpointId;
-
-            std::vector<queued_item>::reverse_iterator reverse_it = item_list.rbegin();
-            // Perform further deduplication here by removing duplicate mutations for each key.
-            for (; reverse_it != item_list.rend(); ++reverse_it) {
-                queued_item qi = *reverse_it;
-                switch (qi->getOperation()) {
-                case queue_op_set:
-                case queue_op_del:
-                    if (!(item_set.insert(qi).second)) {
-                        ++dedup;
-                        vb->doStatsForFlushing(*qi, qi->size());
-                    }
-                default:
-                    // Ignore
-                    ;
-                }
-            }
-
-            uint16_t shard_id = 0;
-            std::set<queued_item, CompareQueuedItemsByKey>::iterator sit = item_set.begin();
-            for (; sit != item_set.end(); ++sit) {
-                const queued_item &qitem = *sit;
-                shard_id = rwUnderlying->getShardId(*qitem);
-                dbShardQueues[shard_id].push_back(*sit);
+        } else {
+            if (diskFlushAll) {
+                writing.push(flushAll);
+                stats.memOverhead.incr(sizeof(queued_item));
             }
-            num_items += item_set.size();
-            item_list.clear();
-            item_set.clear();
+            FlushBatch collected;
+            collectFlushBatch(collected);
+            applyFlushBatch(collected);
         }
+        assert(stats.memOverhead.get() < GIGANTOR);
 
-        if (num_items > 0) {
-            pushToOutgoingQueue();
-        }
         size_t queue_size = getWriteQueueSize();
-        stats.flusherDedup += dedup;
         stats.flusher_todo.set(writing.size());
         stats.queue_size.set(queue_size);
         getLogger()->log(EXTENSION_LOG_DEBUG, NULL,
                          "Flushing %d items with %d still in queue\n",
                          writing.size(), queue_size);
         rv = &writing;
+        flushWriteStart = gethrtime();
+        scheduleFlushBatchCollector();
     }
     return rv;
 }
 
-void EventuallyPersistentStore::pushToOutgoingQueue() {
+/**
+ * Account for a mutation the flusher won't write because a later one
+ * of the same key supersedes it.
+ */
+class FlushDuplicateStats {
+public:
+    FlushDuplicateStats(RCPtr<VBucket> &v) : vb(v) {}
+
+    void operator()(QueuedItem &qi) {
+        vb->doStatsForFlushing(qi, qi.size());
+    }
+
+private:
+    RCPtr<VBucket> &vb;
+};
+
+void EventuallyPersistentStore::collectFlushBatch(FlushBatch &batch) {
+    BlockTimer timer(&stats.flushCollectHisto, "flush_collect", stats.timingLog);
+    std::vector<queued_item> &item_list = flushCollectItems;
+    std::vector<queued_item> &deduped = flushDedupedItems;
+    size_t dedup = 0;
     size_t num_items = 0;
+    size_t numOfVBuckets = vbuckets.getSize();
+
+    assert(numOfVBuckets <= std::numeric_limits<uint16_t>::max());
+
+    for (size_t i = 0; i < numOfVBuckets; ++i) {
+        uint16_t vbid = static_cast<uint16_t>(i);
+        RCPtr<VBucket> vb = vbuckets.getBucket(vbid);
+        if (!vb) {
+            // Undefined vbucket..
+            continue;
+        }
+
+        vbucket_state_t st = vb->getState();
+        if (isVbCachedStateStale(vbid, st)) {
+            batch.vbStateChanges.push_back(std::make_pair(vbid, st));
+        }
+
+        // Grab all the items from online restore.
+        LockHolder rlh(restore.mutex);
+        std::map<uint16_t, std::vector<queued_item> >::iterator rit = restore.items.find(vbid);
+        if (rit != restore.items.end()) {
+            item_list.insert(item_list.end(), rit->second.begin(), rit->second.end());
+            rit->second.clear();
+        }
+        rlh.unlock();
+
+        // Grab all the backfill items if exist.
+        vb->getBackfillItems(item_list);
+
+        // Get all dirty items from the checkpoint.
+        uint64_t checkpointId = vb->checkpointManager.getAllItemsForPersistence(item_list);
+        batch.checkpointIds[vbid] = checkpointId;
+
+        // Perform further deduplication here by removing duplicate
+        // mutations for each key, leaving the rest in row id order.
+        FlushDuplicateStats dupStats(vb);
+        dedup += flushDeduper.dedup(item_list, deduped, dupStats);
+
+        std::vector<queued_item>::iterator dit = deduped.begin();
+        for (; dit != deduped.end(); ++dit) {
+            if (engine.getObserveRegistry().isPersistenceAwaited(**dit)) {
+                flushPriorityItems.push_back(*dit);
+            } else {
+                dbShardQueues[rwUnderlying->getShardId(**dit)].push_back(*dit);
+            }
+        }
+        num_items += deduped.size();
+        item_list.clear();
+        deduped.clear();
+    }
+
+    if (!flushPriorityItems.empty()) {
+        // Written and committed in a small transaction of their own
+        // ahead of the rest, so their waiters hear back soon.
+        stats.flusherPriorityItems.incr(flushPriorityItems.size());
+        batch.items.insert(batch.items.end(), flushPriorityItems.begin(),
+                           flushPriorityItems.end());
+        batch.items.push_back(queued_item(new QueuedItem("", 0xffff,
+                                                         queue_op_commit)));
+        flushPriorityItems.clear();
+    }
+    if (num_items > 0) {
+        pushToOutgoingQueue(batch.items);
+    }
+    stats.flusherDedup += dedup;
+}
+
+void EventuallyPersistentStore::pushToOutgoingQueue(std::vector<queued_item> &out) {
     size_t num_shards = rwUnderlying->getNumShards();
     for (size_t i = 0; i < num_shards; ++i) {
         if (dbShardQueues[i].empty()) {
             continue;
         }
         rwUnderlying->optimizeWrites(dbShardQueues[i]);
-        std::vector<queued_item>::iterator it = dbShardQueues[i].begin();
-        for(; it != dbShardQueues[i].end(); ++it) {
-            writing.push(*it);
-        }
-        num_items += dbShardQueues[i].size();
+        out.insert(out.end(), dbShardQueues[i].begin(), dbShardQueues[i].end());
         dbShardQueues[i].clear();
     }
-    stats.memOverhead.incr(num_items * sizeof(queued_item));
+}
+
+void EventuallyPersistentStore::applyFlushBatch(FlushBatch &batch) {
+    std::vector<std::pair<uint16_t, vbucket_state_t> >::iterator sit;
+    for (sit = batch.vbStateChanges.begin(); sit != batch.vbStateChanges.end(); ++sit) {
+        rwUnderlying->vbStateChanged(sit->first, sit->second);
+    }
+
+    std::map<uint16_t, uint64_t>::iterator cit;
+    for (cit = batch.checkpointIds.begin(); cit != batch.checkpointIds.end(); ++cit) {
+        persistenceCheckpointIds[cit->first] = cit->second;
+    }
+
+    std::vector<queued_item>::iterator it = batch.items.begin();
+    for (; it != batch.items.end(); ++it) {
+        writing.push(*it);
+    }
+    stats.memOverhead.incr(batch.items.size() * sizeof(queued_item));
     assert(stats.memOverhead.get() < GIGANTOR);
 }
 
+void EventuallyPersistentStore::scheduleFlushBatchCollector() {
+    if (flusherPipeline && !flushBatchCollectorScheduled) {
+        flushBatchCollectorScheduled = true;
+        shared_ptr<FlushBatchCollector> cb(new FlushBatchCollector(this));
+        nonIODispatcher->schedule(cb, NULL, Priority::FlushBatchCollectorPriority);
+    }
+}
+
+void EventuallyPersistentStore::prepareFlushBatch() {
+    LockHolder lh(flushCollectMutex);
+    flushBatchCollectorScheduled = false;
+    // Whatever is collected after a flush_all has to be written after
+    // it, so the flusher collects that itself.  And a flusher that is
+    // shutting down may already be past taking a prepared batch.
+    if (preparedFlushBatch || diskFlushAll || flusher->state() != running ||
+        !hasItemsForPersistence()) {
+        return;
+    }
+
+    preparedFlushBatch = new FlushBatch();
+    collectFlushBatch(*preparedFlushBatch);
+    stats.flusher_todo.incr(preparedFlushBatch->items.size());
+}
+
+void EventuallyPersistentStore::updateFlusherTodo() {
+    LockHolder lh(flushCollectMutex);
+    size_t prepared = preparedFlushBatch ? preparedFlushBatch->items.size() : 0;
+    stats.flusher_todo.set(writing.size() + prepared);
+}
+
 void EventuallyPersistentStore::requeueRejectedItems(std::queue<queued_item> *rej) {
     size_t queue_size = rej->size();
     // Requeue the rejects.
@@ -1954,10 +2531,15 @@ void EventuallyPersistentStore::requeueRejectedItems(std::queue<queued_item> *re
     stats.memOverhead.incr(queue_size * sizeof(queued_item));
     assert(stats.memOverhead.get() < GIGANTOR);
     stats.queue_size.set(getWriteQueueSize());
-    stats.flusher_todo.set(writing.size());
+    updateFlusherTodo();
 }
 
 void EventuallyPersistentStore::completeFlush(rel_time_t flush_start) {
+    hrtime_t now = gethrtime();
+    if (now > flushWriteStart) {
+        stats.flushWriteHisto.add((now - flushWriteStart) / 1000);
+    }
+
     LockHolder lh(vbsetMutex);
     size_t numOfVBuckets = vbuckets.getSize();
     bool schedule_vb_snapshot = false;
@@ -1982,7 +2564,7 @@ void EventuallyPersistentStore::completeFlush(rel_time_t flush_start) {
         scheduleVBSnapshot(Priority::VBucketPersistHighPriority);
     }
 
-    stats.flusher_todo.set(writing.size());
+    updateFlusherTodo();
     stats.queue_size.set(getWriteQueueSize());
     rel_time_t complete_time = ep_current_time();
     stats.flushDuration.set(complete_time - flush_start);
@@ -1993,6 +2575,10 @@ void EventuallyPersistentStore::completeFlush(rel_time_t flush_start) {
 
 int EventuallyPersistentStore::flushSome(std::queue<queued_item> *q,
                                          std::queue<queued_item> *rejectQueue) {
+    if (!shardWriters.empty()) {
+        return flushSomeSharded(q, rejectQueue);
+    }
+
     if (!tctx.enter()) {
         ++stats.beginFailed;
         getLogger()->log(EXTENSION_LOG_WARNING, NULL,
@@ -2025,6 +2611,127 @@ int EventuallyPersistentStore::flushSome(std::queue<queued_item> *q,
     return oldest;
 }
 
+/**
+ * Dispatcher job writing the items handed to a shard writer.
+ */
+class ShardFlushCallback : public DispatcherCallback {
+public:
+    ShardFlushCallback(EventuallyPersistentStore *e, ShardWriter *w) :
+        ep(e), writer(w) {}
+
+    bool callback(Dispatcher &, TaskId) {
+        ep->flushShard(*writer);
+        return false;
+    }
+
+    std::string description() {
+        return std::string("Writing a shard");
+    }
+
+private:
+    EventuallyPersistentStore *ep;
+    ShardWriter               *writer;
+};
+
+int EventuallyPersistentStore::flushSomeSharded(std::queue<queued_item> *q,
+                                                std::queue<queued_item> *rejectQueue) {
+    // A flush_all is done here, between passes of the shard writers.
+    // Explicit commits don't mean anything to them, since they commit
+    // at the end of every pass anyway.
+    while (!q->empty()) {
+        enum queue_operation op = q->front()->getOperation();
+        if (op == queue_op_set || op == queue_op_del) {
+            break;
+        } else if (op == queue_op_commit) {
+            q->pop();
+            stats.memOverhead.decr(sizeof(queued_item));
+            stats.flusher_todo--;
+        } else {
+            flushOne(q, rejectQueue);
+        }
+    }
+
+    // Hand everything up to the next flush_all to the shard writers.
+    size_t handedOut = 0;
+    while (!q->empty()) {
+        queued_item qi = q->front();
+        enum queue_operation op = qi->getOperation();
+        if (op != queue_op_set && op != queue_op_del) {
+            break;
+        }
+        q->pop();
+        shardWriters[rwUnderlying->getShardId(*qi)]->items.push(qi);
+        ++handedOut;
+    }
+    if (handedOut == 0) {
+        return stats.min_data_age;
+    }
+
+    LockHolder lh(shardWritersSync);
+    std::vector<ShardWriter*>::iterator it;
+    for (it = shardWriters.begin(); it != shardWriters.end(); ++it) {
+        if (!(*it)->items.empty()) {
+            ++shardWritersBusy;
+            shared_ptr<ShardFlushCallback> cb(new ShardFlushCallback(this, *it));
+            (*it)->dispatcher->schedule(cb, NULL, Priority::FlusherPriority);
+        }
+    }
+    while (shardWritersBusy > 0) {
+        shardWritersSync.wait();
+    }
+    lh.unlock();
+
+    int oldest = stats.min_data_age;
+    for (it = shardWriters.begin(); it != shardWriters.end(); ++it) {
+        ShardWriter *writer = *it;
+        while (!writer->rejects.empty()) {
+            rejectQueue->push(writer->rejects.front());
+            writer->rejects.pop();
+        }
+        if (writer->oldest != 0 && writer->oldest < oldest) {
+            oldest = writer->oldest;
+        }
+    }
+    return oldest;
+}
+
+void EventuallyPersistentStore::flushShard(ShardWriter &writer) {
+    writer.oldest = stats.min_data_age;
+    while (!writer.items.empty()) {
+        if (!writer.tctx.enter()) {
+            ++stats.beginFailed;
+            getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                             "Failed to start a transaction.\n");
+            while (!writer.items.empty()) {
+                writer.rejects.push(writer.items.front());
+                writer.items.pop();
+            }
+            break;
+        }
+        int tsz = writer.tctx.remaining();
+        int completed(0);
+        for (completed = 0; completed < tsz && !writer.items.empty(); ++completed) {
+            queued_item qi = writer.items.front();
+            writer.items.pop();
+            stats.memOverhead.decr(sizeof(queued_item));
+            int n = flushOneMutation(qi, &writer.rejects, writer.tctx,
+                                     writer.underlying);
+            stats.flusher_todo--;
+            if (n != 0 && n < writer.oldest) {
+                writer.oldest = n;
+            }
+        }
+        if (writer.items.empty()) {
+            writer.tctx.commit();
+        }
+        writer.tctx.leave(completed);
+    }
+
+    LockHolder lh(shardWritersSync);
+    --shardWritersBusy;
+    shardWritersSync.notify();
+}
+
 size_t EventuallyPersistentStore::getWriteQueueSize(void) {
     size_t size = 0;
     size_t numOfVBuckets = vbuckets.getSize();
@@ -2157,7 +2864,7 @@ public:
                         EventuallyPersistentStore *st, MutationLog *ml,
                         rel_time_t qd, rel_time_t d, EPStats *s) :
         queuedItem(qi), rq(q), store(st), mutationLog(ml),
-        queued(qd), dirtied(d), stats(s) {
+        queued(qd), dirtied(d), stats(s), removeOnCommit(false) {
 
         assert(rq);
         assert(s);
@@ -2177,7 +2884,7 @@ public:
             if (vb && vb->getState() != vbucket_state_active &&
                 vb->getState() != vbucket_state_pending) {
                 int bucket_num(0);
-                LockHolder lh = vb->ht.getLockedBucket(queuedItem->getKey(), &bucket_num);
+                WriterLockHolder lh = vb->ht.getLockedBucket(queuedItem->getKey(), &bucket_num);
                 StoredValue *v = store->fetchValidValue(vb, queuedItem->getKey(),
                                                         bucket_num, true);
                 double current = static_cast<double>(StoredValue::getCurrentSize(*stats));
@@ -2201,7 +2908,7 @@ public:
             if (value.first == 0) {
                 RCPtr<VBucket> vb = store->getVBucket(queuedItem->getVBucketId());
                 int bucket_num(0);
-                LockHolder lh = vb->ht.getLockedBucket(queuedItem->getKey(), &bucket_num);
+                WriterLockHolder lh = vb->ht.getLockedBucket(queuedItem->getKey(), &bucket_num);
                 StoredValue *v = store->fetchValidValue(vb, queuedItem->getKey(),
                                                         bucket_num, true);
                 if (v) {
@@ -2245,17 +2952,17 @@ public:
             // may now remove it from the hash table.
             if (vb) {
                 int bucket_num(0);
-                LockHolder lh = vb->ht.getLockedBucket(queuedItem->getKey(), &bucket_num);
+                WriterLockHolder lh = vb->ht.getLockedBucket(queuedItem->getKey(), &bucket_num);
                 StoredValue *v = store->fetchValidValue(vb, queuedItem->getKey(),
                                                         bucket_num, true);
-                if (v && v->isDeleted()) {
-                    if (store->getEPEngine().isDegradedMode()) {
-                        LockHolder rlh(store->restore.mutex);
-                        store->restore.itemsDeleted.insert(queuedItem->getKey());
-                    }
-                    bool deleted = vb->ht.unlocked_del(queuedItem->getKey(),
-                                                       bucket_num);
-                    assert(deleted);
+                if (v && v->isDeleted() && value > 0 && store->isFullEviction()) {
+                    // Until the commit a lookup of the key on disk
+                    // would still find the row, so the deleted item
+                    // stays in memory to answer for it.
+                    v->clearId();
+                    removeOnCommit = true;
+                } else if (v && v->isDeleted()) {
+                    removeDeleted(vb, bucket_num);
                 } else if (v) {
                     v->clearId();
                 }
@@ -2265,8 +2972,41 @@ public:
         }
     }
 
+    /**
+     * Called once the transaction this was written in committed.
+     */
+    void committed() {
+        if (!store->isFullEviction()) {
+            return;
+        }
+        RCPtr<VBucket> vb = store->getVBucket(queuedItem->getVBucketId());
+        if (!vb || (!removeOnCommit && queuedItem->getOperation() != queue_op_set)) {
+            return;
+        }
+        int bucket_num(0);
+        WriterLockHolder lh = vb->ht.getLockedBucket(queuedItem->getKey(), &bucket_num);
+        StoredValue *v = vb->ht.unlocked_find(queuedItem->getKey(), bucket_num, true);
+        if (v && removeOnCommit) {
+            // Unless it was set again in the meantime.
+            if (v->isDeleted()) {
+                removeDeleted(vb, bucket_num);
+            }
+        } else if (v) {
+            v->markCommitted();
+        }
+    }
+
 private:
 
+    void removeDeleted(RCPtr<VBucket> &vb, int bucket_num) {
+        if (store->getEPEngine().isDegradedMode()) {
+            LockHolder rlh(store->restore.mutex);
+            store->restore.itemsDeleted.insert(queuedItem->getKey());
+        }
+        bool deleted = vb->ht.unlocked_del(queuedItem->getKey(), bucket_num);
+        assert(deleted);
+    }
+
     void setId(int64_t id) {
         bool did = store->invokeOnLockedStoredValue(queuedItem->getKey(),
                                                     queuedItem->getVBucketId(),
@@ -2295,6 +3035,7 @@ private:
     rel_time_t queued;
     rel_time_t dirtied;
     EPStats *stats;
+    bool removeOnCommit;
     DISALLOW_COPY_AND_ASSIGN(PersistenceCallback);
 };
 
@@ -2317,7 +3058,9 @@ int EventuallyPersistentStore::flushOneDeleteAll() {
 // still a bit better off running the older code that figures it out
 // based on what's in memory.
 int EventuallyPersistentStore::flushOneDelOrSet(const queued_item &qi,
-                                           std::queue<queued_item> *rejectQueue) {
+                                                std::queue<queued_item> *rejectQueue,
+                                                TransactionContext &txn,
+                                                KVStore *underlying) {
 
     RCPtr<VBucket> vb = getVBucket(qi->getVBucketId());
     if (!vb) {
@@ -2325,7 +3068,7 @@ int EventuallyPersistentStore::flushOneDelOrSet(const queued_item &qi,
     }
 
     int bucket_num(0);
-    LockHolder lh = vb->ht.getLockedBucket(qi->getKey(), &bucket_num);
+    WriterLockHolder lh = vb->ht.getLockedBucket(qi->getKey(), &bucket_num);
     StoredValue *v = fetchValidValue(vb, qi->getKey(), bucket_num, true);
 
     size_t itemBytes = qi->size();
@@ -2361,7 +3104,8 @@ int EventuallyPersistentStore::flushOneDelOrSet(const queued_item &qi,
             eligible = false;
         } else if (dirtyAge > stats.queue_age_cap.get()) {
             ++stats.tooOld;
-        } else if (dataAge < stats.min_data_age.get()) {
+        } else if (dataAge < stats.min_data_age.get() &&
+                   !engine.getObserveRegistry().isPersistenceAwaited(*qi)) {
             eligible = false;
             // Skip this one.  It's too young.
             ret = stats.min_data_age.get() - dataAge;
@@ -2405,9 +3149,21 @@ int EventuallyPersistentStore::flushOneDelOrSet(const queued_item &qi,
 
                 Item itm(qi->getKey(), v->getFlags(), v->getExptime(),
                          v->getValue(), v->getCas(), rowid, qi->getVBucketId());
+                // The value may have changed since the item was queued, in
+                // which case its sequence number isn't known yet.
+                itm.setBySeqno(v->getCas() == qi->getCas() ? qi->getBySeqno() : 0);
+                v->setBySeqno(itm.getBySeqno());
                 // TODO: An item should be marked as clean in TransactionContext::commit()
                 // to support a consistent read from disk after the item is ejected.
                 v->markClean(NULL);
+                if (fullEviction) {
+                    // Not to be evicted until readers of the disk
+                    // see it.
+                    v->markUncommitted();
+                }
+                // Once clean, the item may be evicted and looked up on
+                // disk, so its key has to be in the filter by then.
+                vb->addToFilter(qi->getKey());
                 lh.unlock();
                 BlockTimer timer(rowid == -1 ?
                                  &stats.diskInsertHisto : &stats.diskUpdateHisto,
@@ -2416,8 +3172,10 @@ int EventuallyPersistentStore::flushOneDelOrSet(const queued_item &qi,
                 PersistenceCallback *cb;
                 cb = new PersistenceCallback(qi, rejectQueue, this, &mutationLog,
                                              queued, dirtied, &stats);
-                tctx.addCallback(cb);
-                rwUnderlying->set(itm, qi->getVBucketVersion(), *cb);
+                txn.addCallback(cb);
+                underlying->set(itm, qi->getVBucketVersion(), *cb);
+                ioThrottle.consumed(io_flusher,
+                                    itm.getKey().length() + itm.getNBytes());
                 if (rowid == -1)  {
                     ++vb->opsCreate;
                 } else {
@@ -2435,8 +3193,9 @@ int EventuallyPersistentStore::flushOneDelOrSet(const queued_item &qi,
         if (rowid > 0) {
             uint16_t vbid(qi->getVBucketId());
             uint16_t vbver(vbuckets.getBucketVersion(vbid));
-            tctx.addCallback(cb);
-            rwUnderlying->del(qi->getItem(), rowid, vbver, *cb);
+            txn.addCallback(cb);
+            underlying->del(qi->getItem(), rowid, vbver, *cb);
+            ioThrottle.consumed(io_flusher, qi->getKey().length());
         } else {
             // bypass deletion if missing items, but still call the
             // deletion callback for clean cleanup.
@@ -2449,6 +3208,24 @@ int EventuallyPersistentStore::flushOneDelOrSet(const queued_item &qi,
     return ret;
 }
 
+int EventuallyPersistentStore::flushOneMutation(const queued_item &qi,
+                                                std::queue<queued_item> *rejectQueue,
+                                                TransactionContext &txn,
+                                                KVStore *underlying) {
+    int rv = 0;
+    if (qi->getOperation() == queue_op_del ||
+        qi->getVBucketVersion() == vbuckets.getBucketVersion(qi->getVBucketId())) {
+        size_t prevRejectCount = rejectQueue->size();
+
+        rv = flushOneDelOrSet(qi, rejectQueue, txn, underlying);
+        if (rejectQueue->size() == prevRejectCount) {
+            // flush operation was not rejected
+            txn.addUncommittedItem(qi);
+        }
+    }
+    return rv;
+}
+
 int EventuallyPersistentStore::flushOne(std::queue<queued_item> *q,
                                         std::queue<queued_item> *rejectQueue) {
 
@@ -2463,18 +3240,8 @@ int EventuallyPersistentStore::flushOne(std::queue<queued_item> *q,
         rv = flushOneDeleteAll();
         break;
     case queue_op_set:
-        if (qi->getVBucketVersion() == vbuckets.getBucketVersion(qi->getVBucketId())) {
-            size_t prevRejectCount = rejectQueue->size();
-
-            rv = flushOneDelOrSet(qi, rejectQueue);
-            if (rejectQueue->size() == prevRejectCount) {
-                // flush operation was not rejected
-                tctx.addUncommittedItem(qi);
-            }
-        }
-        break;
     case queue_op_del:
-        rv = flushOneDelOrSet(qi, rejectQueue);
+        rv = flushOneMutation(qi, rejectQueue, tctx, rwUnderlying);
         break;
     case queue_op_commit:
         tctx.commit();
@@ -2532,7 +3299,7 @@ int EventuallyPersistentStore::restoreItem(const Item &itm, enum queue_operation
     }
 
     int bucket_num(0);
-    LockHolder lh = vb->ht.getLockedBucket(key, &bucket_num);
+    WriterLockHolder lh = vb->ht.getLockedBucket(key, &bucket_num);
     LockHolder rlh(restore.mutex);
     if (restore.itemsDeleted.find(key) == restore.itemsDeleted.end() &&
         vb->ht.unlocked_restoreItem(itm, op, bucket_num)) {
@@ -2571,6 +3338,52 @@ void EventuallyPersistentStore::warmupCompleted() {
     if (!engine.isDegradedMode()) {
         completeDegradedMode();
     }
+
+    if (bfilterEnabled) {
+        size_t maxSize = vbuckets.getSize();
+        for (size_t i = 0; i < maxSize; ++i) {
+            RCPtr<VBucket> vb = vbuckets.getBucket(static_cast<uint16_t>(i));
+            if (vb) {
+                maintainBloomFilter(vb);
+            }
+        }
+    }
+}
+
+void EventuallyPersistentStore::maintainBloomFilter(RCPtr<VBucket> &vb) {
+    if (!bfilterEnabled) {
+        return;
+    }
+
+    size_t keyCount = bfilterKeyCount;
+    RCPtr<BloomFilter> bf = vb->getFilter();
+    if (bf) {
+        size_t estimate = bf->getEstimatedKeyCount();
+        if (estimate <= bf->getKeyCapacity() &&
+            bf->getFalsePositiveRate() <= 2 * bfilterFpProb) {
+            return;
+        }
+        // Leave room to grow, and don't trust the estimate of a
+        // saturated filter.
+        estimate = std::min(estimate, 2 * bf->getKeyCapacity());
+        keyCount = std::max(keyCount, 2 * estimate);
+    }
+
+    if (vb->initTempFilter(keyCount, bfilterFpProb)) {
+        if (bfilterDispatcher) {
+            shared_ptr<DispatcherCallback> cb(new BloomFilterRebuilder(bfilterUnderlying,
+                                                                       vb));
+            bfilterDispatcher->schedule(cb, NULL,
+                                        Priority::BloomFilterRebuilderPriority);
+        } else {
+            // Behind any background fetches already waiting on the
+            // reader.
+            shared_ptr<DispatcherCallback> cb(new BloomFilterRebuilder(roUnderlying,
+                                                                       vb));
+            roDispatcher->schedule(cb, NULL,
+                                   Priority::BloomFilterRebuilderPriority);
+        }
+    }
 }
 
 static void warmupLogCallback(void *arg, uint16_t vb, uint16_t vbver,
@@ -2645,7 +3458,7 @@ EventuallyPersistentStore::warmup(const std::map<std::pair<uint16_t, uint16_t>,
                          keysOnly ? "keys" : "data", vbp.first,
                          VBucket::toString(vbs.state));
         load_cb->initVBucket(vbp.first, vbp.second, vbs.checkpointId + 1,
-                       vbs.state);
+                       vbs.highSeqno, vbs.state);
     }
 
     if (keysOnly) {
@@ -2666,6 +3479,33 @@ EventuallyPersistentStore::warmup(const std::map<std::pair<uint16_t, uint16_t>,
     }
 }
 
+void EventuallyPersistentStore::updateTxnSizing() {
+    Configuration &config = engine.getConfiguration();
+    int minSize = static_cast<int>(config.getMinTxnSize());
+    hrtime_t target = 0;
+    if (config.isAdaptiveTxnSize()) {
+        // txn_target_latency is in milliseconds.
+        target = static_cast<hrtime_t>(config.getTxnTargetLatency()) * 1000000;
+    }
+    tctx.setAdaptiveSizing(minSize, target);
+    std::vector<ShardWriter*>::iterator it;
+    for (it = shardWriters.begin(); it != shardWriters.end(); ++it) {
+        (*it)->tctx.setAdaptiveSizing(minSize, target);
+    }
+}
+
+void EventuallyPersistentStore::updateIOThrottle() {
+    Configuration &config = engine.getConfiguration();
+    ioThrottle.setLimits(io_flusher, config.getIoFlusherBytesLimit(),
+                         config.getIoFlusherOpsLimit());
+    // Deleting rows costs about the same whatever their size.
+    ioThrottle.setLimits(io_deletion, 0, config.getIoDeletionOpsLimit());
+    ioThrottle.setLimits(io_backfill, config.getIoBackfillBytesLimit(),
+                         config.getIoBackfillOpsLimit());
+    ioThrottle.setLimits(io_restore, config.getIoRestoreBytesLimit(),
+                         config.getIoRestoreOpsLimit());
+}
+
 void EventuallyPersistentStore::setExpiryPagerSleeptime(size_t val) {
     LockHolder lh(expiryPager.mutex);
 
@@ -2703,7 +3543,8 @@ void EventuallyPersistentStore::visit(VBucketVisitor &visitor)
 }
 
 void LoadStorageKVPairCallback::initVBucket(uint16_t vbid, uint16_t vb_version,
-                                            uint64_t checkpointId, vbucket_state_t prevState) {
+                                            uint64_t checkpointId, uint64_t highSeqno,
+                                            vbucket_state_t prevState) {
     RCPtr<VBucket> vb = vbuckets.getBucket(vbid);
     if (!vb) {
         vb.reset(new VBucket(vbid, vbucket_state_dead, stats,
@@ -2719,6 +3560,8 @@ void LoadStorageKVPairCallback::initVBucket(uint16_t vbid, uint16_t vb_version,
     // For each vbucket, set its latest checkpoint Id that was
     // successfully persisted.
     vbuckets.setPersistenceCheckpointId(vbid, checkpointId - 1);
+    // Continue the vbucket's sequence numbers.
+    vb->checkpointManager.setHighSeqno(highSeqno);
 }
 
 void LoadStorageKVPairCallback::callback(GetValue &val) {
@@ -2743,6 +3586,9 @@ void LoadStorageKVPairCallback::callback(GetValue &val) {
             vbuckets.addBucket(vb);
             vbuckets.setBucketVersion(i->getVBucketId(), val.getVBucketVersion());
         }
+        if (i->getBySeqno() != 0) {
+            vb->checkpointManager.setHighSeqno(i->getBySeqno());
+        }
         bool succeeded(false);
         int retry = 2;
         do {
@@ -2827,11 +3673,26 @@ void LoadStorageKVPairCallback::purge() {
     hasPurged = true;
 }
 
+ShardWriter::ShardWriter(EventuallyPersistentEngine &e, KVStore *kvs, size_t s,
+                         MutationLog &log) :
+    underlying(kvs),
+    tctx(e.getEpStats(), kvs, log, e.getObserveRegistry(), static_cast<int>(s)),
+    dispatcher(new Dispatcher(e)), oldest(0) {
+    dispatcher->start();
+}
+
+ShardWriter::~ShardWriter() {
+    delete dispatcher;
+    delete underlying;
+}
+
 bool TransactionContext::enter() {
     if (!intxn) {
         _remaining = txnSize.get();
-        intxn = underlying->begin();
+        intxn = shardId < 0 ? underlying->begin() : underlying->beginShard(shardId);
+        writeTime = 0;
     }
+    segmentStart = gethrtime();
     return intxn;
 }
 
@@ -2840,11 +3701,23 @@ void TransactionContext::leave(int completed) {
     if (remaining() <= 0 && intxn) {
         commit();
     }
+    if (intxn) {
+        // The flusher stops writing until it enters again (e.g. when
+        // it's preempted), which doesn't count towards the transaction.
+        writeTime += gethrtime() - segmentStart;
+        segmentStart = gethrtime();
+    }
 }
 
 void TransactionContext::commit() {
     BlockTimer timer(&stats.diskCommitHisto, "disk_commit", stats.timingLog);
     rel_time_t cstart = ep_current_time();
+    hrtime_t commitStart = gethrtime();
+    size_t written = transactionCallbacks.size();
+    bool measured = intxn;
+    if (measured) {
+        writeTime += commitStart - segmentStart;
+    }
     mutationLog.commit1();
     while (!underlying->commit()) {
         sleep(1);
@@ -2852,11 +3725,15 @@ void TransactionContext::commit() {
     }
     mutationLog.commit2();
     ++stats.flusherCommits;
+    if (!uncommittedItems.empty()) {
+        observeRegistry.itemsPersisted(uncommittedItems);
+    }
 
     std::list<PersistenceCallback*>::iterator iter;
     for (iter = transactionCallbacks.begin();
          iter != transactionCallbacks.end();
          ++iter) {
+        (*iter)->committed();
         delete *iter;
     }
     transactionCallbacks.clear();
@@ -2867,6 +3744,35 @@ void TransactionContext::commit() {
     intxn = false;
     uncommittedItems.clear();
     numUncommittedItems = 0;
+
+    if (measured && written > 0) {
+        adaptTxnSize(written, writeTime + (gethrtime() - commitStart));
+        stats.txnSizeHisto.add(txnSize.get());
+    }
+}
+
+void TransactionContext::adaptTxnSize(size_t written, hrtime_t took) {
+    hrtime_t target = targetLatency.get();
+    int current = txnSize.get();
+    if (target == 0 || (took <= target && written < static_cast<size_t>(current))) {
+        // A transaction that wasn't full and was quick enough says
+        // nothing about how long a full one would take.
+        return;
+    }
+
+    // A transaction costs a commit plus a bit per update, so scaling
+    // the updates written by how far off the target they took
+    // converges on the size that takes the target time.  Growing is
+    // limited to doubling per commit to ride out a lucky one.
+    double wanted = static_cast<double>(written) * static_cast<double>(target) /
+        static_cast<double>(std::max(took, static_cast<hrtime_t>(1)));
+    wanted = std::min(wanted, 2.0 * current);
+    wanted = std::max(wanted, static_cast<double>(minTxnSize.get()));
+    wanted = std::min(wanted, static_cast<double>(maxTxnSize.get()));
+    int next = std::max(static_cast<int>(wanted), 1);
+    if (next != current) {
+        resize(next);
+    }
 }
 
 void TransactionContext::addUncommittedItem(const queued_item &qi) {
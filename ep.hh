@@ -42,12 +42,14 @@ extern EXTENSION_LOGGER_DESCRIPTOR *getLogger(void);
 #include "locks.hh"
 #include "kvstore.hh"
 #include "stored-value.hh"
+#include "flush_dedup.hh"
 #include "observe_registry.hh"
 #include "atomic.hh"
 #include "dispatcher.hh"
 #include "vbucket.hh"
 #include "vbucketmap.hh"
 #include "item_pager.hh"
+#include "io_throttle.hh"
 #include "mutation_log.hh"
 
 #define MAX_BG_FETCH_DELAY 900
@@ -288,6 +290,7 @@ public:
 
 // Forward declaration
 class Flusher;
+class UnrefCheckpointRemover;
 class TapBGFetchCallback;
 class EventuallyPersistentStore;
 
@@ -300,10 +303,14 @@ class PersistenceCallback;
 class TransactionContext {
 public:
 
+    /**
+     * @param shard the shard the transactions only write, or -1 for
+     *              transactions that may write everything
+     */
     TransactionContext(EPStats &st, KVStore *ks, MutationLog &log,
-                       ObserveRegistry &obsReg)
+                       ObserveRegistry &obsReg, int shard = -1)
         : stats(st), underlying(ks), mutationLog(log), _remaining(0), intxn(false),
-        observeRegistry(obsReg) {}
+        observeRegistry(obsReg), shardId(shard), segmentStart(0), writeTime(0) {}
 
     /**
      * Call this whenever entering a transaction.
@@ -355,11 +362,27 @@ public:
     }
 
     /**
-     * Set the current number of updates permitted per transaction.
+     * Set the number of updates permitted per transaction (the most
+     * permitted when sizing adaptively).
      */
     void setTxnSize(int to) {
-        txnSize.set(to);
-        underlying->processTxnSizeChange(to);
+        maxTxnSize.set(to);
+        resize(to);
+    }
+
+    /**
+     * Size transactions so that writing and committing one takes
+     * about the given time, from the write and commit times of the
+     * ones before it.
+     *
+     * @param minSize the fewest updates a transaction is sized to
+     * @param target the time to aim for, or 0 to always permit the
+     *               number set with setTxnSize()
+     */
+    void setAdaptiveSizing(int minSize, hrtime_t target) {
+        minTxnSize.set(minSize);
+        targetLatency.set(target);
+        resize(maxTxnSize.get());
     }
 
     void addUncommittedItem(const queued_item &item);
@@ -373,16 +396,55 @@ public:
     }
 
 private:
+    void resize(int to) {
+        txnSize.set(to);
+        underlying->processTxnSizeChange(to);
+    }
+
+    void adaptTxnSize(size_t written, hrtime_t took);
+
     EPStats     &stats;
     KVStore     *underlying;
     MutationLog &mutationLog;
     int          _remaining;
     Atomic<int>  txnSize;
+    Atomic<int>  maxTxnSize;
+    Atomic<int>  minTxnSize;
+    Atomic<hrtime_t> targetLatency;
     Atomic<size_t> numUncommittedItems;
     bool         intxn;
     std::list<queued_item>     uncommittedItems;
     ObserveRegistry           &observeRegistry;
     std::list<PersistenceCallback*> transactionCallbacks;
+    int                        shardId;
+    //! When the flusher last started writing in the transaction.
+    hrtime_t                   segmentStart;
+    //! Time spent writing in the transaction so far (not committing).
+    hrtime_t                   writeTime;
+};
+
+/**
+ * A connection and thread of its own for writing one database shard,
+ * used by the flusher when flusher_shard_writers is on.
+ */
+class ShardWriter {
+public:
+    ShardWriter(EventuallyPersistentEngine &e, KVStore *kvs, size_t s,
+                MutationLog &log);
+
+    ~ShardWriter();
+
+    KVStore                 *underlying;
+    TransactionContext       tctx;
+    Dispatcher              *dispatcher;
+    //! The items to write on the current pass.
+    std::queue<queued_item>  items;
+    std::queue<queued_item>  rejects;
+    //! The age of the youngest item too young to write on the pass.
+    int                      oldest;
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(ShardWriter);
 };
 
 /**
@@ -415,6 +477,25 @@ private:
 
 class EventuallyPersistentEngine;
 
+/**
+ * The items collected for one flush, deduplicated and in the order
+ * they are to be written, along with what the flusher has to do
+ * with the underlying store before and after writing them.
+ */
+class FlushBatch {
+public:
+    FlushBatch() {}
+
+    std::vector<queued_item> items;
+    //! Vbucket states the underlying store has to be told about first.
+    std::vector<std::pair<uint16_t, vbucket_state_t> > vbStateChanges;
+    //! The checkpoint of each vbucket that is persisted once written.
+    std::map<uint16_t, uint64_t> checkpointIds;
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(FlushBatch);
+};
+
 /**
  * Manager of all interaction with the persistence.
  */
@@ -603,6 +684,41 @@ public:
         return roDispatcher;
     }
 
+    /**
+     * Get the number of dispatchers background fetches are spread
+     * over (the read-only one included).
+     */
+    size_t getNumBGFetchDispatchers() {
+        return bgFetchDispatchers.size();
+    }
+
+    /**
+     * Get the dispatcher doing the background fetches of a vbucket.
+     */
+    Dispatcher* getBGFetchDispatcher(uint16_t vbid) {
+        return bgFetchDispatchers[vbid % bgFetchDispatchers.size()];
+    }
+
+    /**
+     * Get the store the background fetches of a vbucket read from
+     * (only to be used from its getBGFetchDispatcher()).
+     */
+    KVStore* getBGFetchUnderlying(uint16_t vbid) {
+        return bgFetchUnderlying[vbid % bgFetchUnderlying.size()];
+    }
+
+    /**
+     * Get the number of flusher threads writing a shard each (0
+     * unless flusher_shard_writers is on).
+     */
+    size_t getNumShardWriters() {
+        return shardWriters.size();
+    }
+
+    Dispatcher* getShardWriterDispatcher(size_t shard) {
+        return shardWriters[shard]->dispatcher;
+    }
+
     /**
      * True if the RW dispatcher and RO dispatcher are distinct.
      */
@@ -643,21 +759,24 @@ public:
                  const void *cookie);
 
     /**
-     * Complete a background fetch.
+     * Do the background fetches queued on a vbucket so far, reading
+     * them from disk in one batch.
      *
-     * @param key the key that was fetched
-     * @param vbucket the vbucket in which the key lived
+     * @param vb the vbucket the fetches were queued on
      * @param vbver the vbucket version
-     * @param rowid the rowid of the record within its shard
-     * @param cookie the cookie of the requestor
-     * @param init the timestamp of when the request came in
      */
-    void completeBGFetch(const std::string &key,
-                         uint16_t vbucket,
-                         uint16_t vbver,
-                         uint64_t rowid,
-                         const void *cookie,
-                         hrtime_t init);
+    void completeBGFetchBatch(RCPtr<VBucket> &vb, uint16_t vbver);
+
+    /**
+     * Complete a background fetch whose value was read from disk,
+     * waking everyone waiting for it.
+     *
+     * @param queuedOn the vbucket the fetch was queued on
+     * @param fetch the fetch, with what was found on disk
+     * @param start the timestamp of when its batch started loading
+     */
+    void completeBGFetch(RCPtr<VBucket> &queuedOn, VBucketBGFetchItem &fetch,
+                         hrtime_t start);
 
     RCPtr<VBucket> getVBucket(uint16_t vbid);
 
@@ -712,6 +831,25 @@ public:
 
     void setTxnSize(int to) {
         tctx.setTxnSize(to);
+        std::vector<ShardWriter*>::iterator it;
+        for (it = shardWriters.begin(); it != shardWriters.end(); ++it) {
+            (*it)->tctx.setTxnSize(to);
+        }
+    }
+
+    /**
+     * Apply the adaptive_txn_size, min_txn_size and txn_target_latency
+     * settings to the flusher's transactions.
+     */
+    void updateTxnSizing();
+
+    /**
+     * Apply the io_*_limit settings to the IO throttle.
+     */
+    void updateIOThrottle();
+
+    IOThrottle &getIOThrottle() {
+        return ioThrottle;
     }
 
     size_t getNumUncommittedItems() {
@@ -720,8 +858,21 @@ public:
 
     const Flusher* getFlusher();
 
-    bool getKeyStats(const std::string &key, uint16_t vbucket,
-                     key_stats &kstats);
+    /**
+     * Get the flusher to write what's dirty now rather than when it
+     * next gets around to it (for persistence waiters).
+     */
+    void wakeUpFlusher();
+
+    /**
+     * Get the stats of a key.  Under full eviction a key that isn't
+     * in memory is looked up on disk first.
+     *
+     * @return ENGINE_SUCCESS with kstats filled in, ENGINE_KEY_ENOENT,
+     *         or ENGINE_EWOULDBLOCK while the key is looked up
+     */
+    ENGINE_ERROR_CODE getKeyStats(const std::string &key, uint16_t vbucket,
+                                  const void *cookie, key_stats &kstats);
 
     bool getLocked(const std::string &key, uint16_t vbucket,
                    Callback<GetValue> &cb,
@@ -742,10 +893,17 @@ public:
                                 uint16_t vbucket,
                                 bool honorStates = true);
 
+    /**
+     * True if the given version of an item is in memory and waiting
+     * to be persisted, whatever the state of its vbucket.
+     */
+    bool isDirty(const std::string &key, uint16_t vbucket, uint64_t cas);
+
     ENGINE_ERROR_CODE unlockKey(const std::string &key,
                                 uint16_t vbucket,
                                 uint64_t cas,
-                                rel_time_t currentTime);
+                                rel_time_t currentTime,
+                                const void *cookie);
 
 
     KVStore* getRWUnderlying() {
@@ -762,7 +920,38 @@ public:
         return invalidItemDbPager;
     }
 
-    void deleteExpiredItems(std::list<std::pair<uint16_t, std::string> > &);
+    /**
+     * Delete the given items if they're expired, and drop the given
+     * keys that only stand in for keys that aren't on disk.
+     *
+     * @return the number of expired items deleted
+     */
+    size_t deleteExpiredItems(std::list<std::pair<uint16_t, std::string> > &);
+
+    /**
+     * Evict the given items from memory altogether (full eviction).
+     *
+     * Items that got dirty or locked since they were picked are
+     * skipped.
+     *
+     * @return the number of items evicted
+     */
+    size_t evictItems(std::list<std::pair<uint16_t, std::string> > &);
+
+    /**
+     * True if the item pager evicts whole items rather than values
+     * alone, and keys that aren't in memory are looked up on disk.
+     */
+    bool isFullEviction() const {
+        return fullEviction;
+    }
+
+    /**
+     * Start rebuilding the given vbucket's Bloom filter of keys on
+     * disk if it has none yet, or if it got so full that it lets
+     * through many more lookups than it was sized for.
+     */
+    void maintainBloomFilter(RCPtr<VBucket> &vb);
 
     /**
      * Get the memoized storage properties from the DB.kv
@@ -873,7 +1062,7 @@ private:
         }
 
         int bucket_num(0);
-        LockHolder lh = vb->ht.getLockedBucket(key, &bucket_num);
+        WriterLockHolder lh = vb->ht.getLockedBucket(key, &bucket_num);
         StoredValue *v = vb->ht.unlocked_find(key, bucket_num, true);
 
         if (v) {
@@ -883,21 +1072,80 @@ private:
     }
 
     std::queue<queued_item> *beginFlush();
-    void pushToOutgoingQueue();
+    void collectFlushBatch(FlushBatch &batch);
+    void pushToOutgoingQueue(std::vector<queued_item> &out);
+    void applyFlushBatch(FlushBatch &batch);
+    void scheduleFlushBatchCollector();
+    void updateFlusherTodo();
     void requeueRejectedItems(std::queue<queued_item> *rejects);
     void completeFlush(rel_time_t flush_start);
 
+    /**
+     * Collect the next batch for the flusher while it's writing the
+     * current one (see flusher_pipeline).
+     */
+    void prepareFlushBatch();
+
     void enqueueCommit();
     int flushSome(std::queue<queued_item> *q,
                   std::queue<queued_item> *rejectQueue);
+    int flushSomeSharded(std::queue<queued_item> *q,
+                         std::queue<queued_item> *rejectQueue);
+    void flushShard(ShardWriter &writer);
     int flushOne(std::queue<queued_item> *q,
                  std::queue<queued_item> *rejectQueue);
     int flushOneDeleteAll(void);
-    int flushOneDelOrSet(const queued_item &qi, std::queue<queued_item> *rejectQueue);
+    int flushOneMutation(const queued_item &qi, std::queue<queued_item> *rejectQueue,
+                         TransactionContext &txn, KVStore *underlying);
+    int flushOneDelOrSet(const queued_item &qi, std::queue<queued_item> *rejectQueue,
+                         TransactionContext &txn, KVStore *underlying);
 
     StoredValue *fetchValidValue(RCPtr<VBucket> vb, const std::string &key,
                                  int bucket_num, bool wantsDeleted=false);
 
+    /**
+     * Like fetchValidValue, for callers holding only a shared lock on
+     * the bucket.  An expired item can't be deleted under a shared
+     * lock, so it is reported through expired instead; the caller
+     * should release its lock and call expireValue.
+     */
+    StoredValue *peekValidValue(RCPtr<VBucket> vb, const std::string &key,
+                                int bucket_num, bool &expired,
+                                bool wantsDeleted=false);
+
+    /**
+     * Delete the given key if it has expired.  The bucket must not be
+     * locked by the caller.
+     */
+    void expireValue(RCPtr<VBucket> vb, const std::string &key);
+
+    /**
+     * In full eviction mode, start looking up on disk a key that
+     * isn't in memory at all.  The bucket must be locked by the
+     * caller.
+     *
+     * Once the lookup completes the item is in memory (or, with
+     * markMissing, a deleted item stands in for a key that doesn't
+     * exist) and the operation may be retried.
+     *
+     * @return true if a lookup was queued and the caller should
+     *         return ENGINE_EWOULDBLOCK
+     */
+    bool bgFetchMissingKey(RCPtr<VBucket> &vb, const std::string &key,
+                           int bucket_num, const void *cookie,
+                           bool markMissing = false);
+
+    /**
+     * Queue a background fetch on a vbucket (or join one of the same
+     * key), scheduling the task that fetches its batch if there isn't
+     * one pending yet.
+     *
+     * @param rowid the row id to fetch, or -1 to look the key up
+     */
+    void queueBGFetch(RCPtr<VBucket> &vb, uint16_t vbver,
+                      const std::string &key, uint64_t rowid,
+                      const void *cookie, bool markMissing);
+
     bool shouldPreemptFlush(size_t completed) {
         return (completed > 100
                 && bgFetchQueue > 0
@@ -911,7 +1159,9 @@ private:
     bool hasItemsForPersistence(void);
 
     friend class Flusher;
-    friend class BGFetchCallback;
+    friend class FlushBatchCollector;
+    friend class ShardFlushCallback;
+    friend class BGFetchBatchCallback;
     friend class VKeyStatBGFetchCallback;
     friend class TapBGFetchCallback;
     friend class TapConnection;
@@ -927,7 +1177,10 @@ private:
     StorageProperties          storageProperties;
     Dispatcher                *dispatcher;
     Dispatcher                *roDispatcher;
+    std::vector<KVStore*>      bgFetchUnderlying;
+    std::vector<Dispatcher*>   bgFetchDispatchers;
     Dispatcher                *nonIODispatcher;
+    shared_ptr<UnrefCheckpointRemover> unrefCheckpointRemover;
     Flusher                   *flusher;
     InvalidItemDbPager        *invalidItemDbPager;
     VBucketMap                 vbuckets;
@@ -940,14 +1193,40 @@ private:
     // by any other threads (because the flusher use it without
     // locking...
     std::queue<queued_item>    writing;
+    // Collecting items to flush (beginFlush() or a FlushBatchCollector)
+    // takes the lock, and so does flush_all.
+    Mutex                      flushCollectMutex;
     std::vector<queued_item>  *dbShardQueues;
+    std::vector<queued_item>   flushCollectItems;
+    std::vector<queued_item>   flushDedupedItems;
+    //! Items someone waits to see persisted, written first.
+    std::vector<queued_item>   flushPriorityItems;
+    QueuedItemDeduper          flushDeduper;
     std::map<uint16_t, vbucket_state_t> flusherCachedVbStates;
+    bool                       flusherPipeline;
+    bool                       flushBatchCollectorScheduled;
+    FlushBatch                *preparedFlushBatch;
+    hrtime_t                   flushWriteStart;
     pthread_t                  thread;
     Atomic<size_t>             bgFetchQueue;
+    IOThrottle                 ioThrottle;
     Atomic<bool>               diskFlushAll;
     TransactionContext         tctx;
+    // With flusher_shard_writers, the flusher hands the items of each
+    // shard to its writer and waits for them all on the sync object.
+    std::vector<ShardWriter*>  shardWriters;
+    SyncObject                 shardWritersSync;
+    size_t                     shardWritersBusy;
     Mutex                      vbsetMutex;
     uint32_t                   bgFetchDelay;
+    bool                       fullEviction;
+    bool                       bfilterEnabled;
+    size_t                     bfilterKeyCount;
+    double                     bfilterFpProb;
+    // The reader rebuilding the Bloom filters, if they get one apart
+    // from the background fetches.
+    KVStore                   *bfilterUnderlying;
+    Dispatcher                *bfilterDispatcher;
     uint64_t                  *persistenceCheckpointIds;
     // During restore we're bypassing the checkpoint lists with the
     // objects we're restoring, but we need them to be persisted.
@@ -227,6 +227,30 @@ extern "C" {
                 e->getConfiguration().setQueueAgeCap(v);
             } else if (strcmp(keyz, "max_txn_size") == 0) {
                 e->getConfiguration().setMaxTxnSize(v);
+            } else if (strcmp(keyz, "min_txn_size") == 0) {
+                e->getConfiguration().setMinTxnSize(v);
+            } else if (strcmp(keyz, "txn_target_latency") == 0) {
+                e->getConfiguration().setTxnTargetLatency(v);
+            } else if (strcmp(keyz, "adaptive_txn_size") == 0) {
+                if (strcmp(valz, "true") == 0) {
+                    e->getConfiguration().setAdaptiveTxnSize(true);
+                } else {
+                    e->getConfiguration().setAdaptiveTxnSize(false);
+                }
+            } else if (strcmp(keyz, "io_flusher_bytes_limit") == 0) {
+                e->getConfiguration().setIoFlusherBytesLimit(v);
+            } else if (strcmp(keyz, "io_flusher_ops_limit") == 0) {
+                e->getConfiguration().setIoFlusherOpsLimit(v);
+            } else if (strcmp(keyz, "io_deletion_ops_limit") == 0) {
+                e->getConfiguration().setIoDeletionOpsLimit(v);
+            } else if (strcmp(keyz, "io_backfill_bytes_limit") == 0) {
+                e->getConfiguration().setIoBackfillBytesLimit(v);
+            } else if (strcmp(keyz, "io_backfill_ops_limit") == 0) {
+                e->getConfiguration().setIoBackfillOpsLimit(v);
+            } else if (strcmp(keyz, "io_restore_bytes_limit") == 0) {
+                e->getConfiguration().setIoRestoreBytesLimit(v);
+            } else if (strcmp(keyz, "io_restore_ops_limit") == 0) {
+                e->getConfiguration().setIoRestoreOpsLimit(v);
             } else if (strcmp(keyz, "couch_vbucket_batch_count") == 0) {
                 e->getConfiguration().setCouchVbucketBatchCount(v);
             } else if (strcmp(keyz, "bg_fetch_delay") == 0) {
@@ -439,22 +463,25 @@ extern "C" {
         return rv;
     }
 
-    static protocol_binary_response_status unlockKey(EventuallyPersistentEngine *e,
-                                                     protocol_binary_request_header *request,
-                                                     const char **msg,
-                                                     size_t *)
+    static ENGINE_ERROR_CODE unlockKey(EventuallyPersistentEngine *e,
+                                       protocol_binary_request_header *request,
+                                       const void *cookie,
+                                       const char **msg,
+                                       size_t *,
+                                       protocol_binary_response_status *res)
     {
         protocol_binary_request_no_extras *req =
             (protocol_binary_request_no_extras*)request;
 
-        protocol_binary_response_status res = PROTOCOL_BINARY_RESPONSE_SUCCESS;
+        *res = PROTOCOL_BINARY_RESPONSE_SUCCESS;
         char keyz[256];
 
         // Read the key.
         int keylen = ntohs(req->message.header.request.keylen);
         if (keylen >= (int)sizeof(keyz)) {
             *msg = "Key is too large.";
-            return PROTOCOL_BINARY_RESPONSE_EINVAL;
+            *res = PROTOCOL_BINARY_RESPONSE_EINVAL;
+            return ENGINE_EINVAL;
         }
 
         memcpy(keyz, ((char*)request) + sizeof(req->message.header), keylen);
@@ -470,24 +497,28 @@ extern "C" {
         RememberingCallback<GetValue> getCb;
         uint64_t cas = ntohll(request->request.cas);
 
-        ENGINE_ERROR_CODE rv = e->unlockKey(key, vbucket, cas, ep_current_time());
+        ENGINE_ERROR_CODE rv = e->unlockKey(key, vbucket, cas, ep_current_time(),
+                                            cookie);
 
         if (rv == ENGINE_SUCCESS) {
             *msg = "UNLOCKED";
+        } else if (rv == ENGINE_EWOULDBLOCK) {
+            // need to look the key up on disk
+            return rv;
         } else if (rv == ENGINE_TMPFAIL){
             *msg =  "UNLOCK_ERROR";
-            res = PROTOCOL_BINARY_RESPONSE_ETMPFAIL;
+            *res = PROTOCOL_BINARY_RESPONSE_ETMPFAIL;
         } else {
             RCPtr<VBucket> vb = e->getVBucket(vbucket);
             if (!vb) {
                 *msg = "That's not my bucket.";
-                res =  PROTOCOL_BINARY_RESPONSE_NOT_MY_VBUCKET;
+                *res =  PROTOCOL_BINARY_RESPONSE_NOT_MY_VBUCKET;
             }
             *msg = "NOT_FOUND";
-            res =  PROTOCOL_BINARY_RESPONSE_KEY_ENOENT;
+            *res =  PROTOCOL_BINARY_RESPONSE_KEY_ENOENT;
         }
 
-        return res;
+        return rv;
     }
 
     static protocol_binary_response_status setParam(EventuallyPersistentEngine *e,
@@ -757,7 +788,11 @@ extern "C" {
             }
             break;
         case CMD_UNLOCK_KEY:
-            res = unlockKey(h, request, &msg, &msg_size);
+            rv = unlockKey(h, request, cookie, &msg, &msg_size, &res);
+            if (rv == ENGINE_EWOULDBLOCK) {
+                // we don't know the key is there yet
+                return rv;
+            }
             break;
         case CMD_OBSERVE:
             return observeCmd(h, request, cookie, response);
@@ -1061,8 +1096,18 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::initialize(const char* config) {
     // Start updating the variables from the config!
     HashTable::setDefaultNumBuckets(configuration.getHtSize());
     HashTable::setDefaultNumLocks(configuration.getHtLocks());
+    HashTable::setDefaultResizeStep(configuration.getHtResizeStep());
+    HashTable::setDefaultRWLocks(configuration.isHtRwlocks());
+    HashTable::setDefaultLockFreeReads(configuration.isHtLockfreeReads());
+    if (!HashTable::setDefaultLayout(configuration.getHtLayout().c_str())) {
+        getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                         "Unhandled hash table layout: %s",
+                         configuration.getHtLayout().c_str());
+    }
+    SlabAllocator::setEnabled(configuration.isSlabAlloc());
     StoredValue::setMaxDataSize(stats, configuration.getMaxSize());
     StoredValue::setMutationMemoryThreshold(configuration.getMutationMemThreshold());
+    StoredValue::setMaxInlineValueSize(configuration.getMaxInlineValueSize());
     std::string storedValType = configuration.getStoredValType();
     if (storedValType.length() > 0) {
         if (!HashTable::setDefaultStorageValueType(storedValType.c_str())) {
@@ -1411,6 +1456,15 @@ inline tap_event_t EventuallyPersistentEngine::doWalkTapQueue(const void *cookie
             connection->itemRevSeqno = htonl(it->getSeqno());
             *es = &connection->itemRevSeqno;
             *nes = sizeof(connection->itemRevSeqno);
+            if (connection->supportSeqno) {
+                uint64_t bySeqno = htonll(it->getBySeqno());
+                memcpy(connection->itemSeqnos, &connection->itemRevSeqno,
+                       sizeof(connection->itemRevSeqno));
+                memcpy(connection->itemSeqnos + sizeof(connection->itemRevSeqno),
+                       &bySeqno, sizeof(bySeqno));
+                *es = connection->itemSeqnos;
+                *nes = sizeof(connection->itemSeqnos);
+            }
         }
         break;
     case TAP_NOOP:
@@ -1503,6 +1557,7 @@ bool EventuallyPersistentEngine::createTapQueue(const void *cookie,
     uint64_t backfillAge = 0;
     std::vector<uint16_t> vbuckets;
     std::map<uint16_t, uint64_t> lastCheckpointIds;
+    std::map<uint16_t, uint64_t> resumeSeqnos;
 
     if (flags & TAP_CONNECT_FLAG_BACKFILL) { /* */
         if (nuserdata < sizeof(backfillAge)) {
@@ -1588,6 +1643,34 @@ bool EventuallyPersistentEngine::createTapQueue(const void *cookie,
         isClosedCheckpointOnly = closedCheckpointOnly > 0 ? true : false;
     }
 
+    if (flags & TAP_CONNECT_SEQNO) {
+        uint16_t nSeqnos = 0;
+        if (nuserdata >= sizeof(nSeqnos)) {
+            memcpy(&nSeqnos, ptr, sizeof(nSeqnos));
+            nuserdata -= sizeof(nSeqnos);
+            ptr += sizeof(nSeqnos);
+            nSeqnos = ntohs(nSeqnos);
+        }
+        if (nSeqnos > 0) {
+            if (nuserdata < ((sizeof(uint16_t) + sizeof(uint64_t)) * nSeqnos)) {
+                getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                             "# of seqnos not matched. Reject connection request from %s\n",
+                             name.c_str());
+                return false;
+            }
+            for (uint16_t j = 0; j < nSeqnos; ++j) {
+                uint16_t vbid;
+                uint64_t seqno;
+                memcpy(&vbid, ptr, sizeof(vbid));
+                ptr += sizeof(uint16_t);
+                memcpy(&seqno, ptr, sizeof(seqno));
+                ptr += sizeof(uint64_t);
+                resumeSeqnos[ntohs(vbid)] = ntohll(seqno);
+            }
+            nuserdata -= ((sizeof(uint16_t) + sizeof(uint64_t)) * nSeqnos);
+        }
+    }
+
     TapProducer *tp = dynamic_cast<TapProducer*>(tapConnMap->findByName(name));
     if (tp && tp->isConnected() && !tp->doDisconnect() && isRegisteredClient) {
         return false;
@@ -1600,7 +1683,7 @@ bool EventuallyPersistentEngine::createTapQueue(const void *cookie,
     tap->setRegisteredClient(isRegisteredClient);
     tap->setClosedCheckpointOnlyFlag(isClosedCheckpointOnly);
     tap->setVBucketFilter(vbuckets);
-    tap->registerTAPCursor(lastCheckpointIds);
+    tap->registerTAPCursor(lastCheckpointIds, resumeSeqnos);
     serverApi->cookie->store_engine_specific(cookie, tap);
     tapConnMap->notify();
     return true;
@@ -1992,8 +2075,8 @@ static void add_casted_stat(const char *k, const Histogram<T> &v,
 
 bool VBucketCountVisitor::visitBucket(RCPtr<VBucket> &vb) {
     ++numVbucket;
-    numItems += vb->ht.getNumItems();
-    nonResident += vb->ht.getNumNonResidentItems();
+    numItems += vb->getNumItems();
+    nonResident += vb->ht.getNumNonResidentItems() + vb->ht.getNumEvictedItems();
 
     if (desired_state != vbucket_state_dead) {
         htMemory += vb->ht.memorySize();
@@ -2102,6 +2185,8 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doEngineStats(const void *cookie,
                     add_stat, cookie);
     add_casted_stat("ep_commit_num", epstats.flusherCommits,
                     add_stat, cookie);
+    add_casted_stat("ep_txn_size", epstore->getTxnSize(),
+                    add_stat, cookie);
     add_casted_stat("ep_commit_time",
                     epstats.commit_time, add_stat, cookie);
     add_casted_stat("ep_commit_time_total",
@@ -2112,6 +2197,16 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doEngineStats(const void *cookie,
                     epstats.vbucketDeletionFail, add_stat, cookie);
     add_casted_stat("ep_flush_preempts",
                     epstats.flusherPreempts, add_stat, cookie);
+    add_casted_stat("ep_flush_prepared_batches",
+                    epstats.flusherPreparedBatches, add_stat, cookie);
+    add_casted_stat("ep_flush_priority_items",
+                    epstats.flusherPriorityItems, add_stat, cookie);
+    add_casted_stat("ep_persist_wait_p50",
+                    epstats.persistWaitHisto.percentile(0.5), add_stat, cookie);
+    add_casted_stat("ep_persist_wait_p90",
+                    epstats.persistWaitHisto.percentile(0.9), add_stat, cookie);
+    add_casted_stat("ep_persist_wait_p99",
+                    epstats.persistWaitHisto.percentile(0.99), add_stat, cookie);
     add_casted_stat("ep_flush_duration",
                     epstats.flushDuration, add_stat, cookie);
     add_casted_stat("ep_flush_duration_total",
@@ -2253,6 +2348,11 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doEngineStats(const void *cookie,
                     add_stat, cookie);
     add_casted_stat("ep_bg_fetched", epstats.bg_fetched, add_stat,
                     cookie);
+    add_casted_stat("ep_bg_key_lookups", epstats.bg_key_lookups, add_stat,
+                    cookie);
+    add_casted_stat("ep_bg_batches", epstats.bg_batches, add_stat, cookie);
+    add_casted_stat("ep_bg_fetches_coalesced", epstats.bg_fetches_coalesced,
+                    add_stat, cookie);
     add_casted_stat("ep_tap_bg_fetched", stats.numTapBGFetched, add_stat, cookie);
     add_casted_stat("ep_tap_bg_fetch_requeued", stats.numTapBGFetchRequeued,
                     add_stat, cookie);
@@ -2260,12 +2360,29 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doEngineStats(const void *cookie,
                     cookie);
     add_casted_stat("ep_num_expiry_pager_runs", epstats.expiryPagerRuns, add_stat,
                     cookie);
+    add_casted_stat("ep_eviction_candidates_scanned",
+                    epstats.evictionCandidatesScanned, add_stat, cookie);
+    size_t hits = epstats.residentGets - epstats.residentGetsAtPager;
+    size_t misses = epstats.nonResidentGets - epstats.nonResidentGetsAtPager;
+    add_casted_stat("ep_hit_ratio_after_eviction",
+                    hits + misses == 0 ? 0 : hits * 100 / (hits + misses),
+                    add_stat, cookie);
     add_casted_stat("ep_num_checkpoint_remover_runs", epstats.checkpointRemoverRuns,
                     add_stat, cookie);
+    add_casted_stat("ep_checkpoint_remover_wakeups", epstats.checkpointRemoverWakeups,
+                    add_stat, cookie);
     add_casted_stat("ep_items_rm_from_checkpoints", epstats.itemsRemovedFromCheckpoints,
                     add_stat, cookie);
+    add_casted_stat("ep_checkpoint_items_spilled", epstats.checkpointItemsSpilled,
+                    add_stat, cookie);
+    add_casted_stat("ep_checkpoint_spill_reads", epstats.checkpointSpillReads,
+                    add_stat, cookie);
+    add_casted_stat("ep_checkpoint_spill_size", epstats.checkpointSpillSize,
+                    add_stat, cookie);
     add_casted_stat("ep_num_value_ejects", epstats.numValueEjects, add_stat,
                     cookie);
+    add_casted_stat("ep_num_item_ejects", epstats.numItemEjects, add_stat,
+                    cookie);
     add_casted_stat("ep_num_eject_replicas", epstats.numReplicaEjects, add_stat,
                     cookie);
     add_casted_stat("ep_num_eject_failures", epstats.numFailedEjects, add_stat,
@@ -2416,6 +2533,9 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doMemoryStats(const void *cookie,
 
     std::map<std::string, size_t> allocator_stats;
     MemoryAllocatorStats::getAllocatorStats(allocator_stats);
+    if (SlabAllocator::isEnabled()) {
+        SlabAllocator::getStats(allocator_stats);
+    }
     std::map<std::string, size_t>::iterator it = allocator_stats.begin();
     for (; it != allocator_stats.end(); ++it) {
         add_casted_stat(it->first.c_str(), it->second, add_stat, cookie);
@@ -2492,6 +2612,25 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doHashStats(const void *cookie,
             add_casted_stat(buf, depthVisitor.size, add_stat, cookie);
             snprintf(buf, sizeof(buf), "vb_%d:resized", vbid);
             add_casted_stat(buf, vb->ht.getNumResizes(), add_stat, cookie);
+            snprintf(buf, sizeof(buf), "vb_%d:resizing", vbid);
+            add_casted_stat(buf, vb->ht.isResizing() ? "true" : "false",
+                            add_stat, cookie);
+            snprintf(buf, sizeof(buf), "vb_%d:resize_target", vbid);
+            add_casted_stat(buf, vb->ht.getResizeTarget(), add_stat, cookie);
+            snprintf(buf, sizeof(buf), "vb_%d:resize_progress", vbid);
+            add_casted_stat(buf, vb->ht.getResizeProgress(), add_stat, cookie);
+            snprintf(buf, sizeof(buf), "vb_%d:migrated_buckets", vbid);
+            add_casted_stat(buf, vb->ht.getNumMigratedBuckets(), add_stat, cookie);
+            snprintf(buf, sizeof(buf), "vb_%d:fg_migrated_buckets", vbid);
+            add_casted_stat(buf, vb->ht.getNumForegroundMigrations(),
+                            add_stat, cookie);
+            if (vb->ht.usesLockFreeReads()) {
+                snprintf(buf, sizeof(buf), "vb_%d:lockfree_fallbacks", vbid);
+                add_casted_stat(buf, vb->ht.getNumLockFreeFallbacks(),
+                                add_stat, cookie);
+            }
+            snprintf(buf, sizeof(buf), "vb_%d:expiry_index_size", vbid);
+            add_casted_stat(buf, vb->ht.getExpiryIndexSize(), add_stat, cookie);
             snprintf(buf, sizeof(buf), "vb_%d:mem_size", vbid);
             add_casted_stat(buf, vb->ht.memSize, add_stat, cookie);
             snprintf(buf, sizeof(buf), "vb_%d:mem_size_counted", vbid);
@@ -2537,9 +2676,14 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doCheckpointStats(const void *cook
             add_casted_stat(buf, vb->checkpointManager.getNumItems(), add_stat, cookie);
             snprintf(buf, sizeof(buf), "vb_%d:num_checkpoints", vbid);
             add_casted_stat(buf, vb->checkpointManager.getNumCheckpoints(), add_stat, cookie);
+            snprintf(buf, sizeof(buf), "vb_%d:num_spilled_checkpoints", vbid);
+            add_casted_stat(buf, vb->checkpointManager.getNumSpilledCheckpoints(),
+                            add_stat, cookie);
             snprintf(buf, sizeof(buf), "vb_%d:num_items_for_persistence", vbid);
             add_casted_stat(buf, vb->checkpointManager.getNumItemsForPersistence(),
                             add_stat, cookie);
+            snprintf(buf, sizeof(buf), "vb_%d:high_seqno", vbid);
+            add_casted_stat(buf, vb->checkpointManager.getHighSeqno(), add_stat, cookie);
             std::list<std::string> tapcursor_names = vb->checkpointManager.getTAPCursorNames();
             std::list<std::string>::iterator tap_it = tapcursor_names.begin();
             for (;tap_it != tapcursor_names.end(); ++tap_it) {
@@ -2839,7 +2983,8 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doKeyStats(const void *cookie,
         return epstore->getFromUnderlying(key, vbid, cookie, cb);
     }
 
-    if (epstore->getKeyStats(key, vbid, kstats)) {
+    rv = epstore->getKeyStats(key, vbid, cookie, kstats);
+    if (rv == ENGINE_SUCCESS) {
         std::string valid("this_is_a_bug");
         if (validate) {
             if (kstats.dirty) {
@@ -2885,15 +3030,19 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doKeyStats(const void *cookie,
         if (validate) {
             add_casted_stat("key_valid", valid.c_str(), add_stat, cookie);
         }
-        rv = ENGINE_SUCCESS;
-    } else {
-        rv = ENGINE_KEY_ENOENT;
     }
 
     return rv;
 }
 
 
+ENGINE_ERROR_CODE EventuallyPersistentEngine::doTxnStats(const void *cookie,
+                                                        ADD_STAT add_stat) {
+    // Counts of updates, not times, so kept apart from the timings.
+    add_casted_stat("txn_size", stats.txnSizeHisto, add_stat, cookie);
+    return ENGINE_SUCCESS;
+}
+
 ENGINE_ERROR_CODE EventuallyPersistentEngine::doTimingStats(const void *cookie,
                                                             ADD_STAT add_stat) {
     add_casted_stat("bg_wait", stats.bgWaitHisto, add_stat, cookie);
@@ -2929,6 +3078,9 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doTimingStats(const void *cookie,
     add_casted_stat("disk_invalid_vbtable_del", stats.diskInvalidVBTableDelHisto,
                     add_stat, cookie);
     add_casted_stat("disk_commit", stats.diskCommitHisto, add_stat, cookie);
+    add_casted_stat("persistence_wait", stats.persistWaitHisto, add_stat, cookie);
+    add_casted_stat("flush_collect", stats.flushCollectHisto, add_stat, cookie);
+    add_casted_stat("flush_write", stats.flushWriteHisto, add_stat, cookie);
     add_casted_stat("disk_invalid_item_del", stats.diskInvaidItemDelHisto,
                     add_stat, cookie);
 
@@ -2996,6 +3148,25 @@ static void doDispatcherStat(const char *prefix, const DispatcherState &ds,
     showJobLog(prefix, "slow", ds.getSlowLog(), cookie, add_stat);
 }
 
+static void doIOBudgetStat(const char *name, const IOBudget &budget,
+                           const void *cookie, ADD_STAT add_stat) {
+    char statname[80] = {0};
+    snprintf(statname, sizeof(statname), "io_%s:bytes", name);
+    add_casted_stat(statname, budget.getBytes(), add_stat, cookie);
+    snprintf(statname, sizeof(statname), "io_%s:ops", name);
+    add_casted_stat(statname, budget.getOps(), add_stat, cookie);
+    snprintf(statname, sizeof(statname), "io_%s:bytes_limit", name);
+    add_casted_stat(statname, budget.getBytesLimit(), add_stat, cookie);
+    snprintf(statname, sizeof(statname), "io_%s:ops_limit", name);
+    add_casted_stat(statname, budget.getOpsLimit(), add_stat, cookie);
+    snprintf(statname, sizeof(statname), "io_%s:throttled", name);
+    add_casted_stat(statname, budget.getThrottled(), add_stat, cookie);
+    snprintf(statname, sizeof(statname), "io_%s:throttle_time", name);
+    add_casted_stat(statname, budget.getThrottleTime(), add_stat, cookie);
+    snprintf(statname, sizeof(statname), "io_%s:yielded", name);
+    add_casted_stat(statname, budget.getYielded(), add_stat, cookie);
+}
+
 ENGINE_ERROR_CODE EventuallyPersistentEngine::doDispatcherStats(const void *cookie,
                                                                 ADD_STAT add_stat) {
     DispatcherState ds(epstore->getDispatcher()->getDispatcherState());
@@ -3006,9 +3177,30 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doDispatcherStats(const void *cook
         doDispatcherStat("ro_dispatcher", rods, cookie, add_stat);
     }
 
+    for (size_t i = 0; i < epstore->getNumShardWriters(); ++i) {
+        std::stringstream prefix;
+        prefix << "shard_writer_" << i;
+        DispatcherState sws(epstore->getShardWriterDispatcher(i)->getDispatcherState());
+        doDispatcherStat(prefix.str().c_str(), sws, cookie, add_stat);
+    }
+
+    for (size_t i = 1; i < epstore->getNumBGFetchDispatchers(); ++i) {
+        std::stringstream prefix;
+        prefix << "bg_fetch_dispatcher_" << i;
+        DispatcherState bgs(epstore->getBGFetchDispatcher(i)->getDispatcherState());
+        doDispatcherStat(prefix.str().c_str(), bgs, cookie, add_stat);
+    }
+
     DispatcherState nds(epstore->getNonIODispatcher()->getDispatcherState());
     doDispatcherStat("nio_dispatcher", nds, cookie, add_stat);
 
+    IOThrottle &io = epstore->getIOThrottle();
+    for (int i = 0; i < io_num_classes; ++i) {
+        io_class_t cls = static_cast<io_class_t>(i);
+        doIOBudgetStat(IOThrottle::getClassName(cls), io.getBudget(cls),
+                       cookie, add_stat);
+    }
+
     return ENGINE_SUCCESS;
 }
 
@@ -3075,6 +3267,8 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::getStats(const void* cookie,
         rv = doKlogStats(cookie, add_stat);
     } else if (nkey == 7 && strncmp(stat_key, "timings", 7) == 0) {
         rv = doTimingStats(cookie, add_stat);
+    } else if (nkey == 4 && strncmp(stat_key, "txns", 4) == 0) {
+        rv = doTxnStats(cookie, add_stat);
     } else if (nkey == 10 && strncmp(stat_key, "dispatcher", 10) == 0) {
         rv = doDispatcherStats(cookie, add_stat);
     } else if (nkey == 6 && strncmp(stat_key, "memory", 6) == 0) {
@@ -3134,6 +3328,12 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::getStats(const void* cookie,
         rv = ENGINE_SUCCESS;
     } else if (nkey == 7 && strncmp(stat_key, "kvstore", 7) == 0) {
         getEpStore()->getROUnderlying()->addStats("ro", add_stat, cookie);
+        for (size_t i = 1; i < getEpStore()->getNumBGFetchDispatchers(); ++i) {
+            std::stringstream prefix;
+            prefix << "ro_" << i;
+            getEpStore()->getBGFetchUnderlying(i)->addStats(prefix.str(),
+                                                            add_stat, cookie);
+        }
         getEpStore()->getRWUnderlying()->addStats("rw", add_stat, cookie);
         rv = ENGINE_SUCCESS;
     }
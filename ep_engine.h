@@ -476,8 +476,9 @@ public:
     ENGINE_ERROR_CODE unlockKey(const std::string &key,
                                 uint16_t vbucket,
                                 uint64_t cas,
-                                rel_time_t currentTime) {
-        return epstore->unlockKey(key, vbucket, cas, currentTime);
+                                rel_time_t currentTime,
+                                const void *cookie) {
+        return epstore->unlockKey(key, vbucket, cas, currentTime, cookie);
     }
 
     ENGINE_ERROR_CODE observe(const void *cookie,
@@ -698,6 +699,7 @@ private:
     ENGINE_ERROR_CODE doTapAggStats(const void *cookie, ADD_STAT add_stat,
                                     const char *sep, size_t nsep);
     ENGINE_ERROR_CODE doTimingStats(const void *cookie, ADD_STAT add_stat);
+    ENGINE_ERROR_CODE doTxnStats(const void *cookie, ADD_STAT add_stat);
     ENGINE_ERROR_CODE doDispatcherStats(const void *cookie, ADD_STAT add_stat);
     ENGINE_ERROR_CODE doKeyStats(const void *cookie, ADD_STAT add_stat,
                                  uint16_t vbid, std::string &key, bool validate=false);
@@ -179,9 +179,13 @@ ENGINE_ERROR_CODE GetlExtension::executeUnl(int argc, token_t *argv, void *respo
     std::string k(argv[1].value, argv[1].length);
     RememberingCallback<GetValue> getCb;
 
-    ENGINE_ERROR_CODE rv = backend->unlockKey(k, 0, cas, serverApi->core->get_current_time());
+    ENGINE_ERROR_CODE rv = backend->unlockKey(k, 0, cas,
+                                              serverApi->core->get_current_time(),
+                                              response_cookie);
 
-    if (rv == ENGINE_SUCCESS) {
+    if (rv == ENGINE_EWOULDBLOCK) {
+        return rv;
+    } else if (rv == ENGINE_SUCCESS) {
         return response_handler(response_cookie,
                                 sizeof("UNLOCKED\r\n") -1, "UNLOCKED\r\n");
 
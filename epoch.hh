@@ -0,0 +1,162 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#ifndef EPOCH_HH
+#define EPOCH_HH 1
+
+#include <vector>
+#include <utility>
+
+#include "common.hh"
+#include "atomic.hh"
+#include "locks.hh"
+
+/**
+ * Deferred reclamation of memory that is read without locks.
+ *
+ * Lock-free readers bracket their accesses with enter() and exit()
+ * (see EpochGuard).  Writers unlink an object under their usual locks
+ * and hand it to retire() instead of freeing it; it is freed once no
+ * reader that could have seen it is left.
+ *
+ * Two epochs alternate.  Readers announce themselves in a counter of
+ * the current epoch (spread over a few slots so they don't all fight
+ * over one cache line) and retired objects are queued on the current
+ * epoch.  The epoch only moves on once the readers of the previous
+ * one are gone, at which point nothing queued on it is reachable.
+ */
+class EpochManager {
+public:
+
+    typedef void (*reclaimer_t)(void *);
+
+    /**
+     * @param batch number of retired objects queued before trying to
+     *              free them
+     */
+    EpochManager(size_t batch = 128) : epoch(0), retireBatch(batch) {}
+
+    ~EpochManager() {
+        // By now nobody may be reading anything we have queued.
+        reclaim(0);
+        reclaim(1);
+    }
+
+    /**
+     * Announce a reader.
+     *
+     * @param hint any number, used to spread readers over the slots
+     * @return a token to hand to exit()
+     */
+    size_t enter(size_t hint) {
+        size_t slot = hint % NUM_SLOTS;
+        while (true) {
+            int e = epoch.get();
+            ++readers[e][slot].count;
+            if (e == epoch.get()) {
+                return e * NUM_SLOTS + slot;
+            }
+            // The epoch moved on under us; join the new one instead.
+            --readers[e][slot].count;
+        }
+    }
+
+    /**
+     * Retract a reader announced by enter().
+     */
+    void exit(size_t token) {
+        --readers[token / NUM_SLOTS][token % NUM_SLOTS].count;
+    }
+
+    /**
+     * Free an object once lock-free readers can no longer see it.
+     *
+     * The object must already be unreachable for new readers.
+     */
+    void retire(void *p, reclaimer_t reclaimer) {
+        LockHolder lh(mutex);
+        limbo[epoch.get()].push_back(std::make_pair(p, reclaimer));
+        if (limbo[epoch.get()].size() >= retireBatch) {
+            advance();
+        }
+    }
+
+    /**
+     * Free whatever retired objects can be freed right now.
+     */
+    void tryReclaim() {
+        LockHolder lh(mutex);
+        advance();
+    }
+
+    /**
+     * Get the number of retired objects not freed yet.
+     */
+    size_t getNumRetired() {
+        LockHolder lh(mutex);
+        return limbo[0].size() + limbo[1].size();
+    }
+
+private:
+
+    static const size_t NUM_SLOTS = 8;
+
+    struct ReaderSlot {
+        Atomic<size_t> count;
+        char pad[64 - sizeof(Atomic<size_t>)];
+    };
+
+    size_t numReaders(int e) {
+        size_t rv = 0;
+        for (size_t i = 0; i < NUM_SLOTS; ++i) {
+            rv += readers[e][i].count.get();
+        }
+        return rv;
+    }
+
+    // Must hold mutex.
+    void advance() {
+        int prev = epoch.get() ^ 1;
+        if (numReaders(prev) != 0) {
+            return;
+        }
+        reclaim(prev);
+        if (!limbo[epoch.get()].empty()) {
+            epoch.set(prev);
+        }
+    }
+
+    void reclaim(int e) {
+        std::vector<std::pair<void*, reclaimer_t> >::iterator it;
+        for (it = limbo[e].begin(); it != limbo[e].end(); ++it) {
+            it->second(it->first);
+        }
+        limbo[e].clear();
+    }
+
+    ReaderSlot   readers[2][NUM_SLOTS];
+    Atomic<int>  epoch;
+    Mutex        mutex;
+    std::vector<std::pair<void*, reclaimer_t> > limbo[2];
+    size_t       retireBatch;
+
+    DISALLOW_COPY_AND_ASSIGN(EpochManager);
+};
+
+/**
+ * RAII registration of a lock-free reader with an EpochManager.
+ */
+class EpochGuard {
+public:
+    EpochGuard(EpochManager &m, size_t hint) : mgr(m), token(m.enter(hint)) {}
+
+    ~EpochGuard() {
+        mgr.exit(token);
+    }
+
+private:
+    EpochManager &mgr;
+    size_t        token;
+
+    DISALLOW_COPY_AND_ASSIGN(EpochGuard);
+};
+
+#endif /* EPOCH_HH */
@@ -0,0 +1,133 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#ifndef EXPIRY_INDEX_HH
+#define EXPIRY_INDEX_HH 1
+
+#include <map>
+#include <vector>
+
+#include "common.hh"
+#include "atomic.hh"
+#include "locks.hh"
+#include "stats.hh"
+
+// Number of separately locked parts of an expiry index.
+#define EXPIRY_INDEX_STRIPES 16
+
+/**
+ * The hashes of the keys of a hash table that carry an expiry time,
+ * bucketed by the second they expire in, so that expired items can be
+ * found without looking at the ones that aren't.
+ *
+ * Only the hash table's hash of each key is kept, and an entry isn't
+ * taken out when its item goes away or gets another expiry time; the
+ * hash table checks the items of the hashes that come due instead (see
+ * HashTable::popExpiredKeys()).  The index is split in stripes by hash,
+ * each with a lock of its own.  The memory it takes is counted as
+ * overhead in the stats.
+ */
+class ExpiryIndex {
+public:
+
+    ExpiryIndex(EPStats &st) : stats(st) {}
+
+    ~ExpiryIndex() {
+        clear();
+    }
+
+    /**
+     * Note that an item whose key has the given hash expires at the
+     * given time.  0 means it never expires, which adds nothing.
+     */
+    void add(int h, time_t exptime) {
+        if (exptime == 0) {
+            return;
+        }
+        Stripe &s = stripes[static_cast<unsigned int>(h) % EXPIRY_INDEX_STRIPES];
+        LockHolder lh(s.mutex);
+        std::pair<time_map::iterator, bool> ins =
+            s.byTime.insert(std::make_pair(exptime, std::vector<int>()));
+        std::vector<int> &hashes = ins.first->second;
+        size_t oldCapacity = hashes.capacity();
+        hashes.push_back(h);
+        size_t bytes = (hashes.capacity() - oldCapacity) * sizeof(int);
+        if (ins.second) {
+            bytes += nodeSize;
+        }
+        ++numEntries;
+        stats.memOverhead.incr(bytes);
+    }
+
+    /**
+     * Take out the hashes noted to expire before the given time.  The
+     * same hash may show up more than once.
+     *
+     * @param now the time to take the hashes out as of
+     * @param out the hashes are added to it
+     * @return the number of hashes taken out
+     */
+    size_t popDue(time_t now, std::vector<int> &out) {
+        size_t n(0);
+        size_t bytes(0);
+        for (size_t i = 0; i < EXPIRY_INDEX_STRIPES; ++i) {
+            Stripe &s = stripes[i];
+            LockHolder lh(s.mutex);
+            time_map::iterator it;
+            while ((it = s.byTime.begin()) != s.byTime.end() && it->first < now) {
+                out.insert(out.end(), it->second.begin(), it->second.end());
+                n += it->second.size();
+                bytes += nodeSize + it->second.capacity() * sizeof(int);
+                s.byTime.erase(it);
+            }
+        }
+        numEntries.decr(n);
+        stats.memOverhead.decr(bytes);
+        return n;
+    }
+
+    /**
+     * Forget all the hashes.
+     */
+    void clear() {
+        size_t n(0);
+        size_t bytes(0);
+        for (size_t i = 0; i < EXPIRY_INDEX_STRIPES; ++i) {
+            Stripe &s = stripes[i];
+            LockHolder lh(s.mutex);
+            time_map::iterator it;
+            for (it = s.byTime.begin(); it != s.byTime.end(); ++it) {
+                n += it->second.size();
+                bytes += nodeSize + it->second.capacity() * sizeof(int);
+            }
+            s.byTime.clear();
+        }
+        numEntries.decr(n);
+        stats.memOverhead.decr(bytes);
+    }
+
+    /**
+     * Get the number of hashes waiting to come due.
+     */
+    size_t size() const {
+        return numEntries.get();
+    }
+
+private:
+    typedef std::map<time_t, std::vector<int> > time_map;
+
+    struct Stripe {
+        Mutex    mutex;
+        //! The hashes expiring in each second.
+        time_map byTime;
+    };
+
+    // A tree node holding a second's hashes; allocator overhead aside.
+    static const size_t nodeSize = sizeof(time_map::value_type) + 4 * sizeof(void*);
+
+    EPStats                                     &stats;
+    Stripe                                       stripes[EXPIRY_INDEX_STRIPES];
+    Atomic<size_t>                               numEntries;
+
+    DISALLOW_COPY_AND_ASSIGN(ExpiryIndex);
+};
+
+#endif /* EXPIRY_INDEX_HH */
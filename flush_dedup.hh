@@ -0,0 +1,121 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#ifndef FLUSH_DEDUP_HH
+#define FLUSH_DEDUP_HH 1
+
+#include <algorithm>
+#include <vector>
+
+#include "common.hh"
+#include "queueditem.hh"
+#include "stored-value.hh"
+
+/**
+ * Finds the last set or delete queued for each key of a vbucket, so
+ * that the flusher writes every key once.
+ *
+ * Keys are looked up in an open addressing table of item indexes, and
+ * the mutations kept are ordered by sorting their indexes rather than
+ * the items themselves (copying a queued_item is not cheap).  Both are
+ * kept from one call to the next, so deduplicating doesn't allocate
+ * once they have grown to the largest batch seen.
+ */
+class QueuedItemDeduper {
+public:
+
+    QueuedItemDeduper() {}
+
+    /**
+     * Append the last set or delete of each key in the given items to
+     * out, in the order of CompareQueuedItemsByVBAndRowId so they are
+     * written in the order they are laid out on disk.  Earlier
+     * mutations of the same keys are handed to onDuplicate, and any
+     * other operations are skipped.
+     *
+     * @param items the items queued for a single vbucket, oldest first
+     * @param out the distinct mutations are added to it
+     * @param onDuplicate called with each mutation that is superseded
+     * @return the number of duplicates found
+     */
+    template <typename T>
+    size_t dedup(const std::vector<queued_item> &items,
+                 std::vector<queued_item> &out, T &onDuplicate) {
+        size_t want(16);
+        while (want < items.size() * 2) {
+            want <<= 1;
+        }
+        if (slots.size() < want) {
+            slots.resize(want);
+        }
+        std::fill(slots.begin(), slots.begin() + want, Slot());
+        size_t mask(want - 1);
+
+        size_t dups(0);
+        for (size_t i = items.size(); i > 0; --i) {
+            const queued_item &qi = items[i - 1];
+            if (qi->getOperation() != queue_op_set &&
+                qi->getOperation() != queue_op_del) {
+                continue;
+            }
+            const std::string &key = qi->getKey();
+            uint64_t h = HashTable::hash64(key.data(), key.length());
+            uint32_t tag = static_cast<uint32_t>(h >> 32);
+            size_t pos = static_cast<size_t>(h) & mask;
+            bool found(false);
+            for (; slots[pos].ref != 0; pos = (pos + 1) & mask) {
+                if (slots[pos].tag == tag &&
+                    items[slots[pos].ref - 1]->getKey() == key) {
+                    found = true;
+                    break;
+                }
+            }
+            if (found) {
+                ++dups;
+                onDuplicate(*qi);
+            } else {
+                slots[pos].tag = tag;
+                slots[pos].ref = i;
+                kept.push_back(Kept(*qi, i - 1));
+            }
+        }
+
+        std::sort(kept.begin(), kept.end());
+        std::vector<Kept>::iterator it;
+        for (it = kept.begin(); it != kept.end(); ++it) {
+            out.push_back(items[it->index]);
+        }
+        kept.clear();
+        return dups;
+    }
+
+private:
+
+    // ref is one past the index of the item in the slot (0 is empty).
+    struct Slot {
+        Slot() : ref(0), tag(0) {}
+        size_t   ref;
+        uint32_t tag;
+    };
+
+    struct Kept {
+        Kept(const QueuedItem &qi, size_t i) :
+            rowid(qi.getRowId()), index(i), vbucket(qi.getVBucketId()) {}
+
+        bool operator <(const Kept &other) const {
+            if (vbucket != other.vbucket) {
+                return vbucket < other.vbucket;
+            }
+            return rowid == other.rowid ? index < other.index : rowid < other.rowid;
+        }
+
+        int64_t  rowid;
+        size_t   index;
+        uint16_t vbucket;
+    };
+
+    std::vector<Slot> slots;
+    std::vector<Kept> kept;
+
+    DISALLOW_COPY_AND_ASSIGN(QueuedItemDeduper);
+};
+
+#endif /* FLUSH_DEDUP_HH */
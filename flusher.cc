@@ -183,6 +183,14 @@ void Flusher::wake(void) {
     dispatcher->wake(task, &task);
 }
 
+void Flusher::hurry(void) {
+    hurried.set(true);
+    LockHolder lh(taskMutex);
+    if (task.get() && _state == running) {
+        dispatcher->wake(task, &task);
+    }
+}
+
 bool Flusher::step(Dispatcher &d, TaskId tid) {
     try {
         switch (_state) {
@@ -237,6 +245,11 @@ bool Flusher::step(Dispatcher &d, TaskId tid) {
             return false;
         case running:
             {
+                double throttled = store->getIOThrottle().admit(io_flusher);
+                if (throttled > 0) {
+                    d.snooze(tid, throttled);
+                    return true;
+                }
                 doFlush();
                 if (_state == running) {
                     double tosleep = computeMinSleepTime();
@@ -297,6 +310,10 @@ double Flusher::computeMinSleepTime() {
         return 0.0;
     }
 
+    if (hurried.cas(true, false)) {
+        return 0.0;
+    }
+
     if (flushRv + prevFlushRv == 0) {
         minSleepTime = std::min(minSleepTime * 2, 1.0);
     } else {
@@ -62,7 +62,7 @@ public:
         store(st), _state(initializing), dispatcher(d),
         flushRv(0), prevFlushRv(0), minSleepTime(0.1),
         flushQueue(NULL), rejectQueue(NULL), vbStateLoaded(false),
-        forceShutdownReceived(false) {
+        forceShutdownReceived(false), hurried(false) {
     }
 
     ~Flusher() {
@@ -89,6 +89,11 @@ public:
 
     void start(void);
     void wake(void);
+    /**
+     * Start the next flush as soon as possible, skipping the sleep
+     * after the current one if it's in the middle of one.
+     */
+    void hurry(void);
     bool step(Dispatcher&, TaskId);
 
     bool isVBStateLoaded() const {
@@ -131,6 +136,7 @@ private:
 
     Atomic<bool> vbStateLoaded;
     Atomic<bool> forceShutdownReceived;
+    Atomic<bool> hurried;
     hrtime_t     warmupStartTime;
 
     struct {
@@ -258,6 +258,32 @@ public:
         return std::accumulate(begin(), end(), 0, a);
     }
 
+    /**
+     * Estimate the value below which the given fraction of the
+     * samples fall, as the end of the bin that sample is in.
+     *
+     * @param fraction a fraction between 0 and 1 (0.99 for the 99th
+     *        percentile)
+     * @return the estimate, or 0 when there are no samples
+     */
+    T percentile(double fraction) {
+        size_t n = total();
+        if (n == 0) {
+            return 0;
+        }
+        size_t wanted = static_cast<size_t>(std::ceil(fraction * n));
+        wanted = std::max(wanted, static_cast<size_t>(1));
+        size_t seen = 0;
+        typename std::vector<HistogramBin<T>*>::iterator it;
+        for (it = bins.begin(); it != bins.end(); ++it) {
+            seen += (*it)->count();
+            if (seen >= wanted) {
+                return (*it)->end();
+            }
+        }
+        return bins.back()->end();
+    }
+
     /**
      * A HistogramBin iterator.
      */
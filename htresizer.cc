@@ -4,27 +4,47 @@
 
 #include "htresizer.hh"
 #include "ep.hh"
+#include "ep_engine.h"
 #include "stored-value.hh"
 
 static const double FREQUENCY(60.0);
 
 /**
- * Look at all the hash tables and make sure they're sized appropriately.
+ * Look at all the hash tables and make sure they're sized
+ * appropriately, and so are the Bloom filters of keys on disk.
  */
 class ResizingVisitor : public VBucketVisitor {
 public:
 
-    ResizingVisitor() { }
+    ResizingVisitor(EventuallyPersistentStore *s, bool f) :
+        store(s), checkFilters(f) { }
 
     bool visitBucket(RCPtr<VBucket> &vb) {
         vb->ht.resize();
+        // An incremental resize only sets up the new table.  Move the
+        // items over a step at a time so front-end operations only
+        // ever wait on the few locks covering the buckets being moved.
+        size_t step = vb->ht.getResizeStep();
+        while (vb->ht.isResizing() && vb->ht.migrateBuckets(step) > 0) {
+            // Keep going until done or until a visitor or another
+            // migrating thread gets in the way; front-end operations
+            // and the next run pick up from there.
+        }
+        if (checkFilters) {
+            store->maintainBloomFilter(vb);
+        }
         return false;
     }
 
+private:
+    EventuallyPersistentStore *store;
+    // Warmup rebuilds the filters itself once it's done.
+    bool checkFilters;
 };
 
 bool HashtableResizer::callback(Dispatcher &d, TaskId t) {
-    shared_ptr<ResizingVisitor> pv(new ResizingVisitor);
+    bool warm = store->getEPEngine().getEpStats().warmupComplete.get();
+    shared_ptr<ResizingVisitor> pv(new ResizingVisitor(store, warm));
     store->visit(pv, "Hashtable resizer", &d, Priority::ItemPagerPriority);
 
     d.snooze(t, FREQUENCY);
@@ -0,0 +1,95 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+
+#include "config.h"
+#include "io_throttle.hh"
+
+// How long to make way for background fetches before asking again.
+static const double BG_FETCH_YIELD_TIME = 0.01;
+
+// Background jobs still get to run after yielding this long in a row,
+// so that a steady stream of fetches doesn't stall them.
+static const hrtime_t MAX_YIELD_TIME = 1000000000;
+
+void IOBudget::setLimits(size_t bytesPerSec, size_t opsPerSec) {
+    LockHolder lh(mutex);
+    bytesLimit = bytesPerSec;
+    opsLimit = opsPerSec;
+    bytesCredit = static_cast<double>(bytesLimit);
+    opsCredit = static_cast<double>(opsLimit);
+}
+
+double IOBudget::settle(double &credit, size_t used, size_t limit,
+                        double elapsed) {
+    if (limit == 0) {
+        credit = 0;
+        return 0;
+    }
+    double cap = static_cast<double>(limit);
+    credit = std::min(credit + cap * elapsed, cap) - static_cast<double>(used);
+    return credit < 0 ? -credit / cap : 0;
+}
+
+double IOBudget::delay(hrtime_t now) {
+    LockHolder lh(mutex);
+    size_t b(bytes.get()), o(ops.get());
+    double elapsed = 0;
+    if (lastRefill != 0 && now > lastRefill) {
+        elapsed = static_cast<double>(now - lastRefill) / 1000000000.0;
+    }
+    lastRefill = now;
+
+    double wait = std::max(settle(bytesCredit, b - bytesSeen, bytesLimit, elapsed),
+                           settle(opsCredit, o - opsSeen, opsLimit, elapsed));
+    bytesSeen = b;
+    opsSeen = o;
+
+    if (wait > 0) {
+        ++throttled;
+        throttleTime.incr(static_cast<size_t>(wait * 1000000));
+    }
+    return wait;
+}
+
+bool IOBudget::yield(hrtime_t now, bool fetching, hrtime_t maxYield) {
+    LockHolder lh(mutex);
+    if (!fetching) {
+        yieldStart = 0;
+        return false;
+    }
+    if (yieldStart == 0) {
+        yieldStart = now;
+    } else if (now - yieldStart > maxYield) {
+        yieldStart = 0;
+        return false;
+    }
+    ++yielded;
+    return true;
+}
+
+double IOThrottle::admit(io_class_t cls) {
+    assert(cls < io_num_classes);
+    IOBudget &budget = budgets[cls];
+    hrtime_t now = gethrtime();
+    // The flusher already stops for background fetches between items.
+    if (cls != io_flusher &&
+        budget.yield(now, pendingFetches.get() > 0, MAX_YIELD_TIME)) {
+        return BG_FETCH_YIELD_TIME;
+    }
+    return budget.delay(now);
+}
+
+const char *IOThrottle::getClassName(io_class_t cls) {
+    switch (cls) {
+    case io_flusher:
+        return "flusher";
+    case io_deletion:
+        return "deletion";
+    case io_backfill:
+        return "backfill";
+    case io_restore:
+        return "restore";
+    case io_num_classes:
+        break;
+    }
+    return "unknown";
+}
@@ -0,0 +1,147 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#ifndef IO_THROTTLE_HH
+#define IO_THROTTLE_HH 1
+
+#include "common.hh"
+#include "atomic.hh"
+#include "locks.hh"
+
+/**
+ * The kinds of background disk work sharing the IO throttle.
+ *
+ * Background fetches for client requests are not among them: they
+ * are never throttled, and the others make way for them.
+ */
+enum io_class_t {
+    io_flusher,         //!< Persisting dirty items
+    io_deletion,        //!< Removing vbuckets and invalid items from disk
+    io_backfill,        //!< Loading TAP backfills from disk
+    io_restore,         //!< Reading incremental restore files
+    io_num_classes
+};
+
+/**
+ * A token bucket of bytes and operations per second for one class of
+ * disk work.
+ *
+ * Work is charged once it's done, as its cost isn't always known up
+ * front, so the bucket may go into debt.  Whoever asks to do more
+ * then waits until the debt is paid back.  Unused budget is kept for
+ * up to a second, which bounds the bursts.
+ */
+class IOBudget {
+public:
+
+    IOBudget() : bytesLimit(0), opsLimit(0), bytesCredit(0), opsCredit(0),
+                 bytesSeen(0), opsSeen(0), lastRefill(0), yieldStart(0) {}
+
+    /**
+     * Set the budget, where 0 is unlimited.
+     */
+    void setLimits(size_t bytesPerSec, size_t opsPerSec);
+
+    /**
+     * Charge work done against the budget.
+     */
+    void consumed(size_t nbytes, size_t nops) {
+        bytes.incr(nbytes);
+        ops.incr(nops);
+    }
+
+    /**
+     * Get the number of seconds to wait before doing more work.
+     *
+     * @param now the current time
+     */
+    double delay(hrtime_t now);
+
+    /**
+     * Track how long this class has been making way for background
+     * fetches, and say whether it may keep doing so.
+     *
+     * @param now the current time
+     * @param fetching true if background fetches are pending
+     * @param maxYield the longest time to make way in a row (ns)
+     */
+    bool yield(hrtime_t now, bool fetching, hrtime_t maxYield);
+
+    size_t getBytesLimit() const { return bytesLimit; }
+    size_t getOpsLimit() const { return opsLimit; }
+    size_t getBytes() const { return bytes.get(); }
+    size_t getOps() const { return ops.get(); }
+    size_t getThrottled() const { return throttled.get(); }
+    size_t getThrottleTime() const { return throttleTime.get(); }
+    size_t getYielded() const { return yielded.get(); }
+
+private:
+
+    double settle(double &credit, size_t used, size_t limit, double elapsed);
+
+    Mutex          mutex;
+    size_t         bytesLimit;
+    size_t         opsLimit;
+    double         bytesCredit;
+    double         opsCredit;
+    size_t         bytesSeen;
+    size_t         opsSeen;
+    hrtime_t       lastRefill;
+    hrtime_t       yieldStart;
+
+    Atomic<size_t> bytes;
+    Atomic<size_t> ops;
+    Atomic<size_t> throttled;
+    Atomic<size_t> throttleTime;
+    Atomic<size_t> yielded;
+
+    DISALLOW_COPY_AND_ASSIGN(IOBudget);
+};
+
+/**
+ * Shares the disk between the background jobs of each io_class_t,
+ * within the bytes and operations per second configured for them,
+ * and lets them make way for background fetches.
+ */
+class IOThrottle {
+public:
+
+    /**
+     * Construct an IOThrottle.
+     *
+     * @param fetches the number of background fetches pending
+     */
+    IOThrottle(const Atomic<size_t> &fetches) : pendingFetches(fetches) {}
+
+    /**
+     * Ask to do a piece of work of the given class.
+     *
+     * @return 0 if it may go ahead, or else the number of seconds to
+     *         wait before asking again
+     */
+    double admit(io_class_t cls);
+
+    /**
+     * Charge work of the given class once it is done.
+     */
+    void consumed(io_class_t cls, size_t nbytes, size_t nops = 1) {
+        budgets[cls].consumed(nbytes, nops);
+    }
+
+    void setLimits(io_class_t cls, size_t bytesPerSec, size_t opsPerSec) {
+        budgets[cls].setLimits(bytesPerSec, opsPerSec);
+    }
+
+    const IOBudget &getBudget(io_class_t cls) const {
+        return budgets[cls];
+    }
+
+    static const char *getClassName(io_class_t cls);
+
+private:
+
+    const Atomic<size_t> &pendingFetches;
+    IOBudget              budgets[io_num_classes];
+
+    DISALLOW_COPY_AND_ASSIGN(IOThrottle);
+};
+
+#endif /* IO_THROTTLE_HH */
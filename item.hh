@@ -12,6 +12,7 @@
 #include "locks.hh"
 #include "atomic.hh"
 #include "objectregistry.hh"
+#include "slab.hh"
 #include "stats.hh"
 
 /**
@@ -32,7 +33,7 @@ public:
      */
     static Blob* New(const char *start, const size_t len) {
         size_t total_len = len + sizeof(Blob);
-        Blob *t = new (::operator new(total_len)) Blob(start, len);
+        Blob *t = new (SlabAllocator::allocate(total_len)) Blob(start, len);
         assert(t->length() == len);
         return t;
     }
@@ -57,7 +58,7 @@ public:
      */
     static Blob* New(const size_t len) {
         size_t total_len = len + sizeof(Blob);
-        Blob *t = new (::operator new(total_len)) Blob(len);
+        Blob *t = new (SlabAllocator::allocate(total_len)) Blob(len);
         assert(t->length() == len);
         return t;
     }
@@ -95,7 +96,7 @@ public:
     // This is necessary for making C++ happy when I'm doing a
     // placement new on fairly "normal" c++ heap allocations, just
     // with variable-sized objects.
-    void operator delete(void* p) { ::operator delete(p); }
+    void operator delete(void* p) { SlabAllocator::deallocate(p); }
 
     ~Blob() {
         ObjectRegistry::onDeleteBlob(this);
@@ -134,7 +135,7 @@ public:
     Item(const void* k, const size_t nk, const size_t nb,
          const uint32_t fl, const time_t exp, uint64_t theCas = 0,
          int64_t i = -1, uint16_t vbid = 0) :
-        cas(theCas), id(i), exptime(exp), flags(fl), seqno(1), vbucketId(vbid)
+        cas(theCas), bySeqno(0), id(i), exptime(exp), flags(fl), seqno(1), vbucketId(vbid)
     {
         key.assign(static_cast<const char*>(k), nk);
         assert(id != 0);
@@ -145,7 +146,7 @@ public:
     Item(const std::string &k, const uint32_t fl, const time_t exp,
          const void *dta, const size_t nb, uint64_t theCas = 0,
          int64_t i = -1, uint16_t vbid = 0) :
-        cas(theCas), id(i), exptime(exp), flags(fl), seqno(1), vbucketId(vbid)
+        cas(theCas), bySeqno(0), id(i), exptime(exp), flags(fl), seqno(1), vbucketId(vbid)
     {
         key.assign(k);
         assert(id != 0);
@@ -156,7 +157,7 @@ public:
     Item(const std::string &k, const uint32_t fl, const time_t exp,
          const value_t &val, uint64_t theCas = 0,  int64_t i = -1, uint16_t vbid = 0,
          uint32_t sno = 1) :
-         value(val), cas(theCas), id(i), exptime(exp), flags(fl), seqno(sno), vbucketId(vbid)
+         value(val), cas(theCas), bySeqno(0), id(i), exptime(exp), flags(fl), seqno(sno), vbucketId(vbid)
     {
         assert(id != 0);
         key.assign(k);
@@ -166,7 +167,7 @@ public:
     Item(const void *k, uint16_t nk, const uint32_t fl, const time_t exp,
          const void *dta, const size_t nb, uint64_t theCas = 0,
          int64_t i = -1, uint16_t vbid = 0) :
-        cas(theCas), id(i), exptime(exp), flags(fl), seqno(1), vbucketId(vbid)
+        cas(theCas), bySeqno(0), id(i), exptime(exp), flags(fl), seqno(1), vbucketId(vbid)
     {
         assert(id != 0);
         key.assign(static_cast<const char*>(k), nk);
@@ -293,6 +294,18 @@ public:
         seqno = to;
     }
 
+    /**
+     * The position of this mutation in its vbucket's change history,
+     * or 0 if not known.
+     */
+    uint64_t getBySeqno() const {
+        return bySeqno;
+    }
+
+    void setBySeqno(uint64_t to) {
+        bySeqno = to;
+    }
+
     static void encodeMeta(uint32_t seqno, uint64_t cas, uint32_t length,
                            uint32_t flags, std::string &dest)
     {
@@ -380,6 +393,7 @@ private:
     value_t value;
     std::string key;
     uint64_t cas;
+    uint64_t bySeqno;
     int64_t id;
     time_t exptime;
     uint32_t flags;
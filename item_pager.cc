@@ -2,7 +2,6 @@
 
 #include "config.h"
 #include <iostream>
-#include <cstdlib>
 #include <utility>
 #include <list>
 
@@ -14,8 +13,10 @@ static const double threshold = 75.0;
 static const size_t MAX_PERSISTENCE_QUEUE_SIZE = 1000000;
 
 /**
- * As part of the ItemPager, visit all of the objects in memory and
- * eject some within a constrained probability
+ * As part of the ItemPager, sweep the objects in memory like a clock
+ * hand and eject the ones that weren't used since the last sweep.
+ * Used objects get a second chance: their reference bit is cleared and
+ * they're passed over.  Expired objects it comes across are purged.
  */
 class PagingVisitor : public VBucketVisitor {
 public:
@@ -32,8 +33,9 @@ public:
      */
     PagingVisitor(EventuallyPersistentStore *s, EPStats &st, double pcnt,
                   bool *sfin, bool pause = false)
-        : store(s), stats(st), percent(pcnt), ejected(0),
-          startTime(ep_real_time()), stateFinalizer(sfin), canPause(pause) {}
+        : store(s), stats(st), percent(pcnt), ejected(0), toEject(0),
+          startTime(ep_real_time()), stateFinalizer(sfin), canPause(pause),
+          fullEviction(s->isFullEviction()) {}
 
     void visit(StoredValue *v) {
         // Remember expired objects -- we're going to delete them.
@@ -42,8 +44,36 @@ public:
             return;
         }
 
-        double r = static_cast<double>(std::rand()) / static_cast<double>(RAND_MAX);
-        if (percent >= r) {
+        // Clean deleted items only stand in for keys that aren't on
+        // disk; they're always dropped.
+        if (fullEviction && v->isDeleted()) {
+            if (v->isClean()) {
+                evicted.push_back(std::make_pair(currentBucket->getId(), v->getKey()));
+            }
+            return;
+        }
+
+        if (toEject == 0) {
+            return;
+        }
+
+        ++stats.evictionCandidatesScanned;
+        if (v->isReferenced()) {
+            v->clearReferenced();
+            return;
+        }
+
+        if (fullEviction) {
+            // Take the whole item out of memory.  Whether it's still
+            // clean and not in a checkpoint is checked again when it
+            // is actually evicted.
+            if (!v->isClean() || v->isLocked(ep_current_time())) {
+                ++stats.numFailedEjects;
+                return;
+            }
+            evicted.push_back(std::make_pair(currentBucket->getId(), v->getKey()));
+            --toEject;
+        } else {
             if (!v->eligibleForEviction()) {
                 ++stats.numFailedEjects;
                 return;
@@ -58,22 +88,39 @@ public:
                     ++stats.numReplicaEjects;
                 }
                 ++ejected;
+                --toEject;
             }
         }
     }
 
     bool visitBucket(RCPtr<VBucket> &vb) {
-         update();
-         return VBucketVisitor::visitBucket(vb);
+        update();
+        if (!VBucketVisitor::visitBucket(vb)) {
+            return false;
+        }
+        // Sweep from where the last run left this vbucket until enough
+        // unused objects were found, going round once at most.
+        toEject = static_cast<size_t>(percent *
+                                      static_cast<double>(vb->ht.getNumItems()));
+        if (toEject > 0) {
+            vb->ht.sweep(*this);
+        }
+        toEject = 0;
+        return false;
+    }
+
+    bool shouldContinue() {
+        return toEject > 0;
     }
 
     void update() {
-        stats.expired.incr(expired.size());
+        stats.expired.incr(store->deleteExpiredItems(expired));
 
-        store->deleteExpiredItems(expired);
+        ejected += store->evictItems(evicted);
 
         if (numEjected() > 0) {
             getLogger()->log(EXTENSION_LOG_INFO, NULL,
+                             fullEviction ? "Paged out %d items\n" :
                              "Paged out %d values\n", numEjected());
         }
 
@@ -83,6 +130,7 @@ public:
         }
         ejected = 0;
         expired.clear();
+        evicted.clear();
     }
 
     bool pauseVisitor() {
@@ -92,6 +140,8 @@ public:
 
     void complete() {
         update();
+        stats.residentGetsAtPager.set(stats.residentGets.get());
+        stats.nonResidentGetsAtPager.set(stats.nonResidentGets.get());
         if (stateFinalizer) {
             *stateFinalizer = true;
         }
@@ -104,14 +154,17 @@ public:
 
 private:
     std::list<std::pair<uint16_t, std::string> > expired;
+    std::list<std::pair<uint16_t, std::string> > evicted;
 
     EventuallyPersistentStore *store;
     EPStats                   &stats;
     double                     percent;
     size_t                     ejected;
+    size_t                     toEject;
     time_t                     startTime;
     bool                      *stateFinalizer;
     bool                       canPause;
+    bool                       fullEviction;
 };
 
 bool ItemPager::callback(Dispatcher &d, TaskId t) {
@@ -140,13 +193,69 @@ bool ItemPager::callback(Dispatcher &d, TaskId t) {
     return true;
 }
 
+/**
+ * As part of the ExpiredItemPager, purge the items of each vbucket that
+ * its expiry index says are due, without looking at any others.
+ */
+class ExpiryVisitor : public VBucketVisitor {
+public:
+
+    /**
+     * @param s the store that will handle the bulk removal
+     * @param st the stats where we'll track what we've done
+     * @param sfin pointer to a bool to be set to true after run completes
+     */
+    ExpiryVisitor(EventuallyPersistentStore *s, EPStats &st, bool *sfin)
+        : store(s), stats(st), startTime(ep_real_time()),
+          stateFinalizer(sfin), purged(0) {}
+
+    bool visitBucket(RCPtr<VBucket> &vb) {
+        if (VBucketVisitor::visitBucket(vb)) {
+            std::vector<std::string> keys;
+            if (vb->ht.popExpiredKeys(startTime, keys) > 0) {
+                std::list<std::pair<uint16_t, std::string> > due;
+                std::vector<std::string>::iterator it;
+                for (it = keys.begin(); it != keys.end(); ++it) {
+                    due.push_back(std::make_pair(vb->getId(), *it));
+                }
+                size_t n = store->deleteExpiredItems(due);
+                stats.expired.incr(n);
+                purged += n;
+            }
+        }
+        return false;
+    }
+
+    bool pauseVisitor() {
+        size_t queueSize = stats.queue_size.get() + stats.flusher_todo.get();
+        return queueSize >= MAX_PERSISTENCE_QUEUE_SIZE;
+    }
+
+    void complete() {
+        if (purged > 0) {
+            getLogger()->log(EXTENSION_LOG_INFO, NULL,
+                             "Purged %d expired items\n", purged);
+        }
+        if (stateFinalizer) {
+            *stateFinalizer = true;
+        }
+    }
+
+private:
+    EventuallyPersistentStore *store;
+    EPStats                   &stats;
+    time_t                     startTime;
+    bool                      *stateFinalizer;
+    size_t                     purged;
+};
+
 bool ExpiredItemPager::callback(Dispatcher &d, TaskId t) {
     if (available) {
         ++stats.expiryPagerRuns;
 
         available = false;
-        shared_ptr<PagingVisitor> pv(new PagingVisitor(store, stats,
-                                                       -1, &available, true));
+        shared_ptr<ExpiryVisitor> pv(new ExpiryVisitor(store, stats,
+                                                       &available));
         store->visit(pv, "Expired item remover", &d, Priority::ItemPagerPriority,
                      true, 10);
     }
@@ -191,10 +300,18 @@ bool InvalidItemDbPager::callback(Dispatcher &d, TaskId t) {
         return false;
     }
 
+    double throttled = store->getIOThrottle().admit(io_deletion);
+    if (throttled > 0) {
+        d.snooze(t, throttled);
+        return true;
+    }
+
     std::list<row_range_t>::iterator rit = it->second.begin();
     uint16_t vbid = it->first;
     uint16_t vb_version = vb_versions[vbid];
     if (store->getRWUnderlying()->delVBucket(vbid, vb_version, *rit)) {
+        store->getIOThrottle().consumed(io_deletion, 0,
+                                        static_cast<size_t>(rit->second - rit->first + 1));
         it->second.erase(rit);
         if (it->second.begin() == it->second.end()) {
             vb_row_ranges.erase(it);
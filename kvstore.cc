@@ -12,6 +12,34 @@
 #include "mc-kvstore/mc-kvstore.hh"
 #include "blackhole-kvstore/blackhole.hh"
 
+/**
+ * Passes on the items that changed after a sequence number, or whose
+ * sequence number isn't known.
+ */
+class ChangedSinceCallback : public Callback<GetValue> {
+public:
+    ChangedSinceCallback(uint64_t s, shared_ptr<Callback<GetValue> > c) :
+        since(s), cb(c) { }
+
+    void callback(GetValue &gv) {
+        Item *itm = gv.getValue();
+        if (itm && itm->getBySeqno() != 0 && itm->getBySeqno() <= since) {
+            delete itm;
+            return;
+        }
+        cb->callback(gv);
+    }
+
+private:
+    uint64_t since;
+    shared_ptr<Callback<GetValue> > cb;
+};
+
+void KVStore::dumpSince(uint16_t vbid, uint64_t since, shared_ptr<Callback<GetValue> > cb) {
+    shared_ptr<Callback<GetValue> > filter(new ChangedSinceCallback(since, cb));
+    dump(vbid, filter);
+}
+
 KVStore *KVStoreFactory::create(EventuallyPersistentEngine &theEngine) {
     Configuration &c = theEngine.getConfiguration();
 
@@ -5,6 +5,7 @@
 #include <map>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include <cstring>
 
@@ -30,6 +31,7 @@ typedef std::pair<int, int64_t> mutation_result;
 struct vbucket_state {
     vbucket_state_t state;
     uint64_t checkpointId;
+    uint64_t highSeqno;
 };
 
 /**
@@ -37,11 +39,34 @@ struct vbucket_state {
  *
  * key.first is the vbucket identifier.
  * key.second is the vbucket version
- * value is a pair of string representation of the vbucket state and
- * its latest checkpoint Id persisted.
+ * value is the vbucket state, its latest checkpoint Id persisted and
+ * the last sequence number given out when it was persisted.
  */
 typedef std::map<std::pair<uint16_t, uint16_t>, vbucket_state> vbucket_map_t;
 
+/**
+ * A key to get from disk as part of a batch (see KVStore::getMulti),
+ * and what was found for it.
+ *
+ * Whoever is waiting for it and how to finish the fetch come along
+ * for the ride; the KVStore only looks at the key and row id.
+ */
+class VBucketBGFetchItem {
+public:
+    VBucketBGFetchItem(const std::string &k, uint64_t r, const void *c,
+                       hrtime_t i, bool mm = false) :
+        key(k), rowid(r), cookies(1, c), initTime(i), markMissing(mm) {}
+
+    std::string key;
+    //! The row id to get, or -1 to look the key up.
+    uint64_t    rowid;
+    GetValue    value;
+    //! Everyone waiting for the key (see VBucket::queueBGFetch).
+    std::vector<const void*> cookies;
+    hrtime_t    initTime;
+    bool        markMissing;
+};
+
 /**
  * Properites of the storage layer.
  *
@@ -53,9 +78,10 @@ typedef std::map<std::pair<uint16_t, uint16_t>, vbucket_state> vbucket_map_t;
 class StorageProperties {
 public:
 
-    StorageProperties(size_t c, size_t r, size_t w, bool evb, bool evd)
+    StorageProperties(size_t c, size_t r, size_t w, bool evb, bool evd,
+                      bool egk = false)
         : maxc(c), maxr(r), maxw(w), efficientVBDump(evb),
-          efficientVBDeletion(evd) {}
+          efficientVBDeletion(evd), efficientGetByKey(egk) {}
 
     //! The maximum number of active queries.
     size_t maxConcurrency()   const { return maxc; }
@@ -67,6 +93,9 @@ public:
     bool hasEfficientVBDump() const { return efficientVBDump; }
     //! True if we can efficiently delete a vbucket all at once.
     bool hasEfficientVBDeletion() const { return efficientVBDeletion; }
+    //! True if get() can find an item by its key alone (no rowid),
+    //! metadata included.
+    bool hasEfficientGetByKey() const { return efficientGetByKey; }
 
 private:
     size_t maxc;
@@ -74,6 +103,7 @@ private:
     size_t maxw;
     bool efficientVBDump;
     bool efficientVBDeletion;
+    bool efficientGetByKey;
 };
 
 /**
@@ -119,6 +149,18 @@ public:
      */
     virtual bool begin() = 0;
 
+    /**
+     * Begin a transaction that only writes the given shard, so that
+     * other instances may write the other shards at the same time
+     * (see hasConcurrentShardWrites()).
+     *
+     * @return false if we cannot begin a transaction
+     */
+    virtual bool beginShard(size_t shard) {
+        (void)shard;
+        return begin();
+    }
+
     /**
      * Commit a transaction (unless not currently in one).
      *
@@ -149,6 +191,24 @@ public:
                      uint16_t vb, uint16_t vbver,
                      Callback<GetValue> &cb) = 0;
 
+    /**
+     * Get several items of a vbucket in one pass, setting the value
+     * of each fetch.  The fetches come sorted by row id.
+     *
+     * The default gets them one at a time.
+     */
+    virtual void getMulti(uint16_t vb, uint16_t vbver,
+                          std::vector<VBucketBGFetchItem*> &fetches) {
+        std::vector<VBucketBGFetchItem*>::iterator it;
+        for (it = fetches.begin(); it != fetches.end(); ++it) {
+            RememberingCallback<GetValue> gcb;
+            get((*it)->key, (*it)->rowid, vb, vbver, gcb);
+            gcb.waitForValue();
+            assert(gcb.fired);
+            (*it)->value = gcb.val;
+        }
+    }
+
     /**
      * Delete an item from the kv store.
      */
@@ -202,6 +262,15 @@ public:
      */
     virtual void dump(uint16_t vbid, shared_ptr<Callback<GetValue> > cb) = 0;
 
+    /**
+     * Pass the data stored for the given vbucket that changed after
+     * the given sequence number through the given callback, along with
+     * the data whose sequence number isn't known.
+     *
+     * The default filters what the full vbucket dump passes.
+     */
+    virtual void dumpSince(uint16_t vbid, uint64_t since, shared_ptr<Callback<GetValue> > cb);
+
     /**
      * Check if the kv-store supports a dumping all of the keys
      * @return true you may call dumpKeys() to do a prefetch
@@ -228,6 +297,14 @@ public:
         return 1;
     }
 
+    /**
+     * True if separate instances may write different shards at the
+     * same time, each in a transaction from beginShard().
+     */
+    virtual bool hasConcurrentShardWrites() {
+        return false;
+    }
+
     /**
      * get the shard ID for the given queued item.
      */
@@ -9,6 +9,7 @@
 
 #include "common.hh"
 #include "mutex.hh"
+#include "rwlock.hh"
 #include "syncobject.hh"
 
 /**
@@ -121,4 +122,82 @@ private:
     DISALLOW_COPY_AND_ASSIGN(MultiLockHolder);
 };
 
+/**
+ * RAII holder of the shared side of a reader/writer lock.
+ *
+ * Copying hands the lock over the same way LockHolder does.
+ */
+class ReaderLockHolder {
+public:
+    ReaderLockHolder(RWLock &l) : rwlock(l), locked(false) {
+        lock();
+    }
+
+    ReaderLockHolder(const ReaderLockHolder& from) : rwlock(from.rwlock),
+                                                     locked(from.locked) {
+        const_cast<ReaderLockHolder*>(&from)->locked = false;
+    }
+
+    ~ReaderLockHolder() {
+        unlock();
+    }
+
+    void lock() {
+        rwlock.readerLock();
+        locked = true;
+    }
+
+    void unlock() {
+        if (locked) {
+            locked = false;
+            rwlock.readerUnlock();
+        }
+    }
+
+private:
+    RWLock &rwlock;
+    bool locked;
+
+    void operator=(const ReaderLockHolder&);
+};
+
+/**
+ * RAII holder of the exclusive side of a reader/writer lock.
+ *
+ * Copying hands the lock over the same way LockHolder does.
+ */
+class WriterLockHolder {
+public:
+    WriterLockHolder(RWLock &l) : rwlock(l), locked(false) {
+        lock();
+    }
+
+    WriterLockHolder(const WriterLockHolder& from) : rwlock(from.rwlock),
+                                                     locked(from.locked) {
+        const_cast<WriterLockHolder*>(&from)->locked = false;
+    }
+
+    ~WriterLockHolder() {
+        unlock();
+    }
+
+    void lock() {
+        rwlock.writerLock();
+        locked = true;
+    }
+
+    void unlock() {
+        if (locked) {
+            locked = false;
+            rwlock.writerUnlock();
+        }
+    }
+
+private:
+    RWLock &rwlock;
+    bool locked;
+
+    void operator=(const WriterLockHolder&);
+};
+
 #endif /* LOCKS_H */
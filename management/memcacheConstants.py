@@ -126,6 +126,7 @@ TAP_FLAG_SUPPORT_ACK       = 0x10
 TAP_FLAG_REQUEST_KEYS_ONLY = 0x20
 TAP_FLAG_CHECKPOINT        = 0x40
 TAP_FLAG_REGISTERED_CLIENT = 0x80
+TAP_FLAG_SEQNO             = 0x100
 
 TAP_FLAG_TYPES = {TAP_FLAG_BACKFILL: ">Q",
                   TAP_FLAG_REGISTERED_CLIENT: ">B"}
@@ -76,6 +76,8 @@ class TapConnection(mc_bin_server.MemcachedBinaryChannel):
                                        opts[op]))
             elif op == memcacheConstants.TAP_FLAG_LIST_VBUCKETS:
                 val.append(self._encodeVBucketList(opts[op]))
+            elif op == memcacheConstants.TAP_FLAG_SEQNO:
+                val.append(self._encodeSeqnos(opts[op]))
             else:
                 val.append(opts[op])
         return struct.pack(">I", header), ''.join(val)
@@ -87,6 +89,12 @@ class TapConnection(mc_bin_server.MemcachedBinaryChannel):
             vals.append(struct.pack("!H", v))
         return ''.join(vals)
 
+    def _encodeSeqnos(self, seqnos):
+        vals = [struct.pack("!H", len(seqnos))]
+        for vb, seqno in seqnos.items():
+            vals.append(struct.pack("!HQ", vb, seqno))
+        return ''.join(vals)
+
     def processCommand(self, cmd, klen, vb, extralen, cas, data):
         extra = data[0:extralen]
         key = data[extralen:(extralen+klen)]
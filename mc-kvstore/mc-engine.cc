@@ -1147,6 +1147,57 @@ void MemcachedEngine::get(const std::string &key, uint16_t vb,
     wait();
 }
 
+/**
+ * Stores the value a pipelined get got into its fetch.
+ */
+class BGFetchItemCallback : public Callback<GetValue> {
+public:
+    BGFetchItemCallback(VBucketBGFetchItem *f) : fetch(f) {}
+
+    void callback(GetValue &value) {
+        fetch->value = value;
+    }
+
+private:
+    VBucketBGFetchItem *fetch;
+};
+
+void MemcachedEngine::getMulti(uint16_t vb,
+                               std::vector<VBucketBGFetchItem*> &fetches) {
+    // Send all the gets before waiting for any of the responses, so
+    // the batch costs a single round trip to couch.
+    std::vector<BGFetchItemCallback*> callbacks;
+    callbacks.reserve(fetches.size());
+    std::vector<VBucketBGFetchItem*>::iterator it;
+    for (it = fetches.begin(); it != fetches.end(); ++it) {
+        const std::string &key = (*it)->key;
+        protocol_binary_request_get req;
+        memset(req.bytes, 0, sizeof(req.bytes));
+        req.message.header.request.magic = PROTOCOL_BINARY_REQ;
+        req.message.header.request.opcode = PROTOCOL_BINARY_CMD_GET;
+        req.message.header.request.keylen = ntohs((uint16_t)key.length());
+        req.message.header.request.datatype = PROTOCOL_BINARY_RAW_BYTES;
+        req.message.header.request.vbucket = ntohs(vb);
+        req.message.header.request.bodylen = ntohl((uint32_t)key.length());
+        req.message.header.request.opaque = seqno;
+
+        sendIov[0].iov_base = (char*)req.bytes;
+        sendIov[0].iov_len = sizeof(req.bytes);
+        sendIov[1].iov_base = const_cast<char*>(key.c_str());
+        sendIov[1].iov_len = key.length();
+        numiovec = 2;
+        callbacks.push_back(new BGFetchItemCallback(*it));
+        sendCommand(new GetResponseHandler(seqno++, epStats, key, vb,
+                                           *callbacks.back()));
+    }
+    wait();
+
+    std::vector<BGFetchItemCallback*>::iterator cit;
+    for (cit = callbacks.begin(); cit != callbacks.end(); ++cit) {
+        delete *cit;
+    }
+}
+
 void MemcachedEngine::stats(const std::string &key,
                             Callback<std::map<std::string,
                             std::string> > &cb)
@@ -96,6 +96,7 @@ public:
     void flush(Callback<bool> &cb);
     void setmq(const Item &item, Callback<mutation_result> &cb);
     void get(const std::string &key, uint16_t vb, Callback<GetValue> &cb);
+    void getMulti(uint16_t vb, std::vector<VBucketBGFetchItem*> &fetches);
     void delq(const Item &itm, Callback<int> &cb);
     void stats(const std::string &key,
                Callback<std::map<std::string, std::string> > &cb);
@@ -64,6 +64,11 @@ void MCKVStore::get(const std::string &key, uint64_t, uint16_t vb, uint16_t,
     }
 }
 
+void MCKVStore::getMulti(uint16_t vb, uint16_t,
+                         std::vector<VBucketBGFetchItem*> &fetches) {
+    mc->getMulti(vb, fetches);
+}
+
 void MCKVStore::del(const Item &itm, uint64_t, uint16_t, Callback<int> &cb) {
 
     assert(intransaction);
@@ -115,6 +120,8 @@ vbucket_map_t MCKVStore::listPersistedVbuckets() {
         vb_state.state = VBucket::fromString(state.c_str());
         char *ptr = NULL;
         vb_state.checkpointId = strtoull(checkpoint_id.c_str(), &ptr, 10);
+        // Sequence numbers aren't stored by this backend.
+        vb_state.highSeqno = 0;
         rv[vb] = vb_state;
     }
 
@@ -173,7 +180,8 @@ void MCKVStore::dumpKeys(const std::vector<uint16_t> &vbids,  shared_ptr<Callbac
 
 StorageProperties MCKVStore::getStorageProperties() {
     size_t concurrency(10);
-    StorageProperties rv(concurrency, concurrency - 1, 1, true, true);
+    // GETs from couch don't return the expiry time or sequence number.
+    StorageProperties rv(concurrency, concurrency - 1, 1, true, true, false);
     return rv;
 }
 
@@ -238,9 +246,10 @@ void MCKVStore::optimizeWrites(std::vector<queued_item> &items) {
     if (items.empty()) {
         return;
     }
+    // The flusher hands the items over in row id order, but couch
+    // wants them in the ascending order of vbucket ids and keys.
     CompareQueuedItemsByVBAndKey cq;
-    // Make sure that the items are sorted in the ascending order of vbucket ids and keys.
-    assert(sorted(items.begin(), items.end(), cq));
+    std::sort(items.begin(), items.end(), cq);
 
     size_t pos = 0;
     uint16_t current_vbid = items[0]->getVBucketId();
@@ -84,6 +84,12 @@ public:
     void get(const std::string &key, uint64_t rowid,
              uint16_t vb, uint16_t vbver, Callback<GetValue> &cb);
 
+    /**
+     * Overrides getMulti().
+     */
+    void getMulti(uint16_t vb, uint16_t vbver,
+                  std::vector<VBucketBGFetchItem*> &fetches);
+
     /**
      * Overrides del().
      */
@@ -42,7 +42,13 @@ protocol_binary_response_status ObserveRegistry::observeKey(const std::string &k
     } else {
         obs_set = itr->second;
     }
-    return obs_set->add(key, cas, vbucket);
+    protocol_binary_response_status rv = obs_set->add(key, cas, vbucket);
+    rl.unlock();
+
+    if (rv == PROTOCOL_BINARY_RESPONSE_SUCCESS) {
+        addPersistenceWaiter(key, cas, vbucket, expiration);
+    }
+    return rv;
 }
 
 void ObserveRegistry::unobserveKey(const std::string &key,
@@ -58,6 +64,8 @@ void ObserveRegistry::unobserveKey(const std::string &key,
             itr->second->remove(key, cas, vbucket);
         }
     }
+    rl.unlock();
+    removePersistenceWaiter(key, vbucket);
 }
 
 void ObserveRegistry::removeExpired() {
@@ -68,6 +76,63 @@ void ObserveRegistry::removeExpired() {
             removeObserveSet(itr);
         }
     }
+    lh.unlock();
+
+    hrtime_t now = gethrtime();
+    LockHolder wlh(waiters_mutex);
+    waiter_map::iterator wit = persistenceWaiters.begin();
+    while (wit != persistenceWaiters.end()) {
+        if (wit->second.deadline < now) {
+            persistenceWaiters.erase(wit++);
+        } else {
+            ++wit;
+        }
+    }
+    numPersistenceWaiters.set(persistenceWaiters.size());
+}
+
+void ObserveRegistry::addPersistenceWaiter(const std::string &key,
+                                           const uint64_t cas,
+                                           const uint16_t vbucket,
+                                           const uint64_t expiration) {
+    if (!(*epstore)->isDirty(key, vbucket, cas)) {
+        // Nothing to wait for (VBObserveSet::add() saw the same).
+        return;
+    }
+
+    hrtime_t now = gethrtime();
+    persistence_waiter_t waiter(cas, now,
+                                now + expiration * ObserveSet::ONE_SECOND);
+    LockHolder lh(waiters_mutex);
+    std::pair<waiter_map::iterator, bool> res =
+        persistenceWaiters.insert(std::make_pair(std::make_pair(vbucket, key),
+                                                 waiter));
+    if (!res.second) {
+        // Keep the wait of the first observer, but for the newest cas.
+        res.first->second.cas = cas;
+        res.first->second.deadline = std::max(res.first->second.deadline,
+                                              waiter.deadline);
+    }
+    numPersistenceWaiters.set(persistenceWaiters.size());
+    lh.unlock();
+
+    (*epstore)->wakeUpFlusher();
+}
+
+void ObserveRegistry::removePersistenceWaiter(const std::string &key,
+                                              const uint16_t vbucket) {
+    LockHolder lh(waiters_mutex);
+    persistenceWaiters.erase(std::make_pair(vbucket, key));
+    numPersistenceWaiters.set(persistenceWaiters.size());
+}
+
+bool ObserveRegistry::isPersistenceAwaited(const QueuedItem &qi) {
+    if (!hasPersistenceWaiters()) {
+        return false;
+    }
+    LockHolder lh(waiters_mutex);
+    return persistenceWaiters.find(std::make_pair(qi.getVBucketId(), qi.getKey()))
+        != persistenceWaiters.end();
 }
 
 state_map* ObserveRegistry::getObserveSetState(const std::string &obs_set_name) {
@@ -83,9 +148,31 @@ state_map* ObserveRegistry::getObserveSetState(const std::string &obs_set_name)
 }
 
 void ObserveRegistry::itemsPersisted(std::list<queued_item> &itemlist) {
+    if (hasPersistenceWaiters()) {
+        // Whatever version of the key got persisted, observers of an
+        // older one aren't waiting any more (they see it mutated).
+        hrtime_t now = gethrtime();
+        LockHolder wlh(waiters_mutex);
+        std::list<queued_item>::iterator it;
+        for (it = itemlist.begin(); it != itemlist.end(); ++it) {
+            waiter_map::iterator wit =
+                persistenceWaiters.find(std::make_pair((*it)->getVBucketId(),
+                                                       (*it)->getKey()));
+            if (wit != persistenceWaiters.end()) {
+                stats->persistWaitHisto.add((now - wit->second.since) / 1000);
+                persistenceWaiters.erase(wit);
+            }
+        }
+        numPersistenceWaiters.set(persistenceWaiters.size());
+    }
+
     LockHolder lh(registry_mutex);
     std::list<queued_item>::iterator itr;
     for (itr = itemlist.begin(); itr != itemlist.end(); itr++) {
+        if ((*itr)->getOperation() == queue_op_del) {
+            // Its observers were told when it was deleted.
+            continue;
+        }
         std::map<std::string,ObserveSet*>::iterator obs_itr;
         for (obs_itr = registry.begin(); obs_itr != registry.end(); obs_itr++) {
             if (!obs_itr->second->isExpired()) {
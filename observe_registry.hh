@@ -49,6 +49,19 @@ typedef struct observed_key_t {
 
 typedef std::map<std::string, std::string> state_map;
 
+/**
+ * An observer waiting for a mutation to be persisted.
+ */
+typedef struct persistence_waiter_t {
+    persistence_waiter_t(uint64_t aCas, hrtime_t aSince, hrtime_t aDeadline)
+        : cas(aCas), since(aSince), deadline(aDeadline) {
+    }
+
+    uint64_t cas;
+    hrtime_t since;
+    hrtime_t deadline;
+} persistence_waiter_t;
+
 class ObserveSet;
 class VBObserveSet;
 class EventuallyPersistentStore;
@@ -61,6 +74,16 @@ public:
         : epstore(e), stats(stats_ptr) {
     }
 
+    /**
+     * True if an observer waits for this item to be persisted, in
+     * which case the flusher writes it ahead of everything else.
+     */
+    bool isPersistenceAwaited(const QueuedItem &qi);
+
+    bool hasPersistenceWaiters() const {
+        return numPersistenceWaiters.get() != 0;
+    }
+
     protocol_binary_response_status observeKey(const std::string &key,
                                                const uint64_t cas,
                                                const uint16_t vbucket,
@@ -88,10 +111,22 @@ private:
     ObserveSet* addObserveSet(const std::string &obs_set_name,
                               const uint16_t expiration);
 
+    void addPersistenceWaiter(const std::string &key, const uint64_t cas,
+                              const uint16_t vbucket, const uint64_t expiration);
+    void removePersistenceWaiter(const std::string &key, const uint16_t vbucket);
+
+    typedef std::map<std::pair<uint16_t, std::string>,
+                     persistence_waiter_t> waiter_map;
+
     std::map<std::string,ObserveSet*> registry;
     Mutex registry_mutex;
     EventuallyPersistentStore **epstore;
     EPStats *stats;
+    // Dirty items being observed, by vbucket and key.  Looked up by
+    // the flusher, so it has a lock of its own.
+    waiter_map persistenceWaiters;
+    Mutex waiters_mutex;
+    Atomic<size_t> numPersistenceWaiters;
 };
 
 class ObserveSet {
@@ -114,9 +149,10 @@ public:
 
     state_map* getState();
 
+    static const hrtime_t ONE_SECOND;
+
 private:
 
-    static const hrtime_t ONE_SECOND;
     const hrtime_t expiration;
     std::map<int, VBObserveSet* > observe_set;
     EventuallyPersistentStore **epstore;
@@ -21,6 +21,7 @@
 const Priority Priority::BgFetcherPriority("bg_fetcher_priority", 0);
 const Priority Priority::TapBgFetcherPriority("tap_bg_fetcher_priority", 1);
 const Priority Priority::VKeyStatBgFetcherPriority("vkey_stat_bg_fetcher_priority", 3);
+const Priority Priority::BloomFilterRebuilderPriority("bfilter_rebuilder_priority", 9);
 
 // Priorities for Read-Write dispatcher
 const Priority Priority::VBucketPersistHighPriority("vbucket_persist_high_priority", 1);
@@ -34,6 +35,7 @@ const Priority Priority::StatSnapPriority("statsnap_priority", 9);
 const Priority Priority::InvalidItemDbPagerPriority("invalid_item_db_pager_priority", 9);
 
 // Priorities for NON-IO dispatcher
+const Priority Priority::FlushBatchCollectorPriority("flush_batch_collector_priority", 5);
 const Priority Priority::CheckpointRemoverPriority("checkpoint_remover_priority", 6);
 const Priority Priority::ItemPagerPriority("item_pager_priority", 7);
 const Priority Priority::BackfillTaskPriority("backfill_task_priority", 8);
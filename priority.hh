@@ -15,6 +15,7 @@ public:
     static const Priority BgFetcherPriority;
     static const Priority TapBgFetcherPriority;
     static const Priority VKeyStatBgFetcherPriority;
+    static const Priority BloomFilterRebuilderPriority;
 
     // Priorities for Read-Write dispatcher
     static const Priority VBucketPersistHighPriority;
@@ -29,6 +30,7 @@ public:
 
     // Priorities for NON-IO dispatcher
     static const Priority CheckpointRemoverPriority;
+    static const Priority FlushBatchCollectorPriority;
     static const Priority ItemPagerPriority;
     static const Priority BackfillTaskPriority;
     static const Priority TapResumePriority;
@@ -56,6 +56,14 @@ public:
         ObjectRegistry::onDeleteQueuedItem(this);
     }
 
+    void *operator new(size_t n) {
+        return SlabAllocator::allocate(n);
+    }
+
+    void operator delete(void *p) {
+        SlabAllocator::deallocate(p);
+    }
+
     const std::string &getKey(void) const { return itm.getKey(); }
     uint16_t getVBucketId(void) const { return itm.getVBucketId(); }
     uint16_t getVBucketVersion(void) const { return vbucket_version; }
@@ -66,6 +74,7 @@ public:
     time_t getExpiryTime() const { return itm.getExptime(); }
     uint64_t getCas() const { return itm.getCas(); }
     uint32_t getSeqno() const { return itm.getSeqno(); }
+    uint64_t getBySeqno() const { return itm.getBySeqno(); }
     const value_t &getValue() const { return itm.getValue(); }
     Item &getItem() { return itm; }
 
@@ -140,7 +149,7 @@ public:
     CompareQueuedItemsByVBAndKey() {}
     bool operator()(const queued_item &i1, const queued_item &i2) {
         return i1->getVBucketId() == i2->getVBucketId()
-            ? i1->getKey() <= i2->getKey()
+            ? i1->getKey() < i2->getKey()
             : i1->getVBucketId() < i2->getVBucketId();
     }
 };
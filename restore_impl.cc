@@ -163,6 +163,7 @@ public:
         while ((rc = sqlite3_step(statement)) != SQLITE_DONE) {
             if (rc == SQLITE_ROW) {
                 processEntry();
+                throttle();
             } else if (rc == SQLITE_BUSY) {
                 ++busy;
             } else {
@@ -179,6 +180,21 @@ public:
 
 private:
 
+    /**
+     * Charge the row just read to the restore IO budget, and wait if
+     * the budget is used up.
+     */
+    void throttle() {
+        IOThrottle &io = store.getIOThrottle();
+        io.consumed(io_restore,
+                    sqlite3_column_bytes(statement, key_idx) +
+                    sqlite3_column_bytes(statement, val_idx));
+        double wait;
+        while ((wait = io.admit(io_restore)) > 0) {
+            usleep(static_cast<useconds_t>(wait * 1000000));
+        }
+    }
+
     /**
      * callback to process the current item
      */
@@ -0,0 +1,137 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#ifndef RWLOCK_HH
+#define RWLOCK_HH 1
+
+#include <stdexcept>
+#include <string>
+#include <pthread.h>
+#include <cerrno>
+#include <cstring>
+
+#include "common.hh"
+
+#if defined(HAVE_GCC_ATOMICS)
+#include "atomic/gcc_atomics.h"
+#elif defined(HAVE_ATOMIC_H)
+#include "atomic/libatomic.h"
+#else
+#error "Don't know how to use atomics on your target system!"
+#endif
+
+/**
+ * Abstraction built on top of pthread reader/writer locks.
+ *
+ * Readers share the lock unless readersShare is switched off, in
+ * which case readers take it exclusively just like writers do.
+ *
+ * The lock also keeps a sequence number that is bumped whenever a
+ * writer acquires or releases it, so code reading without the lock
+ * can tell whether a writer was around in the meantime.
+ */
+class RWLock {
+public:
+    RWLock() : writerSeqno(0), shared(true) {
+        pthread_rwlockattr_t attr;
+        int e;
+        if ((e = pthread_rwlockattr_init(&attr)) != 0) {
+            throwError("Failed to initialize rwlock attributes: ", e);
+        }
+#if defined(__GLIBC__)
+        // glibc prefers readers by default, which would let a steady
+        // stream of lookups starve out mutations on a busy stripe.
+        pthread_rwlockattr_setkind_np(&attr,
+                                      PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+        e = pthread_rwlock_init(&lock, &attr);
+        pthread_rwlockattr_destroy(&attr);
+        if (e != 0) {
+            throwError("Failed to initialize rwlock: ", e);
+        }
+    }
+
+    ~RWLock() {
+        int e;
+        if ((e = pthread_rwlock_destroy(&lock)) != 0) {
+            throwError("Failed to destroy rwlock: ", e);
+        }
+    }
+
+    /**
+     * Set whether readers may hold this lock concurrently.
+     *
+     * Only change this while nobody holds or waits for the lock.
+     */
+    void readersShare(bool to) {
+        shared = to;
+    }
+
+    /**
+     * True if readers may hold this lock concurrently.
+     */
+    bool readersShare() const {
+        return shared;
+    }
+
+    /**
+     * Get the writer sequence number.  It is odd while a writer holds
+     * the lock and changes every time one takes or releases it.
+     */
+    uint32_t getWriterSeqno() const {
+        return writerSeqno;
+    }
+
+protected:
+
+    // The holders of locks twiddle these.
+    friend class ReaderLockHolder;
+    friend class WriterLockHolder;
+
+    void readerLock() {
+        int e = shared ? pthread_rwlock_rdlock(&lock)
+                       : pthread_rwlock_wrlock(&lock);
+        if (e != 0) {
+            throwError("Failed to acquire read lock: ", e);
+        }
+    }
+
+    void readerUnlock() {
+        unlock();
+    }
+
+    void writerLock() {
+        int e;
+        if ((e = pthread_rwlock_wrlock(&lock)) != 0) {
+            throwError("Failed to acquire write lock: ", e);
+        }
+        ep_sync_add_and_fetch(&writerSeqno, 1);
+    }
+
+    void writerUnlock() {
+        ep_sync_add_and_fetch(&writerSeqno, 1);
+        unlock();
+    }
+
+private:
+
+    void unlock() {
+        int e;
+        if ((e = pthread_rwlock_unlock(&lock)) != 0) {
+            throwError("Failed to release lock: ", e);
+        }
+    }
+
+    static void throwError(const char *msg, int e) {
+        std::string message = "RWLOCK ERROR: ";
+        message.append(msg);
+        message.append(std::strerror(e));
+        throw std::runtime_error(message);
+    }
+
+    pthread_rwlock_t lock;
+    volatile uint32_t writerSeqno;
+    bool shared;
+
+    DISALLOW_COPY_AND_ASSIGN(RWLock);
+};
+
+#endif /* RWLOCK_HH */
@@ -69,6 +69,10 @@ int main(int, char **) {
     display("... Small data", sizeof(struct small_data));
     display("... Feature data", sizeof(struct feature_data));
     display("... Bodies Union", sizeof(union stored_value_bodies));
+    // Bytes per resident item besides its key and value bytes.
+    display("Item overhead (blob value)",
+            StoredValue::sizeOf(false) + sizeof(Blob) - 1);
+    display("Item overhead (inline value)", StoredValue::sizeOf(false));
 
     display("Stored Value Factory", sizeof(StoredValueFactory));
     display("Blob", sizeof(Blob));
@@ -0,0 +1,279 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#include "config.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include "slab.hh"
+#include "atomic.hh"
+#include "locks.hh"
+
+bool SlabAllocator::enabled = false;
+
+static const int SLAB_SHIFT = 16;
+static const size_t SLAB_SIZE = static_cast<size_t>(1) << SLAB_SHIFT;
+static const size_t CHUNK_ALIGN = 16;
+static const size_t MAX_CHUNK = 1024;
+static const int MAX_CLASSES = 32;
+
+// Chunks moved between a thread cache and the shared free list at once.
+static const size_t CACHE_BATCH = 32;
+
+// Slabs are found by address through a two level map from slab
+// number to size class (plus one; zero means not a slab).
+static const int ADDRESS_BITS = sizeof(void*) == 8 ? 48 : 32;
+static const int LEAF_BITS = 16;
+static const int ROOT_BITS = ADDRESS_BITS - SLAB_SHIFT - LEAF_BITS;
+
+static uint8_t *pageMap[1 << ROOT_BITS];
+static Mutex pageMapMutex;
+
+/**
+ * The shared part of a size class.
+ */
+struct SlabClass {
+    SlabClass() : chunkSize(0), freeList(NULL), numSlabs(0) {}
+
+    size_t         chunkSize;
+    Mutex          mutex;
+    void          *freeList;
+    size_t         numSlabs;
+    Atomic<size_t> numUsed;
+};
+
+static SlabClass classes[MAX_CLASSES];
+static int numClasses;
+// Size class of each request size, in CHUNK_ALIGN steps.
+static uint8_t classBySize[MAX_CHUNK / CHUNK_ALIGN + 1];
+
+/**
+ * A thread's free chunks of each size class.
+ */
+struct ThreadCache {
+    ThreadCache() {
+        std::memset(heads, 0, sizeof(heads));
+        std::memset(counts, 0, sizeof(counts));
+    }
+
+    void  *heads[MAX_CLASSES];
+    size_t counts[MAX_CLASSES];
+};
+
+static void *&nextChunk(void *chunk) {
+    return *static_cast<void**>(chunk);
+}
+
+// Give up to n chunks of the thread's list of class c back.  Must
+// hold the class lock.
+static void releaseChunks(ThreadCache *tc, int c, size_t n) {
+    SlabClass &sc = classes[c];
+    for (size_t i = 0; i < n && tc->heads[c]; ++i) {
+        void *chunk = tc->heads[c];
+        tc->heads[c] = nextChunk(chunk);
+        --tc->counts[c];
+        nextChunk(chunk) = sc.freeList;
+        sc.freeList = chunk;
+    }
+}
+
+extern "C" {
+    static void destroyThreadCache(void *p) {
+        ThreadCache *tc = static_cast<ThreadCache*>(p);
+        for (int c = 0; c < numClasses; ++c) {
+            LockHolder lh(classes[c].mutex);
+            releaseChunks(tc, c, tc->counts[c]);
+        }
+        delete tc;
+    }
+}
+
+static ThreadLocal<ThreadCache*> *threadCaches;
+
+class SlabInstaller {
+public:
+    SlabInstaller() {
+        // 16 byte steps up to 128, then about 25% apart.
+        size_t sz = CHUNK_ALIGN;
+        while (true) {
+            assert(numClasses < MAX_CLASSES);
+            classes[numClasses++].chunkSize = sz;
+            if (sz == MAX_CHUNK) {
+                break;
+            }
+            size_t next = sz < 128 ? sz + CHUNK_ALIGN : sz + sz / 4;
+            next = (next + CHUNK_ALIGN - 1) & ~(CHUNK_ALIGN - 1);
+            sz = std::min(next, MAX_CHUNK);
+        }
+        int c = 0;
+        for (size_t i = 0; i <= MAX_CHUNK / CHUNK_ALIGN; ++i) {
+            while (classes[c].chunkSize < i * CHUNK_ALIGN) {
+                ++c;
+            }
+            classBySize[i] = static_cast<uint8_t>(c);
+        }
+        threadCaches = new ThreadLocal<ThreadCache*>(destroyThreadCache);
+    }
+} slabInstaller;
+
+static ThreadCache *getThreadCache() {
+    ThreadCache *tc = threadCaches->get();
+    if (tc == NULL) {
+        tc = new ThreadCache();
+        threadCaches->set(tc);
+    }
+    return tc;
+}
+
+static int classOf(void *p) {
+    uintptr_t slab = reinterpret_cast<uintptr_t>(p) >> SLAB_SHIFT;
+    uintptr_t root = slab >> LEAF_BITS;
+    if (root >= (static_cast<uintptr_t>(1) << ROOT_BITS)) {
+        return -1;
+    }
+    uint8_t *leaf = pageMap[root];
+    if (leaf == NULL) {
+        return -1;
+    }
+    return static_cast<int>(leaf[slab & ((1 << LEAF_BITS) - 1)]) - 1;
+}
+
+static bool registerSlab(void *slab, int c) {
+    uintptr_t n = reinterpret_cast<uintptr_t>(slab) >> SLAB_SHIFT;
+    uintptr_t root = n >> LEAF_BITS;
+    if (root >= (static_cast<uintptr_t>(1) << ROOT_BITS)) {
+        return false;
+    }
+    LockHolder lh(pageMapMutex);
+    if (pageMap[root] == NULL) {
+        uint8_t *leaf = static_cast<uint8_t*>(calloc(1 << LEAF_BITS, 1));
+        if (leaf == NULL) {
+            return false;
+        }
+        ep_sync_synchronize();
+        pageMap[root] = leaf;
+    }
+    pageMap[root][n & ((1 << LEAF_BITS) - 1)] = static_cast<uint8_t>(c + 1);
+    return true;
+}
+
+// Must hold the class lock.
+static bool addSlab(int c) {
+    SlabClass &sc = classes[c];
+    void *slab = NULL;
+    if (posix_memalign(&slab, SLAB_SIZE, SLAB_SIZE) != 0) {
+        return false;
+    }
+    if (!registerSlab(slab, c)) {
+        free(slab);
+        return false;
+    }
+    char *base = static_cast<char*>(slab);
+    size_t nchunks = SLAB_SIZE / sc.chunkSize;
+    for (size_t i = nchunks; i > 0; --i) {
+        void *chunk = base + (i - 1) * sc.chunkSize;
+        nextChunk(chunk) = sc.freeList;
+        sc.freeList = chunk;
+    }
+    ++sc.numSlabs;
+    return true;
+}
+
+static void refill(ThreadCache *tc, int c) {
+    SlabClass &sc = classes[c];
+    LockHolder lh(sc.mutex);
+    if (sc.freeList == NULL && !addSlab(c)) {
+        return;
+    }
+    for (size_t i = 0; i < CACHE_BATCH && sc.freeList; ++i) {
+        void *chunk = sc.freeList;
+        sc.freeList = nextChunk(chunk);
+        nextChunk(chunk) = tc->heads[c];
+        tc->heads[c] = chunk;
+        ++tc->counts[c];
+    }
+}
+
+void *SlabAllocator::allocate(size_t n) {
+    if (!enabled || n == 0 || n > MAX_CHUNK) {
+        return ::operator new(n);
+    }
+    int c = classBySize[(n + CHUNK_ALIGN - 1) / CHUNK_ALIGN];
+    ThreadCache *tc = getThreadCache();
+    if (tc->heads[c] == NULL) {
+        refill(tc, c);
+        if (tc->heads[c] == NULL) {
+            return ::operator new(n);
+        }
+    }
+    void *rv = tc->heads[c];
+    tc->heads[c] = nextChunk(rv);
+    --tc->counts[c];
+    ++classes[c].numUsed;
+    return rv;
+}
+
+void SlabAllocator::deallocate(void *p) {
+    if (p == NULL) {
+        return;
+    }
+    int c = classOf(p);
+    if (c < 0) {
+        ::operator delete(p);
+        return;
+    }
+    ThreadCache *tc = getThreadCache();
+    nextChunk(p) = tc->heads[c];
+    tc->heads[c] = p;
+    ++tc->counts[c];
+    --classes[c].numUsed;
+    if (tc->counts[c] > 2 * CACHE_BATCH) {
+        LockHolder lh(classes[c].mutex);
+        releaseChunks(tc, c, CACHE_BATCH);
+    }
+}
+
+size_t SlabAllocator::getChunkSize(size_t n) {
+    if (!enabled || n == 0 || n > MAX_CHUNK) {
+        return n;
+    }
+    return classes[classBySize[(n + CHUNK_ALIGN - 1) / CHUNK_ALIGN]].chunkSize;
+}
+
+void SlabAllocator::setEnabled(bool to) {
+    enabled = to;
+}
+
+bool SlabAllocator::isEnabled() {
+    return enabled;
+}
+
+void SlabAllocator::getStats(std::map<std::string, size_t> &stats) {
+    size_t total(0), used(0);
+    for (int c = 0; c < numClasses; ++c) {
+        SlabClass &sc = classes[c];
+        size_t slabs;
+        {
+            LockHolder lh(sc.mutex);
+            slabs = sc.numSlabs;
+        }
+        if (slabs == 0) {
+            continue;
+        }
+        size_t chunks = sc.numUsed.get();
+        total += slabs * SLAB_SIZE;
+        used += chunks * sc.chunkSize;
+
+        char buf[64];
+        snprintf(buf, sizeof(buf), "ep_slab_%d:slabs", static_cast<int>(sc.chunkSize));
+        stats[buf] = slabs;
+        snprintf(buf, sizeof(buf), "ep_slab_%d:used_chunks", static_cast<int>(sc.chunkSize));
+        stats[buf] = chunks;
+    }
+    stats["ep_slab_total_bytes"] = total;
+    stats["ep_slab_used_bytes"] = used;
+    stats["ep_slab_free_bytes"] = total - used;
+}
@@ -0,0 +1,69 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#ifndef SLAB_HH
+#define SLAB_HH 1
+
+#include <map>
+#include <string>
+
+#include "common.hh"
+
+/**
+ * Size class allocator for the small objects the cache keeps lots of
+ * (stored values, blobs and queued items).
+ *
+ * Requests are rounded up to one of a few chunk sizes and carved out
+ * of 64KB slabs holding chunks of a single size, so a node with
+ * millions of items doesn't scatter them all over the heap.  Each
+ * thread keeps a small cache of free chunks per size class and only
+ * goes to the shared free lists (under a lock) in batches.
+ *
+ * Anything larger than the biggest chunk, and anything allocated
+ * while the allocator is disabled, comes from the regular heap.
+ * deallocate() tells the two apart by address, so the allocator may
+ * be switched on and off at any time.
+ *
+ * Slabs are never handed back to the system; their free chunks are
+ * reused for later allocations of the same size class.
+ */
+class SlabAllocator {
+public:
+
+    /**
+     * Allocate n bytes.
+     */
+    static void *allocate(size_t n);
+
+    /**
+     * Free memory obtained from allocate().
+     */
+    static void deallocate(void *p);
+
+    /**
+     * Get the number of bytes really set aside for an allocation of n
+     * bytes.
+     */
+    static size_t getChunkSize(size_t n);
+
+    /**
+     * Set whether new allocations come from slabs.
+     */
+    static void setEnabled(bool to);
+
+    /**
+     * True if new allocations come from slabs.
+     */
+    static bool isEnabled();
+
+    /**
+     * Get the occupancy of the slabs.
+     *
+     * Fills in the total, used and free bytes of all slabs and the
+     * number of slabs and used chunks of each size class in use.
+     */
+    static void getStats(std::map<std::string, size_t> &stats);
+
+private:
+    static bool enabled;
+};
+
+#endif /* SLAB_HH */
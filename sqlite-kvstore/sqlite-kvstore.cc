@@ -40,6 +40,7 @@ void StrategicSqlite3::insert(const Item &itm, uint16_t vb_version,
     ins_stmt->bind64(5, itm.getCas());
     ins_stmt->bind(6, itm.getVBucketId());
     ins_stmt->bind(7, vb_version);
+    ins_stmt->bind64(8, itm.getBySeqno());
 
     ++stats.io_num_write;
     stats.io_write_bytes += itm.getKey().length() + itm.getNBytes();
@@ -66,7 +67,8 @@ void StrategicSqlite3::update(const Item &itm, uint16_t vb_version,
     upd_stmt->bind(4, itm.getExptime());
     upd_stmt->bind64(5, itm.getCas());
     upd_stmt->bind(6, vb_version);
-    upd_stmt->bind64(7, itm.getId());
+    upd_stmt->bind64(7, itm.getBySeqno());
+    upd_stmt->bind64(8, itm.getId());
 
     int rv = upd_stmt->execute();
     ++stats.io_num_write;
@@ -88,6 +90,7 @@ vbucket_map_t StrategicSqlite3::listPersistedVbuckets() {
         vbucket_state vb_state;
         vb_state.state = (vbucket_state_t)st->column_int(2);
         vb_state.checkpointId = st->column_int64(3);
+        vb_state.highSeqno = st->column_int64(4);
         rv[vb] = vb_state;
     }
 
@@ -105,30 +108,53 @@ void StrategicSqlite3::set(const Item &itm, uint16_t vb_version,
     }
 }
 
-void StrategicSqlite3::get(const std::string &key, uint64_t rowid,
-                           uint16_t vb, uint16_t vbver, Callback<GetValue> &cb) {
-    PreparedStatement *sel_stmt = strategy->getStatements(vb, vbver, key)->sel();
-    sel_stmt->bind64(1, rowid);
+GetValue StrategicSqlite3::getRow(const std::string &key, uint64_t rowid,
+                                  uint16_t vb, uint16_t vbver) {
+    Statements *st = strategy->getStatements(vb, vbver, key);
+    PreparedStatement *sel_stmt;
+    if (rowid == static_cast<uint64_t>(-1)) {
+        // The item isn't in memory, so its row id isn't known.
+        sel_stmt = st->selByKey();
+        sel_stmt->bind(1, key);
+        sel_stmt->bind(2, vb);
+        sel_stmt->bind(3, vbver);
+    } else {
+        sel_stmt = st->sel();
+        sel_stmt->bind64(1, rowid);
+    }
 
     ++stats.io_num_read;
 
+    GetValue rv;
     if(sel_stmt->fetch()) {
-        GetValue rv(new Item(key.data(),
-                             static_cast<uint16_t>(key.length()),
-                             sel_stmt->column_int(1),
-                             sel_stmt->column_int(2),
-                             sel_stmt->column_blob(0),
-                             sel_stmt->column_bytes(0),
-                             sel_stmt->column_int64(3),
-                             sel_stmt->column_int64(4),
-                             static_cast<uint16_t>(sel_stmt->column_int(5))));
+        rv = GetValue(new Item(key.data(),
+                               static_cast<uint16_t>(key.length()),
+                               sel_stmt->column_int(1),
+                               sel_stmt->column_int(2),
+                               sel_stmt->column_blob(0),
+                               sel_stmt->column_bytes(0),
+                               sel_stmt->column_int64(3),
+                               sel_stmt->column_int64(4),
+                               static_cast<uint16_t>(sel_stmt->column_int(5))));
         stats.io_read_bytes += key.length() + rv.getValue()->getNBytes();
-        cb.callback(rv);
-    } else {
-        GetValue rv;
-        cb.callback(rv);
     }
     sel_stmt->reset();
+    return rv;
+}
+
+void StrategicSqlite3::get(const std::string &key, uint64_t rowid,
+                           uint16_t vb, uint16_t vbver, Callback<GetValue> &cb) {
+    GetValue rv(getRow(key, rowid, vb, vbver));
+    cb.callback(rv);
+}
+
+void StrategicSqlite3::getMulti(uint16_t vb, uint16_t vbver,
+                                std::vector<VBucketBGFetchItem*> &fetches) {
+    // In row id order the reads walk each table's b-tree forwards.
+    std::vector<VBucketBGFetchItem*>::iterator it;
+    for (it = fetches.begin(); it != fetches.end(); ++it) {
+        (*it)->value = getRow((*it)->key, (*it)->rowid, vb, vbver);
+    }
 }
 
 void StrategicSqlite3::reset() {
@@ -266,6 +292,7 @@ static void processDumpRow(EPStats &stats,
                 ENGINE_SUCCESS,
                 -1,
                 static_cast<uint16_t>(st->column_int(6)));
+    rv.getValue()->setBySeqno(st->column_int64(8));
     stats.io_read_bytes += rv.getValue()->getKey().length() + rv.getValue()->getNBytes();
     cb->callback(rv);
 }
@@ -299,6 +326,22 @@ void StrategicSqlite3::dump(uint16_t vb, shared_ptr<Callback<GetValue> > cb) {
     strategy->closeVBStatements(loaders);
 }
 
+void StrategicSqlite3::dumpSince(uint16_t vb, uint64_t since, shared_ptr<Callback<GetValue> > cb) {
+    assert(strategy->hasEfficientVBLoad());
+    std::vector<PreparedStatement*> loaders(strategy->getVBStatements(vb, select_since));
+
+    std::vector<PreparedStatement*>::iterator it;
+    for (it = loaders.begin(); it != loaders.end(); ++it) {
+        PreparedStatement *st = *it;
+        st->bind64(1, since);
+        while (st->fetch()) {
+            processDumpRow(stats, st, cb);
+        }
+    }
+
+    strategy->closeVBStatements(loaders);
+}
+
 
 static char lc(const char i) {
     return std::tolower(i);
@@ -331,6 +374,6 @@ StorageProperties StrategicSqlite3::getStorageProperties() {
     size_t concurrency(allows_concurrency ? 10 : 1);
     StorageProperties rv(concurrency, concurrency - 1, 1,
                          strategy->hasEfficientVBLoad(),
-                         strategy->hasEfficientVBDeletion());
+                         strategy->hasEfficientVBDeletion(), true);
     return rv;
 }
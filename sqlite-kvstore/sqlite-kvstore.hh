@@ -93,6 +93,22 @@ public:
         return intransaction;
     }
 
+    /**
+     * Overrides beginShard().
+     *
+     * The transaction is deferred, so it only locks the shard's file
+     * once it writes there.
+     */
+    bool beginShard(size_t shard) {
+        (void)shard;
+        if(!intransaction) {
+            if (execute("begin") != -1) {
+                intransaction = true;
+            }
+        }
+        return intransaction;
+    }
+
     /**
      * Commit a transaction (unless not currently in one).
      *
@@ -133,6 +149,12 @@ public:
     void get(const std::string &key, uint64_t rowid,
              uint16_t vb, uint16_t vbver, Callback<GetValue> &cb);
 
+    /**
+     * Overrides getMulti().
+     */
+    void getMulti(uint16_t vb, uint16_t vbver,
+                  std::vector<VBucketBGFetchItem*> &fetches);
+
     /**
      * Overrides del().
      */
@@ -162,10 +184,16 @@ public:
 
     void dump(uint16_t vb, shared_ptr<Callback<GetValue> > cb);
 
+    void dumpSince(uint16_t vb, uint64_t since, shared_ptr<Callback<GetValue> > cb);
+
     size_t getNumShards() {
         return strategy->getNumOfDbShards();
     }
 
+    bool hasConcurrentShardWrites() {
+        return strategy->getNumOfDbShards() > 1 && strategy->hasShardFiles();
+    }
+
     size_t getShardId(const QueuedItem &i) {
         return strategy->getDbShardId(i);
     }
@@ -179,6 +207,12 @@ public:
     }
 
 private:
+    /**
+     * Read one row by its row id (an empty GetValue if it's gone).
+     */
+    GetValue getRow(const std::string &key, uint64_t rowid,
+                    uint16_t vb, uint16_t vbver);
+
     /**
      * Shortcut to execute a simple query.
      *
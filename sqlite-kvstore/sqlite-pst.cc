@@ -56,7 +56,8 @@ int PreparedStatement::bind(int pos, std::pair<int, int> pv) {
 int PreparedStatement::bind(int pos, vbucket_state vb_state) {
     bind(pos, vb_state.state);
     bind64(++pos, vb_state.checkpointId);
-    return 2;
+    bind64(++pos, vb_state.highSeqno);
+    return 3;
 }
 
 int PreparedStatement::bind64(int pos, uint64_t v) {
@@ -147,8 +148,12 @@ void Statements::initStatements(const StatementFactory *sfact) {
     assert(upd_stmt);
     sel_stmt = sfact->mkSelect(db, tableName);
     assert(sel_stmt);
+    sel_key_stmt = sfact->mkSelectByKey(db, tableName);
+    assert(sel_key_stmt);
     all_stmt = sfact->mkSelectAll(db, tableName);
     assert(all_stmt);
+    since_stmt = sfact->mkSelectSince(db, tableName);
+    assert(since_stmt);
     del_stmt = sfact->mkDelete(db, tableName);
     assert(del_stmt);
     del_vb_stmt = sfact->mkDeleteVBucket(db, tableName);
@@ -159,8 +164,8 @@ PreparedStatement *StatementFactory::mkInsert(sqlite3 *db,
                                               const std::string &table) const {
     char buf[1024];
     snprintf(buf, sizeof(buf),
-             "insert into %s (k, v, flags, exptime, cas, vbucket, vb_version) "
-             "values(?, ?, ?, ?, ?, ?, ?)", table.c_str());
+             "insert into %s (k, v, flags, exptime, cas, vbucket, vb_version, by_seqno) "
+             "values(?, ?, ?, ?, ?, ?, ?, ?)", table.c_str());
     return new PreparedStatement(db, buf);
 }
 
@@ -169,8 +174,8 @@ PreparedStatement *StatementFactory::mkUpdate(sqlite3 *db,
     char buf[1024];
     // Note that vbucket IDs don't change here.
     snprintf(buf, sizeof(buf),
-             "update %s set k=?, v=?, flags=?, exptime=?, cas=?, vb_version=? "
-             " where rowid = ?", table.c_str());
+             "update %s set k=?, v=?, flags=?, exptime=?, cas=?, vb_version=?, "
+             "by_seqno=? where rowid = ?", table.c_str());
     return new PreparedStatement(db, buf);
 }
 
@@ -184,16 +189,41 @@ PreparedStatement *StatementFactory::mkSelect(sqlite3 *db,
     return new PreparedStatement(db, buf);
 }
 
+PreparedStatement *StatementFactory::mkSelectByKey(sqlite3 *db,
+                                                   const std::string &table) const {
+    char buf[1024];
+    // Same columns as mkSelect.  Rows of other versions of the vbucket
+    // are left over from deleting it.
+    snprintf(buf, sizeof(buf),
+             "select v, flags, exptime, cas, rowid, vbucket "
+             "from %s where k = ? and vbucket = ? and vb_version = ?",
+             table.c_str());
+    return new PreparedStatement(db, buf);
+}
+
 PreparedStatement *StatementFactory::mkSelectAll(sqlite3 *db,
                                                  const std::string &table) const {
     char buf[1024];
-    // k=0, v=1, flags=2, exptime=3, cas=4, vbucket=5, rowid=6
+    // k=0, v=1, flags=2, exptime=3, cas=4, vbucket=5, vb_version=6,
+    // rowid=7, by_seqno=8
     snprintf(buf, sizeof(buf),
-             "select k, v, flags, exptime, cas, vbucket, vb_version, rowid "
+             "select k, v, flags, exptime, cas, vbucket, vb_version, rowid, by_seqno "
              "from %s", table.c_str());
     return new PreparedStatement(db, buf);
 }
 
+PreparedStatement *StatementFactory::mkSelectSince(sqlite3 *db,
+                                                   const std::string &table) const {
+    char buf[1024];
+    // Same columns as mkSelectAll.  Rows without a sequence number are
+    // always selected, as they may have changed since.
+    snprintf(buf, sizeof(buf),
+             "select k, v, flags, exptime, cas, vbucket, vb_version, rowid, by_seqno "
+             "from %s where coalesce(by_seqno, 0) = 0 or by_seqno > ?",
+             table.c_str());
+    return new PreparedStatement(db, buf);
+}
+
 PreparedStatement *StatementFactory::mkDelete(sqlite3 *db,
                                               const std::string &table) const {
     char buf[1024];
@@ -206,8 +206,12 @@ public:
                                         const std::string &table) const;
     virtual PreparedStatement *mkSelect(sqlite3 *dbh,
                                         const std::string &table) const;
+    virtual PreparedStatement *mkSelectByKey(sqlite3 *dbh,
+                                             const std::string &table) const;
     virtual PreparedStatement *mkSelectAll(sqlite3 *dbh,
                                            const std::string &table) const;
+    virtual PreparedStatement *mkSelectSince(sqlite3 *dbh,
+                                             const std::string &table) const;
     virtual PreparedStatement *mkDelete(sqlite3 *dbh,
                                         const std::string &table) const;
     virtual PreparedStatement *mkDeleteVBucket(sqlite3 *dbh,
@@ -230,10 +234,13 @@ public:
         delete ins_stmt;
         delete upd_stmt;
         delete sel_stmt;
+        delete sel_key_stmt;
         delete del_stmt;
         delete del_vb_stmt;
         delete all_stmt;
-        ins_stmt = upd_stmt = sel_stmt = del_stmt = del_vb_stmt = all_stmt = NULL;
+        delete since_stmt;
+        ins_stmt = upd_stmt = sel_stmt = sel_key_stmt = del_stmt = del_vb_stmt = NULL;
+        all_stmt = since_stmt = NULL;
     }
 
     PreparedStatement *ins() {
@@ -248,6 +255,10 @@ public:
         return sel_stmt;
     }
 
+    PreparedStatement *selByKey() {
+        return sel_key_stmt;
+    }
+
     PreparedStatement *del() {
         return del_stmt;
     }
@@ -259,6 +270,10 @@ public:
     PreparedStatement *all() {
         return all_stmt;
     }
+
+    PreparedStatement *since() {
+        return since_stmt;
+    }
 private:
 
     void initStatements(const StatementFactory *sfact);
@@ -268,9 +283,11 @@ private:
     PreparedStatement *ins_stmt;
     PreparedStatement *upd_stmt;
     PreparedStatement *sel_stmt;
+    PreparedStatement *sel_key_stmt;
     PreparedStatement *del_stmt;
     PreparedStatement *del_vb_stmt;
     PreparedStatement *all_stmt;
+    PreparedStatement *since_stmt;
 
     DISALLOW_COPY_AND_ASSIGN(Statements);
 };
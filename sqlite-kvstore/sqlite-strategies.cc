@@ -9,7 +9,7 @@
 #include "ep.hh"
 #include "pathexpand.hh"
 
-static const int CURRENT_SCHEMA_VERSION(2);
+static const int CURRENT_SCHEMA_VERSION(3);
 
 bool SqliteStrategy::shouldCheckSchemaVersion = true;
 
@@ -48,6 +48,7 @@ void SqliteStrategy::initMetaTables() {
             "  vb_version integer,"
             "  state varchar(16),"
             "  checkpoint_id integer,"
+            "  high_seqno integer,"
             "  last_change datetime)");
 
     execute("create table if not exists stats_snap"
@@ -58,14 +59,15 @@ void SqliteStrategy::initMetaTables() {
 
 void SqliteStrategy::initMetaStatements(void) {
     const char *ins_query = "insert into vbucket_states"
-        " (vbid, vb_version, state, checkpoint_id, last_change)"
-        " values (?, ?, ?, ?, current_timestamp)";
+        " (vbid, vb_version, state, checkpoint_id, high_seqno, last_change)"
+        " values (?, ?, ?, ?, ?, current_timestamp)";
     ins_vb_stmt = new PreparedStatement(db, ins_query);
 
     const char *del_query = "delete from vbucket_states";
     clear_vb_stmt = new PreparedStatement(db, del_query);
 
-    const char *sel_query = "select vbid, vb_version, state, checkpoint_id from vbucket_states";
+    const char *sel_query = "select vbid, vb_version, state, checkpoint_id, high_seqno"
+        " from vbucket_states";
     sel_vb_stmt = new PreparedStatement(db, sel_query);
 
     const char *clear_stats_query = "delete from stats_snap";
@@ -157,6 +159,28 @@ void SqliteStrategy::execute(const char * const query) {
     st.execute();
 }
 
+// An index is named after its table, and lives in the same database.
+static std::string keyIndexName(const std::string &table) {
+    return table + "_k";
+}
+
+void SqliteStrategy::createKeyIndex(const std::string &table) {
+    std::string::size_type dot = table.find('.');
+    std::string unqualified(dot == std::string::npos ?
+                            table : table.substr(dot + 1));
+    char buf[1024];
+    snprintf(buf, sizeof(buf), "create index if not exists %s on %s (k)",
+             keyIndexName(table).c_str(), unqualified.c_str());
+    execute(buf);
+}
+
+void SqliteStrategy::dropKeyIndex(const std::string &table) {
+    char buf[1024];
+    snprintf(buf, sizeof(buf), "drop index if exists %s",
+             keyIndexName(table).c_str());
+    execute(buf);
+}
+
 // ----------------------------------------------------------------------
 
 void SingleTableSqliteStrategy::destroyStatements() {
@@ -176,7 +200,9 @@ void SingleTableSqliteStrategy::initTables(void) {
             "  flags integer,"
             "  exptime integer,"
             "  cas integer,"
+            "  by_seqno integer,"
             "  v text)");
+    createKeyIndex("kv");
 }
 
 void SingleTableSqliteStrategy::initStatements(void) {
@@ -238,8 +264,11 @@ void MultiDBSingleTableSqliteStrategy::initTables() {
                  "  flags integer,"
                  "  exptime integer,"
                  "  cas integer,"
+                 "  by_seqno integer,"
                  "  v text)", i);
         execute(buf);
+        snprintf(buf, sizeof(buf), "kv_%d.kv", i);
+        createKeyIndex(buf);
     }
 }
 
@@ -313,8 +342,11 @@ void MultiTableSqliteStrategy::initTables() {
                  "  flags integer,"
                  "  exptime integer,"
                  "  cas integer,"
+                 "  by_seqno integer,"
                  "  v text)", static_cast<int>(i));
         execute(buf);
+        snprintf(buf, sizeof(buf), "kv_%d", static_cast<int>(i));
+        createKeyIndex(buf);
     }
 }
 
@@ -365,6 +397,8 @@ void MultiTableSqliteStrategy::destroyInvalidTables(bool destroyOnlyOne) {
 void MultiTableSqliteStrategy::renameVBTable(uint16_t vbucket, const std::string &newName) {
     assert(db);
     char buf[1024];
+    snprintf(buf, sizeof(buf), "kv_%d", static_cast<int>(vbucket));
+    dropKeyIndex(buf);
     snprintf(buf, sizeof(buf),
              "alter table kv_%d rename to %s", static_cast<int>(vbucket), newName.c_str());
     execute(buf);
@@ -381,8 +415,11 @@ void MultiTableSqliteStrategy::createVBTable(uint16_t vbucket) {
              "  flags integer,"
              "  exptime integer,"
              "  cas integer,"
+             "  by_seqno integer,"
              "  v text)", static_cast<int>(vbucket));
     execute(buf);
+    snprintf(buf, sizeof(buf), "kv_%d", static_cast<int>(vbucket));
+    createKeyIndex(buf);
 }
 
 void MultiTableSqliteStrategy::destroyStatements() {
@@ -458,6 +495,9 @@ void ShardedMultiTableSqliteStrategy::renameVBTable(uint16_t vbucket, const std:
     assert(db);
     char buf[1024];
     for (size_t i = 0; i < shardCount; ++i) {
+        snprintf(buf, sizeof(buf), "kv_%d.kv_%d",
+                 static_cast<int>(i), static_cast<int>(vbucket));
+        dropKeyIndex(buf);
         snprintf(buf, sizeof(buf),
                  "alter table kv_%d.kv_%d rename to %s",
                  static_cast<int>(i), static_cast<int>(vbucket), newName.c_str());
@@ -477,8 +517,12 @@ void ShardedMultiTableSqliteStrategy::createVBTable(uint16_t vbucket) {
                  "  flags integer,"
                  "  exptime integer,"
                  "  cas integer,"
+                 "  by_seqno integer,"
                  "  v text)", static_cast<int>(i), static_cast<int>(vbucket));
         execute(buf);
+        snprintf(buf, sizeof(buf), "kv_%d.kv_%d",
+                 static_cast<int>(i), static_cast<int>(vbucket));
+        createKeyIndex(buf);
     }
 }
 
@@ -492,6 +536,9 @@ std::vector<PreparedStatement*> ShardedMultiTableSqliteStrategy::getVBStatements
         case select_all:
             rv.push_back(st.at(vb)->all());
             break;
+        case select_since:
+            rv.push_back(st.at(vb)->since());
+            break;
         case delete_vbucket:
             rv.push_back(st.at(vb)->del_vb());
             break;
@@ -528,9 +575,13 @@ void ShardedMultiTableSqliteStrategy::initTables() {
                      "  flags integer,"
                      "  exptime integer,"
                      "  cas integer,"
+                     "  by_seqno integer,"
                      "  v text)",
                      static_cast<int>(i), static_cast<int>(j));
             execute(buf);
+            snprintf(buf, sizeof(buf), "kv_%d.kv_%d",
+                     static_cast<int>(i), static_cast<int>(j));
+            createKeyIndex(buf);
         }
     }
 }
@@ -600,6 +651,10 @@ void ShardedByVBucketSqliteStrategy::destroyInvalidTables(bool destroyOnlyOne) {
 void ShardedByVBucketSqliteStrategy::renameVBTable(uint16_t vbucket, const std::string &newName) {
     assert(db);
     char buf[1024];
+    snprintf(buf, sizeof(buf), "kv_%d.kv_%d",
+             static_cast<int>(getShardForVBucket(static_cast<uint16_t>(vbucket))),
+             static_cast<int>(vbucket));
+    dropKeyIndex(buf);
     snprintf(buf, sizeof(buf),
              "alter table kv_%d.kv_%d rename to %s",
              static_cast<int>(getShardForVBucket(static_cast<uint16_t>(vbucket))),
@@ -619,10 +674,15 @@ void ShardedByVBucketSqliteStrategy::createVBTable(uint16_t vbucket) {
              "  flags integer,"
              "  exptime integer,"
              "  cas integer,"
+             "  by_seqno integer,"
              "  v text)",
              static_cast<int>(getShardForVBucket(static_cast<uint16_t>(vbucket))),
              static_cast<int>(vbucket));
     execute(buf);
+    snprintf(buf, sizeof(buf), "kv_%d.kv_%d",
+             static_cast<int>(getShardForVBucket(static_cast<uint16_t>(vbucket))),
+             static_cast<int>(vbucket));
+    createKeyIndex(buf);
 }
 
 void ShardedByVBucketSqliteStrategy::initDB() {
@@ -650,10 +710,15 @@ void ShardedByVBucketSqliteStrategy::initTables() {
                  "  flags integer,"
                  "  exptime integer,"
                  "  cas integer,"
+                 "  by_seqno integer,"
                  "  v text)",
                  static_cast<int>(getShardForVBucket(static_cast<uint16_t>(j))),
                  static_cast<int>(j));
         execute(buf);
+        snprintf(buf, sizeof(buf), "kv_%d.kv_%d",
+                 static_cast<int>(getShardForVBucket(static_cast<uint16_t>(j))),
+                 static_cast<int>(j));
+        createKeyIndex(buf);
     }
 }
 
@@ -14,6 +14,7 @@ class EventuallyPersistentEngine;
 
 typedef enum {
     select_all,
+    select_since,
     delete_vbucket
 } vb_statement_type;
 
@@ -70,6 +71,11 @@ public:
 
     virtual bool hasEfficientVBDeletion() { return false; }
 
+    /**
+     * True if each shard is a database file of its own.
+     */
+    virtual bool hasShardFiles() { return false; }
+
     virtual std::vector<PreparedStatement*> getVBStatements(uint16_t vb, vb_statement_type vbst) {
         (void)vb;
         (void)vbst;
@@ -107,6 +113,19 @@ protected:
 
     void doFile(const char * const filename);
 
+    /**
+     * Index the keys of a kv table, so items can be read by key.
+     *
+     * @param table the table, qualified by its database if attached
+     */
+    void createKeyIndex(const std::string &table);
+
+    /**
+     * Drop the key index of a kv table about to be renamed, so the
+     * table replacing it can have one of the same name.
+     */
+    void dropKeyIndex(const std::string &table);
+
     uint16_t getDbShardIdForKey(const std::string &key) {
         assert(shardCount > 0);
         int h=5381;
@@ -214,6 +233,9 @@ public:
             case select_all:
                 rv.push_back((*it)->all());
                 break;
+            case select_since:
+                rv.push_back((*it)->since());
+                break;
             case delete_vbucket:
                 rv.push_back((*it)->del_vb());
                 break;
@@ -278,6 +300,8 @@ public:
     void destroyTables(void);
     void destroyInvalidTables(bool destroyOnlyOne = false);
 
+    bool hasShardFiles() { return true; }
+
 private:
     const char * const shardpattern;
     int numTables;
@@ -347,6 +371,9 @@ public:
         case select_all:
             rv.push_back(statements.at(vb)->all());
             break;
+        case select_since:
+            rv.push_back(statements.at(vb)->since());
+            break;
         case delete_vbucket:
             rv.push_back(statements.at(vb)->del_vb());
             break;
@@ -416,6 +443,8 @@ public:
 
     virtual ~ShardedMultiTableSqliteStrategy() { }
 
+    bool hasShardFiles() { return true; }
+
     Statements *getStatements(uint16_t vbid, uint16_t vbver,
                               const std::string &key);
 
@@ -482,6 +511,8 @@ public:
 
     virtual ~ShardedByVBucketSqliteStrategy() { }
 
+    bool hasShardFiles() { return true; }
+
     void destroyTables();
     void destroyInvalidTables(bool destroyOnlyOne = false);
 
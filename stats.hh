@@ -26,6 +26,7 @@ public:
                 dirtyAgeHisto(GrowingWidthGenerator<hrtime_t>(0, ONE_SECOND, 1.4), 25),
                 dataAgeHisto(GrowingWidthGenerator<hrtime_t>(0, ONE_SECOND, 1.4), 25),
                 diskCommitHisto(GrowingWidthGenerator<hrtime_t>(0, ONE_SECOND, 1.4), 25),
+                persistWaitHisto(GrowingWidthGenerator<hrtime_t>(0, 1000, 1.4), 35),
                 timingLog(NULL) {}
 
     ~EPStats() {
@@ -58,6 +59,10 @@ public:
     Atomic<size_t> flusherCommits;
     //! Number of times the flusher was preempted for a read
     Atomic<size_t> flusherPreempts;
+    //! Number of flushes of a batch collected while the previous was written
+    Atomic<size_t> flusherPreparedBatches;
+    //! Number of items written ahead of their batch for a persistence waiter
+    Atomic<size_t> flusherPriorityItems;
     //! Total time spent flushing.
     Atomic<size_t> cumulativeFlushTime;
     //! Total time spent committing.
@@ -109,16 +114,42 @@ public:
     Atomic<int> queue_age_cap;
     //! Number of times background fetches occurred.
     Atomic<size_t> bg_fetched;
+    //! Number of disk lookups of keys that weren't in memory.
+    Atomic<size_t> bg_key_lookups;
+    //! Number of batches the background fetches were done in.
+    Atomic<size_t> bg_batches;
+    //! Number of requests that joined a background fetch of the same key.
+    Atomic<size_t> bg_fetches_coalesced;
     //! Number of times we needed to kick in the pager
     Atomic<size_t> pagerRuns;
+    //! Number of items the pager looked at as eviction candidates
+    Atomic<size_t> evictionCandidatesScanned;
+    //! Number of gets that found the value in memory
+    Atomic<size_t> residentGets;
+    //! Number of gets that had to go to disk
+    Atomic<size_t> nonResidentGets;
+    //! residentGets as of the end of the last pager run
+    Atomic<size_t> residentGetsAtPager;
+    //! nonResidentGets as of the end of the last pager run
+    Atomic<size_t> nonResidentGetsAtPager;
     //! Number of times the expiry pager runs for purging expired items
     Atomic<size_t> expiryPagerRuns;
     //! Number of times the checkpoint remover runs for removing closed unreferenced checkpoints.
     Atomic<size_t> checkpointRemoverRuns;
+    //! Number of times the checkpoint remover woke up for checkpoints left by their last cursor.
+    Atomic<size_t> checkpointRemoverWakeups;
     //! Number of items removed from closed unreferenced checkpoints.
     Atomic<size_t> itemsRemovedFromCheckpoints;
+    //! Number of items spilled to disk from closed checkpoints of slow TAP cursors.
+    Atomic<size_t> checkpointItemsSpilled;
+    //! Number of chunks of spilled checkpoints read back from disk.
+    Atomic<size_t> checkpointSpillReads;
+    //! Size of the checkpoint spill files.
+    Atomic<size_t> checkpointSpillSize;
     //! Number of times a value is ejected
     Atomic<size_t> numValueEjects;
+    //! Number of times a whole item (key and metadata too) is ejected
+    Atomic<size_t> numItemEjects;
     //! Number of times a replica value is ejected
     Atomic<size_t> numReplicaEjects;
     //! Number of times a value could not be ejected
@@ -333,6 +364,18 @@ public:
     //! Histogram of disk commits
     Histogram<hrtime_t> diskCommitHisto;
 
+    //! Histogram of how long observers waited for an item to be persisted
+    Histogram<hrtime_t> persistWaitHisto;
+
+    //! Histogram of the transaction sizes in effect at each commit
+    Histogram<size_t> txnSizeHisto;
+
+    //! Histogram of collecting (and deduplicating) a batch to flush
+    Histogram<hrtime_t> flushCollectHisto;
+
+    //! Histogram of writing a batch, from the first write to the last commit
+    Histogram<hrtime_t> flushWriteHisto;
+
     //! Histogram of purging a chunk of items with the old vbucket version from disk
     Histogram<hrtime_t> diskInvaidItemDelHisto;
 
@@ -359,9 +402,18 @@ public:
         flushDurationHighWat.set(0);
         commit_time.set(0);
         pagerRuns.set(0);
+        evictionCandidatesScanned.set(0);
+        residentGets.set(0);
+        nonResidentGets.set(0);
+        residentGetsAtPager.set(0);
+        nonResidentGetsAtPager.set(0);
         checkpointRemoverRuns.set(0);
+        checkpointRemoverWakeups.set(0);
         itemsRemovedFromCheckpoints.set(0);
+        checkpointItemsSpilled.set(0);
+        checkpointSpillReads.set(0);
         numValueEjects.set(0);
+        numItemEjects.set(0);
         numFailedEjects.set(0);
         numNotMyVBuckets.set(0);
         io_num_read.set(0);
@@ -419,6 +471,10 @@ public:
         diskVBDelHisto.reset();
         diskInvalidVBTableDelHisto.reset();
         diskCommitHisto.reset();
+        txnSizeHisto.reset();
+        persistWaitHisto.reset();
+        flushCollectHisto.reset();
+        flushWriteHisto.reset();
         diskInvaidItemDelHisto.reset();
 
         dataAgeHisto.reset();
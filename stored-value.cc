@@ -2,6 +2,10 @@
 #include "config.h"
 #include <cassert>
 #include <limits>
+#include <strings.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "stored-value.hh"
 
@@ -11,8 +15,13 @@
 
 size_t HashTable::defaultNumBuckets = DEFAULT_HT_SIZE;
 size_t HashTable::defaultNumLocks = 193;
+size_t HashTable::defaultResizeStep = 0;
+bool HashTable::defaultRWLocks = false;
+bool HashTable::defaultLockFreeReads = false;
+enum hash_table_layout HashTable::defaultLayout = chained_layout;
 enum stored_value_type HashTable::defaultStoredValueType = featured;
 double StoredValue::mutation_mem_threshold = 0.9;
+size_t StoredValue::maxInlineValueSize = 0;
 
 static ssize_t prime_size_table[] = {
     3, 7, 13, 23, 47, 97, 193, 383, 769, 1531, 3067, 6143, 12289, 24571, 49157,
@@ -21,18 +30,53 @@ static ssize_t prime_size_table[] = {
     1610612741, -1
 };
 
+/**
+ * RAII holder over an ascending set of a hash table's lock stripes,
+ * all taken exclusively.
+ */
+class StripeLockHolder {
+public:
+    StripeLockHolder(RWLock *m, const std::vector<int> &s) {
+        holders.reserve(s.size());
+        std::vector<int>::const_iterator it;
+        for (it = s.begin(); it != s.end(); ++it) {
+            holders.push_back(new WriterLockHolder(m[*it]));
+        }
+    }
+
+    StripeLockHolder(RWLock *m, size_t n) {
+        holders.reserve(n);
+        for (size_t i = 0; i < n; ++i) {
+            holders.push_back(new WriterLockHolder(m[i]));
+        }
+    }
+
+    ~StripeLockHolder() {
+        std::vector<WriterLockHolder*>::reverse_iterator it;
+        for (it = holders.rbegin(); it != holders.rend(); ++it) {
+            delete *it;
+        }
+    }
+
+private:
+    std::vector<WriterLockHolder*> holders;
+
+    DISALLOW_COPY_AND_ASSIGN(StripeLockHolder);
+};
+
 bool StoredValue::ejectValue(EPStats &stats, HashTable &ht) {
     if (eligibleForEviction()) {
         size_t oldsize = size();
-        size_t old_valsize = value->length();
+        size_t old_valsize = externalValLength();
         blobval uval;
         uval.len = valLength();
         RCPtr<Blob> sp(Blob::New(uval.chlen, sizeof(uval)));
-        extra.feature.resident = false;
+        bits &= ~RESIDENT_BIT;
         timestampEviction();
+        retainForReaders(ht);
         value = sp;
         size_t newsize = size();
-        size_t new_valsize = value->length();
+        size_t new_valsize = externalValLength();
 
         // ejecting the value may increase the object size....
         if (oldsize < newsize) {
@@ -57,10 +101,14 @@ bool StoredValue::ejectValue(EPStats &stats, HashTable &ht) {
     return false;
 }
 
+void StoredValue::retainForReaders(HashTable &ht) {
+    ht.keepForReaders(value.get());
+}
+
 bool StoredValue::restoreValue(const value_t &v, EPStats &stats, HashTable &ht) {
     if (!isResident()) {
         size_t oldsize = size();
-        size_t old_valsize = isDeleted() ? 0 : value->length();
+        size_t old_valsize = externalValLength();
         assert(v);
         if (v->length() != valLength()) {
             int diff(static_cast<int>(valLength()) - // expected
@@ -71,11 +119,12 @@ bool StoredValue::restoreValue(const value_t &v, EPStats &stats, HashTable &ht)
         }
         rel_time_t evicted_time(getEvictedTime());
         stats.pagedOutTimeHisto.add(ep_current_time() - evicted_time);
-        extra.feature.resident = true;
-        value = v;
+        bits |= RESIDENT_BIT;
+        retainForReaders(ht);
+        assignValue(v);
 
         size_t newsize = size();
-        size_t new_valsize = value->length();
+        size_t new_valsize = externalValLength();
         if (oldsize < newsize) {
             increaseCacheSize(ht, newsize - oldsize, true);
         } else if (newsize < oldsize) {
@@ -125,6 +174,140 @@ void HashTable::setDefaultNumLocks(size_t to) {
     }
 }
 
+/**
+ * Set the default number of buckets moved per incremental resize step.
+ */
+void HashTable::setDefaultResizeStep(size_t to) {
+    defaultResizeStep = to;
+}
+
+/**
+ * Set whether lookups take hashtable locks in shared mode.
+ */
+void HashTable::setDefaultRWLocks(bool to) {
+    defaultRWLocks = to;
+}
+
+/**
+ * Set whether hashtables support lock-free lookups.
+ */
+void HashTable::setDefaultLockFreeReads(bool to) {
+    defaultLockFreeReads = to;
+}
+
+void HashTable::reclaimValue(void *p) {
+    delete static_cast<StoredValue*>(p);
+}
+
+void HashTable::releaseValueRef(void *p) {
+    delete static_cast<value_t*>(p);
+}
+
+void *HashTable::allocTable(size_t n) {
+    if (!grouped) {
+        return calloc(n, sizeof(StoredValue*));
+    }
+    // Keep every group on its own pair of cache lines.
+    void *rv = NULL;
+    if (posix_memalign(&rv, 64, n * sizeof(BucketGroup)) != 0) {
+        return NULL;
+    }
+    std::memset(rv, 0, n * sizeof(BucketGroup));
+    return rv;
+}
+
+/**
+ * Get a bit for each slot of the group whose tag is the given one.
+ */
+static inline unsigned int matchTags(const uint8_t *tags, uint8_t tag) {
+#ifdef __SSE2__
+    __m128i t = _mm_set1_epi8(static_cast<char>(tag));
+    __m128i g = _mm_loadu_si128(reinterpret_cast<const __m128i*>(tags));
+    return static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(g, t)));
+#else
+    unsigned int rv = 0;
+    for (int i = 0; i < 16; ++i) {
+        if (tags[i] == tag) {
+            rv |= 1 << i;
+        }
+    }
+    return rv;
+#endif
+}
+
+StoredValue *HashTable::findInGroup(BucketGroup &g, const std::string &key,
+                                    int h) {
+    unsigned int m = matchTags(g.tags, tagFor(h)) & ((1 << GROUP_SLOTS) - 1);
+    while (m) {
+        int i = ffs(m) - 1;
+        m &= m - 1;
+        // The slot may be emptied after we looked at its tag when
+        // nothing is locked.
+        StoredValue *v = g.slots[i];
+        if (v && v->hasKey(key)) {
+            return v;
+        }
+    }
+    StoredValue *v = g.overflow;
+    while (v && !v->hasKey(key)) {
+        v = v->next;
+    }
+    return v;
+}
+
+void HashTable::linkInto(void *table, int b, int h, StoredValue *v) {
+    if (!grouped) {
+        StoredValue **values = static_cast<StoredValue**>(table);
+        v->next = values[b];
+        publish(values[b], v);
+        return;
+    }
+    BucketGroup &g = static_cast<BucketGroup*>(table)[b];
+    unsigned int m = matchTags(g.tags, 0) & ((1 << GROUP_SLOTS) - 1);
+    if (m) {
+        int i = ffs(m) - 1;
+        v->next = NULL;
+        // The slot before its tag, so a matching tag always comes
+        // with its item for lock-free readers.
+        publish(g.slots[i], v);
+        ep_sync_synchronize();
+        g.tags[i] = tagFor(h);
+    } else {
+        v->next = g.overflow;
+        publish(g.overflow, v);
+    }
+}
+
+void HashTable::unlinkFrom(void *table, int b, StoredValue *v) {
+    StoredValue **head;
+    if (grouped) {
+        BucketGroup &g = static_cast<BucketGroup*>(table)[b];
+        for (int i = 0; i < GROUP_SLOTS; ++i) {
+            if (g.slots[i] == v) {
+                g.tags[i] = 0;
+                g.slots[i] = NULL;
+                return;
+            }
+        }
+        head = &g.overflow;
+    } else {
+        head = static_cast<StoredValue**>(table) + b;
+    }
+    while (*head != v) {
+        assert(*head);
+        head = &(*head)->next;
+    }
+    *head = v->next;
+}
+
+void HashTable::clearBucket(void *table, int b) {
+    if (grouped) {
+        std::memset(static_cast<BucketGroup*>(table) + b, 0, sizeof(BucketGroup));
+    } else {
+        static_cast<StoredValue**>(table)[b] = NULL;
+    }
+}
+
 HashTableStatVisitor HashTable::clear(bool deactivate) {
     HashTableStatVisitor rv;
 
@@ -132,30 +315,69 @@ HashTableStatVisitor HashTable::clear(bool deactivate) {
         // If not deactivating, assert we're already active.
         assert(isActive());
     }
-    MultiLockHolder mlh(mutexes, n_locks);
+    StripeLockHolder slh(mutexes, n_locks);
     if (deactivate) {
         setActiveState(false);
     }
-    for (int i = 0; i < (int)size; i++) {
-        while (values[i]) {
-            StoredValue *v = values[i];
-            rv.visit(v);
-            values[i] = v->next;
-            delete v;
+    for (int t = 0; t < 2; ++t) {
+        for (int i = 0; tables[t] && i < (int)sizes[t]; i++) {
+            BucketWalker walker(*this, tables[t], i);
+            while (StoredValue *v = walker.next()) {
+                rv.visit(v);
+                freeValue(v);
+            }
+            clearBucket(tables[t], i);
         }
     }
 
     numItems.set(0);
     numNonResidentItems.set(0);
+    numTempItems.set(0);
+    numEvictedItems.set(0);
     memSize.set(0);
     cacheSize.set(0);
+    expiryIndex.clear();
 
     return rv;
 }
 
+size_t HashTable::popExpiredKeys(time_t now, std::vector<std::string> &out) {
+    std::vector<int> hashes;
+    if (expiryIndex.popDue(now, hashes) == 0) {
+        return 0;
+    }
+    // A hash noted more than once needs looking at once.
+    std::sort(hashes.begin(), hashes.end());
+    hashes.erase(std::unique(hashes.begin(), hashes.end()), hashes.end());
+
+    size_t n(0);
+    std::vector<int>::iterator it;
+    for (it = hashes.begin(); it != hashes.end(); ++it) {
+        int bucket_num(0);
+        ReaderLockHolder rlh = getReadLockedBucket(*it, &bucket_num);
+        int table(0);
+        int b = decodeBucket(bucket_num, &table);
+        BucketWalker walker(*this, tables[table], b);
+        while (StoredValue *v = walker.next()) {
+            // Items that went away, got a later expiry time or share
+            // the bucket are left alone.
+            if ((v->isTempItem() || (!v->isDeleted() && v->isExpired(now))) &&
+                hash(v->getKeyBytes(), v->getKeyLen()) == *it) {
+                out.push_back(v->getKey());
+                ++n;
+            }
+        }
+    }
+    return n;
+}
+
 void HashTable::resize(size_t newSize) {
     assert(isActive());
 
+    if (grouped) {
+        newSize = roundToPowerOfTwo(newSize);
+    }
+
     // Due to the way hashing works, we can't fit anything larger than
     // an int.
     if (newSize > static_cast<size_t>(std::numeric_limits<int>::max())) {
@@ -163,12 +385,17 @@ void HashTable::resize(size_t newSize) {
     }
 
     // Don't resize to the same size, either.
-    if (newSize == size) {
+    if (newSize == getSize() || resizing) {
         return;
     }
 
-    MultiLockHolder mlh(mutexes, n_locks);
-    if (visitors.get() > 0) {
+    if (resizeStep > 0) {
+        startIncrementalResize(newSize);
+        return;
+    }
+
+    StripeLockHolder slh(mutexes, n_locks);
+    if (visitors.get() > 0 || resizing) {
         // Do not allow a resize while any visitors are actually
         // processing.  The next attempt will have to pick it up.  New
         // visitors cannot start doing meaningful work (we own all
@@ -177,8 +404,7 @@ void HashTable::resize(size_t newSize) {
     }
 
     // Get a place for the new items.
-    StoredValue **newValues = static_cast<StoredValue**>(calloc(newSize,
-                                                                sizeof(StoredValue*)));
+    void *newValues = allocTable(newSize);
     // If we can't allocate memory, don't move stuff around.
     if (!newValues) {
         return;
@@ -187,31 +413,217 @@ void HashTable::resize(size_t newSize) {
     stats.memOverhead.decr(memorySize());
     ++numResizes;
 
-    // Set the new size so all the hashy stuff works.
-    size_t oldSize = size;
-    size = newSize;
-    ep_sync_synchronize();
+    void *values = tables[activeTable];
+    size_t oldSize = sizes[activeTable];
 
     // Move existing records into the new space.
     for (size_t i = 0; i < oldSize; i++) {
-        while (values[i]) {
-            StoredValue *v = values[i];
-            values[i] = v->next;
-
-            int newBucket = getBucketForHash(hash(v->getKeyBytes(), v->getKeyLen()));
-            v->next = newValues[newBucket];
-            newValues[newBucket] = v;
+        BucketWalker walker(*this, values, i);
+        while (StoredValue *v = walker.next()) {
+            int h = hash(v->getKeyBytes(), v->getKeyLen());
+            linkInto(newValues, bucketIn(h, newSize), h, v);
         }
+        clearBucket(values, i);
     }
 
-    // values still points to the old (now empty) table.
-    free(values);
-    values = newValues;
+    // Switch to the new space; values still points to the old (now
+    // empty) table.
+    ++layoutSeqno;
+    tables[activeTable] = newValues;
+    sizes[activeTable] = newSize;
+    ++layoutSeqno;
+    freeTable(values);
 
     stats.memOverhead.incr(memorySize());
     assert(stats.memOverhead.get() < GIGANTOR);
 }
 
+void HashTable::startIncrementalResize(size_t newSize) {
+    if (!migrating.cas(false, true)) {
+        return;
+    }
+    if (visitors.get() > 0 || resizing) {
+        // Same rule as for a full resize: leave it to the next attempt.
+        migrating.set(false);
+        return;
+    }
+
+    int next = activeTable ^ 1;
+    assert(tables[next] == NULL);
+    void *newValues = allocTable(newSize);
+    if (!newValues) {
+        migrating.set(false);
+        return;
+    }
+
+    stats.memOverhead.decr(memorySize());
+    ++numResizes;
+
+    ++layoutSeqno;
+    tables[next] = newValues;
+    sizes[next] = newSize;
+    migrateCursor.set(0);
+    resizing.set(true);
+    ++layoutSeqno;
+
+    stats.memOverhead.incr(memorySize());
+    assert(stats.memOverhead.get() < GIGANTOR);
+
+    migrating.set(false);
+}
+
+size_t HashTable::migrateBuckets(size_t n, bool foreground) {
+    size_t migrated = 0;
+    if (!resizing || !migrating.cas(false, true)) {
+        return migrated;
+    }
+    // A visitor registers itself before waiting for us to finish,
+    // so checking after taking the migration flag is enough to never
+    // move items underneath a visitor.
+    if (visitors.get() == 0) {
+        while (migrated < n && resizing && migrateNextBucket()) {
+            ++migrated;
+        }
+        numMigratedBuckets.incr(migrated);
+        if (foreground) {
+            numFgMigrations.incr(migrated);
+        }
+    }
+    migrating.set(false);
+    return migrated;
+}
+
+bool HashTable::migrateNextBucket() {
+    int from = activeTable;
+    int to = from ^ 1;
+    size_t ob = migrateCursor;
+    assert(ob < sizes[from]);
+
+    // The old bucket's stripe plus the stripe of every new bucket one
+    // of its items lands in, always acquired in ascending order.
+    std::vector<int> stripes;
+    stripes.push_back(static_cast<int>(ob % n_locks));
+    while (true) {
+        StripeLockHolder slh(mutexes, stripes);
+        if (!isActive()) {
+            return false;
+        }
+
+        std::vector<int> needed(stripes);
+        BucketWalker items(*this, tables[from], ob);
+        while (StoredValue *v = items.next()) {
+            int nb = bucketIn(hash(v->getKeyBytes(), v->getKeyLen()), sizes[to]);
+            needed.push_back(nb % static_cast<int>(n_locks));
+        }
+        std::sort(needed.begin(), needed.end());
+        needed.erase(std::unique(needed.begin(), needed.end()), needed.end());
+        if (needed != stripes) {
+            // Items were added to the bucket since we looked; retry
+            // with the larger set of locks.
+            stripes = needed;
+            continue;
+        }
+
+        BucketWalker walker(*this, tables[from], ob);
+        while (StoredValue *v = walker.next()) {
+            int h = hash(v->getKeyBytes(), v->getKeyLen());
+            linkInto(tables[to], bucketIn(h, sizes[to]), h, v);
+        }
+        clearBucket(tables[from], ob);
+        migrateCursor.set(ob + 1);
+
+        if (ob + 1 == sizes[from]) {
+            // Everything has moved over; retire the old array while
+            // the last old bucket is still locked.
+            stats.memOverhead.decr(memorySize());
+            ++layoutSeqno;
+            freeTable(tables[from]);
+            tables[from] = NULL;
+            sizes[from] = 0;
+            activeTable = to;
+            resizing.set(false);
+            migrateCursor.set(0);
+            ++layoutSeqno;
+            stats.memOverhead.incr(memorySize());
+            assert(stats.memOverhead.get() < GIGANTOR);
+        }
+        return true;
+    }
+}
+
+Item *HashTable::lockFreeGet(const std::string &key, uint16_t vbucket,
+                             time_t asOf, StoredValue **sv) {
+    assert(epochs);
+    int h = hash(key.data(), key.size());
+    EpochGuard guard(*epochs, static_cast<size_t>(h));
+
+    // Same as getBucketForHash, but the table has to be picked up
+    // along with its size as the old one may be retired at any time.
+    uint32_t seqno = layoutSeqno;
+    if (seqno & 1) {
+        ++numLockFreeFallbacks;
+        return NULL;
+    }
+    ep_sync_synchronize();
+    int t = activeTable;
+    int b = bucketIn(h, sizes[t]);
+    if (resizing && b < static_cast<int>(migrateCursor.get())) {
+        t ^= 1;
+        b = bucketIn(h, sizes[t]);
+    }
+    void *values = tables[t];
+    ep_sync_synchronize();
+    if (seqno != layoutSeqno) {
+        ++numLockFreeFallbacks;
+        return NULL;
+    }
+
+    // Anything a writer does to the bucket happens with its stripe
+    // write-locked, which shows up in the stripe's writer seqno.
+    RWLock &stripe = mutexes[b % static_cast<int>(n_locks)];
+    uint32_t wseqno = stripe.getWriterSeqno();
+    if (wseqno & 1) {
+        ++numLockFreeFallbacks;
+        return NULL;
+    }
+    ep_sync_synchronize();
+
+    Item *rv = NULL;
+    StoredValue *v;
+    if (grouped) {
+        v = findInGroup(static_cast<BucketGroup*>(values)[b], key, h);
+    } else {
+        v = static_cast<StoredValue**>(values)[b];
+        while (v && !v->hasKey(key)) {
+            v = v->next;
+        }
+    }
+    if (v && !v->isDeleted() && v->isResident() && !v->hasLock()
+        && !v->isExpired(asOf)) {
+        rv = v->toItem(false, vbucket);
+        // The epoch guard keeps v around even if it was just removed.
+        v->markReferenced();
+    }
+
+    ep_sync_synchronize();
+    if (rv && stripe.getWriterSeqno() != wseqno) {
+        delete rv;
+        rv = NULL;
+    }
+    if (rv) {
+        *sv = v;
+    } else {
+        ++numLockFreeFallbacks;
+    }
+    return rv;
+}
+
+void HashTable::waitForMigration() {
+    while (migrating) {
+        sched_yield();
+    }
+}
+
 static size_t distance(size_t a, size_t b) {
     return std::max(a, b) - std::min(a, b);
 }
@@ -226,10 +638,24 @@ static bool isCurrently(size_t size, ssize_t a, ssize_t b) {
 }
 
 void HashTable::resize() {
+    if (resizing) {
+        return;
+    }
+    size_t size = getSize();
     size_t ni = getNumItems();
     int i(0);
     size_t new_size(0);
 
+    if (grouped) {
+        // Aim for about six items per group, staying put anywhere
+        // from two to ten so we don't flap between two sizes.
+        if (size * 2 <= ni && ni <= size * 10) {
+            return;
+        }
+        resize(roundToPowerOfTwo(std::max(ni / 6, defaultNumBuckets)));
+        return;
+    }
+
     // Figure out where in the prime table we are.
     ssize_t target(static_cast<ssize_t>(ni));
     for (i = 0; prime_size_table[i] > 0 && prime_size_table[i] < target; ++i) {
@@ -259,25 +685,57 @@ void HashTable::visit(HashTableVisitor &visitor) {
         return;
     }
     VisitorTracker vt(&visitors);
+    // Incremental resizing pauses while we're registered, so the
+    // layout is stable for the rest of the walk.
+    waitForMigration();
     bool aborted = !visitor.shouldContinue();
     size_t visited = 0;
     for (int l = 0; isActive() && !aborted && l < static_cast<int>(n_locks); l++) {
-        LockHolder lh(mutexes[l]);
-        for (int i = l; i < static_cast<int>(size); i+= n_locks) {
-            assert(l == mutexForBucket(i));
-            StoredValue *v = values[i];
-            assert(v == NULL || i == getBucketForHash(hash(v->getKeyBytes(),
-                                                           v->getKeyLen())));
-            while (v) {
-                visitor.visit(v);
-                v = v->next;
+        WriterLockHolder lh(mutexes[l]);
+        for (int t = 0; t < 2; ++t) {
+            for (int i = l; tables[t] && i < static_cast<int>(sizes[t]); i+= n_locks) {
+                int bucket_num = encodeBucket(t, i);
+                assert(l == mutexForBucket(bucket_num));
+                BucketWalker walker(*this, tables[t], i);
+                while (StoredValue *v = walker.next()) {
+                    assert(bucket_num == getBucketForHash(hash(v->getKeyBytes(),
+                                                               v->getKeyLen())));
+                    visitor.visit(v);
+                }
+                ++visited;
             }
-            ++visited;
         }
         lh.unlock();
         aborted = !visitor.shouldContinue();
     }
-    assert(aborted || visited == size);
+    assert(aborted || visited == sizes[0] + sizes[1]);
+}
+
+void HashTable::sweep(HashTableVisitor &visitor) {
+    if (numItems.get() == 0 || !isActive()) {
+        return;
+    }
+    VisitorTracker vt(&visitors);
+    waitForMigration();
+    size_t hand = clockHand.get() % n_locks;
+    for (size_t n = 0; isActive() && n < n_locks; ++n) {
+        if (!visitor.shouldContinue()) {
+            break;
+        }
+        int l = static_cast<int>(hand);
+        WriterLockHolder lh(mutexes[l]);
+        for (int t = 0; t < 2; ++t) {
+            for (int i = l; tables[t] && i < static_cast<int>(sizes[t]); i+= n_locks) {
+                BucketWalker walker(*this, tables[t], i);
+                while (StoredValue *v = walker.next()) {
+                    visitor.visit(v);
+                }
+            }
+        }
+        lh.unlock();
+        hand = (hand + 1) % n_locks;
+    }
+    clockHand.set(hand);
 }
 
 void HashTable::visitDepth(HashTableDepthVisitor &visitor) {
@@ -286,26 +744,45 @@ void HashTable::visitDepth(HashTableDepthVisitor &visitor) {
     }
     size_t visited = 0;
     VisitorTracker vt(&visitors);
+    waitForMigration();
 
     for (int l = 0; l < static_cast<int>(n_locks); l++) {
-        LockHolder lh(mutexes[l]);
-        for (int i = l; i < static_cast<int>(size); i+= n_locks) {
-            size_t depth = 0;
-            StoredValue *p = values[i];
-            assert(p == NULL || i == getBucketForHash(hash(p->getKeyBytes(),
-                                                           p->getKeyLen())));
-            size_t mem(0);
-            while (p) {
-                depth++;
-                mem += p->size();
-                p = p->next;
+        WriterLockHolder lh(mutexes[l]);
+        for (int t = 0; t < 2; ++t) {
+            for (int i = l; tables[t] && i < static_cast<int>(sizes[t]); i+= n_locks) {
+                size_t depth = 0;
+                int bucket_num = encodeBucket(t, i);
+                BucketWalker walker(*this, tables[t], i);
+                size_t mem(0);
+                while (StoredValue *p = walker.next()) {
+                    assert(bucket_num == getBucketForHash(hash(p->getKeyBytes(),
+                                                               p->getKeyLen())));
+                    depth++;
+                    mem += p->size();
+                }
+                visitor.visit(bucket_num, depth, mem);
+                ++visited;
             }
-            visitor.visit(i, depth, mem);
-            ++visited;
         }
     }
 
-    assert(visited == size);
+    assert(visited == sizes[0] + sizes[1]);
+}
+
+bool HashTable::setDefaultLayout(const char *l) {
+    bool rv = false;
+    if (l && strcmp(l, "chained") == 0) {
+        setDefaultLayout(chained_layout);
+        rv = true;
+    } else if (l && strcmp(l, "grouped") == 0) {
+        setDefaultLayout(grouped_layout);
+        rv = true;
+    }
+    return rv;
+}
+
+void HashTable::setDefaultLayout(enum hash_table_layout l) {
+    defaultLayout = l;
 }
 
 bool HashTable::setDefaultStorageValueType(const char *t) {
@@ -362,6 +839,14 @@ void StoredValue::setMutationMemoryThreshold(double memThreshold) {
     }
 }
 
+/**
+ * Set the largest value new items store inline.
+ */
+void StoredValue::setMaxInlineValueSize(size_t to) {
+    // The length byte reserves one value to mean "not inline".
+    maxInlineValueSize = std::min(to, static_cast<size_t>(NO_INLINE_VALUE - 1));
+}
+
 /**
  * What's the total size of allocations?
  */
@@ -414,16 +899,17 @@ bool StoredValue::hasAvailableSpace(EPStats &st, const Item &itm) {
 
 Item* StoredValue::toItem(bool locked, uint16_t vbucket) const {
     Item *ret;
+    value_t val(getValue());
 
-    if (_isSmall) {
+    if (isSmall()) {
         ret = new Item(getKey(), flags, 0,
-                       value,
+                       val,
                        locked ? static_cast<uint64_t>(-1) : 0,
                        id, vbucket);
     } else {
-        ret = new Item(getKey(), flags, extra.feature.exptime,
-                       value,
-                       locked ? static_cast<uint64_t>(-1) : extra.feature.cas,
+        ret = new Item(getKey(), flags, exptime,
+                       val,
+                       locked ? static_cast<uint64_t>(-1) : getCas(),
                        id, vbucket, extra.feature.seqno);
     }
 
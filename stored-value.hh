@@ -3,12 +3,15 @@
 #define STORED_VALUE_H 1
 
 #include <climits>
+#include <cstddef>
 #include <cstring>
 #include <algorithm>
 
 #include "common.hh"
 #include "item.hh"
 #include "locks.hh"
+#include "epoch.hh"
+#include "expiry_index.hh"
 #include "stats.hh"
 #include "histo.hh"
 #include "queueditem.hh"
@@ -24,12 +27,15 @@ class StoredValueFactory;
 // One of the following structs overlays at the end of StoredItem.
 // This is figured out dynamically and stored in one bit in
 // StoredValue so it can figure it out at runtime.
+//
+// Items created while small values are inlined (and whose value was
+// small enough) have an inline value area right after the key bytes.
+// Its capacity and current length live in StoredValue itself.
 
 /**
  * StoredValue "small" data storage.
  */
 struct small_data {
-    uint8_t keylen;             //!< Length of the key.
     char    keybytes[1];        //!< The key itself.
 };
 
@@ -38,12 +44,10 @@ struct small_data {
  */
 struct feature_data {
     uint64_t   cas;             //!< CAS identifier.
-    uint32_t   exptime;         //!< Expiration time of this item.
     uint32_t   seqno;           //!< Revision id sequence number
-    rel_time_t lock_expiry;     //!< getl lock expiration
-    bool       locked : 1;      //!< True if this item is locked
-    bool       resident : 1;    //!< True if this object's value is in memory.
-    uint8_t    keylen;          //!< Length of the key
+    rel_time_t lock_expiry;     //!< getl lock expiration; 0 if not locked
+    uint32_t   by_seqno_lo;     //!< Low 32 bits of the change history position
+    uint16_t   by_seqno_hi;     //!< And its high 16 bits
     char       keybytes[1];     //!< The key itself.
 };
 
@@ -70,24 +74,58 @@ class StoredValue {
 public:
 
     void operator delete(void* p) {
-        ::operator delete(p);
-     }
+        SlabAllocator::deallocate(p);
+    }
 
     /**
-     * Update the "last used" time for the object.
+     * Update the "last used" time for the object, and give it another
+     * chance to stay in memory the next time the pager comes by.
+     *
+     * This needs the bucket lock held exclusively.
      */
     void touch() {
         if (isResident() && !isDirty()) {
-            dirtiness = ep_current_time() >> 2;
+            setDirtiness(ep_current_time() >> 2);
+        }
+        markReferenced();
+    }
+
+    /**
+     * Give this object another chance to stay in memory the next time
+     * the pager comes by.
+     *
+     * The flag is set with an atomic or, so readers holding the bucket
+     * lock shared, or no lock at all, may set it.
+     */
+    void markReferenced() {
+        if (!(bits & REFERENCED_BIT)) {
+            ep_sync_fetch_and_or(reinterpret_cast<volatile uint32_t*>(&bits),
+                                 REFERENCED_BIT);
         }
     }
 
+    /**
+     * True if this object was used since the pager last came by.
+     */
+    bool isReferenced() const {
+        return (bits & REFERENCED_BIT) != 0;
+    }
+
+    /**
+     * Take away this object's second chance; the pager may evict it
+     * next time unless it's used before then.
+     */
+    void clearReferenced() {
+        ep_sync_fetch_and_and(reinterpret_cast<volatile uint32_t*>(&bits),
+                              ~REFERENCED_BIT);
+    }
+
     /**
      * Mark this item as needing to be persisted.
      */
     void markDirty() {
-        dirtiness = ep_current_time() >> 2;
-        _isDirty = 1;
+        setDirtiness(ep_current_time() >> 2);
+        bits |= DIRTY_BIT;
     }
 
     /**
@@ -99,8 +137,8 @@ public:
      * @param dataAge the previous dataAge of this record
      */
     void reDirty(rel_time_t dataAge) {
-        dirtiness = dataAge >> 2;
-        _isDirty = 1;
+        setDirtiness(dataAge >> 2);
+        bits |= DIRTY_BIT;
         clearPendingId();
     }
 
@@ -113,9 +151,9 @@ public:
      */
     void markClean(rel_time_t *dataAge) {
         if (dataAge) {
-            *dataAge = dirtiness << 2;
+            *dataAge = getDirtiness() << 2;
         }
-        _isDirty = 0;
+        bits &= ~DIRTY_BIT;
         touch();
     }
 
@@ -123,7 +161,7 @@ public:
      * True if this object is dirty.
      */
     bool isDirty() const {
-        return _isDirty;
+        return (bits & DIRTY_BIT) != 0;
     }
 
     /**
@@ -133,8 +171,33 @@ public:
         return !isDirty();
     }
 
+    /**
+     * Note that this item was written by a transaction that hasn't
+     * committed yet, so readers of the disk may still see an older
+     * version of it (or none).
+     */
+    void markUncommitted() {
+        bits |= UNCOMMITTED_BIT;
+    }
+
+    /**
+     * Note that the transaction this item was written in committed.
+     */
+    void markCommitted() {
+        bits &= ~UNCOMMITTED_BIT;
+    }
+
+    /**
+     * False while the last write of this item isn't committed.
+     */
+    bool isCommitted() const {
+        return (bits & UNCOMMITTED_BIT) == 0;
+    }
+
     bool eligibleForEviction() {
-        return isResident() && isClean() && !isDeleted() && !_isSmall;
+        // Ejecting an inline value wouldn't free anything.
+        return isResident() && isClean() && !isDeleted() && !isSmall()
+            && !isInline();
     }
 
     /**
@@ -154,7 +217,7 @@ public:
      * Get the pointer to the beginning of the key.
      */
     const char* getKeyBytes() const {
-        if (_isSmall) {
+        if (isSmall()) {
             return extra.small.keybytes;
         } else {
             return extra.feature.keybytes;
@@ -165,11 +228,7 @@ public:
      * Get the length of the key.
      */
     uint8_t getKeyLen() const {
-        if (_isSmall) {
-            return extra.small.keylen;
-        } else {
-            return extra.feature.keylen;
-        }
+        return keylen;
     }
 
     /**
@@ -192,9 +251,29 @@ public:
 
     /**
      * Get this item's value.
+     *
+     * An inline value is copied into a new Blob.
+     */
+    value_t getValue() const {
+        if (isInline()) {
+            return value_t(Blob::New(inlineData(), inlineLen));
+        }
+        return value_t(value.get());
+    }
+
+    /**
+     * True if this item's value is stored inline.
      */
-    const value_t &getValue() const {
-        return value;
+    bool isInline() const {
+        return inlineCap > 0 && inlineLen != NO_INLINE_VALUE;
+    }
+
+    /**
+     * Get the length of the value bytes held in a Blob of this item
+     * (as opposed to inline or not at all).
+     */
+    size_t externalValLength() const {
+        return (isDeleted() || isInline()) ? 0 : value->length();
     }
 
     /**
@@ -203,16 +282,16 @@ public:
      * @return the expiration time for feature items, 0 for small items
      */
     time_t getExptime() const {
-        if (_isSmall) {
+        if (isSmall()) {
             return 0;
         } else {
-            return extra.feature.exptime;
+            return exptime;
         }
     }
 
     void setExptime(time_t tim) {
-        if (!_isSmall) {
-            extra.feature.exptime = tim;
+        if (!isSmall()) {
+            exptime = tim;
             markDirty();
         }
     }
@@ -250,13 +329,14 @@ public:
     void setValue(Item &itm, EPStats &stats, HashTable &ht, bool preserveSeqno) {
         size_t currSize = size();
         reduceCacheSize(ht, currSize);
-        reduceCurrentSize(stats, isDeleted() ? currSize : currSize - value->length());
-        value = itm.getValue();
+        reduceCurrentSize(stats, currSize - externalValLength());
+        retainForReaders(ht);
+        assignValue(itm.getValue());
         setResident();
         flags = itm.getFlags();
-        if (!_isSmall) {
-            extra.feature.cas = itm.getCas();
-            extra.feature.exptime = itm.getExptime();
+        if (!isSmall()) {
+            setCas(itm.getCas());
+            exptime = itm.getExptime();
             if (preserveSeqno) {
                 extra.feature.seqno = itm.getSeqno();
             } else {
@@ -267,13 +347,15 @@ public:
         markDirty();
         size_t newSize = size();
         increaseCacheSize(ht, newSize);
-        increaseCurrentSize(stats, newSize - value->length());
+        increaseCurrentSize(stats, newSize - externalValLength());
         replicas = 0;
     }
 
     size_t valLength() {
         if (isDeleted()) {
             return 0;
+        } else if (isInline()) {
+            return inlineLen;
         } else if (isResident()) {
             return value->length();
         } else {
@@ -309,7 +391,7 @@ public:
      * @return the cas ID for feature items, 0 for small items
      */
     uint64_t getCas() const {
-        if (_isSmall) {
+        if (isSmall()) {
             return 0;
         } else {
             return extra.feature.cas;
@@ -323,7 +405,7 @@ public:
      * timestamp only has four seconds of accuracy.
      */
     rel_time_t getDataAge() const {
-        return dirtiness << 2;
+        return getDirtiness() << 2;
     }
 
     /**
@@ -340,7 +422,7 @@ public:
      * This is a NOOP for small item types.
      */
     void setCas(uint64_t c) {
-        if (!_isSmall) {
+        if (!isSmall()) {
             extra.feature.cas = c;
         }
     }
@@ -351,9 +433,9 @@ public:
      * This is a NOOP for small item types.
      */
     void lock(rel_time_t expiry) {
-        if (!_isSmall) {
-            extra.feature.locked = true;
-            extra.feature.lock_expiry = expiry;
+        if (!isSmall()) {
+            // A zero expiry means unlocked.
+            extra.feature.lock_expiry = expiry ? expiry : 1;
         }
     }
 
@@ -361,8 +443,7 @@ public:
      * Unlock this item.
      */
     void unlock() {
-        if (!_isSmall) {
-            extra.feature.locked = false;
+        if (!isSmall()) {
             extra.feature.lock_expiry = 0;
         }
     }
@@ -436,6 +517,22 @@ public:
         }
     }
 
+    /**
+     * True if this item only stands in for a key that is on disk
+     * neither (see HashTable::unlocked_addTempDeleted).
+     */
+    bool isTempItem() {
+        return id == -3;
+    }
+
+    /**
+     * Mark this item as standing in for a missing key.
+     */
+    void markTempItem() {
+        assert(!hasId());
+        id = -3;
+    }
+
     /**
      * Get the total size of this item.
      *
@@ -445,16 +542,17 @@ public:
         // This differs from valLength in that it reports the
         // *resident* length instead of the length of the actual value
         // as it existed.
-        size_t vallen = isDeleted() ? 0 : value->length();
+        size_t vallen = externalValLength();
         size_t valign = 0;
         if (vallen % sizeof(void*) != 0) {
             valign = sizeof(void*) - vallen % sizeof(void*);
         }
+        size_t keyarea = getKeyLen() + inlineCap;
         size_t kalign = 0;
-        if (getKeyLen() % sizeof(void*) != 0) {
-            kalign = sizeof(void*) - getKeyLen() % sizeof(void*);
+        if (keyarea % sizeof(void*) != 0) {
+            kalign = sizeof(void*) - keyarea % sizeof(void*);
         }
-        return sizeOf(_isSmall) + getKeyLen() + vallen + valign + kalign;
+        return sizeOf(isSmall()) + keyarea + vallen + valign + kalign;
     }
 
     /**
@@ -464,33 +562,36 @@ public:
      * @return true if the item is locked
      */
     bool isLocked(rel_time_t curtime) {
-        if (_isSmall) {
+        if (isSmall()) {
             return false;
         } else {
-            if (extra.feature.locked && (curtime > extra.feature.lock_expiry)) {
-                extra.feature.locked = false;
+            if (hasLock() && (curtime > extra.feature.lock_expiry)) {
+                extra.feature.lock_expiry = 0;
                 return false;
             }
-            return extra.feature.locked;
+            return hasLock();
         }
     }
 
+    /**
+     * True if this item carries a lock, whether or not it has expired.
+     */
+    bool hasLock() const {
+        return !isSmall() && extra.feature.lock_expiry != 0;
+    }
+
     /**
      * True if this value is resident in memory currently.
      */
     bool isResident() const {
-        if (_isSmall) {
-            return true;
-        } else {
-            return extra.feature.resident;
-        }
+        return (bits & RESIDENT_BIT) != 0;
     }
 
     /**
      * True if this object is logically deleted.
      */
     bool isDeleted() const {
-        return value.get() == NULL;
+        return value.get() == NULL && !isInline();
     }
 
     /**
@@ -502,9 +603,11 @@ public:
         }
 
         size_t oldsize = size();
-        size_t old_valsize = value->length();
+        size_t old_valsize = externalValLength();
 
+        retainForReaders(ht);
         value.reset();
+        clearInlineValue();
         markDirty();
         setCas(getCas() + 1);
 
@@ -526,7 +629,7 @@ public:
 
 
     uint32_t getSeqno() {
-        if (_isSmall) {
+        if (isSmall()) {
             return 0;
         } else {
             return extra.feature.seqno;
@@ -539,11 +642,40 @@ public:
      * This is a NOOP for small item types.
      */
     void setSeqno(uint32_t s) {
-        if (!_isSmall) {
+        if (!isSmall()) {
             extra.feature.seqno = s;
         }
     }
 
+    /**
+     * Get the position of the last persisted mutation of this item in
+     * its vbucket's change history, or 0 if not known.
+     */
+    uint64_t getBySeqno() {
+        if (isSmall()) {
+            return 0;
+        } else {
+            return static_cast<uint64_t>(extra.feature.by_seqno_hi) << 32 |
+                extra.feature.by_seqno_lo;
+        }
+    }
+
+    /**
+     * Set the position in the vbucket's change history.  Only 48 bits
+     * of it are kept; a position beyond that is recorded as not known.
+     *
+     * This is a NOOP for small item types.
+     */
+    void setBySeqno(uint64_t s) {
+        if (!isSmall()) {
+            if (s >> 48) {
+                s = 0;
+            }
+            extra.feature.by_seqno_lo = static_cast<uint32_t>(s);
+            extra.feature.by_seqno_hi = static_cast<uint16_t>(s >> 32);
+        }
+    }
+
 
     /**
      * Generate a new Item out of this object
@@ -562,9 +694,12 @@ public:
      * @return the size in bytes required (minus key) for a StoredValue.
      */
     static size_t sizeOf(bool small) {
-        // Subtract one because the length of the string is computed on demand.
-        size_t base = sizeof(StoredValue) - sizeof(union stored_value_bodies) - 1;
-        return base + (small ? sizeof(struct small_data) : sizeof(struct feature_data));
+        // Everything before the bodies plus the body up to the key
+        // bytes.  The members are laid out so the bodies start on an
+        // eight byte boundary and the object has no tail padding.
+        size_t base = sizeof(StoredValue) - sizeof(union stored_value_bodies);
+        return base + (small ? offsetof(struct small_data, keybytes)
+                             : offsetof(struct feature_data, keybytes));
     }
 
     /**
@@ -590,26 +725,58 @@ public:
      */
     static size_t getCurrentSize(EPStats&);
 
+    /**
+     * Set the largest value stored inline in new items (0 to keep all
+     * values in Blobs).
+     */
+    static void setMaxInlineValueSize(size_t to);
+
+    /**
+     * Get the largest value stored inline in new items.
+     */
+    static size_t getMaxInlineValueSize() {
+        return maxInlineValueSize;
+    }
+
+    /**
+     * Get the inline value capacity a new item with the given key and
+     * value lengths gets (0 for none).
+     */
+    static size_t inlineCapacityFor(size_t keylen, size_t vallen) {
+        if (maxInlineValueSize == 0 || vallen > maxInlineValueSize) {
+            return 0;
+        }
+        // Use up the padding the key and value would get anyway so
+        // the value has some room to grow in place.
+        size_t used = keylen + vallen;
+        size_t cap = vallen;
+        if (used % sizeof(void*) != 0) {
+            cap += sizeof(void*) - used % sizeof(void*);
+        }
+        return std::min(cap, maxInlineValueSize);
+    }
+
 private:
 
     StoredValue(const Item &itm, StoredValue *n, EPStats &stats, HashTable &ht,
-                bool setDirty = true, bool small = false) :
-        value(itm.getValue()), next(n), id(itm.getId()),
-        dirtiness(0), _isSmall(small), flags(itm.getFlags()), replicas(0)
+                bool setDirty = true, bool small = false, size_t icap = 0) :
+        next(n), id(itm.getId()), bits(RESIDENT_BIT | (small ? SMALL_BIT : 0)),
+        flags(itm.getFlags()),
+        exptime(0), replicas(0),
+        keylen(itm.getKey().length()), inlineCap(icap),
+        inlineLen(NO_INLINE_VALUE)
     {
-
-        if (_isSmall) {
-            extra.small.keylen = itm.getKey().length();
-        } else {
-            extra.feature.cas = itm.getCas();
-            extra.feature.exptime = itm.getExptime();
-            extra.feature.locked = false;
-            extra.feature.resident = true;
+        markReferenced();
+        if (!isSmall()) {
+            setCas(itm.getCas());
+            exptime = itm.getExptime();
             extra.feature.lock_expiry = 0;
-            extra.feature.keylen = itm.getKey().length();
             extra.feature.seqno = itm.getSeqno();
+            setBySeqno(itm.getBySeqno());
         }
 
+        assignValue(itm.getValue());
+
         if (setDirty) {
             markDirty();
         } else {
@@ -617,31 +784,84 @@ private:
         }
 
         increaseCacheSize(ht, size());
-        increaseCurrentSize(stats, size() - value->length());
+        increaseCurrentSize(stats, size() - externalValLength());
     }
 
-    void setResident() {
-        if (!_isSmall) {
-            extra.feature.resident = 1;
+    static const uint8_t NO_INLINE_VALUE = 0xff;
+
+    const char *inlineData() const {
+        return getKeyBytes() + getKeyLen();
+    }
+
+    /**
+     * Take the given value, inline if it fits.
+     */
+    void assignValue(const value_t &v) {
+        if (v && v->length() <= inlineCap) {
+            std::memcpy(const_cast<char*>(inlineData()), v->getData(), v->length());
+            inlineLen = static_cast<uint8_t>(v->length());
+            value.reset();
+        } else {
+            clearInlineValue();
+            value = v;
         }
     }
 
+    void clearInlineValue() {
+        inlineLen = NO_INLINE_VALUE;
+    }
+
+    // The bits of the flag word.  It's written under the bucket lock,
+    // except for the referenced bit, which is set and cleared with
+    // atomic operations; a plain write racing with one of those may
+    // only lose the referenced bit, which merely costs a second chance.
+    static const uint32_t DIRTINESS_MASK  = 0x07ffffff; // time >> 2
+    static const uint32_t SMALL_BIT       = 1u << 27;
+    static const uint32_t DIRTY_BIT       = 1u << 28;
+    static const uint32_t RESIDENT_BIT    = 1u << 29;
+    static const uint32_t UNCOMMITTED_BIT = 1u << 30;
+    static const uint32_t REFERENCED_BIT  = 1u << 31;
+
+    bool isSmall() const {
+        return (bits & SMALL_BIT) != 0;
+    }
+
+    uint32_t getDirtiness() const {
+        return bits & DIRTINESS_MASK;
+    }
+
+    void setDirtiness(uint32_t d) {
+        bits = (bits & ~DIRTINESS_MASK) | (d & DIRTINESS_MASK);
+    }
+
+    void setResident() {
+        bits |= RESIDENT_BIT;
+    }
+
+    /**
+     * Keep the current value alive for lock-free readers that may be
+     * taking a reference to it while we replace it.
+     */
+    void retainForReaders(HashTable &ht);
+
     void timestampEviction() {
         assert(!isResident());
-        dirtiness = ep_current_time() >> 2;
+        setDirtiness(ep_current_time() >> 2);
     }
 
     friend class HashTable;
     friend class StoredValueFactory;
 
-    value_t            value;          // 16 bytes
+    SingleThreadedRCPtr<Blob> value;   // 8 bytes
     StoredValue        *next;          // 8 bytes
     int64_t            id;             // 8 bytes
-    uint32_t           dirtiness : 30; // 30 bits -+
-    bool               _isSmall  :  1; // 1 bit    | 4 bytes
-    bool               _isDirty  :  1; // 1 bit  --+
+    uint32_t           bits;           // 4 bytes (see below)
     uint32_t           flags;          // 4 bytes
+    uint32_t           exptime;        // 4 bytes (featured only)
     Atomic<uint8_t>    replicas;       // 1 byte
+    uint8_t            keylen;         // 1 byte
+    uint8_t            inlineCap;      // 1 byte (0 if no inline area)
+    uint8_t            inlineLen;      // 1 byte (NO_INLINE_VALUE if none)
 
 
     union stored_value_bodies extra;
@@ -654,6 +874,7 @@ private:
     static void reduceCurrentSize(EPStats&, size_t by);
     static bool hasAvailableSpace(EPStats&, const Item &item);
     static double mutation_mem_threshold;
+    static size_t maxInlineValueSize;
 
     DISALLOW_COPY_AND_ASSIGN(StoredValue);
 };
@@ -763,7 +984,7 @@ public:
     void visit(StoredValue *v) {
         ++numTotal;
         memSize += v->size();
-        valSize += v->isDeleted() ? 0 : v->getValue()->length();
+        valSize += v->externalValLength();
 
         if (v->isResident()) {
             cacheSize += v->size();
@@ -813,6 +1034,14 @@ enum stored_value_type {
     featured                    //!< Full featured stored values.
 };
 
+/**
+ * Ways of laying out the buckets of a hash table.
+ */
+enum hash_table_layout {
+    chained_layout,             //!< One chain of items per bucket.
+    grouped_layout              //!< Fingerprinted groups of item slots.
+};
+
 /**
  * Creator of StoredValue instances.
  */
@@ -856,8 +1085,17 @@ private:
         assert(key.length() < 256);
         size_t len = key.length() + base;
 
-        StoredValue *t = new (::operator new(len))
-            StoredValue(itm, n, *stats, ht, setDirty, small);
+        size_t inlineCap = 0;
+        if (itm.getValue()) {
+            inlineCap = StoredValue::inlineCapacityFor(key.length(),
+                                                       itm.getValue()->length());
+        }
+        if (inlineCap > 0) {
+            len += inlineCap;
+        }
+
+        StoredValue *t = new (SlabAllocator::allocate(len))
+            StoredValue(itm, n, *stats, ht, setDirty, small, inlineCap);
         if (small) {
             std::memcpy(t->extra.small.keybytes, key.data(), key.length());
         } else {
@@ -887,39 +1125,57 @@ public:
      * @param t the type of StoredValues this hash table will contain
      */
     HashTable(EPStats &st, size_t s = 0, size_t l = 0,
-              enum stored_value_type t = featured) : stats(st), valFact(st, t) {
-        size = HashTable::getNumBuckets(s);
+              enum stored_value_type t = featured) : stats(st), valFact(st, t),
+                                                     expiryIndex(st) {
+        size_t size = HashTable::getNumBuckets(s);
         n_locks = HashTable::getNumLocks(l);
+        resizeStep = defaultResizeStep;
         valFact = StoredValueFactory(st, getDefaultStorageValueType());
+        grouped = defaultLayout == grouped_layout;
+        if (grouped) {
+            size = roundToPowerOfTwo(size);
+        }
         assert(size > 0);
         assert(n_locks > 0);
         assert(visitors == 0);
-        values = static_cast<StoredValue**>(calloc(size, sizeof(StoredValue*)));
-        mutexes = new Mutex[n_locks];
+        activeTable = 0;
+        tables[0] = allocTable(size);
+        sizes[0] = size;
+        tables[1] = NULL;
+        sizes[1] = 0;
+        migrateCursor = 0;
+        mutexes = new RWLock[n_locks];
+        for (size_t i = 0; i < n_locks; ++i) {
+            mutexes[i].readersShare(defaultRWLocks);
+        }
+        epochs = defaultLockFreeReads ? new EpochManager() : NULL;
         activeState = true;
     }
 
     ~HashTable() {
         clear(true);
-        // Wait for any outstanding visitors to finish.
-        while (visitors > 0) {
+        // Wait for any outstanding visitors or migrations to finish.
+        while (visitors > 0 || migrating) {
             usleep(100);
         }
         delete []mutexes;
-        free(values);
-        values = NULL;
+        delete epochs;
+        free(tables[0]);
+        free(tables[1]);
+        tables[0] = tables[1] = NULL;
     }
 
     size_t memorySize() {
         return sizeof(HashTable)
-            + (size * sizeof(StoredValue*))
-            + (n_locks * sizeof(Mutex));
+            + ((sizes[0] + sizes[1]) * bucketSize())
+            + (n_locks * sizeof(RWLock))
+            + (epochs ? sizeof(EpochManager) : 0);
     }
 
     /**
      * Get the number of hash table buckets this hash table has.
      */
-    size_t getSize(void) { return size; }
+    size_t getSize(void) { return sizes[activeTable]; }
 
     /**
      * Get the number of locks in this hash table.
@@ -931,6 +1187,18 @@ public:
      */
     size_t getNumItems(void) { return numItems; }
 
+    /**
+     * Get the number of items standing in for keys that are missing
+     * from disk as well.
+     */
+    size_t getNumTempItems(void) { return numTempItems; }
+
+    /**
+     * Get the number of items evicted from this hash table altogether
+     * that are still on disk.
+     */
+    size_t getNumEvictedItems(void) { return numEvictedItems; }
+
     /**
      * Get the number of non-resident items within this hash table.
      */
@@ -967,9 +1235,96 @@ public:
 
     /**
      * Resize to the specified size.
+     *
+     * When incremental resizing is enabled this only sets up the new
+     * bucket array; the items are moved over by subsequent calls to
+     * migrateBuckets.
      */
     void resize(size_t to);
 
+    /**
+     * Move up to the given number of buckets from the old bucket
+     * array into the new one while an incremental resize is in
+     * progress.
+     *
+     * Only the locks covering the buckets being moved are held, and
+     * nothing is moved while a visitor is walking the table.
+     *
+     * @param n the maximum number of buckets to migrate
+     * @param foreground true if called on behalf of a front-end operation
+     * @return the number of buckets migrated
+     */
+    size_t migrateBuckets(size_t n, bool foreground = false);
+
+    /**
+     * True if an incremental resize is in progress.
+     */
+    bool isResizing() { return resizing; }
+
+    /**
+     * Get the size this hash table is being resized to (or the
+     * current size if no resize is in progress).
+     */
+    size_t getResizeTarget() {
+        return resizing ? sizes[activeTable ^ 1] : getSize();
+    }
+
+    /**
+     * Get the number of buckets of the old array already migrated by
+     * the incremental resize in progress.
+     */
+    size_t getResizeProgress() { return resizing ? migrateCursor.get() : 0; }
+
+    /**
+     * Get the total number of buckets moved by incremental resizes.
+     */
+    size_t getNumMigratedBuckets() { return numMigratedBuckets; }
+
+    /**
+     * Get the number of buckets moved by front-end operations.
+     */
+    size_t getNumForegroundMigrations() { return numFgMigrations; }
+
+    /**
+     * Set the number of buckets migrated per incremental resize step
+     * (0 disables incremental resizing).
+     */
+    void setResizeStep(size_t to) { resizeStep = to; }
+
+    /**
+     * Get the number of buckets migrated per incremental resize step.
+     */
+    size_t getResizeStep() { return resizeStep; }
+
+    /**
+     * True if this hash table supports lockFreeGet.
+     */
+    bool usesLockFreeReads() { return epochs != NULL; }
+
+    /**
+     * Get a copy of a resident item without taking any locks.
+     *
+     * This only covers the common case: the item exists, is resident,
+     * unlocked and not expired, and no writer touched its bucket while
+     * it was being copied.  Anything else returns NULL and the caller
+     * should repeat the lookup under the bucket lock.  Unlike a locked
+     * lookup this doesn't refresh the item's access time or reference
+     * bit.
+     *
+     * @param key the key to look up
+     * @param vbucket the vbucket to stamp on the item
+     * @param asOf the time to check the item's expiry against
+     * @param sv output parameter to receive the StoredValue found
+     * @return a new Item, or NULL to fall back to a locked lookup
+     */
+    Item *lockFreeGet(const std::string &key, uint16_t vbucket,
+                      time_t asOf, StoredValue **sv);
+
+    /**
+     * Get the number of lockFreeGet calls that had to fall back.
+     */
+    size_t getNumLockFreeFallbacks() { return numLockFreeFallbacks; }
+
     /**
      * Find the item with the given key.
      *
@@ -979,7 +1334,7 @@ public:
     StoredValue *find(std::string &key) {
         assert(isActive());
         int bucket_num(0);
-        LockHolder lh = getLockedBucket(key, &bucket_num);
+        ReaderLockHolder rlh = getReadLockedBucket(key, &bucket_num);
         return unlocked_find(key, bucket_num);
     }
 
@@ -997,13 +1352,90 @@ public:
             return false;
         }
 
-        StoredValue *v = valFact(itm, values[bucket_num], *this);
+        StoredValue *v = valFact(itm, NULL, *this);
         assert(v);
-        values[bucket_num] = v;
+        linkValue(bucket_num, v);
         ++numItems;
         if (op == queue_op_del) {
             unlocked_softDelete(v, itm.getCas());
+        } else {
+            indexExpiry(v);
+        }
+        return true;
+    }
+
+    /**
+     * Bring an item read from disk back after it was evicted along
+     * with its key and metadata.
+     *
+     * @param itm the item as read from disk
+     * @param bucket_num the bucket of the item's key (must be locked)
+     * @return ADD_EXISTS if the key is already in memory
+     */
+    add_type_t unlocked_restoreEvicted(const Item &itm, int bucket_num) {
+        if (unlocked_find(itm.getKey(), bucket_num, true)) {
+            return ADD_EXISTS;
+        }
+        if (!StoredValue::hasAvailableSpace(stats, itm)) {
+            return ADD_NOMEM;
+        }
+        StoredValue *v = valFact(itm, NULL, *this, false);
+        linkValue(bucket_num, v);
+        ++numItems;
+        --numEvictedItems;
+        indexExpiry(v);
+        return ADD_SUCCESS;
+    }
+
+    /**
+     * Remember that a key which isn't in memory isn't on disk either,
+     * by adding a clean deleted item for it.
+     *
+     * @param key the key that wasn't found on disk
+     * @param bucket_num the bucket of the key (must be locked)
+     * @return false if the key is already in memory
+     */
+    bool unlocked_addTempDeleted(const std::string &key, int bucket_num) {
+        if (unlocked_find(key, bucket_num, true)) {
+            return false;
+        }
+        Item itm(key, 0, 0, value_t(NULL));
+        StoredValue *v = valFact(itm, NULL, *this, false);
+        v->markTempItem();
+        linkValue(bucket_num, v);
+        ++numItems;
+        ++numTempItems;
+        // The next expiry run drops it again.
+        expiryIndex.add(hash(key), ep_real_time());
+        return true;
+    }
+
+    /**
+     * Drop a clean item from memory altogether, key and metadata
+     * included.  The item itself stays on disk.
+     *
+     * Items whose last write isn't committed aren't on disk for
+     * readers yet, so they stay.
+     *
+     * @param key the key of the item to evict
+     * @param bucket_num the bucket of the key (must be locked)
+     * @return true if the item was evicted
+     */
+    bool unlocked_evictItem(const std::string &key, int bucket_num) {
+        assert(isActive());
+        StoredValue *v = unlocked_find(key, bucket_num, true);
+        if (!v || !v->isClean() || !v->isCommitted() || v->isPendingId() ||
+            v->isLocked(ep_current_time())) {
+            return false;
+        }
+        if (!v->isResident()) {
+            --numNonResidentItems;
+        }
+        if (!v->isDeleted()) {
+            ++numEvictedItems;
         }
+        unlocked_remove(v, bucket_num);
+        ++numEjects;
         return true;
     }
 
@@ -1022,8 +1454,9 @@ public:
         }
 
         mutation_type_t rv = NOT_FOUND;
+        time_t oldExptime(0);
         int bucket_num(0);
-        LockHolder lh = getLockedBucket(val.getKey(), &bucket_num);
+        WriterLockHolder lh = getLockedBucket(val.getKey(), &bucket_num);
         StoredValue *v = unlocked_find(val.getKey(), bucket_num, true);
         /*
          * prior to checking for the lock, we should check if this object
@@ -1061,6 +1494,8 @@ public:
             if (!v->isResident()) {
                 --numNonResidentItems;
             }
+            oldExptime = indexedExptime(v);
+            unlocked_claimTempItem(v);
             v->setValue(itm, stats, *this, false);
             row_id = v->getId();
         } else {
@@ -1069,10 +1504,11 @@ public:
             }
 
             itm.setCas();
-            v = valFact(itm, values[bucket_num], *this);
-            values[bucket_num] = v;
+            v = valFact(itm, NULL, *this);
+            linkValue(bucket_num, v);
             ++numItems;
         }
+        indexExpiry(v, oldExptime);
         return rv;
     }
 
@@ -1094,8 +1530,9 @@ public:
         }
 
         mutation_type_t rv = NOT_FOUND;
+        time_t oldExptime(0);
         int bucket_num(0);
-        LockHolder lh = getLockedBucket(val.getKey(), &bucket_num);
+        WriterLockHolder lh = getLockedBucket(val.getKey(), &bucket_num);
         StoredValue *v = unlocked_find(val.getKey(), bucket_num, true);
 
         /*
@@ -1137,15 +1574,18 @@ public:
             if (!v->isResident()) {
                 --numNonResidentItems;
             }
+            oldExptime = indexedExptime(v);
+            unlocked_claimTempItem(v);
             v->setValue(itm, stats, *this, true);
             row_id = v->getId();
         } else if (cas != 0) {
-            rv = NOT_FOUND;
+            return NOT_FOUND;
         } else {
-            v = valFact(itm, values[bucket_num], *this);
-            values[bucket_num] = v;
+            v = valFact(itm, NULL, *this);
+            linkValue(bucket_num, v);
             ++numItems;
         }
+        indexExpiry(v, oldExptime);
         return rv;
     }
 
@@ -1170,16 +1610,17 @@ public:
         assert(itm.getCas() != static_cast<uint64_t>(-1));
 
         mutation_type_t rv = NOT_FOUND;
+        time_t oldExptime(0);
         int bucket_num(0);
-        LockHolder lh = getLockedBucket(itm.getKey(), &bucket_num);
+        WriterLockHolder lh = getLockedBucket(itm.getKey(), &bucket_num);
         StoredValue *v = unlocked_find(itm.getKey(), bucket_num, true);
 
         if (v == NULL) {
-            v = valFact(itm, values[bucket_num], *this);
+            v = valFact(itm, NULL, *this);
             if (partial) {
-                v->extra.feature.resident = false;
+                v->bits &= ~StoredValue::RESIDENT_BIT;
             }
-            values[bucket_num] = v;
+            linkValue(bucket_num, v);
             ++numItems;
         } else {
             if (partial) {
@@ -1196,10 +1637,13 @@ public:
                 --numNonResidentItems;
             }
 
+            oldExptime = indexedExptime(v);
+            unlocked_claimTempItem(v);
             v->setValue(const_cast<Item&>(itm), stats, *this, true);
         }
 
         v->markClean(NULL);
+        indexExpiry(v, oldExptime);
 
         if (eject && !partial) {
             v->ejectValue(stats, *this);
@@ -1219,9 +1663,10 @@ public:
     add_type_t add(const Item &val, bool isDirty = true, bool storeVal = true) {
         assert(isActive());
         int bucket_num(0);
-        LockHolder lh = getLockedBucket(val.getKey(), &bucket_num);
+        WriterLockHolder lh = getLockedBucket(val.getKey(), &bucket_num);
         StoredValue *v = unlocked_find(val.getKey(), bucket_num, true);
         add_type_t rv = ADD_SUCCESS;
+        time_t oldExptime(0);
         if (v && !v->isDeleted() && !v->isExpired(ep_real_time())) {
             rv = ADD_EXISTS;
         } else {
@@ -1232,6 +1677,8 @@ public:
             }
             if (v) {
                 rv = (v->isDeleted() || v->isExpired(ep_real_time())) ? ADD_UNDEL : ADD_SUCCESS;
+                oldExptime = indexedExptime(v);
+                unlocked_claimTempItem(v);
                 v->setValue(itm, stats, *this, false);
                 if (isDirty) {
                     v->markDirty();
@@ -1239,13 +1686,14 @@ public:
                     v->markClean(NULL);
                 }
             } else {
-                v = valFact(itm, values[bucket_num], *this, isDirty);
-                values[bucket_num] = v;
+                v = valFact(itm, NULL, *this, isDirty);
+                linkValue(bucket_num, v);
                 ++numItems;
             }
             if (!storeVal) {
                 v->ejectValue(stats, *this);
             }
+            indexExpiry(v, oldExptime);
         }
 
         return rv;
@@ -1263,7 +1711,7 @@ public:
                                int64_t &row_id) {
         assert(isActive());
         int bucket_num(0);
-        LockHolder lh = getLockedBucket(key, &bucket_num);
+        WriterLockHolder lh = getLockedBucket(key, &bucket_num);
         StoredValue *v = unlocked_find(key, bucket_num);
         if (v) {
             row_id = v->getId();
@@ -1327,16 +1775,20 @@ public:
      */
     StoredValue *unlocked_find(const std::string &key, int bucket_num,
                                bool wantsDeleted=false) {
-        StoredValue *v = values[bucket_num];
-        while (v) {
-            if (v->hasKey(key)) {
-                if (wantsDeleted || !v->isDeleted()) {
-                    return v;
-                } else {
-                    return NULL;
-                }
+        StoredValue *v;
+        if (grouped) {
+            int table(0);
+            int b = decodeBucket(bucket_num, &table);
+            assert(b < static_cast<int>(sizes[table]));
+            v = findInGroup(groupsIn(table)[b], key, hash(key));
+        } else {
+            v = bucketHead(bucket_num);
+            while (v && !v->hasKey(key)) {
+                v = v->next;
             }
-            v = v->next;
+        }
+        if (v && (wantsDeleted || !v->isDeleted())) {
+            return v;
         }
         return NULL;
     }
@@ -1351,6 +1803,10 @@ public:
      */
     inline int hash(const char *str, const size_t len) {
         assert(isActive());
+        if (grouped) {
+            uint64_t h64 = hash64(str, len);
+            return static_cast<int>(h64 ^ (h64 >> 32));
+        }
         int h=5381;
 
         for(size_t i=0; i < len; i++) {
@@ -1370,23 +1826,66 @@ public:
         return hash(s.data(), s.length());
     }
 
+    /**
+     * MurmurHash64A, used for the grouped layout and the Bloom filters.
+     */
+    static uint64_t hash64(const char *str, size_t len) {
+        const uint64_t m = 0xc6a4a7935bd1e995ULL;
+        const int r = 47;
+        uint64_t h = 0x9747b28c ^ (len * m);
+
+        const char *end = str + (len & ~static_cast<size_t>(7));
+        for (; str != end; str += 8) {
+            uint64_t k;
+            std::memcpy(&k, str, sizeof(k));
+            k *= m;
+            k ^= k >> r;
+            k *= m;
+            h ^= k;
+            h *= m;
+        }
+
+        const unsigned char *tail = reinterpret_cast<const unsigned char*>(str);
+        switch (len & 7) {
+        case 7:
+            h ^= static_cast<uint64_t>(tail[6]) << 48;
+            // FALLTHROUGH
+        case 6:
+            h ^= static_cast<uint64_t>(tail[5]) << 40;
+            // FALLTHROUGH
+        case 5:
+            h ^= static_cast<uint64_t>(tail[4]) << 32;
+            // FALLTHROUGH
+        case 4:
+            h ^= static_cast<uint64_t>(tail[3]) << 24;
+            // FALLTHROUGH
+        case 3:
+            h ^= static_cast<uint64_t>(tail[2]) << 16;
+            // FALLTHROUGH
+        case 2:
+            h ^= static_cast<uint64_t>(tail[1]) << 8;
+            // FALLTHROUGH
+        case 1:
+            h ^= static_cast<uint64_t>(tail[0]);
+            h *= m;
+        }
+
+        h ^= h >> r;
+        h *= m;
+        h ^= h >> r;
+        return h;
+    }
+
     /**
      * Get a lock holder holding a lock for the bucket for the given
      * hash.
      *
      * @param h the input hash
      * @param bucket output parameter to receive a bucket
-     * @return a locked LockHolder
+     * @return a locked WriterLockHolder
      */
-    inline LockHolder getLockedBucket(int h, int *bucket) {
-        while (true) {
-            assert(isActive());
-            *bucket = getBucketForHash(h);
-            LockHolder rv(mutexes[mutexForBucket(*bucket)]);
-            if (*bucket == getBucketForHash(h)) {
-                return rv;
-            }
-        }
+    inline WriterLockHolder getLockedBucket(int h, int *bucket) {
+        return lockBucket<WriterLockHolder>(h, bucket);
     }
 
     /**
@@ -1396,9 +1895,9 @@ public:
      * @param s the start of the key
      * @param n the size of the key
      * @param bucket output parameter to receive a bucket
-     * @return a locked LockHolder
+     * @return a locked WriterLockHolder
      */
-    inline LockHolder getLockedBucket(const char *s, size_t n, int *bucket) {
+    inline WriterLockHolder getLockedBucket(const char *s, size_t n, int *bucket) {
         return getLockedBucket(hash(s, n), bucket);
     }
 
@@ -1408,12 +1907,40 @@ public:
      *
      * @param s the key
      * @param bucket output parameter to receive a bucket
-     * @return a locked LockHolder
+     * @return a locked WriterLockHolder
      */
-    inline LockHolder getLockedBucket(const std::string &s, int *bucket) {
+    inline WriterLockHolder getLockedBucket(const std::string &s, int *bucket) {
         return getLockedBucket(hash(s.data(), s.size()), bucket);
     }
 
+    /**
+     * Get a lock holder holding a shared lock for the bucket for the
+     * given hash.
+     *
+     * Other readers may hold the same bucket concurrently (when the
+     * table uses reader/writer locks), so the caller must not modify
+     * the bucket's chain or its items' state through this lock.
+     *
+     * @param h the input hash
+     * @param bucket output parameter to receive a bucket
+     * @return a locked ReaderLockHolder
+     */
+    inline ReaderLockHolder getReadLockedBucket(int h, int *bucket) {
+        return lockBucket<ReaderLockHolder>(h, bucket);
+    }
+
+    /**
+     * Get a lock holder holding a shared lock for the bucket for the
+     * hash of the given key.
+     *
+     * @param s the key
+     * @param bucket output parameter to receive a bucket
+     * @return a locked ReaderLockHolder
+     */
+    inline ReaderLockHolder getReadLockedBucket(const std::string &s, int *bucket) {
+        return getReadLockedBucket(hash(s.data(), s.size()), bucket);
+    }
+
     /**
      * Delete a key from the cache without trying to lock the cache first
      * (Please note that you <b>MUST</b> acquire the mutex before calling
@@ -1425,48 +1952,15 @@ public:
      */
     bool unlocked_del(const std::string &key, int bucket_num) {
         assert(isActive());
-        StoredValue *v = values[bucket_num];
-
-        // Special case empty bucket.
+        StoredValue *v = unlocked_find(key, bucket_num, true);
         if (!v) {
             return false;
         }
-
-        // Special case the first one
-        if (v->hasKey(key)) {
-            if (!v->isDeleted() && v->isLocked(ep_current_time())) {
-                return false;
-            }
-            values[bucket_num] = v->next;
-            size_t currSize = v->size();
-            v->reduceCacheSize(*this, currSize);
-            v->reduceCurrentSize(stats,
-                                 v->isDeleted() ? currSize : currSize - v->getValue()->length());
-            delete v;
-            --numItems;
-            return true;
-        }
-
-        while (v->next) {
-            if (v->next->hasKey(key)) {
-                StoredValue *tmp = v->next;
-                if (!tmp->isDeleted() && tmp->isLocked(ep_current_time())) {
-                    return false;
-                }
-                v->next = v->next->next;
-                size_t currSize = tmp->size();
-                tmp->reduceCacheSize(*this, currSize);
-                tmp->reduceCurrentSize(stats,
-                               tmp->isDeleted() ? currSize : currSize - tmp->getValue()->length());
-                delete tmp;
-                --numItems;
-                return true;
-            } else {
-                v = v->next;
-            }
+        if (!v->isDeleted() && v->isLocked(ep_current_time())) {
+            return false;
         }
-
-        return false;
+        unlocked_remove(v, bucket_num);
+        return true;
     }
 
     /**
@@ -1478,7 +1972,7 @@ public:
     bool del(const std::string &key) {
         assert(isActive());
         int bucket_num(0);
-        LockHolder lh = getLockedBucket(key, &bucket_num);
+        WriterLockHolder lh = getLockedBucket(key, &bucket_num);
         return unlocked_del(key, bucket_num);
     }
 
@@ -1487,6 +1981,58 @@ public:
      */
     void visit(HashTableVisitor &visitor);
 
+    /**
+     * Visit items like visit(), but start where the last sweep
+     * stopped, go round the table once at most, and stop as soon as
+     * the visitor no longer wants to continue (checked between lock
+     * stripes).  This is the clock hand of the item pager.
+     */
+    void sweep(HashTableVisitor &visitor);
+
+    /**
+     * Note that the given item now expires at its expiry time.
+     * Everything that stores an item does this already; the bucket
+     * should be locked.
+     *
+     * @param v the item
+     * @param oldExptime the expiry time it was indexed with before
+     *                   (see indexedExptime())
+     */
+    void indexExpiry(StoredValue *v, time_t oldExptime = 0) {
+        if (v->getExptime() != oldExptime) {
+            expiryIndex.add(hash(v->getKeyBytes(), v->getKeyLen()),
+                            v->getExptime());
+        }
+    }
+
+    /**
+     * The expiry time the given item is in the index with; deleted
+     * items aren't in it.
+     */
+    static time_t indexedExptime(StoredValue *v) {
+        return v->isDeleted() ? 0 : v->getExptime();
+    }
+
+    /**
+     * Take out the keys of the items that have expired as of the given
+     * time.  Stand-ins for missing keys show up too.
+     *
+     * The index only has the hashes of the keys, so the items of each
+     * hash that came due are looked at in their bucket, and only those
+     * still expired are taken.
+     *
+     * @return the number of keys added to out
+     */
+    size_t popExpiredKeys(time_t now, std::vector<std::string> &out);
+
+    /**
+     * Get the number of entries in the expiry index.  An item has one
+     * more for each time its expiry time changed before coming due.
+     */
+    size_t getExpiryIndexSize() {
+        return expiryIndex.size();
+    }
+
     /**
      * Visit all items within this call with a depth visitor.
      */
@@ -1516,6 +2062,62 @@ public:
      */
     static void setDefaultNumLocks(size_t);
 
+    /**
+     * Set the default number of buckets migrated per incremental
+     * resize step (0 disables incremental resizing).
+     */
+    static void setDefaultResizeStep(size_t);
+
+    /**
+     * Set whether new hash tables let lookups share their bucket
+     * locks (otherwise readers exclude each other, too).
+     */
+    static void setDefaultRWLocks(bool);
+
+    /**
+     * Set whether new hash tables support lockFreeGet.
+     */
+    static void setDefaultLockFreeReads(bool);
+
+    /**
+     * Hold on to a value an item is letting go of until lock-free
+     * readers that may have seen it are done.  A no-op unless this
+     * table serves lock-free reads.
+     */
+    void keepForReaders(Blob *b) {
+        if (epochs && b) {
+            epochs->retire(new value_t(b), releaseValueRef);
+        }
+    }
+
+    /**
+     * Set the bucket layout of new hash tables by name.
+     *
+     * @param l either "chained" or "grouped"
+     *
+     * @return false if the layout is unknown
+     */
+    static bool setDefaultLayout(const char *l);
+
+    /**
+     * Set the bucket layout of new hash tables.
+     */
+    static void setDefaultLayout(enum hash_table_layout);
+
+    /**
+     * Get the bucket layout of this hash table.
+     */
+    enum hash_table_layout getLayout() {
+        return grouped ? grouped_layout : chained_layout;
+    }
+
+    /**
+     * True if lookups in this hash table share their bucket locks.
+     */
+    bool usesRWLocks() {
+        return mutexes[0].readersShare();
+    }
+
     /**
      * Set the stored value type by name.
      *
@@ -1541,6 +2143,8 @@ public:
     static const char* getDefaultStorageValueTypeStr();
 
     Atomic<size_t>       numNonResidentItems;
+    Atomic<size_t>       numTempItems;
+    Atomic<size_t>       numEvictedItems;
     Atomic<size_t>       numEjects;
     //! Memory consumed by items in this hashtable.
     Atomic<size_t>       memSize;
@@ -1549,12 +2153,17 @@ public:
 
 private:
     inline bool isActive() const { return activeState; }
+
     inline void setActiveState(bool newv) { activeState = newv; }
 
-    size_t               size;
     size_t               n_locks;
-    StoredValue        **values;
-    Mutex               *mutexes;
+    //! Bucket arrays (of chain heads or BucketGroups depending on the
+    //! layout); only tables[activeTable] is live unless resizing.
+    void                *tables[2];
+    bool                 grouped;
+    size_t               sizes[2];
+    int                  activeTable;
+    RWLock              *mutexes;
     EPStats&             stats;
     StoredValueFactory   valFact;
     Atomic<size_t>       visitors;
@@ -1562,23 +2171,260 @@ private:
     Atomic<size_t>       numResizes;
     bool                 activeState;
 
+    //! True while items are being moved to tables[activeTable ^ 1].
+    Atomic<bool>         resizing;
+    //! Held by whoever is currently migrating buckets.
+    Atomic<bool>         migrating;
+    //! Buckets of the active table below this have been migrated.
+    Atomic<size_t>       migrateCursor;
+    //! Odd while the table layout (sizes, activeTable) is changing.
+    Atomic<uint32_t>     layoutSeqno;
+    size_t               resizeStep;
+    Atomic<size_t>       numMigratedBuckets;
+    Atomic<size_t>       numFgMigrations;
+    //! Defers frees for lock-free readers; NULL unless enabled.
+    EpochManager        *epochs;
+    Atomic<size_t>       numLockFreeFallbacks;
+    //! The lock stripe the next sweep starts at.
+    Atomic<size_t>       clockHand;
+    ExpiryIndex          expiryIndex;
+
     static size_t                 defaultNumBuckets;
     static size_t                 defaultNumLocks;
+    static size_t                 defaultResizeStep;
+    static bool                   defaultRWLocks;
+    static bool                   defaultLockFreeReads;
+    static enum hash_table_layout defaultLayout;
     static enum stored_value_type defaultStoredValueType;
 
+    // Bucket numbers handed out to callers encode the table they
+    // refer to, so they stay valid when the tables trade places at
+    // the end of an incremental resize.
+    static int encodeBucket(int table, int b) {
+        return table == 0 ? b : -b - 1;
+    }
+
+    static int decodeBucket(int bucket_num, int *table) {
+        if (bucket_num >= 0) {
+            *table = 0;
+            return bucket_num;
+        }
+        *table = 1;
+        return -bucket_num - 1;
+    }
+
+    inline StoredValue *&bucketHead(int bucket_num) {
+        int table(0);
+        int b = decodeBucket(bucket_num, &table);
+        assert(tables[table]);
+        assert(b < static_cast<int>(sizes[table]));
+        return chainsIn(table)[b];
+    }
+
+    inline int bucketIn(int h, size_t sz) {
+        if (grouped) {
+            // Group counts are powers of two.
+            return static_cast<int>(static_cast<unsigned int>(h) & (sz - 1));
+        }
+        return abs(h % static_cast<int>(sz));
+    }
+
+    static const int GROUP_SLOTS = 13;
+
+    /**
+     * A bucket of the grouped layout.  Items go into the first free
+     * slot, tagged with a fingerprint of their hash so a lookup only
+     * compares keys of the slots whose tag matches; the rare item that
+     * doesn't fit goes on the overflow chain.  Tags of free slots are
+     * zero.  Exactly two cache lines.
+     */
+    struct BucketGroup {
+        uint8_t      tags[16];
+        StoredValue *slots[GROUP_SLOTS];
+        StoredValue *overflow;
+    };
+
+    static uint8_t tagFor(int h) {
+        // The high bits; bucketIn() uses the low ones.
+        return 0x80 | (static_cast<uint32_t>(h) >> 25);
+    }
+
+    static size_t roundToPowerOfTwo(size_t n) {
+        size_t rv = 1;
+        while (rv < n) {
+            rv <<= 1;
+        }
+        return rv;
+    }
+
+    StoredValue **chainsIn(int table) {
+        assert(!grouped);
+        return static_cast<StoredValue**>(tables[table]);
+    }
+
+    BucketGroup *groupsIn(int table) {
+        assert(grouped);
+        return static_cast<BucketGroup*>(tables[table]);
+    }
+
+    size_t bucketSize() {
+        return grouped ? sizeof(BucketGroup) : sizeof(StoredValue*);
+    }
+
+    void *allocTable(size_t n);
+    StoredValue *findInGroup(BucketGroup &g, const std::string &key, int h);
+    void linkInto(void *table, int b, int h, StoredValue *v);
+    void unlinkFrom(void *table, int b, StoredValue *v);
+    void clearBucket(void *table, int b);
+
+    void linkValue(int bucket_num, StoredValue *v) {
+        int table(0);
+        int b = decodeBucket(bucket_num, &table);
+        assert(b < static_cast<int>(sizes[table]));
+        linkInto(tables[table], b,
+                 grouped ? hash(v->getKeyBytes(), v->getKeyLen()) : 0, v);
+    }
+
+    /**
+     * Walks the items of one bucket of either layout.  The item last
+     * returned may be unlinked or moved before asking for the next.
+     */
+    class BucketWalker {
+    public:
+        BucketWalker(HashTable &ht, void *table, int b) : group(NULL), slot(0) {
+            if (ht.grouped) {
+                group = static_cast<BucketGroup*>(table) + b;
+                chain = NULL;
+            } else {
+                chain = static_cast<StoredValue**>(table)[b];
+            }
+        }
+
+        StoredValue *next() {
+            if (group) {
+                while (slot < GROUP_SLOTS) {
+                    StoredValue *v = group->slots[slot++];
+                    if (v) {
+                        return v;
+                    }
+                }
+                if (slot == GROUP_SLOTS) {
+                    chain = group->overflow;
+                    ++slot;
+                }
+            }
+            StoredValue *v = chain;
+            if (v) {
+                chain = v->next;
+            }
+            return v;
+        }
+
+    private:
+        BucketGroup *group;
+        StoredValue *chain;
+        int          slot;
+    };
+
     int getBucketForHash(int h) {
-        return abs(h % static_cast<int>(size));
+        while (true) {
+            uint32_t seqno = layoutSeqno;
+            if (seqno & 1) {
+                sched_yield();
+                continue;
+            }
+            ep_sync_synchronize();
+            int t = activeTable;
+            int b = bucketIn(h, sizes[t]);
+            if (resizing && b < static_cast<int>(migrateCursor.get())) {
+                t ^= 1;
+                b = bucketIn(h, sizes[t]);
+            }
+            ep_sync_synchronize();
+            if (seqno == layoutSeqno) {
+                return encodeBucket(t, b);
+            }
+        }
+    }
+
+    template <typename H>
+    inline H lockBucket(int h, int *bucket) {
+        if (resizing) {
+            migrateBuckets(1, true);
+        }
+        while (true) {
+            assert(isActive());
+            *bucket = getBucketForHash(h);
+            H rv(mutexes[mutexForBucket(*bucket)]);
+            if (*bucket == getBucketForHash(h)) {
+                return rv;
+            }
+        }
     }
 
     inline int mutexForBucket(int bucket_num) {
         assert(isActive());
-        assert(bucket_num >= 0);
-        int lock_num = bucket_num % static_cast<int>(n_locks);
+        int table(0);
+        int lock_num = decodeBucket(bucket_num, &table) % static_cast<int>(n_locks);
         assert(lock_num < static_cast<int>(n_locks));
         assert(lock_num >= 0);
         return lock_num;
     }
 
+    // Link a fully initialized item in; lock-free readers may follow
+    // the new pointer right away.
+    static void publish(StoredValue *&slot, StoredValue *v) {
+        ep_sync_synchronize();
+        slot = v;
+    }
+
+    static void reclaimValue(void *p);
+    static void releaseValueRef(void *p);
+
+    // Unlink the given item from its (locked) bucket and free it.
+    void unlocked_remove(StoredValue *v, int bucket_num) {
+        int table(0);
+        int b = decodeBucket(bucket_num, &table);
+        unlinkFrom(tables[table], b, v);
+        size_t currSize = v->size();
+        v->reduceCacheSize(*this, currSize);
+        v->reduceCurrentSize(stats,
+                             currSize - v->externalValLength());
+        if (v->isTempItem()) {
+            --numTempItems;
+        }
+        freeValue(v);
+        --numItems;
+    }
+
+    // A stored item takes the place of a missing key's stand-in.
+    void unlocked_claimTempItem(StoredValue *v) {
+        if (v->isTempItem()) {
+            v->clearId();
+            --numTempItems;
+        }
+    }
+
+    void freeValue(StoredValue *v) {
+        if (epochs) {
+            epochs->retire(v, reclaimValue);
+        } else {
+            delete v;
+        }
+    }
+
+    void freeTable(void *t) {
+        if (epochs) {
+            epochs->retire(t, free);
+        } else {
+            free(t);
+        }
+    }
+
+    void startIncrementalResize(size_t newSize);
+    bool migrateNextBucket();
+    void waitForMigration();
+
     DISALLOW_COPY_AND_ASSIGN(HashTable);
 };
 
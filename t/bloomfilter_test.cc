@@ -0,0 +1,90 @@
+#include "config.h"
+
+#include <cassert>
+#include <cstdio>
+#include <string>
+
+#include "bloomfilter.hh"
+#include "threadtests.hh"
+
+static std::string makeKey(const char *prefix, int i) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%s%d", prefix, i);
+    return std::string(buf);
+}
+
+static void testSizing() {
+    BloomFilter bf(10000, 0.01);
+    assert(bf.getKeyCapacity() == 10000);
+    // About 9.6 bits and 7 hashes per key for 1%.
+    assert(bf.getNumBits() >= 95000 && bf.getNumBits() <= 97000);
+    assert(bf.getNumHashes() == 7);
+    assert(bf.getEstimatedKeyCount() == 0);
+    assert(bf.getFalsePositiveRate() == 0.0);
+}
+
+static void testNoFalseNegatives() {
+    BloomFilter bf(10000, 0.01);
+    for (int i = 0; i < 10000; ++i) {
+        bf.addKey(makeKey("key", i));
+    }
+    for (int i = 0; i < 10000; ++i) {
+        assert(bf.maybeKeyExists(makeKey("key", i)));
+    }
+
+    size_t est = bf.getEstimatedKeyCount();
+    assert(est > 9500 && est < 10500);
+    assert(bf.getFalsePositiveRate() < 0.02);
+
+    int fp = 0;
+    for (int i = 0; i < 10000; ++i) {
+        if (bf.maybeKeyExists(makeKey("other", i))) {
+            ++fp;
+        }
+    }
+    assert(fp < 200);
+}
+
+static void testOverfull() {
+    BloomFilter bf(100, 0.01);
+    for (int i = 0; i < 1000; ++i) {
+        bf.addKey(makeKey("key", i));
+    }
+    assert(bf.getEstimatedKeyCount() > bf.getKeyCapacity());
+    assert(bf.getFalsePositiveRate() > 0.02);
+}
+
+class Adder : public Generator<bool> {
+public:
+    Adder(BloomFilter &b) : bf(b) {}
+
+    bool operator()() {
+        int id = nextId++;
+        for (int i = 0; i < 5000; ++i) {
+            bf.addKey(makeKey("key", id * 5000 + i));
+        }
+        return true;
+    }
+
+private:
+    BloomFilter &bf;
+    Atomic<int> nextId;
+};
+
+static void testConcurrentAdds() {
+    const int n = 4;
+    BloomFilter bf(n * 5000, 0.01);
+    Adder adder(bf);
+    getCompletedThreads<bool>(n, &adder);
+    for (int i = 0; i < n * 5000; ++i) {
+        assert(bf.maybeKeyExists(makeKey("key", i)));
+    }
+}
+
+int main() {
+    testSizing();
+    testNoFalseNegatives();
+    testOverfull();
+    testConcurrentAdds();
+    return 0;
+}
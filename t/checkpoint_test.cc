@@ -4,9 +4,11 @@
 #include <signal.h>
 #include <unistd.h>
 
+#include <iostream>
 #include <vector>
 #include <set>
 #include <algorithm>
+#include <limits>
 
 #include "assert.h"
 #include "queueditem.hh"
@@ -143,6 +145,415 @@ static void *launch_set_thread(void *arg) {
 }
 }
 
+#define NUM_DEDUP_KEYS 10
+#define NUM_DEDUP_UPDATES 5000
+
+/**
+ * Read the remaining items of a TAP cursor, checking that each one
+ * with a key is the latest update of it.
+ */
+static size_t drainTAPCursor(CheckpointManager *checkpoint_manager, const std::string &name,
+                             const std::vector<uint32_t> &latest) {
+    size_t numItems = 0;
+    bool isLastMutationItem;
+    std::set<std::string> keys;
+    while (true) {
+        queued_item qi = checkpoint_manager->nextItem(name, isLastMutationItem);
+        if (qi->getOperation() == queue_op_empty) {
+            break;
+        }
+        if (qi->getKey().size() > 0) {
+            assert(keys.insert(qi->getKey()).second);
+            size_t k = atoi(qi->getKey().c_str() + 4);
+            assert(qi->getFlags() == latest[k]);
+        }
+        ++numItems;
+    }
+    return numItems;
+}
+
+/**
+ * Update a few keys many times over, so that the open checkpoint is
+ * compacted while TAP cursors are in it, and check what they read.
+ */
+static void testDedupCompaction(RCPtr<VBucket> &vbucket) {
+    CheckpointManager *checkpoint_manager = new CheckpointManager(global_stats, 0,
+                                                                  checkpoint_config, 1);
+    checkpoint_manager->registerTAPCursor("tap-slow");
+    checkpoint_manager->registerTAPCursor("tap-fast");
+    size_t memOverhead = global_stats.memOverhead.get();
+
+    std::vector<uint32_t> latest(NUM_DEDUP_KEYS);
+    bool isLastMutationItem;
+    for (uint32_t i = 0; i < NUM_DEDUP_UPDATES; ++i) {
+        std::stringstream key;
+        key << "key-" << (i * 7) % NUM_DEDUP_KEYS;
+        latest[(i * 7) % NUM_DEDUP_KEYS] = i;
+        queued_item qi(new QueuedItem(key.str(), 0, queue_op_set, -1, -1, i));
+        checkpoint_manager->queueDirty(qi, vbucket);
+        if (i % 3 == 0) {
+            checkpoint_manager->nextItem("tap-fast", isLastMutationItem);
+        }
+    }
+    // The empty slots are compacted away.
+    assert(global_stats.memOverhead.get() - memOverhead <
+           4 * CHECKPOINT_CHUNK_SIZE * sizeof(queued_item));
+
+    size_t remains = checkpoint_manager->getNumItemsForTAPConnection("tap-fast");
+    assert(drainTAPCursor(checkpoint_manager, "tap-fast", latest) == remains);
+    assert(checkpoint_manager->getNumItemsForTAPConnection("tap-fast") == 0);
+
+    assert(checkpoint_manager->getNumItemsForTAPConnection("tap-slow") == NUM_DEDUP_KEYS + 1);
+    assert(drainTAPCursor(checkpoint_manager, "tap-slow", latest) == NUM_DEDUP_KEYS + 1);
+
+    std::vector<queued_item> items;
+    checkpoint_manager->getAllItemsForPersistence(items);
+    assert(items.size() == NUM_DEDUP_KEYS + 1);
+
+    checkpoint_manager->removeTAPCursor("tap-slow");
+    checkpoint_manager->removeTAPCursor("tap-fast");
+    delete checkpoint_manager;
+    assert(global_stats.memOverhead.get() < memOverhead);
+}
+
+#define NUM_TIMED_KEYS 1000
+#define NUM_TIMED_UPDATES 200000
+
+/**
+ * Time updating keys that are already in the open checkpoint, with
+ * TAP cursors spread over it, and check what is left for each cursor.
+ */
+static void timeDedup(RCPtr<VBucket> &vbucket, size_t numCursors) {
+    CheckpointManager *checkpoint_manager = new CheckpointManager(global_stats, 0,
+                                                                  checkpoint_config, 1);
+    std::vector<std::string> keys;
+    for (size_t i = 0; i < NUM_TIMED_KEYS; ++i) {
+        std::stringstream key;
+        key << "key-" << i;
+        keys.push_back(key.str());
+        queued_item qi(new QueuedItem(key.str(), 0, queue_op_set));
+        checkpoint_manager->queueDirty(qi, vbucket);
+    }
+
+    std::vector<uint32_t> latest(NUM_TIMED_KEYS);
+    bool isLastMutationItem;
+    for (size_t c = 0; c < numCursors; ++c) {
+        std::stringstream name;
+        name << "tap-" << c;
+        checkpoint_manager->registerTAPCursor(name.str());
+        for (size_t i = 0; i < c * NUM_TIMED_KEYS / numCursors; ++i) {
+            checkpoint_manager->nextItem(name.str(), isLastMutationItem);
+        }
+    }
+
+    hrtime_t start = gethrtime();
+    for (uint32_t i = 0; i < NUM_TIMED_UPDATES; ++i) {
+        size_t k = (i * 7919) % NUM_TIMED_KEYS;
+        latest[k] = i;
+        queued_item qi(new QueuedItem(keys[k], 0, queue_op_set, -1, -1, i));
+        checkpoint_manager->queueDirty(qi, vbucket);
+    }
+    hrtime_t elapsed = gethrtime() - start;
+    std::cout << "Deduplicating with " << numCursors << " TAP cursors: "
+              << (elapsed / NUM_TIMED_UPDATES) << "ns per update" << std::endl;
+
+    for (size_t c = 0; c < numCursors; ++c) {
+        std::stringstream name;
+        name << "tap-" << c;
+        size_t remains = checkpoint_manager->getNumItemsForTAPConnection(name.str());
+        assert(drainTAPCursor(checkpoint_manager, name.str(), latest) == remains);
+        checkpoint_manager->removeTAPCursor(name.str());
+    }
+    delete checkpoint_manager;
+}
+
+#define NUM_SPILL_ROUNDS 8
+
+/**
+ * A checkpoint config that spills to the given directory, with small
+ * checkpoints.
+ */
+class SpillCheckpointConfig : public CheckpointConfig {
+public:
+    SpillCheckpointConfig(const std::string &dir) {
+        setSpillPath(dir);
+        setCheckpointMaxItems(MIN_CHECKPOINT_ITEMS);
+        setMaxCheckpoints(MAX_CHECKPOINTS_UPPER_BOUND);
+    }
+};
+
+/**
+ * Leave a TAP cursor behind while checkpoints are persisted and closed,
+ * spill the checkpoints it pins, and check it reads them back.
+ */
+static void testSpill(RCPtr<VBucket> &vbucket) {
+    char dir[] = "/tmp/checkpoint_spill_test.XXXXXX";
+    assert(mkdtemp(dir) != NULL);
+    SpillCheckpointConfig config(dir);
+    global_stats.mem_low_wat.set(0);
+
+    CheckpointManager *checkpoint_manager = new CheckpointManager(global_stats, 0, config, 1);
+    checkpoint_manager->registerTAPCursor("tap-slow");
+
+    size_t numKeys = 0;
+    std::vector<queued_item> items;
+    for (size_t r = 0; r < NUM_SPILL_ROUNDS; ++r) {
+        for (size_t i = 0; i < MIN_CHECKPOINT_ITEMS; ++i, ++numKeys) {
+            std::stringstream key, value;
+            key << "key-" << numKeys;
+            value << "value-" << numKeys;
+            value_t blob(Blob::New(value.str()));
+            queued_item qi(new QueuedItem(key.str(), blob, 0, queue_op_set, -1,
+                                          numKeys + 1, numKeys));
+            checkpoint_manager->queueDirty(qi, vbucket);
+        }
+        checkpoint_manager->getAllItemsForPersistence(items);
+        checkpoint_manager->spillClosedCheckpoints();
+    }
+    // Spilled checkpoints don't keep new ones from being created.
+    assert(checkpoint_manager->getNumCheckpoints() == NUM_SPILL_ROUNDS + 1);
+    assert(checkpoint_manager->getNumSpilledCheckpoints() == NUM_SPILL_ROUNDS - 1);
+    assert(global_stats.checkpointSpillSize.get() > 0);
+
+    // Read everything back in order.
+    size_t remains = checkpoint_manager->getNumItemsForTAPConnection("tap-slow");
+    size_t numItems = 0, numKeysRead = 0;
+    bool isLastMutationItem;
+    while (true) {
+        queued_item qi = checkpoint_manager->nextItem("tap-slow", isLastMutationItem);
+        if (qi->getOperation() == queue_op_empty) {
+            break;
+        }
+        ++numItems;
+        if (qi->getOperation() == queue_op_set) {
+            std::stringstream key, value;
+            key << "key-" << numKeysRead;
+            value << "value-" << numKeysRead;
+            assert(qi->getKey() == key.str());
+            assert(qi->getFlags() == numKeysRead);
+            assert(qi->getRowId() == static_cast<int64_t>(numKeysRead + 1));
+            assert(std::string(qi->getValue()->getData(), qi->getValue()->length()) ==
+                   value.str());
+            ++numKeysRead;
+        }
+    }
+    assert(numItems == remains);
+    assert(numKeysRead == numKeys);
+    assert(global_stats.checkpointSpillReads.get() > 0);
+
+    // The file is truncated once no spilled checkpoint is left, and
+    // removed along with the checkpoint manager.
+    checkpoint_manager->removeTAPCursor("tap-slow");
+    bool newCheckpointCreated;
+    checkpoint_manager->removeClosedUnrefCheckpoints(vbucket, newCheckpointCreated);
+    assert(checkpoint_manager->getNumSpilledCheckpoints() == 0);
+    checkpoint_manager->spillClosedCheckpoints();
+    assert(global_stats.checkpointSpillSize.get() == 0);
+
+    std::stringstream path;
+    path << dir << "/checkpoints-0.spill";
+    assert(access(path.str().c_str(), F_OK) == 0);
+    delete checkpoint_manager;
+    assert(access(path.str().c_str(), F_OK) != 0);
+    assert(rmdir(dir) == 0);
+}
+
+/**
+ * Lose the spill file under a TAP cursor, and check the cursor is
+ * dropped, so that the connection gets backfilled instead.
+ */
+static void testSpillReadFailure(RCPtr<VBucket> &vbucket) {
+    char dir[] = "/tmp/checkpoint_spill_test.XXXXXX";
+    assert(mkdtemp(dir) != NULL);
+    SpillCheckpointConfig config(dir);
+    global_stats.mem_low_wat.set(0);
+
+    CheckpointManager *checkpoint_manager = new CheckpointManager(global_stats, 0, config, 1);
+    checkpoint_manager->registerTAPCursor("tap-slow");
+
+    std::vector<queued_item> items;
+    for (size_t r = 0; r < 3; ++r) {
+        for (size_t i = 0; i < MIN_CHECKPOINT_ITEMS; ++i) {
+            std::stringstream key;
+            key << "key-" << r << "-" << i;
+            queued_item qi(new QueuedItem(key.str(), 0, queue_op_set));
+            checkpoint_manager->queueDirty(qi, vbucket);
+        }
+        checkpoint_manager->getAllItemsForPersistence(items);
+        checkpoint_manager->spillClosedCheckpoints();
+    }
+    assert(checkpoint_manager->getNumSpilledCheckpoints() > 0);
+
+    std::stringstream path;
+    path << dir << "/checkpoints-0.spill";
+    assert(truncate(path.str().c_str(), 0) == 0);
+
+    bool isLastMutationItem;
+    size_t numItems = 0;
+    while (checkpoint_manager->nextItem("tap-slow", isLastMutationItem)->getOperation() !=
+           queue_op_empty) {
+        ++numItems;
+    }
+    // Only the start of the first checkpoint was still in memory.
+    assert(numItems <= 1);
+    assert(checkpoint_manager->getNumOfTAPCursors() == 0);
+    assert(checkpoint_manager->wasTAPCursorDropped("tap-slow"));
+    assert(!checkpoint_manager->wasTAPCursorDropped("tap-slow"));
+
+    delete checkpoint_manager;
+    assert(rmdir(dir) == 0);
+}
+
+#define NUM_RESUME_ROUNDS 3
+
+/**
+ * Check the sequence numbers given to queued items, and resume TAP
+ * cursors from them before and after old checkpoints are removed.
+ */
+static void testResumeBySeqno(RCPtr<VBucket> &vbucket) {
+    SpillCheckpointConfig config("");
+    CheckpointManager *checkpoint_manager = new CheckpointManager(global_stats, 0, config, 1);
+
+    uint64_t numItems = 0;
+    std::vector<queued_item> items;
+    for (size_t r = 0; r < NUM_RESUME_ROUNDS; ++r) {
+        for (size_t i = 0; i < MIN_CHECKPOINT_ITEMS; ++i, ++numItems) {
+            std::stringstream key;
+            key << "key-" << numItems;
+            // End the first round with a deletion.
+            enum queue_operation op = (r == 0 && i == MIN_CHECKPOINT_ITEMS - 1) ?
+                queue_op_del : queue_op_set;
+            queued_item qi(new QueuedItem(key.str(), 0, op, -1, -1, numItems));
+            checkpoint_manager->queueDirty(qi, vbucket);
+        }
+        items.clear();
+        checkpoint_manager->getAllItemsForPersistence(items);
+        uint64_t bySeqno = r * MIN_CHECKPOINT_ITEMS;
+        std::vector<queued_item>::iterator it = items.begin();
+        for (; it != items.end(); ++it) {
+            if ((*it)->getKey().size() > 0) {
+                assert((*it)->getBySeqno() == ++bySeqno);
+            }
+        }
+        assert(bySeqno == numItems);
+    }
+    assert(checkpoint_manager->getHighSeqno() == numItems);
+    assert(checkpoint_manager->getNumCheckpoints() > 2);
+
+    // Only what came after the sequence number is read.
+    uint64_t seqno = numItems / 2;
+    assert(checkpoint_manager->registerTAPCursorBySeqno("tap-resume", seqno) ==
+           RESUME_FROM_CHECKPOINTS);
+    bool isLastMutationItem;
+    size_t numMutations = 0;
+    while (true) {
+        queued_item qi = checkpoint_manager->nextItem("tap-resume", isLastMutationItem);
+        if (qi->getOperation() == queue_op_empty) {
+            break;
+        }
+        if (qi->getKey().size() > 0) {
+            assert(qi->getBySeqno() == ++seqno);
+            ++numMutations;
+        }
+    }
+    assert(numMutations == numItems / 2);
+    checkpoint_manager->removeTAPCursor("tap-resume");
+
+    // A sequence number from another history of the vbucket.
+    assert(checkpoint_manager->registerTAPCursorBySeqno("tap-future", numItems + 1) ==
+           RESUME_INVALID);
+    assert(!checkpoint_manager->removeTAPCursor("tap-future"));
+
+    // Once the closed checkpoints are gone, what they had is backfilled,
+    // unless deletions that came after the sequence number went with them.
+    size_t numCheckpoints = checkpoint_manager->getNumCheckpoints();
+    bool newCheckpointCreated;
+    checkpoint_manager->removeClosedUnrefCheckpoints(vbucket, newCheckpointCreated);
+    assert(checkpoint_manager->getNumCheckpoints() < numCheckpoints);
+    assert(checkpoint_manager->registerTAPCursorBySeqno("tap-behind",
+                                                        MIN_CHECKPOINT_ITEMS - 1) ==
+           RESUME_INVALID);
+    assert(checkpoint_manager->registerTAPCursorBySeqno("tap-behind",
+                                                        MIN_CHECKPOINT_ITEMS) ==
+           RESUME_WITH_BACKFILL);
+    checkpoint_manager->removeTAPCursor("tap-behind");
+
+    delete checkpoint_manager;
+}
+
+/**
+ * Count the times a checkpoint manager tells about its oldest checkpoint
+ * becoming unreferenced.
+ */
+class UnrefCheckpointCounter : public UnrefCheckpointListener {
+public:
+    UnrefCheckpointCounter() : count(0) {}
+
+    void unrefCheckpoint(uint16_t vbid) {
+        assert(vbid == 0);
+        ++count;
+    }
+
+    size_t count;
+};
+
+/**
+ * A checkpoint config with small checkpoints, telling the given listener
+ * about unreferenced ones.
+ */
+class ListenedCheckpointConfig : public CheckpointConfig {
+public:
+    ListenedCheckpointConfig(UnrefCheckpointListener *listener) {
+        setCheckpointMaxItems(MIN_CHECKPOINT_ITEMS);
+        setMaxCheckpoints(MAX_CHECKPOINTS_UPPER_BOUND);
+        setUnrefCheckpointListener(listener);
+    }
+};
+
+/**
+ * Close checkpoints under a TAP cursor and the persistence cursor, and
+ * check the listener hears about each once the last cursor leaves it.
+ */
+static void testUnrefCheckpointListener(RCPtr<VBucket> &vbucket) {
+    UnrefCheckpointCounter counter;
+    ListenedCheckpointConfig config(&counter);
+    // Keep new checkpoints from being created for the lack of memory.
+    size_t memHighWat = global_stats.mem_high_wat.get();
+    global_stats.mem_high_wat.set(std::numeric_limits<size_t>::max());
+    CheckpointManager *checkpoint_manager = new CheckpointManager(global_stats, 0, config, 1);
+    checkpoint_manager->registerTAPCursor("tap");
+
+    std::vector<queued_item> items;
+    for (size_t r = 0; r < 2; ++r) {
+        for (size_t i = 0; i < MIN_CHECKPOINT_ITEMS; ++i) {
+            std::stringstream key;
+            key << "key-" << i;
+            queued_item qi(new QueuedItem(key.str(), 0, queue_op_set));
+            checkpoint_manager->queueDirty(qi, vbucket);
+        }
+        assert(checkpoint_manager->getNumCheckpoints() == 2);
+        checkpoint_manager->getAllItemsForPersistence(items);
+        assert(counter.count == r);
+
+        if (r == 0) {
+            bool isLastMutationItem;
+            while (checkpoint_manager->nextItem("tap", isLastMutationItem)->getOperation() !=
+                   queue_op_empty) {
+            }
+        } else {
+            checkpoint_manager->removeTAPCursor("tap");
+        }
+        assert(counter.count == r + 1);
+
+        bool newCheckpointCreated;
+        checkpoint_manager->removeClosedUnrefCheckpoints(vbucket, newCheckpointCreated);
+        assert(checkpoint_manager->getNumCheckpoints() == 1);
+    }
+
+    delete checkpoint_manager;
+    global_stats.mem_high_wat.set(memHighWat);
+}
+
 int main(int argc, char **argv) {
     (void)argc; (void)argv;
     putenv(strdup("ALLOW_NO_STATS_UPDATE=yeah"));
@@ -151,6 +562,15 @@ int main(int argc, char **argv) {
     HashTable::setDefaultNumLocks(1);
     RCPtr<VBucket> vbucket(new VBucket(0, vbucket_state_active, global_stats, checkpoint_config));
 
+    testDedupCompaction(vbucket);
+    timeDedup(vbucket, 1);
+    timeDedup(vbucket, 8);
+    timeDedup(vbucket, 64);
+    testSpill(vbucket);
+    testSpillReadFailure(vbucket);
+    testResumeBySeqno(vbucket);
+    testUnrefCheckpointListener(vbucket);
+
     CheckpointManager *checkpoint_manager = new CheckpointManager(global_stats, 0,
                                                                   checkpoint_config, 1);
     SyncObject *mutex = new SyncObject();
@@ -57,6 +57,48 @@ bool TestCallback::callback(Dispatcher &d, TaskId t) {
     return thing->doSomething(d, t);
 }
 
+/**
+ * A daemon task that sleeps for long unless woken up.
+ */
+class SleepyCallback : public DispatcherCallback {
+public:
+    bool callback(Dispatcher &d, TaskId t) {
+        ++callbacks;
+        d.snooze(t, 3600);
+        return true;
+    }
+
+    std::string description() { return std::string("Sleepy"); }
+};
+
+/**
+ * Wake a sleeping task twice before its dispatcher starts, and check
+ * that it runs only once.
+ */
+static bool testWakeTwice() {
+    Dispatcher d(*engine);
+    TaskId task;
+    d.schedule(shared_ptr<SleepyCallback>(new SleepyCallback()), &task,
+               Priority::FlusherPriority, 3600);
+    d.wake(task, &task);
+    d.wake(task, &task);
+
+    callbacks = 0;
+    d.start();
+    while (callbacks < 1) {
+        usleep(1);
+    }
+    // Give a leftover copy of the task the time to run.
+    usleep(100000);
+    d.stop();
+    if (callbacks != 1) {
+        std::cerr << "Expected the woken task to run once, but it ran "
+                  << callbacks << " times" << std::endl;
+        return false;
+    }
+    return true;
+}
+
 int main(int argc, char **argv) {
     (void)argc; (void)argv;
     int expected_num_callbacks=3;
@@ -85,6 +127,10 @@ int main(int argc, char **argv) {
         return 1;
     }
 
+    if (!testWakeTwice()) {
+        return 1;
+    }
+
     IdleTask it;
     assert(hrtime2text(it.maxExpectedDuration()) == std::string("3600 s"));
 
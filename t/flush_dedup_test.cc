@@ -0,0 +1,176 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#include "config.h"
+
+#include <signal.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+
+#include "common.hh"
+#include "queueditem.hh"
+#include "flush_dedup.hh"
+#include "stats.hh"
+
+EPStats global_stats;
+
+extern "C" {
+    static rel_time_t basic_current_time(void) {
+        return 0;
+    }
+
+    rel_time_t (*ep_current_time)() = basic_current_time;
+
+    time_t ep_real_time() {
+        return time(NULL);
+    }
+}
+
+class CountDuplicates {
+public:
+    CountDuplicates() : count(0) {}
+
+    void operator()(QueuedItem &) {
+        ++count;
+    }
+
+    size_t count;
+};
+
+static std::string keyOf(size_t n) {
+    std::stringstream ss;
+    ss << "key-" << n;
+    return ss.str();
+}
+
+/**
+ * Queue numItems mutations over numKeys keys of a vbucket, with the
+ * row id of a key being one more than its number.
+ */
+static void queueItems(std::vector<queued_item> &items, uint16_t vbid,
+                       size_t numKeys, size_t numItems) {
+    for (size_t i = 0; i < numItems; ++i) {
+        size_t k = (i * 7919) % numKeys;
+        enum queue_operation op = (i % 5 == 0) ? queue_op_del : queue_op_set;
+        items.push_back(queued_item(new QueuedItem(keyOf(k), vbid, op, 0,
+                                                   static_cast<int64_t>(k + 1),
+                                                   static_cast<uint32_t>(i))));
+    }
+}
+
+static void testDedup() {
+    QueuedItemDeduper deduper;
+    std::vector<queued_item> items;
+    std::vector<queued_item> out;
+
+    queueItems(items, 3, 100, 1000);
+    items.push_back(queued_item(new QueuedItem("", 3, queue_op_commit)));
+    items.push_back(queued_item(new QueuedItem("", 3, queue_op_checkpoint_start)));
+
+    CountDuplicates dups;
+    assert(deduper.dedup(items, out, dups) == 900);
+    assert(dups.count == 900);
+    assert(out.size() == 100);
+    assert(sorted(out.begin(), out.end(), CompareQueuedItemsByVBAndRowId()));
+
+    // Only the last mutation of each key is kept.
+    std::set<std::string> seen;
+    std::vector<queued_item>::iterator it;
+    for (it = out.begin(); it != out.end(); ++it) {
+        assert(seen.insert((*it)->getKey()).second);
+        size_t k = static_cast<size_t>((*it)->getRowId()) - 1;
+        size_t last = 0;
+        for (size_t i = 0; i < 1000; ++i) {
+            if ((i * 7919) % 100 == k) {
+                last = i;
+            }
+        }
+        assert((*it)->getFlags() == last);
+    }
+
+    // The table is reused for smaller and empty batches.
+    items.clear();
+    out.clear();
+    queueItems(items, 4, 10, 10);
+    assert(deduper.dedup(items, out, dups) == 0);
+    assert(out.size() == 10);
+
+    items.clear();
+    out.clear();
+    assert(deduper.dedup(items, out, dups) == 0);
+    assert(out.empty());
+}
+
+static size_t dedupWithSet(std::vector<queued_item> &items,
+                           std::vector<queued_item> &out) {
+    std::set<queued_item, CompareQueuedItemsByKey> item_set;
+    size_t dups = 0;
+    std::vector<queued_item>::reverse_iterator rit = items.rbegin();
+    for (; rit != items.rend(); ++rit) {
+        if (!item_set.insert(*rit).second) {
+            ++dups;
+        }
+    }
+    out.insert(out.end(), item_set.begin(), item_set.end());
+    return dups;
+}
+
+static size_t dedupWithHash(QueuedItemDeduper &deduper,
+                            std::vector<queued_item> &items,
+                            std::vector<queued_item> &out) {
+    CountDuplicates dups;
+    deduper.dedup(items, out, dups);
+    return dups.count;
+}
+
+/**
+ * Time deduplicating a flusher batch of 100k mutations over 1024
+ * vbuckets, with a set per vbucket as the flusher used to and with a
+ * QueuedItemDeduper (which also orders them by row id).
+ */
+static void testDedupTiming() {
+    const size_t numVBuckets = 1024;
+    const size_t perVBucket = 100;
+    std::vector<std::vector<queued_item> > batches(numVBuckets);
+    for (size_t i = 0; i < numVBuckets; ++i) {
+        queueItems(batches[i], static_cast<uint16_t>(i), perVBucket / 2, perVBucket);
+    }
+
+    QueuedItemDeduper deduper;
+    std::vector<queued_item> out;
+    hrtime_t times[2] = { 0, 0 };
+    for (size_t round = 0; round < 5; ++round) {
+        for (int way = 0; way < 2; ++way) {
+            size_t dups = 0;
+            hrtime_t start = gethrtime();
+            for (size_t i = 0; i < numVBuckets; ++i) {
+                if (way == 0) {
+                    dups += dedupWithSet(batches[i], out);
+                } else {
+                    dups += dedupWithHash(deduper, batches[i], out);
+                }
+                assert(out.size() == perVBucket / 2);
+                out.clear();
+            }
+            times[way] += gethrtime() - start;
+            assert(dups == numVBuckets * perVBucket / 2);
+        }
+    }
+    std::cout << "Deduplicating " << numVBuckets * perVBucket
+              << " mutations: " << (times[0] / 5000) << "us with sets, "
+              << (times[1] / 5000) << "us hashed" << std::endl;
+}
+
+int main() {
+    putenv(strdup("ALLOW_NO_STATS_UPDATE=yeah"));
+    alarm(60);
+    testDedup();
+    testDedupTiming();
+    exit(0);
+}
@@ -273,6 +273,53 @@ static void testResize() {
     verifyFound(h, keys);
 }
 
+static void testIncrementalResize() {
+    HashTable::setDefaultResizeStep(2);
+    HashTable h(global_stats, 5, 3);
+    assert(h.getResizeStep() == 2);
+
+    std::vector<std::string> keys = generateKeys(5000);
+    storeMany(h, keys);
+
+    h.resize(6143);
+    assert(h.isResizing());
+    assert(h.getSize() == 5);
+    assert(h.getResizeTarget() == 6143);
+    assert(count(h) == 5000);
+
+    assert(h.migrateBuckets(2) == 2);
+    assert(h.getResizeProgress() == 2);
+    assert(h.getNumForegroundMigrations() == 0);
+
+    // Lookups help the resize along.
+    verifyFound(h, keys);
+    assert(!h.isResizing());
+    assert(h.getSize() == 6143);
+    assert(h.getNumMigratedBuckets() == 5);
+    assert(h.getNumForegroundMigrations() == 3);
+    assert(count(h) == 5000);
+
+    h.resize(769);
+    assert(h.isResizing());
+    // Items can be added and removed with the old and new tables live.
+    std::vector<std::string> moreKeys = generateKeys(6000, 5000);
+    storeMany(h, moreKeys);
+    std::vector<std::string>::iterator it;
+    for (it = moreKeys.begin(); it != moreKeys.end(); ++it) {
+        assert(h.del(*it));
+    }
+    while (h.migrateBuckets(h.getResizeStep()) > 0) {
+        // Keep moving.
+    }
+    assert(!h.isResizing());
+    assert(h.getSize() == 769);
+    assert(h.getNumResizes() == 2);
+    assert(count(h) == 5000);
+    verifyFound(h, keys);
+
+    HashTable::setDefaultResizeStep(0);
+}
+
 class AccessGenerator : public Generator<bool> {
 public:
 
@@ -318,6 +365,579 @@ static void testConcurrentAccessResize() {
     getCompletedThreads(16, &gen);
 }
 
+static void testConcurrentAccessIncrementalResize() {
+    HashTable::setDefaultResizeStep(4);
+    HashTable h(global_stats, 5, 3);
+    HashTable::setDefaultResizeStep(0);
+
+    std::vector<std::string> keys = generateKeys(20000);
+    storeMany(h, keys);
+
+    verifyFound(h, keys);
+
+    srand(918475);
+    AccessGenerator gen(keys, h);
+    getCompletedThreads(16, &gen);
+    assert(count(h) == 0);
+}
+
+static Item *lockFreeGet(HashTable &h, const std::string &k) {
+    StoredValue *sv(NULL);
+    Item *itm = h.lockFreeGet(k, 0, ep_real_time(), &sv);
+    if (itm) {
+        assert(sv);
+        assert(itm->getKey() == k);
+        assert(std::string(itm->getValue()->getData(),
+                           itm->getValue()->length()) == k);
+    }
+    return itm;
+}
+
+static void testLockFreeGet() {
+    HashTable::setDefaultLockFreeReads(true);
+    HashTable h(global_stats, 5, 3);
+    HashTable::setDefaultLockFreeReads(false);
+    assert(h.usesLockFreeReads());
+
+    std::vector<std::string> keys = generateKeys(1000);
+    storeMany(h, keys);
+
+    std::vector<std::string>::iterator it;
+    for (it = keys.begin(); it != keys.end(); ++it) {
+        h.find(*it)->clearReferenced();
+        Item *itm = lockFreeGet(h, *it);
+        assert(itm);
+        delete itm;
+        // Lock-free hits count as uses for the pager too.
+        assert(h.find(*it)->isReferenced());
+    }
+    assert(h.getNumLockFreeFallbacks() == 0);
+
+    // Anything but a plain resident hit is left to the locked path.
+    assert(!lockFreeGet(h, "missing"));
+    assert(h.del(keys[0]));
+    assert(!lockFreeGet(h, keys[0]));
+    h.find(keys[1])->lock(ep_current_time() + 15);
+    assert(!lockFreeGet(h, keys[1]));
+    assert(h.getNumLockFreeFallbacks() == 3);
+
+    // The old bucket array outlives the resize for any late readers.
+    h.resize(769);
+    for (it = keys.begin() + 2; it != keys.end(); ++it) {
+        Item *itm = lockFreeGet(h, *it);
+        assert(itm);
+        delete itm;
+    }
+}
+
+class LockFreeReadGenerator : public Generator<bool> {
+public:
+
+    LockFreeReadGenerator(const std::vector<std::string> &k,
+                          HashTable &h) : keys(k), ht(h) {}
+
+    bool operator()() {
+        if (threads.incr(1) == 0) {
+            write();
+        } else {
+            read();
+        }
+        return true;
+    }
+
+private:
+
+    // Delete, re-add and resize under the readers' feet.
+    void write() {
+        size_t sizes[] = { 769, 3067 };
+        for (int round = 0; round < 20; ++round) {
+            ht.resize(sizes[round % 2]);
+            std::vector<std::string>::iterator it;
+            for (it = keys.begin(); it != keys.end(); ++it) {
+                if (rand() % 3 == 0) {
+                    assert(ht.del(*it));
+                    store(ht, *it);
+                }
+            }
+        }
+        done.set(true);
+    }
+
+    void read() {
+        size_t hits(0);
+        while (!done) {
+            std::vector<std::string>::iterator it;
+            for (it = keys.begin(); it != keys.end(); ++it) {
+                Item *itm = lockFreeGet(ht, *it);
+                if (itm) {
+                    ++hits;
+                    delete itm;
+                }
+            }
+        }
+        assert(hits > 0);
+    }
+
+    std::vector<std::string>  keys;
+    HashTable                &ht;
+    Atomic<int>               threads;
+    Atomic<bool>              done;
+};
+
+static void testConcurrentLockFreeReads() {
+    HashTable::setDefaultLockFreeReads(true);
+    HashTable::setDefaultResizeStep(4);
+    HashTable h(global_stats, 5, 3);
+    HashTable::setDefaultResizeStep(0);
+    HashTable::setDefaultLockFreeReads(false);
+
+    std::vector<std::string> keys = generateKeys(2000);
+    storeMany(h, keys);
+
+    srand(918475);
+    LockFreeReadGenerator gen(keys, h);
+    getCompletedThreads(4, &gen);
+    assert(count(h) == 2000);
+    verifyFound(h, keys);
+}
+
+class ReadMostlyGenerator : public Generator<bool> {
+public:
+
+    ReadMostlyGenerator(const std::vector<std::string> &k,
+                        HashTable &h, size_t n) : keys(k), ht(h), ops(n) {}
+
+    bool operator()() {
+        unsigned int seed = seeds.incr(1);
+        for (size_t i = 0; i < ops; ++i) {
+            std::string &k = keys[rand_r(&seed) % keys.size()];
+            if (rand_r(&seed) % 20 == 0) {
+                Item itm(k, 0, 0, k.c_str(), k.length());
+                int64_t row_id = -1;
+                assert(ht.set(itm, row_id) != NOT_FOUND);
+            } else {
+                assert(ht.find(k));
+            }
+        }
+        return true;
+    }
+
+private:
+    std::vector<std::string>  keys;
+    HashTable                &ht;
+    size_t                    ops;
+    Atomic<unsigned int>      seeds;
+};
+
+static hrtime_t timeReadMostly(bool rwlocks, size_t nthreads) {
+    HashTable::setDefaultRWLocks(rwlocks);
+    HashTable h(global_stats, 47, 1);
+    HashTable::setDefaultRWLocks(false);
+    assert(h.usesRWLocks() == rwlocks);
+
+    std::vector<std::string> keys = generateKeys(2000);
+    storeMany(h, keys);
+
+    ReadMostlyGenerator gen(keys, h, 200000 / nthreads);
+    hrtime_t start = gethrtime();
+    getCompletedThreads(nthreads, &gen);
+    hrtime_t taken = gethrtime() - start;
+
+    verifyFound(h, keys);
+    return taken;
+}
+
+/**
+ * 95% lookups / 5% updates against a single lock stripe, with
+ * exclusive and then shared read locking.
+ */
+static void testReadMostlyScaling() {
+    size_t threads[] = { 1, 4, 16 };
+    for (size_t i = 0; i < sizeof(threads) / sizeof(threads[0]); ++i) {
+        hrtime_t excl = timeReadMostly(false, threads[i]);
+        hrtime_t shared = timeReadMostly(true, threads[i]);
+        std::cout << "Read-mostly with " << threads[i] << " threads: "
+                  << (excl / 1000000) << "ms exclusive, "
+                  << (shared / 1000000) << "ms shared" << std::endl;
+    }
+}
+
+class DepthSum : public HashTableDepthVisitor {
+public:
+    DepthSum() : items(0) {}
+
+    void visit(int, int depth, size_t) {
+        items += depth;
+    }
+
+    size_t items;
+};
+
+static void testGroupedLayout() {
+    HashTable::setDefaultLayout(grouped_layout);
+    HashTable h(global_stats, 5, 3);
+    HashTable::setDefaultLayout(chained_layout);
+    assert(h.getLayout() == grouped_layout);
+    // Groups come in powers of two.
+    assert(h.getSize() == 8);
+
+    // Far more items than slots, so most end up on overflow chains.
+    std::vector<std::string> keys = generateKeys(5000);
+    storeMany(h, keys);
+    assert(count(h) == 5000);
+    verifyFound(h, keys);
+    std::string missingKey("aMissingKey");
+    assert(!h.find(missingKey));
+
+    // Deleting frees slots up for new items.
+    for (size_t i = 0; i < keys.size(); i += 2) {
+        assert(h.del(keys[i]));
+        assert(!h.find(keys[i]));
+    }
+    assert(count(h) == 2500);
+    for (size_t i = 0; i < keys.size(); i += 2) {
+        store(h, keys[i]);
+    }
+    assert(count(h) == 5000);
+    verifyFound(h, keys);
+
+    h.resize(1000);
+    assert(h.getSize() == 1024);
+    verifyFound(h, keys);
+
+    DepthSum depths;
+    h.visitDepth(depths);
+    assert(depths.items == 5000);
+
+    h.resize();
+    assert(h.getSize() == 1024);
+    h.resize(3);
+    assert(h.getSize() == 4);
+    h.resize();
+    assert(h.getSize() == 1024);
+    verifyFound(h, keys);
+
+    h.clear();
+    assert(count(h) == 0);
+    assert(!h.find(keys[0]));
+}
+
+static void testGroupedLayoutIncrementalResize() {
+    HashTable::setDefaultLayout(grouped_layout);
+    HashTable::setDefaultResizeStep(3);
+    HashTable::setDefaultLockFreeReads(true);
+    HashTable h(global_stats, 5, 3);
+    HashTable::setDefaultLockFreeReads(false);
+    HashTable::setDefaultResizeStep(0);
+    HashTable::setDefaultLayout(chained_layout);
+
+    std::vector<std::string> keys = generateKeys(5000);
+    storeMany(h, keys);
+
+    h.resize(2048);
+    assert(h.isResizing());
+    std::vector<std::string> moreKeys = generateKeys(1000, 5000);
+    storeMany(h, moreKeys);
+    std::vector<std::string>::iterator it;
+    for (it = moreKeys.begin(); it != moreKeys.end(); ++it) {
+        assert(h.del(*it));
+    }
+    while (h.migrateBuckets(h.getResizeStep()) > 0) {
+        // Keep moving.
+    }
+    assert(!h.isResizing());
+    assert(h.getSize() == 2048);
+    assert(count(h) == 5000);
+    verifyFound(h, keys);
+
+    for (it = keys.begin(); it != keys.end(); ++it) {
+        Item *itm = lockFreeGet(h, *it);
+        assert(itm);
+        delete itm;
+    }
+    assert(!lockFreeGet(h, "aMissingKey"));
+}
+
+static void testConcurrentGroupedLayout() {
+    HashTable::setDefaultLayout(grouped_layout);
+    HashTable::setDefaultLockFreeReads(true);
+    HashTable::setDefaultResizeStep(4);
+    HashTable h(global_stats, 5, 3);
+    HashTable::setDefaultResizeStep(0);
+    HashTable::setDefaultLockFreeReads(false);
+    HashTable::setDefaultLayout(chained_layout);
+
+    std::vector<std::string> keys = generateKeys(2000);
+    storeMany(h, keys);
+
+    srand(918475);
+    LockFreeReadGenerator gen(keys, h);
+    getCompletedThreads(4, &gen);
+    assert(count(h) == 2000);
+    verifyFound(h, keys);
+
+    AccessGenerator dels(keys, h);
+    getCompletedThreads(16, &dels);
+    assert(count(h) == 0);
+}
+
+static void testInlineValues() {
+    size_t initialSize = global_stats.currentSize.get();
+    StoredValue::setMaxInlineValueSize(32);
+    HashTable h(global_stats, 5, 3);
+
+    std::vector<std::string> keys = generateKeys(1000);
+    storeMany(h, keys);
+    // The values are the keys, so they are all small enough.
+    assert(count(h) == 1000);
+    std::vector<std::string>::iterator it;
+    for (it = keys.begin(); it != keys.end(); ++it) {
+        StoredValue *v = h.find(*it);
+        assert(v && v->isInline());
+        assert(v->valLength() == it->length());
+        assert(v->externalValLength() == 0);
+        assert(!v->eligibleForEviction());
+        Item *itm = v->toItem(false, 0);
+        assert(itm->getValue()->to_s() == *it);
+        delete itm;
+    }
+
+    // Values too big for the inline area go to a blob and back.
+    std::string k(keys[0]);
+    std::string big(100, 'x');
+    int64_t row_id = -1;
+    Item bigItem(k, 0, 0, big.data(), big.length());
+    assert(h.set(bigItem, row_id) == WAS_DIRTY);
+    StoredValue *v = h.find(k);
+    assert(!v->isInline());
+    assert(v->externalValLength() == big.length());
+    assert(v->getValue()->to_s() == big);
+    Item smallItem(k, 0, 0, k.data(), k.length());
+    assert(h.set(smallItem, row_id) == WAS_DIRTY);
+    assert(v->isInline());
+    assert(v->getValue()->to_s() == k);
+
+    // Deletion leaves nothing inline.
+    assert(h.softDelete(k, 0, row_id) == WAS_DIRTY);
+    assert(v->isDeleted());
+    assert(!v->isInline());
+    assert(v->valLength() == 0);
+
+    // Items born with big values have no inline area at all.
+    std::string bigKey("a big one");
+    Item bigNew(bigKey, 0, 0, big.data(), big.length());
+    assert(h.set(bigNew, row_id) == NOT_FOUND);
+    assert(!h.find(bigKey)->isInline());
+    assert(h.del(bigKey));
+
+    StoredValue::setMaxInlineValueSize(0);
+    for (it = keys.begin(); it != keys.end(); ++it) {
+        assert(h.del(*it));
+    }
+    assert(count(h) == 0);
+    assert(global_stats.currentSize.get() == initialSize);
+}
+
+static void testEvictItems() {
+    size_t initialSize = global_stats.currentSize.get();
+    HashTable h(global_stats, 5, 3);
+
+    std::vector<std::string> keys = generateKeys(100);
+    storeMany(h, keys);
+
+    // Dirty items stay.
+    std::string k(keys[0]);
+    int bucket_num(0);
+    {
+        WriterLockHolder lh = h.getLockedBucket(k, &bucket_num);
+        assert(!h.unlocked_evictItem(k, bucket_num));
+    }
+
+    std::vector<std::string>::iterator it;
+    for (it = keys.begin(); it != keys.end(); ++it) {
+        h.find(*it)->markClean(NULL);
+    }
+    // So do ones whose write hasn't committed or got its row yet.
+    {
+        WriterLockHolder lh = h.getLockedBucket(k, &bucket_num);
+        StoredValue *sv = h.unlocked_find(k, bucket_num);
+        sv->markUncommitted();
+        assert(!h.unlocked_evictItem(k, bucket_num));
+        sv->markCommitted();
+        sv->setPendingId();
+        assert(!h.unlocked_evictItem(k, bucket_num));
+        sv->clearId();
+    }
+    // Clean ones go away entirely, non-resident ones too.
+    assert(h.find(keys[1])->ejectValue(global_stats, h));
+    assert(h.getNumNonResidentItems() == 1);
+    for (it = keys.begin(); it != keys.end(); ++it) {
+        WriterLockHolder lh = h.getLockedBucket(*it, &bucket_num);
+        assert(h.unlocked_evictItem(*it, bucket_num));
+    }
+    assert(count(h) == 0);
+    assert(h.getNumItems() == 0);
+    assert(h.getNumNonResidentItems() == 0);
+    assert(h.getNumEvictedItems() == keys.size());
+    assert(global_stats.currentSize.get() == initialSize);
+
+    // Items read back from disk come back clean.
+    Item itm(k, 0, 0, k.data(), k.length());
+    {
+        WriterLockHolder lh = h.getLockedBucket(k, &bucket_num);
+        assert(h.unlocked_restoreEvicted(itm, bucket_num) == ADD_SUCCESS);
+        assert(h.unlocked_restoreEvicted(itm, bucket_num) == ADD_EXISTS);
+    }
+    StoredValue *v = h.find(k);
+    assert(v && v->isClean() && v->isResident());
+    assert(v->getValue()->to_s() == k);
+    assert(h.getNumEvictedItems() == keys.size() - 1);
+
+    // Keys that aren't on disk either are remembered as deleted.
+    std::string missing("missing");
+    {
+        WriterLockHolder lh = h.getLockedBucket(missing, &bucket_num);
+        assert(h.unlocked_addTempDeleted(missing, bucket_num));
+        assert(!h.unlocked_addTempDeleted(missing, bucket_num));
+        v = h.unlocked_find(missing, bucket_num, true);
+        assert(v && v->isDeleted() && v->isClean() && v->isTempItem());
+    }
+    assert(h.find(missing) == NULL);
+    assert(h.getNumTempItems() == 1);
+    assert(h.add(Item(missing, 0, 0, k.data(), k.length())) == ADD_UNDEL);
+    assert(h.getNumTempItems() == 0);
+    assert(!h.find(missing)->isTempItem());
+
+    // Dropping a stand-in doesn't make it an evicted item.
+    std::string gone("gone");
+    {
+        WriterLockHolder lh = h.getLockedBucket(gone, &bucket_num);
+        assert(h.unlocked_addTempDeleted(gone, bucket_num));
+        assert(h.unlocked_evictItem(gone, bucket_num));
+    }
+    assert(h.getNumTempItems() == 0);
+    assert(h.getNumEvictedItems() == keys.size() - 1);
+
+    assert(h.del(k));
+    assert(h.del(missing));
+    assert(global_stats.currentSize.get() == initialSize);
+}
+
+/**
+ * Stands in for the item pager: clears reference bits and counts the
+ * items it would have ejected, until it has enough.
+ */
+class ClockVisitor : public HashTableVisitor {
+public:
+    ClockVisitor(size_t n) : wanted(n), scanned(0) {}
+
+    void visit(StoredValue *v) {
+        if (victims.size() == wanted) {
+            return;
+        }
+        ++scanned;
+        if (v->isReferenced()) {
+            v->clearReferenced();
+        } else {
+            victims.push_back(v->getKey());
+        }
+    }
+
+    bool shouldContinue() {
+        return victims.size() < wanted;
+    }
+
+    size_t wanted;
+    size_t scanned;
+    std::vector<std::string> victims;
+};
+
+static void testClockSweep() {
+    HashTable h(global_stats, 5, 3);
+
+    std::vector<std::string> keys = generateKeys(100);
+    storeMany(h, keys);
+
+    // Everything was just stored, so the first sweep goes round once
+    // giving everything its second chance.
+    ClockVisitor first(10);
+    h.sweep(first);
+    assert(first.victims.empty());
+    assert(first.scanned == keys.size());
+
+    // Use half of the items again; only the others get picked.
+    for (size_t i = 0; i < keys.size(); i += 2) {
+        h.find(keys[i])->touch();
+    }
+    ClockVisitor second(keys.size());
+    h.sweep(second);
+    assert(second.victims.size() == keys.size() / 2);
+    std::vector<std::string>::iterator it;
+    for (it = second.victims.begin(); it != second.victims.end(); ++it) {
+        assert(!h.find(*it)->isReferenced());
+    }
+
+    // A sweep that stops early leaves the hand where it stopped, so
+    // the next one starts past what the last one looked at.
+    ClockVisitor third(1);
+    h.sweep(third);
+    ClockVisitor fourth(1);
+    h.sweep(fourth);
+    assert(third.victims.size() == 1 && fourth.victims.size() == 1);
+    assert(third.victims[0] != fourth.victims[0]);
+}
+
+static void testExpiryIndex() {
+    HashTable h(global_stats, 5, 3);
+    time_t now = ep_real_time();
+
+    std::vector<std::string> keys = generateKeys(10);
+    for (size_t i = 0; i < keys.size(); ++i) {
+        // Every other key never expires.
+        time_t exptime = i % 2 ? 0 : now + 10 * (i + 1);
+        Item itm(keys[i], 0, exptime, keys[i].data(), keys[i].length());
+        h.add(itm);
+    }
+    assert(h.getExpiryIndexSize() == keys.size() / 2);
+
+    std::vector<std::string> due;
+    assert(h.popExpiredKeys(now + 10, due) == 0);
+    assert(h.popExpiredKeys(now + 31, due) == 2);
+    std::sort(due.begin(), due.end());
+    assert(due[0] == keys[0] && due[1] == keys[2]);
+    assert(h.getExpiryIndexSize() == 3);
+
+    // A new expiry time is noted too, and the old one no longer
+    // takes the key when it comes due.
+    int64_t rowid;
+    Item again(keys[4], 0, now + 100, keys[4].data(), keys[4].length());
+    h.set(again, rowid);
+    assert(h.getExpiryIndexSize() == 4);
+    due.clear();
+    assert(h.popExpiredKeys(now + 60, due) == 0);
+    assert(h.getExpiryIndexSize() == 3);
+
+    // Setting the same expiry time again adds nothing.  Items that go
+    // away leave their entries behind, but aren't taken.
+    h.set(again, rowid);
+    assert(h.getExpiryIndexSize() == 3);
+    assert(h.softDelete(keys[6], 0, rowid) == WAS_DIRTY);
+    assert(h.del(keys[8]));
+    assert(h.getExpiryIndexSize() == 3);
+
+    assert(h.popExpiredKeys(now + 101, due) == 1);
+    assert(due[0] == keys[4]);
+    assert(h.getExpiryIndexSize() == 0);
+
+    // The index's memory is counted as overhead.
+    size_t overhead = global_stats.memOverhead.get();
+    Item later(keys[1], 0, now + 100, keys[1].data(), keys[1].length());
+    h.set(later, rowid);
+    assert(global_stats.memOverhead.get() > overhead);
+    h.clear();
+    assert(global_stats.memOverhead.get() == overhead);
+}
+
 static void testAutoResize() {
     HashTable h(global_stats, 5, 3);
 
@@ -404,6 +1024,18 @@ int main() {
     testPoisonKey();
     testResize();
     testConcurrentAccessResize();
+    testIncrementalResize();
+    testConcurrentAccessIncrementalResize();
+    testReadMostlyScaling();
+    testLockFreeGet();
+    testConcurrentLockFreeReads();
+    testGroupedLayout();
+    testGroupedLayoutIncrementalResize();
+    testConcurrentGroupedLayout();
+    testInlineValues();
+    testEvictItems();
+    testClockSweep();
+    testExpiryIndex();
     testAutoResize();
     exit(0);
 }
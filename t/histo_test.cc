@@ -79,6 +79,26 @@ static void test_exponential() {
     assert(s.str() == expected);
 }
 
+static void test_percentile() {
+    std::vector<int> figinput;
+    figinput.push_back(0);
+    figinput.push_back(10);
+    figinput.push_back(100);
+    figinput.push_back(1000);
+    FixedInputGenerator<int> fig(figinput);
+    Histogram<int> histo(fig, 3);
+    assert(histo.percentile(0.5) == 0);
+
+    histo.add(5, 90);
+    histo.add(50, 9);
+    histo.add(500, 1);
+    assert(histo.percentile(0.5) == 10);
+    assert(histo.percentile(0.9) == 10);
+    assert(histo.percentile(0.95) == 100);
+    assert(histo.percentile(0.99) == 100);
+    assert(histo.percentile(1.0) == 1000);
+}
+
 static void test_complete_range() {
     GrowingWidthGenerator<uint16_t> gen(0, 10, M_E);
     Histogram<uint16_t> histo(gen, 10);
@@ -93,6 +113,7 @@ int main() {
     test_basic();
     test_fixed_input();
     test_exponential();
+    test_percentile();
     test_complete_range();
     return 0;
 }
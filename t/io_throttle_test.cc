@@ -0,0 +1,95 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#include "config.h"
+
+#include <cassert>
+#include <cmath>
+
+#include "io_throttle.hh"
+
+static const hrtime_t ONE_SECOND(1000000000);
+
+static bool near(double a, double b) {
+    return std::fabs(a - b) < 0.0001;
+}
+
+static void testUnlimited() {
+    IOBudget budget;
+    budget.consumed(1 << 30, 1000000);
+    assert(budget.delay(ONE_SECOND) == 0);
+    assert(budget.getBytes() == 1 << 30);
+    assert(budget.getOps() == 1000000);
+    assert(budget.getThrottled() == 0);
+}
+
+static void testDebt() {
+    IOBudget budget;
+    budget.setLimits(1000, 100);
+    assert(budget.delay(ONE_SECOND) == 0);
+
+    // Half a second's worth of bytes is fine, two seconds' is not.
+    budget.consumed(500, 1);
+    assert(budget.delay(ONE_SECOND) == 0);
+    budget.consumed(2000, 1);
+    assert(near(budget.delay(ONE_SECOND), 1.5));
+    assert(budget.getThrottled() == 1);
+
+    // Paid back after waiting that long in all.
+    assert(near(budget.delay(ONE_SECOND + ONE_SECOND / 2), 1.0));
+    assert(budget.delay(ONE_SECOND * 3) == 0);
+
+    // Operations are limited on their own.
+    budget.consumed(0, 200);
+    assert(near(budget.delay(ONE_SECOND * 3), 1.0));
+    assert(budget.getThrottled() == 3);
+}
+
+static void testBurst() {
+    IOBudget budget;
+    budget.setLimits(1000, 0);
+    assert(budget.delay(ONE_SECOND) == 0);
+
+    // A long idle time still only buys a second's worth.
+    budget.consumed(1500, 1);
+    assert(near(budget.delay(ONE_SECOND * 100), 0.5));
+}
+
+static void testYield() {
+    IOBudget budget;
+    assert(!budget.yield(ONE_SECOND, false, ONE_SECOND));
+    assert(budget.yield(ONE_SECOND, true, ONE_SECOND));
+    assert(budget.yield(ONE_SECOND * 3 / 2, true, ONE_SECOND));
+    // Not for longer than allowed in a row.
+    assert(!budget.yield(ONE_SECOND * 5 / 2, true, ONE_SECOND));
+    assert(budget.yield(ONE_SECOND * 5 / 2, true, ONE_SECOND));
+    assert(!budget.yield(ONE_SECOND * 5 / 2, false, ONE_SECOND));
+    assert(budget.getYielded() == 3);
+}
+
+static void testThrottle() {
+    Atomic<size_t> fetches;
+    IOThrottle throttle(fetches);
+    assert(throttle.admit(io_deletion) == 0);
+
+    // Background jobs make way for fetches, the flusher doesn't.
+    ++fetches;
+    assert(throttle.admit(io_deletion) > 0);
+    assert(throttle.admit(io_flusher) == 0);
+    --fetches;
+    assert(throttle.admit(io_deletion) == 0);
+
+    throttle.setLimits(io_restore, 0, 10);
+    assert(throttle.admit(io_restore) == 0);
+    throttle.consumed(io_restore, 100, 100);
+    assert(throttle.admit(io_restore) > 0);
+    assert(throttle.getBudget(io_restore).getOps() == 100);
+    assert(throttle.admit(io_backfill) == 0);
+}
+
+int main() {
+    testUnlimited();
+    testDebt();
+    testBurst();
+    testYield();
+    testThrottle();
+    return 0;
+}
@@ -0,0 +1,127 @@
+#include "config.h"
+
+#include <cassert>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "slab.hh"
+#include "atomic.hh"
+#include "threadtests.hh"
+
+static size_t slabStat(const char *name) {
+    std::map<std::string, size_t> stats;
+    SlabAllocator::getStats(stats);
+    return stats[name];
+}
+
+static void testDisabled() {
+    SlabAllocator::setEnabled(false);
+    assert(SlabAllocator::getChunkSize(37) == 37);
+    void *p = SlabAllocator::allocate(37);
+    assert(p);
+    SlabAllocator::deallocate(p);
+    assert(slabStat("ep_slab_total_bytes") == 0);
+}
+
+static void testSizeClasses() {
+    SlabAllocator::setEnabled(true);
+    assert(SlabAllocator::getChunkSize(1) == 16);
+    assert(SlabAllocator::getChunkSize(16) == 16);
+    assert(SlabAllocator::getChunkSize(17) == 32);
+    assert(SlabAllocator::getChunkSize(128) == 128);
+    for (size_t n = 1; n <= 1024; ++n) {
+        size_t c = SlabAllocator::getChunkSize(n);
+        assert(c >= n);
+        assert(c % 16 == 0);
+        // No more than 25% plus alignment wasted.
+        assert(c <= n + n / 4 + 16);
+    }
+    // Bigger things come straight from the heap.
+    assert(SlabAllocator::getChunkSize(4096) == 4096);
+}
+
+static void testAllocFree() {
+    SlabAllocator::setEnabled(true);
+    std::vector<char*> chunks;
+    for (int i = 0; i < 10000; ++i) {
+        size_t n = 1 + (i % 1500);
+        char *p = static_cast<char*>(SlabAllocator::allocate(n));
+        assert(p);
+        std::memset(p, i & 0xff, n);
+        chunks.push_back(p);
+    }
+    assert(slabStat("ep_slab_total_bytes") > 0);
+    assert(slabStat("ep_slab_used_bytes") > 0);
+    assert(slabStat("ep_slab_used_bytes") <= slabStat("ep_slab_total_bytes"));
+    assert(slabStat("ep_slab_16:used_chunks") > 0);
+
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        size_t n = 1 + (i % 1500);
+        for (size_t j = 0; j < n; ++j) {
+            assert(chunks[i][j] == static_cast<char>(i & 0xff));
+        }
+        SlabAllocator::deallocate(chunks[i]);
+    }
+    assert(slabStat("ep_slab_used_bytes") == 0);
+    assert(slabStat("ep_slab_free_bytes") == slabStat("ep_slab_total_bytes"));
+
+    // Chunks allocated while enabled may be freed after switching off.
+    void *p = SlabAllocator::allocate(100);
+    SlabAllocator::setEnabled(false);
+    SlabAllocator::deallocate(p);
+    assert(slabStat("ep_slab_used_bytes") == 0);
+    SlabAllocator::setEnabled(true);
+}
+
+class AllocGenerator : public Generator<bool> {
+public:
+    bool operator()() {
+        int seed = seeds.incr(1);
+        std::vector<void*> mine;
+        for (int round = 0; round < 50; ++round) {
+            for (int i = 0; i < 1000; ++i) {
+                mine.push_back(SlabAllocator::allocate(1 + (i * seed) % 1024));
+            }
+            // Free chunks other threads allocated, too.
+            LockHolder lh(mutex);
+            shared.insert(shared.end(), mine.begin(), mine.end());
+            mine.clear();
+            while (shared.size() > 500) {
+                SlabAllocator::deallocate(shared.back());
+                shared.pop_back();
+            }
+        }
+        return true;
+    }
+
+    void freeAll() {
+        std::vector<void*>::iterator it;
+        for (it = shared.begin(); it != shared.end(); ++it) {
+            SlabAllocator::deallocate(*it);
+        }
+        shared.clear();
+    }
+
+private:
+    Atomic<int>        seeds;
+    Mutex              mutex;
+    std::vector<void*> shared;
+};
+
+static void testConcurrentAllocFree() {
+    SlabAllocator::setEnabled(true);
+    AllocGenerator gen;
+    getCompletedThreads(8, &gen);
+    gen.freeAll();
+    assert(slabStat("ep_slab_used_bytes") == 0);
+}
+
+int main() {
+    testDisabled();
+    testSizeClasses();
+    testAllocFree();
+    testConcurrentAllocFree();
+    return 0;
+}
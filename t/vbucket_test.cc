@@ -9,6 +9,7 @@
 #include <algorithm>
 
 #include "configuration.hh"
+#include "kvstore.hh"
 #include "vbucket.hh"
 #include "vbucketmap.hh"
 #include "stats.hh"
@@ -178,6 +179,40 @@ static void testVBucketFilterFormatter(void) {
     assertFilterTxt(filter, "{ [1,103] }");
 }
 
+static void testBGFetchCoalescing(void) {
+    VBucket vb(0, vbucket_state_active, global_stats, checkpoint_config);
+    int c1, c2, c3, c4, c5;
+
+    assert(vb.queueBGFetch("a", 1, &c1, false) == BG_FETCH_NEW_BATCH);
+    assert(vb.queueBGFetch("b", 2, &c2, false) == BG_FETCH_QUEUED);
+    assert(vb.queueBGFetch("a", 1, &c3, false) == BG_FETCH_COALESCED);
+    // Wanting a missing key remembered needs a fetch of its own.
+    assert(vb.queueBGFetch("a", -1, &c4, true) == BG_FETCH_QUEUED);
+
+    std::vector<VBucketBGFetchItem*> fetches;
+    vb.getBGFetchItems(fetches);
+    assert(fetches.size() == 3);
+    assert(fetches[0]->key == "a");
+    assert(fetches[0]->cookies.size() == 2);
+
+    // Still joinable while being read, but not once complete.
+    assert(vb.queueBGFetch("a", 1, &c5, false) == BG_FETCH_COALESCED);
+    assert(fetches[0]->cookies.size() == 3);
+    vb.completeBGFetchItem(fetches[0]);
+    assert(vb.queueBGFetch("a", 1, &c5, false) == BG_FETCH_NEW_BATCH);
+
+    std::vector<VBucketBGFetchItem*>::iterator it;
+    for (it = fetches.begin(); it != fetches.end(); ++it) {
+        vb.completeBGFetchItem(*it);
+        delete *it;
+    }
+    fetches.clear();
+    vb.getBGFetchItems(fetches);
+    assert(fetches.size() == 1);
+    vb.completeBGFetchItem(fetches[0]);
+    delete fetches[0];
+}
+
 int main(int argc, char **argv) {
     (void)argc; (void)argv;
     putenv(strdup("ALLOW_NO_STATS_UPDATE=yeah"));
@@ -191,4 +226,5 @@ int main(int argc, char **argv) {
     testConcurrentUpdate();
     testVBucketFilter();
     testVBucketFilterFormatter();
+    testBGFetchCoalescing();
 }
@@ -140,6 +140,7 @@ TapProducer::TapProducer(EventuallyPersistentEngine &theEngine,
     backfillAge(0),
     dumpQueue(false),
     doTakeOver(false),
+    supportSeqno(false),
     takeOverCompletionPhase(false),
     doRunBackfill(false),
     backfillCompleted(true),
@@ -210,6 +211,11 @@ void TapProducer::evaluateFlags()
         ss << ",checkpoints";
     }
 
+    if (flags & TAP_CONNECT_SEQNO) {
+        supportSeqno = true;
+        ss << ",seqno";
+    }
+
     if (ss.str().length() > 0) {
         std::stringstream m;
         m.setf(std::ios::hex);
@@ -325,7 +331,8 @@ void TapProducer::setVBucketFilter(const std::vector<uint16_t> &vbuckets)
     }
 }
 
-void TapProducer::registerTAPCursor(std::map<uint16_t, uint64_t> &lastCheckpointIds) {
+void TapProducer::registerTAPCursor(std::map<uint16_t, uint64_t> &lastCheckpointIds,
+                                    std::map<uint16_t, uint64_t> &resumeSeqnos) {
     LockHolder lh(queueLock);
 
     tapCheckpointState.clear();
@@ -372,6 +379,7 @@ void TapProducer::registerTAPCursor(std::map<uint16_t, uint64_t> &lastCheckpoint
                 tapCheckpointState[vbid] = st;
                 continue;
             }
+            backfillSeqnos.erase(vbid);
 
             // As TAP dump option simply requires the snapshot of each vbucket, simply schedule
             // backfill and skip the checkpoint cursor registration.
@@ -382,6 +390,32 @@ void TapProducer::registerTAPCursor(std::map<uint16_t, uint64_t> &lastCheckpoint
                 continue;
             }
 
+            // A client resuming from a sequence number only needs what changed since, either
+            // from the checkpoints alone or backfilled first.  Otherwise, carry on as if it
+            // didn't give one.
+            std::map<uint16_t, uint64_t>::iterator sit = resumeSeqnos.find(vbid);
+            if (sit != resumeSeqnos.end() && sit->second > 0 && !closedCheckpointOnly) {
+                resume_seqno_t res =
+                    vb->checkpointManager.registerTAPCursorBySeqno(name, sit->second);
+                if (res != RESUME_INVALID) {
+                    uint64_t cid = vb->checkpointManager.getCheckpointIdForTAPCursor(name);
+                    if (res == RESUME_WITH_BACKFILL) {
+                        TapCheckpointState st(vbid, cid, backfill);
+                        tapCheckpointState[vbid] = st;
+                        backfillSeqnos[vbid] = sit->second;
+                        backfill_vbuckets.push_back(vbid);
+                    } else {
+                        TapCheckpointState st(vbid, cid, checkpoint_start);
+                        tapCheckpointState[vbid] = st;
+                    }
+                    continue;
+                }
+                getLogger()->log(EXTENSION_LOG_INFO, NULL,
+                                 "TAP %s can't resume vbucket %d from seqno %llu\n",
+                                 name.c_str(), vbid,
+                                 static_cast<unsigned long long>(sit->second));
+            }
+
             // If the connection is for a registered TAP client that is only interested in closed
             // checkpoints, we always start from the beginning of the checkpoint to which the
             // registered TAP client's cursor currently belongs.
@@ -884,11 +918,15 @@ bool TapProducer::checkBackfillCompletion_UNLOCKED() {
         backfillCompleted = true;
         std::set<uint16_t>::iterator it = backfillVBuckets.begin();
         for (; it != backfillVBuckets.end(); ++it) {
+            if (backfillSeqnos.find(*it) != backfillSeqnos.end()) {
+                continue;
+            }
             TapVBucketEvent backfillEnd(TAP_OPAQUE, *it,
                                         (vbucket_state_t)htonl(TAP_OPAQUE_CLOSE_BACKFILL));
             addVBucketHighPriority_UNLOCKED(backfillEnd);
         }
         backfillVBuckets.clear();
+        backfillSeqnos.clear();
 
         rv = true;
     }
@@ -973,7 +1011,7 @@ public:
             RCPtr<VBucket> vb = epstore->getVBucket(vbucket);
             if (vb) {
                 int bucket_num(0);
-                LockHolder lh = vb->ht.getLockedBucket(key, &bucket_num);
+                WriterLockHolder lh = vb->ht.getLockedBucket(key, &bucket_num);
                 StoredValue *v = epstore->fetchValidValue(vb, key, bucket_num);
                 if (v) {
                     const TapConfig &config = epe->getTapConfig();
@@ -1474,6 +1512,15 @@ queued_item TapProducer::nextFgFetched_UNLOCKED(bool &shouldPause) {
                 }
                 break;
             case queue_op_empty:
+                if (vb->checkpointManager.wasTAPCursorDropped(name)) {
+                    // What the cursor still needed couldn't be read back from the
+                    // spill file, so backfill the vbucket in full instead.
+                    TapCheckpointState st(vbid, 0, backfill);
+                    it->second = st;
+                    backfillSeqnos.erase(vbid);
+                    std::vector<uint16_t> vbs(1, vbid);
+                    scheduleBackfill_UNLOCKED(vbs);
+                }
                 {
                     ++open_checkpoint_count;
                     if (closedCheckpointOnly) {
@@ -1627,10 +1674,14 @@ void TapProducer::scheduleBackfill_UNLOCKED(const std::vector<uint16_t> &vblist)
     }
 
     // Send an initial_vbucket_stream message to the destination node so that it can
-    // delete the corresponding vbucket before receiving the backfill stream.
+    // delete the corresponding vbucket before receiving the backfill stream.  The
+    // vbuckets only backfilled with what changed since a sequence number are kept.
     const std::vector<uint16_t> &newBackfillVBs = backFillVBucketFilter.getVector();
     std::vector<uint16_t>::const_iterator it = newBackfillVBs.begin();
     for (; it != newBackfillVBs.end(); ++it) {
+        if (backfillSeqnos.find(*it) != backfillSeqnos.end()) {
+            continue;
+        }
         TapVBucketEvent hi(TAP_OPAQUE, *it,
                            (vbucket_state_t)htonl(TAP_OPAQUE_INITIAL_VBUCKET_STREAM));
         addVBucketHighPriority_UNLOCKED(hi);
@@ -1695,6 +1746,9 @@ Item* TapProducer::getNextItem(const void *c, uint16_t *vbucket, tap_event_t &re
             ret = TAP_NOOP;
             return NULL;
         }
+        // Backfilled items are sent in no particular order, so they
+        // aren't a position to resume from.
+        itm->setBySeqno(0);
         ret = TAP_MUTATION;
         ++stats.numTapBGFetched;
         ++queueDrain;
@@ -1779,6 +1833,7 @@ Item* TapProducer::getNextItem(const void *c, uint16_t *vbucket, tap_event_t &re
         }
 
         if (ret == TAP_MUTATION || ret == TAP_DELETION) {
+            itm->setBySeqno(qi->getBySeqno());
             ++queueDrain;
             addTapLogElement_UNLOCKED(qi);
         }
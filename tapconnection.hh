@@ -38,6 +38,17 @@ struct PopulateEventsBody;
 #define TAP_OPAQUE_CLOSE_TAP_STREAM 7
 #define TAP_OPAQUE_CLOSE_BACKFILL 8
 
+#ifndef TAP_CONNECT_SEQNO
+/**
+ * The client resumes from the sequence number of the last item it
+ * received for each vbucket, and wants the sequence number of each item
+ * sent.  The body lists the vbuckets after the registered client flag,
+ * as a 16 bit count followed by a 16 bit vbucket id and a 64 bit
+ * sequence number for each.
+ */
+#define TAP_CONNECT_SEQNO 0x0100
+#endif
+
 /**
  * A tap event that represents a change to the state of a vbucket.
  *
@@ -855,6 +866,11 @@ private:
 
     void scheduleBackfill(const std::vector<uint16_t> &vblist) {
         LockHolder lh(queueLock);
+        // These are backfilled in full.
+        std::vector<uint16_t>::const_iterator it = vblist.begin();
+        for (; it != vblist.end(); ++it) {
+            backfillSeqnos.erase(*it);
+        }
         scheduleBackfill_UNLOCKED(vblist);
     }
 
@@ -941,6 +957,15 @@ private:
 
     bool SetCursorToOpenCheckpoint(uint16_t vbucket);
 
+    /**
+     * Return the sequence number to backfill each vbucket from, for the
+     * vbuckets that only need what changed since.
+     */
+    std::map<uint16_t, uint64_t> getBackfillSeqnos() {
+        LockHolder lh(queueLock);
+        return backfillSeqnos;
+    }
+
     void setTakeOverCompletionPhase(bool completionPhase) {
         takeOverCompletionPhase = completionPhase;
     }
@@ -968,7 +993,8 @@ private:
     /**
      * Register the unified queue cursor for this TAP producer.
      */
-    void registerTAPCursor(std::map<uint16_t, uint64_t> &lastCheckpointIds);
+    void registerTAPCursor(std::map<uint16_t, uint64_t> &lastCheckpointIds,
+                           std::map<uint16_t, uint64_t> &resumeSeqnos);
 
     size_t getTapAckLogSize(void) {
         LockHolder lh(queueLock);
@@ -1040,6 +1066,11 @@ private:
      */
     bool doTakeOver;
 
+    /**
+     * Send the sequence number of each item?
+     */
+    bool supportSeqno;
+
     /**
      * Take over completion phase?
      */
@@ -1079,6 +1110,12 @@ private:
      */
     std::set<uint16_t> backfillVBuckets;
 
+    /**
+     * The vbuckets of the current backfill session that are only
+     * backfilled with what changed since a sequence number.
+     */
+    std::map<uint16_t, uint64_t> backfillSeqnos;
+
     /**
      * For each vbucket, maintain the current checkpoint Id that this TAP producer should
      * transmit to its TAP client.
@@ -1149,6 +1186,13 @@ private:
      */
     uint32_t itemRevSeqno;
 
+    /**
+     * Revision seq number of the item to be transmitted, followed by its
+     * sequence number in the vbucket's change history, for the clients
+     * that resume from sequence numbers.
+     */
+    char itemSeqnos[sizeof(uint32_t) + sizeof(uint64_t)];
+
     /**
      * Is this tap connection in a suspended state (the receiver may
      * be too slow
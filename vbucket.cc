@@ -4,6 +4,7 @@
 
 #include "vbucket.hh"
 #include "ep_engine.h"
+#include "kvstore.hh"
 
 VBucketFilter VBucketFilter::filter_diff(const VBucketFilter &other) const {
     std::vector<uint16_t> tmp(acceptable.size() + other.size());
@@ -182,10 +183,81 @@ void VBucket::resetStats() {
     dirtyQueueDrain.set(0);
 }
 
+void VBucket::createFilter(size_t key_count, double probability) {
+    RCPtr<BloomFilter> bf(new BloomFilter(key_count, probability));
+    LockHolder lh(filterLock);
+    if (bFilter) {
+        stats.memOverhead.decr(bFilter->getMemorySize());
+    }
+    if (tempFilter) {
+        stats.memOverhead.decr(tempFilter->getMemorySize());
+        tempFilter.reset();
+    }
+    bFilter = bf;
+    stats.memOverhead.incr(bFilter->getMemorySize());
+}
+
+void VBucket::clearFilter() {
+    LockHolder lh(filterLock);
+    if (bFilter) {
+        stats.memOverhead.decr(bFilter->getMemorySize());
+        bFilter.reset();
+    }
+    if (tempFilter) {
+        stats.memOverhead.decr(tempFilter->getMemorySize());
+        tempFilter.reset();
+    }
+}
+
+bool VBucket::initTempFilter(size_t key_count, double probability) {
+    RCPtr<BloomFilter> bf(new BloomFilter(key_count, probability));
+    LockHolder lh(filterLock);
+    if (tempFilter) {
+        return false;
+    }
+    tempFilter = bf;
+    stats.memOverhead.incr(tempFilter->getMemorySize());
+    return true;
+}
+
+void VBucket::addToTempFilter(const std::string &key) {
+    LockHolder lh(filterLock);
+    if (tempFilter) {
+        tempFilter->addKey(key);
+    }
+}
+
+void VBucket::swapFilter() {
+    LockHolder lh(filterLock);
+    if (!tempFilter) {
+        return;
+    }
+    if (bFilter) {
+        stats.memOverhead.decr(bFilter->getMemorySize());
+    }
+    bFilter = tempFilter;
+    tempFilter.reset();
+}
+
+void VBucket::addToFilter(const std::string &key) {
+    LockHolder lh(filterLock);
+    if (bFilter) {
+        bFilter->addKey(key);
+    }
+    if (tempFilter) {
+        tempFilter->addKey(key);
+    }
+}
+
+bool VBucket::maybeKeyExistsInFilter(const std::string &key) {
+    LockHolder lh(filterLock);
+    return !bFilter || bFilter->maybeKeyExists(key);
+}
+
 void VBucket::addStats(bool details, ADD_STAT add_stat, const void *c) {
     addStat(NULL, toString(state), add_stat, c);
     if (details) {
-        addStat("num_items", ht.getNumItems(), add_stat, c);
+        addStat("num_items", getNumItems(), add_stat, c);
         addStat("num_resident", ht.getNumNonResidentItems(), add_stat, c);
         addStat("ht_memory", ht.memorySize(), add_stat, c);
         addStat("ht_item_memory", ht.getItemMemory(), add_stat, c);
@@ -203,5 +275,59 @@ void VBucket::addStats(bool details, ADD_STAT add_stat, const void *c) {
         addStat("pending_writes", dirtyQueuePendingWrites, add_stat, c);
         addStat("online_update", checkpointManager.isOnlineUpdate() ?
                 "true" : "false", add_stat, c);
+
+        LockHolder lh(filterLock);
+        if (bFilter) {
+            size_t mem = bFilter->getMemorySize();
+            if (tempFilter) {
+                mem += tempFilter->getMemorySize();
+            }
+            addStat("bloom_filter", tempFilter ? "rebuilding" : "enabled",
+                    add_stat, c);
+            addStat("bloom_filter_size", bFilter->getNumBits(), add_stat, c);
+            addStat("bloom_filter_memory", mem, add_stat, c);
+            addStat("bloom_filter_key_count", bFilter->getEstimatedKeyCount(),
+                    add_stat, c);
+            addStat("bloom_filter_fp_rate", bFilter->getFalsePositiveRate(),
+                    add_stat, c);
+        } else {
+            addStat("bloom_filter", "disabled", add_stat, c);
+        }
+        lh.unlock();
+        addStat("bloom_filter_lookups_avoided", bfLookupsAvoided, add_stat, c);
+        addStat("bloom_filter_false_positives", bfFalsePositives, add_stat, c);
+    }
+}
+
+bg_fetch_queue_t VBucket::queueBGFetch(const std::string &key, uint64_t rowid,
+                                       const void *cookie, bool markMissing) {
+    LockHolder lh(pendingBGFetchesLock);
+    std::map<std::string, VBucketBGFetchItem*>::iterator it;
+    it = bgFetchesInFlight.find(key);
+    if (it != bgFetchesInFlight.end()) {
+        // A requester that wants a missing key remembered can't share
+        // a fetch that wouldn't remember it, and vice versa.
+        if (it->second->markMissing == markMissing) {
+            it->second->cookies.push_back(cookie);
+            return BG_FETCH_COALESCED;
+        }
+    }
+
+    VBucketBGFetchItem *fetch = new VBucketBGFetchItem(key, rowid, cookie,
+                                                       gethrtime(),
+                                                       markMissing);
+    if (it == bgFetchesInFlight.end()) {
+        bgFetchesInFlight[key] = fetch;
+    }
+    pendingBGFetches.push_back(fetch);
+    return pendingBGFetches.size() == 1 ? BG_FETCH_NEW_BATCH : BG_FETCH_QUEUED;
+}
+
+void VBucket::completeBGFetchItem(VBucketBGFetchItem *fetch) {
+    LockHolder lh(pendingBGFetchesLock);
+    std::map<std::string, VBucketBGFetchItem*>::iterator it;
+    it = bgFetchesInFlight.find(fetch->key);
+    if (it != bgFetchesInFlight.end() && it->second == fetch) {
+        bgFetchesInFlight.erase(it);
     }
 }
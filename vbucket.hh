@@ -14,6 +14,7 @@
 #include "queueditem.hh"
 #include "common.hh"
 #include "atomic.hh"
+#include "bloomfilter.hh"
 #include "stored-value.hh"
 #include "checkpoint.hh"
 
@@ -96,6 +97,16 @@ private:
 };
 
 class EventuallyPersistentEngine;
+class VBucketBGFetchItem;
+
+/**
+ * What became of a background fetch queued on a vbucket.
+ */
+typedef enum {
+    BG_FETCH_COALESCED,         //!< Joined a fetch of the same key
+    BG_FETCH_QUEUED,            //!< Queued on a batch already scheduled
+    BG_FETCH_NEW_BATCH          //!< Started a batch that needs scheduling
+} bg_fetch_queue_t;
 
 /**
  * An individual vbucket.
@@ -122,6 +133,7 @@ public:
                              pendingOps.size());
         }
         stats.memOverhead.decr(sizeof(VBucket) + ht.memorySize() + sizeof(CheckpointManager));
+        clearFilter();
         assert(stats.memOverhead.get() < GIGANTOR);
         getLogger()->log(EXTENSION_LOG_INFO, NULL,
                          "Destroying vbucket %d\n", id);
@@ -169,6 +181,17 @@ public:
         return v.size;
     }
 
+    /**
+     * The number of items in this vbucket, counting those evicted
+     * from memory along with their keys but not the stand-ins for
+     * keys that are missing from disk.
+     */
+    size_t getNumItems(void) {
+        size_t total = ht.getNumItems() + ht.getNumEvictedItems();
+        size_t temp = ht.getNumTempItems();
+        return total > temp ? total - temp : 0;
+    }
+
     size_t getBackfillSize() {
         LockHolder lh(backfill.mutex);
         return backfill.items.size();
@@ -197,6 +220,81 @@ public:
         backfill.isBackfillPhase = backfillPhase;
     }
 
+    /**
+     * Start over with an empty filter of the keys on disk.
+     *
+     * Only valid when nothing of this vbucket is on disk, or when all
+     * of its keys on disk are going to be added (warmup).
+     */
+    void createFilter(size_t key_count, double probability);
+
+    /**
+     * Drop the filters; every key may be on disk from now on.
+     */
+    void clearFilter();
+
+    /**
+     * Start building a replacement filter.  Keys added from now on go
+     * into both filters.
+     *
+     * @return false if a replacement is already being built
+     */
+    bool initTempFilter(size_t key_count, double probability);
+
+    /**
+     * Add a key found on disk to the replacement filter.
+     */
+    void addToTempFilter(const std::string &key);
+
+    /**
+     * Replace the filter with the one built since initTempFilter().
+     */
+    void swapFilter();
+
+    /**
+     * Note that the given key is (about to be) on disk.
+     */
+    void addToFilter(const std::string &key);
+
+    /**
+     * False if the given key is surely not on disk.
+     */
+    bool maybeKeyExistsInFilter(const std::string &key);
+
+    /**
+     * Get the filter of keys on disk (NULL if there is none).
+     */
+    RCPtr<BloomFilter> getFilter() {
+        LockHolder lh(filterLock);
+        return bFilter;
+    }
+
+    /**
+     * Queue a fetch of a key for the next batch of background fetches
+     * of this vbucket.  If the key is already being fetched (queued
+     * or read from disk, and not completed yet) the cookie is woken
+     * along with that fetch instead.
+     *
+     * @param rowid the row id to fetch, or -1 to look the key up
+     * @param markMissing see EventuallyPersistentStore::bgFetchMissingKey
+     */
+    bg_fetch_queue_t queueBGFetch(const std::string &key, uint64_t rowid,
+                                  const void *cookie, bool markMissing);
+
+    /**
+     * Take out the batch of background fetches queued so far.
+     */
+    void getBGFetchItems(std::vector<VBucketBGFetchItem*> &fetches) {
+        LockHolder lh(pendingBGFetchesLock);
+        fetches.swap(pendingBGFetches);
+    }
+
+    /**
+     * Note that a fetch from getBGFetchItems() is complete; no more
+     * cookies are added to it after this.
+     */
+    void completeBGFetchItem(VBucketBGFetchItem *fetch);
+
     HashTable         ht;
     CheckpointManager checkpointManager;
     struct {
@@ -246,6 +344,11 @@ public:
     Atomic<uint64_t>    dirtyQueueAge;
     Atomic<size_t>  dirtyQueuePendingWrites;
 
+    //! Disk lookups skipped because the filter ruled the key out.
+    Atomic<size_t>  bfLookupsAvoided;
+    //! Disk lookups the filter let through for keys not on disk.
+    Atomic<size_t>  bfFalsePositives;
+
 private:
     template <typename T>
     void addStat(const char *nm, T val, ADD_STAT add_stat, const void *c) {
@@ -271,6 +374,12 @@ private:
     std::vector<const void*> pendingOps;
     hrtime_t                 pendingOpsStart;
     EPStats                 &stats;
+    Mutex                    filterLock;
+    RCPtr<BloomFilter>       bFilter;
+    RCPtr<BloomFilter>       tempFilter;
+    Mutex                    pendingBGFetchesLock;
+    std::vector<VBucketBGFetchItem*> pendingBGFetches;
+    std::map<std::string, VBucketBGFetchItem*> bgFetchesInFlight;
 
     DISALLOW_COPY_AND_ASSIGN(VBucket);
 };